@@ -3,6 +3,10 @@
 #include "RegAccess.h"
 #include "NetKVMAux.h"
 #include "RegParam.h"
+#include <winioctl.h>
+#include <ntddndis.h>
+#include "..\Common\QueueStatistics.h"
+#include "..\..\VirtIO\virtio_trace.h"
 
 //This is NetSH Helper GUID {D9C599C4-8DCF-4a6a-93AA-A16FE6D5125C}
 static const GUID NETKVM_HELPER_GUID =
@@ -24,6 +28,7 @@ static const LPCWSTR NETKVM_PARAM_PARAM_NAME = L"param";
 static const LPCTSTR NETKVM_PARAM_PARAM_NAME_T = TEXT("param");
 static const LPCWSTR NETKVM_VALUE_PARAM_NAME = L"value";
 static const LPCTSTR NETKVM_VALUE_PARAM_NAME_T = TEXT("value");
+static const LPCWSTR NETKVM_FILE_PARAM_NAME  = L"file";
 
 static HINSTANCE g_hinstThisDLL = NULL;
 
@@ -447,6 +452,65 @@ static bool _NetKVMSetParamValue(DWORD dwDeviceIndex,
     return pParam->Save();
 }
 
+static bool _NetKVMQueryOid(DWORD dwDeviceIndex, ULONG Oid, vector<BYTE> &Buffer, size_t MaxSize, DWORD &dwReturned)
+{
+    neTKVMRegAccess DeviceRegKey(HKEY_LOCAL_MACHINE, g_DevicesOfInterest[dwDeviceIndex].strRegPathName.c_str());
+    TCHAR szInstanceId[MAX_PATH];
+
+    if(!DeviceRegKey.ReadString(TEXT("NetCfgInstanceId"), szInstanceId, ARRAY_SIZE(szInstanceId)))
+    {
+        return false;
+    }
+
+    tstring strDevicePath = tstring(TEXT("\\\\.\\")) + szInstanceId;
+    HANDLE hDevice = CreateFile(strDevicePath.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                                NULL, OPEN_EXISTING, 0, NULL);
+    if(INVALID_HANDLE_VALUE == hDevice)
+    {
+        NETCO_DEBUG_PRINT(TEXT("CreateFile failed: ") << GetLastError());
+        return false;
+    }
+
+    BOOL bResult;
+
+    dwReturned = 0;
+    for(;;)
+    {
+        bResult = DeviceIoControl(hDevice, IOCTL_NDIS_QUERY_GLOBAL_STATS, &Oid, sizeof(Oid),
+                                  &Buffer[0], (DWORD)Buffer.size(), &dwReturned, NULL);
+        if(bResult || (GetLastError() != ERROR_INSUFFICIENT_BUFFER && GetLastError() != ERROR_MORE_DATA) ||
+           Buffer.size() >= MaxSize)
+        {
+            break;
+        }
+        Buffer.resize(Buffer.size() * 2);
+    }
+    CloseHandle(hDevice);
+
+    if(!bResult)
+    {
+        NETCO_DEBUG_PRINT(TEXT("DeviceIoControl failed: ") << GetLastError());
+        return false;
+    }
+    return true;
+}
+
+static bool _NetKVMQueryQueuesStatistics(DWORD dwDeviceIndex, vector<BYTE> &Buffer)
+{
+    DWORD dwReturned;
+
+    Buffer.resize(NETKVM_QUEUES_STATISTICS_SIZE(16));
+    if(!_NetKVMQueryOid(dwDeviceIndex, OID_VENDOR_3, Buffer, NETKVM_QUEUES_STATISTICS_SIZE(1024), dwReturned) ||
+       dwReturned < NETKVM_QUEUES_STATISTICS_SIZE(0))
+    {
+        return false;
+    }
+
+    PNETKVM_QUEUES_STATISTICS pStatistics = (PNETKVM_QUEUES_STATISTICS)&Buffer[0];
+    return pStatistics->Version == NETKVM_QUEUES_STATISTICS_VERSION &&
+           dwReturned >= NETKVM_QUEUES_STATISTICS_SIZE(pStatistics->NumberOfQueues);
+}
+
 //
 // Usage: show devices
 //
@@ -968,6 +1032,197 @@ DWORD WINAPI _NetKVMRestartDeviceCmdHandler(__in   PWCHAR  /*pwszMachine*/,
     }
 }
 
+//
+// Usage: show statistics [idx=]0-N
+//
+// Parameters:
+//
+//      IDX - Specifies the device index as it is shown in "show devices" output.
+//
+// Remarks:
+//
+//      Shows per-queue counters of the running device specified by index.
+//
+// Examples:
+//
+//      show statistics idx=0
+//      show statistics 2
+//
+DWORD WINAPI _NetKVMShowStatisticsCmdHandler(__in   PWCHAR  /*pwszMachine*/,
+                                             __in   PWCHAR* ppwcArguments,
+                                             __in   DWORD   dwCurrentIndex,
+                                             __in   DWORD   dwArgCount,
+                                             __in   DWORD   /*dwFlags*/,
+                                             __in   PVOID   /*pvData*/,
+                                             __out  BOOL*   pbDone)
+{
+    *pbDone = FALSE; /* Just to make static analyzer happy */
+
+    try
+    {
+        NETCO_DEBUG_PRINT(TEXT("_NetKVMShowStatisticsCmdHandler called"));
+        TAG_TYPE TagsList[] =
+            { {NETKVM_IDX_PARAM_NAME,   NS_REQ_PRESENT} };
+
+        auto_ptr<DWORD> pdwTagMatchResults(new DWORD[dwArgCount - dwCurrentIndex]);
+        DWORD dwPreprocessResult = PreprocessCommand(NULL, ppwcArguments,
+                                                     dwCurrentIndex, dwArgCount,
+                                                     TagsList, ARRAY_SIZE(TagsList),
+                                                     ARRAY_SIZE(TagsList), ARRAY_SIZE(TagsList),
+                                                     pdwTagMatchResults.get());
+
+        switch (dwPreprocessResult)
+        {
+        case NO_ERROR:
+            {
+                DWORD dwIndex;
+                if(__NetKVMConvertDeviceIndex(ppwcArguments[dwCurrentIndex + pdwTagMatchResults.get()[0]], &dwIndex))
+                {
+                    static const LPCTSTR QueueTypes[] = { TEXT("RX"), TEXT("TX"), TEXT("CX") };
+                    vector<BYTE> Buffer;
+
+                    if(!_NetKVMQueryQueuesStatistics(dwIndex, Buffer))
+                    {
+                        PrintMessageFromModule(g_hinstThisDLL, IDS_STATSUNAVAILABLE);
+                        tcout << endl;
+                        return ERROR_NOT_READY;
+                    }
+
+                    PNETKVM_QUEUES_STATISTICS pStatistics = (PNETKVM_QUEUES_STATISTICS)&Buffer[0];
+                    for(ULONG i = 0; i < pStatistics->NumberOfQueues; ++i)
+                    {
+                        const NETKVM_QUEUE_STATISTICS &Queue = pStatistics->Queues[i];
+                        tcout << TEXT("Queue ") << Queue.Index << TEXT(" (")
+                              << (Queue.Type < ARRAY_SIZE(QueueTypes) ? QueueTypes[Queue.Type] : TEXT("??"))
+                              << TEXT("), ring size ") << Queue.RingSize << endl;
+                        tcout << TEXT("\tDPCs: ") << Queue.DPCs
+                              << TEXT(", packets per DPC: ") << (Queue.DPCs ? Queue.DPCPackets / Queue.DPCs : 0)
+                              << TEXT(" avg, ") << Queue.MaxDPCPackets << TEXT(" max") << endl;
+                        tcout << TEXT("\tKicks: ") << Queue.Kicks
+                              << TEXT(", ring full: ") << Queue.RingFull << endl;
+                    }
+                    return NO_ERROR;
+                }
+                else
+                {
+                    return ERROR_INVALID_PARAMETER;
+                }
+            }
+            __fallthrough;
+        default:
+            NETCO_DEBUG_PRINT(TEXT("PreprocessCommand returned: ") << dwPreprocessResult);
+            return dwPreprocessResult;
+        }
+    }
+    catch(const exception& ex)
+    {
+        PrintError(g_hinstThisDLL, IDS_LOGICEXCEPTION);
+        tcout << TEXT(": ") << string2tstring(string(ex.what())) << endl;
+        return ERROR_EXCEPTION_IN_SERVICE;
+    }
+    catch(...)
+    {
+        return ERROR_UNKNOWN_EXCEPTION;
+    }
+}
+
+//
+// Usage: savetrace [idx=]0-N [file=]path
+//
+// Remarks:
+//
+//      Saves the virtqueue event trace of the running device specified by
+//      index to a file, to be decoded by NetKVMDumpParser. The trace is
+//      only collected when the VirtioTraceRecords parameter is set.
+//
+// Examples:
+//
+//      savetrace idx=0 file=c:\trace.bin
+//      savetrace 2 trace.bin
+//
+DWORD WINAPI _NetKVMSaveTraceCmdHandler(__in   PWCHAR  /*pwszMachine*/,
+                                        __in   PWCHAR* ppwcArguments,
+                                        __in   DWORD   dwCurrentIndex,
+                                        __in   DWORD   dwArgCount,
+                                        __in   DWORD   /*dwFlags*/,
+                                        __in   PVOID   /*pvData*/,
+                                        __out  BOOL*   pbDone)
+{
+    *pbDone = FALSE; /* Just to make static analyzer happy */
+
+    try
+    {
+        NETCO_DEBUG_PRINT(TEXT("_NetKVMSaveTraceCmdHandler called"));
+        TAG_TYPE TagsList[] =
+            { {NETKVM_IDX_PARAM_NAME,   NS_REQ_PRESENT},
+              {NETKVM_FILE_PARAM_NAME,  NS_REQ_PRESENT} };
+
+        auto_ptr<DWORD> pdwTagMatchResults(new DWORD[dwArgCount - dwCurrentIndex]);
+        DWORD dwPreprocessResult = PreprocessCommand(NULL, ppwcArguments,
+                                                     dwCurrentIndex, dwArgCount,
+                                                     TagsList, ARRAY_SIZE(TagsList),
+                                                     ARRAY_SIZE(TagsList), ARRAY_SIZE(TagsList),
+                                                     pdwTagMatchResults.get());
+
+        switch (dwPreprocessResult)
+        {
+        case NO_ERROR:
+            {
+                DWORD dwIndex;
+                if(__NetKVMConvertDeviceIndex(ppwcArguments[dwCurrentIndex + pdwTagMatchResults.get()[0]], &dwIndex))
+                {
+                    LPCWSTR pwszFileName = ppwcArguments[dwCurrentIndex + pdwTagMatchResults.get()[1]];
+                    vector<BYTE> Buffer(1024 * 1024);
+                    DWORD dwReturned;
+
+                    if(!_NetKVMQueryOid(dwIndex, OID_VENDOR_4, Buffer, 256 * 1024 * 1024, dwReturned) ||
+                       dwReturned < sizeof(VIRTIO_TRACE_HEADER))
+                    {
+                        PrintMessageFromModule(g_hinstThisDLL, IDS_TRACEUNAVAILABLE);
+                        tcout << endl;
+                        return ERROR_NOT_READY;
+                    }
+
+                    HANDLE hFile = CreateFileW(pwszFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                                               FILE_ATTRIBUTE_NORMAL, NULL);
+                    if(INVALID_HANDLE_VALUE == hFile)
+                    {
+                        return GetLastError();
+                    }
+                    DWORD dwWritten = 0;
+                    BOOL bResult = WriteFile(hFile, &Buffer[0], dwReturned, &dwWritten, NULL);
+                    DWORD dwError = GetLastError();
+                    CloseHandle(hFile);
+                    if(!bResult)
+                    {
+                        return dwError;
+                    }
+                    tcout << dwWritten << TEXT(" bytes saved") << endl;
+                    return NO_ERROR;
+                }
+                else
+                {
+                    return ERROR_INVALID_PARAMETER;
+                }
+            }
+            __fallthrough;
+        default:
+            NETCO_DEBUG_PRINT(TEXT("PreprocessCommand returned: ") << dwPreprocessResult);
+            return dwPreprocessResult;
+        }
+    }
+    catch(const exception& ex)
+    {
+        PrintError(g_hinstThisDLL, IDS_LOGICEXCEPTION);
+        tcout << TEXT(": ") << string2tstring(string(ex.what())) << endl;
+        return ERROR_EXCEPTION_IN_SERVICE;
+    }
+    catch(...)
+    {
+        return ERROR_UNKNOWN_EXCEPTION;
+    }
+}
+
 #define CMD_NETKVM_SHOW_DEVICES       L"devices"
 #define HLP_NETKVM_SHOW_DEVICES       IDS_SHOWDEVICESSHORT
 #define HLP_NETKVM_SHOW_DEVICES_EX    IDS_SHOWDEVICESLONG
@@ -977,6 +1232,9 @@ DWORD WINAPI _NetKVMRestartDeviceCmdHandler(__in   PWCHAR  /*pwszMachine*/,
 #define CMD_NETKVM_SHOW_PARAMINFO     L"paraminfo"
 #define HLP_NETKVM_SHOW_PARAMINFO     IDS_SHOWPARAMINFOSHORT
 #define HLP_NETKVM_SHOW_PARAMINFO_EX  IDS_SHOWPARAMINFOLONG
+#define CMD_NETKVM_SHOW_STATS         L"statistics"
+#define HLP_NETKVM_SHOW_STATS         IDS_SHOWSTATSSHORT
+#define HLP_NETKVM_SHOW_STATS_EX      IDS_SHOWSTATSLONG
 
 CMD_ENTRY  g_ShowCmdTable[] =
 {
@@ -988,6 +1246,9 @@ CMD_ENTRY  g_ShowCmdTable[] =
                         CMD_FLAG_PRIVATE | CMD_FLAG_LOCAL),
     CREATE_CMD_ENTRY_EX(NETKVM_SHOW_PARAMINFO,
                         (PFN_HANDLE_CMD) _NetKVMShowParamInfoCmdHandler,
+                        CMD_FLAG_PRIVATE | CMD_FLAG_LOCAL),
+    CREATE_CMD_ENTRY_EX(NETKVM_SHOW_STATS,
+                        (PFN_HANDLE_CMD) _NetKVMShowStatisticsCmdHandler,
                         CMD_FLAG_PRIVATE | CMD_FLAG_LOCAL)
 
 };
@@ -1003,6 +1264,9 @@ CMD_ENTRY  g_ShowCmdTable[] =
 #define CMD_NETKVM_SET_PARAM_T          TEXT("setparam")
 #define HLP_NETKVM_SET_PARAM            IDS_SETPARAM
 #define HLP_NETKVM_SET_PARAM_EX         IDS_SETPARAMLONG
+#define CMD_NETKVM_SAVE_TRACE           L"savetrace"
+#define HLP_NETKVM_SAVE_TRACE           IDS_SAVETRACE
+#define HLP_NETKVM_SAVE_TRACE_EX        IDS_SAVETRACELONG
 
 CMD_ENTRY  g_TopLevelCommands[] =
 {
@@ -1014,6 +1278,9 @@ CMD_ENTRY  g_TopLevelCommands[] =
                         CMD_FLAG_PRIVATE | CMD_FLAG_LOCAL),
     CREATE_CMD_ENTRY_EX(NETKVM_SET_PARAM,
                         (PFN_HANDLE_CMD) _NetKVMSetParamCmdHandler,
+                        CMD_FLAG_PRIVATE | CMD_FLAG_LOCAL),
+    CREATE_CMD_ENTRY_EX(NETKVM_SAVE_TRACE,
+                        (PFN_HANDLE_CMD) _NetKVMSaveTraceCmdHandler,
                         CMD_FLAG_PRIVATE | CMD_FLAG_LOCAL)
 };
 
@@ -45,6 +45,12 @@
 #define IDS_SETPARAMLONG                141
 #define IDS_SETPARAM                    142
 #define IDS_LOCALONLY                   143
+#define IDS_SHOWSTATSSHORT              144
+#define IDS_SHOWSTATSLONG               145
+#define IDS_STATSUNAVAILABLE            146
+#define IDS_SAVETRACE                   147
+#define IDS_SAVETRACELONG               148
+#define IDS_TRACEUNAVAILABLE            149
 
 // Next default values for new objects
 //
@@ -89,7 +89,7 @@ typedef struct _tagBugCheckDataLocation
 }tBugCheckDataLocation;
 
 #define PARANDIS_DEBUG_STATIC_DATA_VERSION          1
-#define PARANDIS_DEBUG_PER_NIC_DATA_VERSION         0
+#define PARANDIS_DEBUG_PER_NIC_DATA_VERSION         1
 #define PARANDIS_DEBUG_HISTORY_DATA_VERSION         1
 #define PARANDIS_DEBUG_PENDING_NBL_ENTRY_VERSION    0
 
@@ -190,6 +190,8 @@ typedef struct _tagBugCheckPerNicDataContent_V1
     LARGE_INTEGER       LastInterruptTimeStamp;
     LARGE_INTEGER       LastTxCompletionTimeStamp;
     ULONG               nofReadyTxBuffers;
+    ULONG               VirtioTraceSize;    // 0 if the virtqueue event trace is not enabled
+    UINT64              VirtioTrace;        // VIRTIO_TRACE_HEADER, see virtio_trace.h
 }tBugCheckPerNicDataContent_V1;
 
 
@@ -54,6 +54,16 @@ public:
         m_pVirtQueue->Renew();
     }
 
+    void GetQueueStatistics(NETKVM_QUEUE_STATISTICS &Statistics)
+    {
+        m_pVirtQueue->GetStatistics(Statistics);
+    }
+
+    void ResetQueueStatistics()
+    {
+        m_pVirtQueue->ResetStatistics();
+    }
+
     ULONG getCPUIndex();
 
     VOID SetLastInterruptTimestamp(LARGE_INTEGER timestamp)
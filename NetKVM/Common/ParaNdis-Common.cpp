@@ -93,6 +93,7 @@ typedef struct _tagConfigurationEntries
     tConfigurationEntry VlanId;
     tConfigurationEntry MTU;
     tConfigurationEntry NumberOfHandledRXPacketsInDPC;
+    tConfigurationEntry VirtioTraceRecords;
 #if PARANDIS_SUPPORT_RSS
     tConfigurationEntry RSSOffloadSupported;
     tConfigurationEntry NumRSSQueues;
@@ -125,6 +126,7 @@ static const tConfigurationEntries defaultConfiguration =
     { "VlanId", 0, 0, MAX_VLAN_ID},
     { "MTU", 1500, 576, 65500},
     { "NumberOfHandledRXPacketsInDPC", MAX_RX_LOOPS, 1, 10000},
+    { "VirtioTraceRecords", 0, 0, 16384},
 #if PARANDIS_SUPPORT_RSS
     { "*RSS", 1, 0, 1},
     { "*NumRssQueues", 8, 1, PARANDIS_RSS_MAX_RECEIVE_QUEUES},
@@ -253,6 +255,7 @@ static void ReadNicConfiguration(PARANDIS_ADAPTER *pContext, PUCHAR pNewMACAddre
             GetConfigurationEntry(cfg, &pConfiguration->VlanId);
             GetConfigurationEntry(cfg, &pConfiguration->MTU);
             GetConfigurationEntry(cfg, &pConfiguration->NumberOfHandledRXPacketsInDPC);
+            GetConfigurationEntry(cfg, &pConfiguration->VirtioTraceRecords);
 #if PARANDIS_SUPPORT_RSS
             GetConfigurationEntry(cfg, &pConfiguration->RSSOffloadSupported);
             GetConfigurationEntry(cfg, &pConfiguration->NumRSSQueues);
@@ -267,6 +270,7 @@ static void ReadNicConfiguration(PARANDIS_ADAPTER *pContext, PUCHAR pNewMACAddre
             pContext->maxFreeTxDescriptors = pConfiguration->TxCapacity.ulValue;
             pContext->NetMaxReceiveBuffers = pConfiguration->RxCapacity.ulValue;
             pContext->uNumberOfHandledRXPacketsInDPC = pConfiguration->NumberOfHandledRXPacketsInDPC.ulValue;
+            pContext->ulVirtioTraceRecords = pConfiguration->VirtioTraceRecords.ulValue;
             pContext->bDoSupportPriority = pConfiguration->PrioritySupport.ulValue != 0;
             pContext->Offload.flagsValue = 0;
             // TX caps: 1 - TCP, 2 - UDP, 4 - IP, 8 - TCPv6, 16 - UDPv6
@@ -402,6 +406,7 @@ static void DumpVirtIOFeatures(PPARANDIS_ADAPTER pContext)
         {VIRTIO_RING_F_EVENT_IDX, "VIRTIO_RING_F_EVENT_IDX"},
         {VIRTIO_F_VERSION_1, "VIRTIO_F_VERSION_1"},
         {VIRTIO_F_RING_PACKED, "VIRTIO_F_RING_PACKED"},
+        {VIRTIO_F_IN_ORDER, "VIRTIO_F_IN_ORDER"},
         {VIRTIO_NET_F_CTRL_GUEST_OFFLOADS, "VIRTIO_NET_F_CTRL_GUEST_OFFLOADS" },
         {VIRTIO_NET_F_RSC_EXT, "VIRTIO_NET_F_RSC_EXT" },
     };
@@ -431,14 +436,17 @@ Prints out statistics
 ***********************************************************/
 static void PrintStatistics(PARANDIS_ADAPTER *pContext)
 {
+    PARANDIS_CPU_STATISTICS Statistics;
+    ParaNdis_GetStatistics(pContext, &Statistics);
+
     ULONG64 totalTxFrames =
-        pContext->Statistics.ifHCOutBroadcastPkts +
-        pContext->Statistics.ifHCOutMulticastPkts +
-        pContext->Statistics.ifHCOutUcastPkts;
+        Statistics.ifHCOutBroadcastPkts +
+        Statistics.ifHCOutMulticastPkts +
+        Statistics.ifHCOutUcastPkts;
     ULONG64 totalRxFrames =
-        pContext->Statistics.ifHCInBroadcastPkts +
-        pContext->Statistics.ifHCInMulticastPkts +
-        pContext->Statistics.ifHCInUcastPkts;
+        Statistics.ifHCInBroadcastPkts +
+        Statistics.ifHCInMulticastPkts +
+        Statistics.ifHCInUcastPkts;
 
 #if 0 /* TODO - setup accessor functions*/
     DPrintf(0, "[Diag!%X] RX buffers at VIRTIO %d of %d\n",
@@ -452,15 +460,74 @@ static void PrintStatistics(PARANDIS_ADAPTER *pContext)
         pContext->TXPath.GetFreeHWBuffers());
 #endif
     DPrintf(0, "[Diag!] Bytes transmitted %I64u, received %I64u\n",
-        pContext->Statistics.ifHCOutOctets,
-        pContext->Statistics.ifHCInOctets);
+        Statistics.ifHCOutOctets,
+        Statistics.ifHCInOctets);
     DPrintf(0, "[Diag!] Tx frames %I64u, CSO %d, LSO %d\n",
         totalTxFrames,
-        pContext->extraStatistics.framesCSOffload,
-        pContext->extraStatistics.framesLSO);
+        Statistics.framesCSOffload,
+        Statistics.framesLSO);
     DPrintf(0, "[Diag!] Rx frames %I64u, Rx.Pri %d, RxHwCS.OK %d, FiltOut %d\n",
-        totalRxFrames, pContext->extraStatistics.framesRxPriority,
-        pContext->extraStatistics.framesRxCSHwOK, pContext->extraStatistics.framesFilteredOut);
+        totalRxFrames, Statistics.framesRxPriority,
+        Statistics.framesRxCSHwOK, Statistics.framesFilteredOut);
+}
+
+/**********************************************************
+Sums up the per CPU statistics blocks
+Parameters:
+    context
+    PPARANDIS_CPU_STATISTICS pTotal     receives the sums
+***********************************************************/
+void ParaNdis_GetStatistics(PARANDIS_ADAPTER *pContext, PPARANDIS_CPU_STATISTICS pTotal)
+{
+    NdisZeroMemory(pTotal, sizeof(*pTotal));
+
+    for (ULONG i = 0; i < pContext->nCPUStatistics; i++)
+    {
+        auto pStatistics = (PPARANDIS_CPU_STATISTICS)RtlOffsetToPointer(pContext->pCPUStatistics,
+            i * pContext->ulCPUStatisticsStride);
+
+        pTotal->ifInDiscards += pStatistics->ifInDiscards;
+        pTotal->ifInErrors += pStatistics->ifInErrors;
+        pTotal->ifHCInOctets += pStatistics->ifHCInOctets;
+        pTotal->ifHCInUcastPkts += pStatistics->ifHCInUcastPkts;
+        pTotal->ifHCInMulticastPkts += pStatistics->ifHCInMulticastPkts;
+        pTotal->ifHCInBroadcastPkts += pStatistics->ifHCInBroadcastPkts;
+        pTotal->ifHCOutOctets += pStatistics->ifHCOutOctets;
+        pTotal->ifHCOutUcastPkts += pStatistics->ifHCOutUcastPkts;
+        pTotal->ifHCOutMulticastPkts += pStatistics->ifHCOutMulticastPkts;
+        pTotal->ifHCOutBroadcastPkts += pStatistics->ifHCOutBroadcastPkts;
+        pTotal->ifHCInUcastOctets += pStatistics->ifHCInUcastOctets;
+        pTotal->ifHCInMulticastOctets += pStatistics->ifHCInMulticastOctets;
+        pTotal->ifHCInBroadcastOctets += pStatistics->ifHCInBroadcastOctets;
+        pTotal->ifHCOutUcastOctets += pStatistics->ifHCOutUcastOctets;
+        pTotal->ifHCOutMulticastOctets += pStatistics->ifHCOutMulticastOctets;
+        pTotal->ifHCOutBroadcastOctets += pStatistics->ifHCOutBroadcastOctets;
+
+        pTotal->framesCSOffload += pStatistics->framesCSOffload;
+        pTotal->framesLSO += pStatistics->framesLSO;
+        pTotal->framesRxPriority += pStatistics->framesRxPriority;
+        pTotal->framesRxCSHwOK += pStatistics->framesRxCSHwOK;
+        pTotal->framesFilteredOut += pStatistics->framesFilteredOut;
+        pTotal->framesCoalescedHost += pStatistics->framesCoalescedHost;
+        pTotal->framesCoalescedWindows += pStatistics->framesCoalescedWindows;
+    }
+}
+
+void ParaNdis_ResetExtraStatistics(PARANDIS_ADAPTER *pContext)
+{
+    for (ULONG i = 0; i < pContext->nCPUStatistics; i++)
+    {
+        auto pStatistics = (PPARANDIS_CPU_STATISTICS)RtlOffsetToPointer(pContext->pCPUStatistics,
+            i * pContext->ulCPUStatisticsStride);
+
+        pStatistics->framesCSOffload = 0;
+        pStatistics->framesLSO = 0;
+        pStatistics->framesRxPriority = 0;
+        pStatistics->framesRxCSHwOK = 0;
+        pStatistics->framesFilteredOut = 0;
+        pStatistics->framesCoalescedHost = 0;
+        pStatistics->framesCoalescedWindows = 0;
+    }
 }
 
 static
@@ -756,6 +823,16 @@ NDIS_STATUS ParaNdis_InitializeContext(
             return status;
         }
 
+        // hidden parameter, records per CPU of the virtqueue event trace (OID_VENDOR_4)
+        if (pContext->ulVirtioTraceRecords)
+        {
+            nt_status = virtio_trace_enable(&pContext->IODevice, pContext->ulVirtioTraceRecords);
+            if (!NT_SUCCESS(nt_status))
+            {
+                DPrintf(0, "[%s] virtio_trace_enable failed with %x\n", __FUNCTION__, nt_status);
+            }
+        }
+
         pContext->u64HostFeatures = virtio_get_features(&pContext->IODevice);
         DumpVirtIOFeatures(pContext);
 
@@ -862,6 +939,10 @@ NDIS_STATUS ParaNdis_InitializeContext(
         {
             DPrintf(0, "[%s] Using PACKED ring\n", __FUNCTION__);
         }
+        if (AckFeature(pContext, VIRTIO_F_IN_ORDER))
+        {
+            DPrintf(0, "[%s] Device uses buffers in order\n", __FUNCTION__);
+        }
     }
 
     if (pContext->bControlQueueSupported)
@@ -1024,6 +1105,22 @@ static NDIS_STATUS ParaNdis_VirtIONetInit(PARANDIS_ADAPTER *pContext)
 
     }
 
+    /* one cache aligned block of counters per CPU, hot-added ones included */
+    ULONG ulStatisticsSize;
+    pContext->nCPUStatistics = ParaNdis_GetMaximumCPUCount();
+    pContext->ulCPUStatisticsStride = ALIGN_UP_BY(sizeof(PARANDIS_CPU_STATISTICS), NdisGetSharedDataAlignment());
+    ulStatisticsSize = pContext->nCPUStatistics * pContext->ulCPUStatisticsStride + NdisGetSharedDataAlignment();
+    pContext->pCPUStatisticsAllocation = NdisAllocateMemoryWithTagPriority(pContext->MiniportHandle, ulStatisticsSize,
+        PARANDIS_MEMORY_TAG, NormalPoolPriority);
+    if (pContext->pCPUStatisticsAllocation == nullptr)
+    {
+        DPrintf(0, "[%s] Statistics allocation failed\n", __FUNCTION__);
+        pContext->nCPUStatistics = 0;
+        return status;
+    }
+    NdisZeroMemory(pContext->pCPUStatisticsAllocation, ulStatisticsSize);
+    pContext->pCPUStatistics = ALIGN_UP_POINTER_BY(pContext->pCPUStatisticsAllocation, NdisGetSharedDataAlignment());
+
     pContext->pPathBundles = (CPUPathBundle *)NdisAllocateMemoryWithTagPriority(pContext->MiniportHandle, pContext->nPathBundles * sizeof(*pContext->pPathBundles),
         PARANDIS_MEMORY_TAG, NormalPoolPriority);
     if (pContext->pPathBundles == nullptr)
@@ -1349,6 +1446,14 @@ VOID ParaNdis_CleanupContext(PARANDIS_ADAPTER *pContext)
         pContext->pPathBundles = nullptr;
     }
 
+    if (pContext->pCPUStatisticsAllocation != NULL)
+    {
+        NdisFreeMemoryWithTagPriority(pContext->MiniportHandle, pContext->pCPUStatisticsAllocation, PARANDIS_MEMORY_TAG);
+        pContext->pCPUStatisticsAllocation = nullptr;
+        pContext->pCPUStatistics = nullptr;
+        pContext->nCPUStatistics = 0;
+    }
+
     if (pContext->RSS2QueueMap)
     {
         NdisFreeMemoryWithTagPriority(pContext->MiniportHandle, pContext->RSS2QueueMap, PARANDIS_MEMORY_TAG);
@@ -1375,10 +1480,51 @@ VOID ParaNdis_OnShutdown(PARANDIS_ADAPTER *pContext)
     pContext->m_StateMachine.NotifyShutdown();
 }
 
-static ULONG ShallPassPacket(PARANDIS_ADAPTER *pContext, PNET_PACKET_INFO pPacketInfo)
+static FORCEINLINE ULONG ParaNdis_MulticastHash(const UCHAR *Address)
 {
-    ULONG i;
+    // the group bits of IPv4 and IPv6 multicast addresses are in the low bytes
+    return (Address[5] ^ (Address[4] * 7) ^ (Address[3] * 13) ^ Address[2]) &
+        (PARANDIS_MULTICAST_HASH_SIZE - 1);
+}
+
+static BOOLEAN ParaNdis_IsMulticastMember(tMulticastData *pData, const UCHAR *Address)
+{
+    ULONG i = pData->HashHeads[ParaNdis_MulticastHash(Address)];
+    ULONG nLookups = 0;
 
+    // the bound on lookups protects from the list being replaced meanwhile
+    while (i != PARANDIS_MULTICAST_NO_ENTRY &&
+        i < pData->nofMulticastEntries && nLookups++ < PARANDIS_MULTICAST_LIST_SIZE)
+    {
+        ULONG Res;
+
+        ETH_COMPARE_NETWORK_ADDRESSES_EQ_SAFE(Address, &pData->MulticastList[i * ETH_ALEN], &Res);
+        if (!Res)
+            return TRUE;
+
+        i = pData->HashNext[i];
+    }
+    return FALSE;
+}
+
+static void ParaNdis_BuildMulticastHash(tMulticastData *pData)
+{
+    for (ULONG i = 0; i < PARANDIS_MULTICAST_HASH_SIZE; i++)
+    {
+        pData->HashHeads[i] = PARANDIS_MULTICAST_NO_ENTRY;
+    }
+
+    for (USHORT i = 0; i < pData->nofMulticastEntries; i++)
+    {
+        ULONG hash = ParaNdis_MulticastHash(&pData->MulticastList[i * ETH_ALEN]);
+
+        pData->HashNext[i] = pData->HashHeads[hash];
+        pData->HashHeads[hash] = i;
+    }
+}
+
+static ULONG ShallPassPacket(PARANDIS_ADAPTER *pContext, PNET_PACKET_INFO pPacketInfo)
+{
     if (pPacketInfo->dataLength > pContext->MaxPacketSize.nMaxFullSizeOsRx + ETH_PRIORITY_HEADER_SIZE)
         return FALSE;
 
@@ -1418,18 +1564,7 @@ static ULONG ShallPassPacket(PARANDIS_ADAPTER *pContext, PNET_PACKET_INFO pPacke
     if(!(pContext->PacketFilter & NDIS_PACKET_TYPE_MULTICAST))
         return FALSE;
 
-    for (i = 0; i < pContext->MulticastData.nofMulticastEntries; i++)
-    {
-        ULONG Res;
-        PUCHAR CurrMcastAddr = &pContext->MulticastData.MulticastList[i*ETH_ALEN];
-
-        ETH_COMPARE_NETWORK_ADDRESSES_EQ_SAFE(pPacketInfo->ethDestAddr, CurrMcastAddr, &Res);
-
-        if(!Res)
-            return TRUE;
-    }
-
-    return FALSE;
+    return ParaNdis_IsMulticastMember(&pContext->MulticastData, pPacketInfo->ethDestAddr);
 }
 
 static __inline
@@ -1468,22 +1603,24 @@ UpdateReceiveSuccessStatistics(PPARANDIS_ADAPTER pContext,
                                PNET_PACKET_INFO pPacketInfo,
                                UINT nCoalescedSegmentsCount)
 {
-    pContext->Statistics.ifHCInOctets += pPacketInfo->dataLength;
+    PPARANDIS_CPU_STATISTICS pStatistics = ParaNdis_CPUStatistics(pContext);
+
+    pStatistics->ifHCInOctets += pPacketInfo->dataLength;
 
     if(pPacketInfo->isUnicast)
     {
-        pContext->Statistics.ifHCInUcastPkts += nCoalescedSegmentsCount;
-        pContext->Statistics.ifHCInUcastOctets += pPacketInfo->dataLength;
+        pStatistics->ifHCInUcastPkts += nCoalescedSegmentsCount;
+        pStatistics->ifHCInUcastOctets += pPacketInfo->dataLength;
     }
     else if (pPacketInfo->isBroadcast)
     {
-        pContext->Statistics.ifHCInBroadcastPkts += nCoalescedSegmentsCount;
-        pContext->Statistics.ifHCInBroadcastOctets += pPacketInfo->dataLength;
+        pStatistics->ifHCInBroadcastPkts += nCoalescedSegmentsCount;
+        pStatistics->ifHCInBroadcastOctets += pPacketInfo->dataLength;
     }
     else if (pPacketInfo->isMulticast)
     {
-        pContext->Statistics.ifHCInMulticastPkts += nCoalescedSegmentsCount;
-        pContext->Statistics.ifHCInMulticastOctets += pPacketInfo->dataLength;
+        pStatistics->ifHCInMulticastPkts += nCoalescedSegmentsCount;
+        pStatistics->ifHCInMulticastOctets += pPacketInfo->dataLength;
     }
     else
     {
@@ -1494,8 +1631,10 @@ UpdateReceiveSuccessStatistics(PPARANDIS_ADAPTER pContext,
 static __inline VOID
 UpdateReceiveFailStatistics(PPARANDIS_ADAPTER pContext, UINT nCoalescedSegmentsCount)
 {
-    pContext->Statistics.ifInErrors++;
-    pContext->Statistics.ifInDiscards += nCoalescedSegmentsCount;
+    PPARANDIS_CPU_STATISTICS pStatistics = ParaNdis_CPUStatistics(pContext);
+
+    pStatistics->ifInErrors++;
+    pStatistics->ifInDiscards += nCoalescedSegmentsCount;
 }
 
 static void ProcessReceiveQueue(PARANDIS_ADAPTER *pContext,
@@ -1543,7 +1682,7 @@ static void ProcessReceiveQueue(PARANDIS_ADAPTER *pContext,
         }
         else
         {
-            pContext->extraStatistics.framesFilteredOut++;
+            ParaNdis_CPUStatistics(pContext)->framesFilteredOut++;
             pBufferDescriptor->Queue->ReuseReceiveBuffer(pBufferDescriptor);
         }
     }
@@ -1769,6 +1908,7 @@ NDIS_STATUS ParaNdis_SetMulticastList(
         if (length)
             NdisMoveMemory(pContext->MulticastData.MulticastList, Buffer, length);
         pContext->MulticastData.nofMulticastEntries = length / ETH_ALEN;
+        ParaNdis_BuildMulticastHash(&pContext->MulticastData);
         DPrintf(1, "[%s] New multicast list of %d bytes\n", __FUNCTION__, length);
         *pBytesRead = length;
         status = NDIS_STATUS_SUCCESS;
@@ -1828,7 +1968,9 @@ static VOID ParaNdis_DeviceFiltersUpdateRxMode(PARANDIS_ADAPTER *pContext)
     ULONG f = pContext->PacketFilter;
     val = (f & NDIS_PACKET_TYPE_PROMISCUOUS) ? 1 : 0;
     pContext->CXPath.SendControlMessage(VIRTIO_NET_CTRL_RX, VIRTIO_NET_CTRL_RX_PROMISC, &val, sizeof(val), NULL, 0, 2);
-    val = (f & NDIS_PACKET_TYPE_ALL_MULTICAST) ? 1 : 0;
+    val = ((f & NDIS_PACKET_TYPE_ALL_MULTICAST) ||
+           ((f & NDIS_PACKET_TYPE_MULTICAST) &&
+            pContext->MulticastData.nofMulticastEntries > PARANDIS_DEVICE_MULTICAST_LIST_SIZE)) ? 1 : 0;
     pContext->CXPath.SendControlMessage(VIRTIO_NET_CTRL_RX, VIRTIO_NET_CTRL_RX_ALLMULTI, &val, sizeof(val), NULL, 0, 2);
 
     if (pContext->bCtrlRXExtraFiltersSupported)
@@ -1845,12 +1987,28 @@ static VOID ParaNdis_DeviceFiltersUpdateRxMode(PARANDIS_ADAPTER *pContext)
 static VOID ParaNdis_DeviceFiltersUpdateAddresses(PARANDIS_ADAPTER *pContext)
 {
     u32 u32UniCastEntries = 0;
-    pContext->CXPath.SendControlMessage(VIRTIO_NET_CTRL_MAC, VIRTIO_NET_CTRL_MAC_TABLE_SET,
-                        &u32UniCastEntries,
-                        sizeof(u32UniCastEntries),
-                        &pContext->MulticastData,
-                        sizeof(pContext->MulticastData.nofMulticastEntries) + pContext->MulticastData.nofMulticastEntries * ETH_ALEN,
-                        2);
+    u32 u32MultiCastEntries = 0;
+
+    if (pContext->MulticastData.nofMulticastEntries <= PARANDIS_DEVICE_MULTICAST_LIST_SIZE)
+    {
+        pContext->CXPath.SendControlMessage(VIRTIO_NET_CTRL_MAC, VIRTIO_NET_CTRL_MAC_TABLE_SET,
+                            &u32UniCastEntries,
+                            sizeof(u32UniCastEntries),
+                            &pContext->MulticastData,
+                            sizeof(pContext->MulticastData.nofMulticastEntries) + pContext->MulticastData.nofMulticastEntries * ETH_ALEN,
+                            2);
+    }
+    else
+    {
+        // the device receives all multicast (see ParaNdis_DeviceFiltersUpdateRxMode)
+        // and the hash in MulticastData filters it
+        pContext->CXPath.SendControlMessage(VIRTIO_NET_CTRL_MAC, VIRTIO_NET_CTRL_MAC_TABLE_SET,
+                            &u32UniCastEntries,
+                            sizeof(u32UniCastEntries),
+                            &u32MultiCastEntries,
+                            sizeof(u32MultiCastEntries),
+                            2);
+    }
 }
 
 static VOID SetSingleVlanFilter(PARANDIS_ADAPTER *pContext, ULONG vlanId, BOOLEAN bOn, int levelIfOK)
@@ -2092,7 +2250,7 @@ tChecksumCheckResult ParaNdis_CheckRxChecksum(
 
     if (virtioFlags & VIRTIO_NET_HDR_F_DATA_VALID)
     {
-        pContext->extraStatistics.framesRxCSHwOK++;
+        ParaNdis_CPUStatistics(pContext)->framesRxCSHwOK++;
         ppr.xxpCheckSum = ppresCSOK;
     }
 
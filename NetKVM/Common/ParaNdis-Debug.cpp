@@ -283,6 +283,8 @@ static UINT FillDataOnBugCheck()
 
         pSave->LastInterruptTimeStamp.QuadPart = PARANDIS_GET_LAST_INTERRUPT_TIMESTAMP(p);
         pSave->LastTxCompletionTimeStamp = p->LastTxCompletionTimeStamp;
+        pSave->VirtioTrace = (UINT_PTR)(PVOID)p->IODevice.trace_block;
+        pSave->VirtioTraceSize = virtio_trace_size(&p->IODevice);
         ParaNdis_CallOnBugCheck(p);
         ++n;
     }
@@ -228,6 +228,7 @@ NDIS_STATUS ParaNdis_OidQueryCommon(PARANDIS_ADAPTER *pContext, tOidDesc *pOid)
     PVOID pInfo  = NULL;
     ULONG ulSize = 0;
     BOOLEAN bFreeInfo = FALSE;
+    PARANDIS_CPU_STATISTICS Statistics;
     union _tagtemp
     {
         NDIS_MEDIUM                             Medium;
@@ -237,6 +238,7 @@ NDIS_STATUS ParaNdis_OidQueryCommon(PARANDIS_ADAPTER *pContext, tOidDesc *pOid)
         NDIS_PNP_CAPABILITIES                   PMCaps;
     } u;
 #define SETINFO(field, value) pInfo = &u.##field; ulSize = sizeof(u.##field); u.##field = (value)
+#define SETSTAT(value) ParaNdis_GetStatistics(pContext, &Statistics); SETINFO(ul64, value)
     switch (pOid->Oid)
     {
     case OID_GEN_SUPPORTED_LIST:
@@ -354,52 +356,52 @@ NDIS_STATUS ParaNdis_OidQueryCommon(PARANDIS_ADAPTER *pContext, tOidDesc *pOid)
         pInfo = &status;
         break;
     case OID_GEN_DIRECTED_BYTES_XMIT:
-        SETINFO(ul64, pContext->Statistics.ifHCOutUcastOctets);
+        SETSTAT(Statistics.ifHCOutUcastOctets);
         break;
     case OID_GEN_DIRECTED_FRAMES_XMIT:
-        SETINFO(ul64, pContext->Statistics.ifHCOutUcastPkts);
+        SETSTAT(Statistics.ifHCOutUcastPkts);
         break;
     case OID_GEN_MULTICAST_BYTES_XMIT:
-        SETINFO(ul64, pContext->Statistics.ifHCOutMulticastOctets);
+        SETSTAT(Statistics.ifHCOutMulticastOctets);
         break;
     case OID_GEN_MULTICAST_FRAMES_XMIT:
-        SETINFO(ul64, pContext->Statistics.ifHCOutMulticastPkts);
+        SETSTAT(Statistics.ifHCOutMulticastPkts);
         break;
     case OID_GEN_BROADCAST_BYTES_XMIT:
-        SETINFO(ul64, pContext->Statistics.ifHCOutBroadcastOctets);
+        SETSTAT(Statistics.ifHCOutBroadcastOctets);
         break;
     case OID_GEN_BROADCAST_FRAMES_XMIT:
-        SETINFO(ul64, pContext->Statistics.ifHCOutBroadcastPkts);
+        SETSTAT(Statistics.ifHCOutBroadcastPkts);
         break;
     case OID_GEN_DIRECTED_BYTES_RCV:
-        SETINFO(ul64, pContext->Statistics.ifHCInUcastOctets);
+        SETSTAT(Statistics.ifHCInUcastOctets);
         break;
     case OID_GEN_DIRECTED_FRAMES_RCV:
-        SETINFO(ul64, pContext->Statistics.ifHCInUcastPkts);
+        SETSTAT(Statistics.ifHCInUcastPkts);
         break;
     case OID_GEN_MULTICAST_BYTES_RCV:
-        SETINFO(ul64, pContext->Statistics.ifHCInMulticastOctets);
+        SETSTAT(Statistics.ifHCInMulticastOctets);
         break;
     case OID_GEN_MULTICAST_FRAMES_RCV:
-        SETINFO(ul64, pContext->Statistics.ifHCInMulticastPkts);
+        SETSTAT(Statistics.ifHCInMulticastPkts);
         break;
     case OID_GEN_BROADCAST_BYTES_RCV:
-        SETINFO(ul64, pContext->Statistics.ifHCInBroadcastOctets);
+        SETSTAT(Statistics.ifHCInBroadcastOctets);
         break;
     case OID_GEN_BROADCAST_FRAMES_RCV:
-        SETINFO(ul64, pContext->Statistics.ifHCInBroadcastPkts);
+        SETSTAT(Statistics.ifHCInBroadcastPkts);
         break;
     case OID_GEN_XMIT_OK:
-        SETINFO(ul64,
-            pContext->Statistics.ifHCOutUcastPkts +
-            pContext->Statistics.ifHCOutMulticastPkts +
-            pContext->Statistics.ifHCOutBroadcastPkts);
+        SETSTAT(
+            Statistics.ifHCOutUcastPkts +
+            Statistics.ifHCOutMulticastPkts +
+            Statistics.ifHCOutBroadcastPkts);
         break;
     case OID_GEN_RCV_OK:
-        SETINFO(ul64,
-            pContext->Statistics.ifHCInUcastPkts +
-            pContext->Statistics.ifHCInMulticastPkts +
-            pContext->Statistics.ifHCInBroadcastPkts);
+        SETSTAT(
+            Statistics.ifHCInUcastPkts +
+            Statistics.ifHCInMulticastPkts +
+            Statistics.ifHCInBroadcastPkts);
         DPrintf(4, "[%s] Total frames %I64u\n", __FUNCTION__, u.ul64);
         break;
     case OID_GEN_XMIT_ERROR:
@@ -6,11 +6,29 @@
 #include "ParaNdis-RX.tmh"
 #endif
 
-static FORCEINLINE VOID ParaNdis_ReceiveQueueAddBuffer(PPARANDIS_RECEIVE_QUEUE pQueue, pRxNetDescriptor pBuffer)
+// Mergeable RX buffers are page-sized fragments carved from blocks of this size
+#define PARANDIS_RX_POOL_BLOCK_SIZE     (16 * PAGE_SIZE)
+
+/* Moves a batch of descriptors linked by ReceiveQueueListEntry to the tail
+   of the receive queue, taking the queue lock once for the whole batch */
+static FORCEINLINE VOID ParaNdis_ReceiveQueueAddBuffers(PPARANDIS_RECEIVE_QUEUE pQueue, PLIST_ENTRY pBuffers)
 {
-    NdisInterlockedInsertTailList(&pQueue->BuffersList,
-        &pBuffer->ReceiveQueueListEntry,
-        &pQueue->Lock);
+    if (IsListEmpty(pBuffers))
+    {
+        return;
+    }
+
+    PLIST_ENTRY pFirst = pBuffers->Flink;
+    PLIST_ENTRY pLast = pBuffers->Blink;
+
+    NdisDprAcquireSpinLock(&pQueue->Lock);
+    pFirst->Blink = pQueue->BuffersList.Blink;
+    pLast->Flink = &pQueue->BuffersList;
+    pQueue->BuffersList.Blink->Flink = pFirst;
+    pQueue->BuffersList.Blink = pLast;
+    NdisDprReleaseSpinLock(&pQueue->Lock);
+
+    InitializeListHead(pBuffers);
 }
 
 static void ParaNdis_UnbindRxBufferFromPacket(
@@ -62,7 +80,14 @@ static void ParaNdis_FreeRxBufferDescriptor(PARANDIS_ADAPTER *pContext, pRxNetDe
     ULONG i;
 
     ParaNdis_UnbindRxBufferFromPacket(p);
-    for (i = 0; i < p->BufferSGLength; i++)
+    if (p->MergedHolder)
+    {
+        NdisAdjustMdlLength(p->MergedHolder, p->BufferSGArray[0].length);
+        NdisFreeMdl(p->MergedHolder);
+    }
+
+    // the fragment of a mergeable buffer belongs to the pool of the queue
+    for (i = 0; !p->MergeableBuffer && i < p->BufferSGLength; i++)
     {
         ParaNdis_FreePhysicalMemory(pContext, &p->PhysicalPages[i]);
     }
@@ -82,6 +107,7 @@ CParaNdisRX::CParaNdisRX() : m_nReusedRxBuffersCounter(0), m_NetNofReceiveBuffer
 
 CParaNdisRX::~CParaNdisRX()
 {
+    FreePool();
     NdisFreeSpinLock(&m_UnclassifiedPacketsQueue.Lock);
 }
 
@@ -98,6 +124,9 @@ bool CParaNdisRX::Create(PPARANDIS_ADAPTER Context, UINT DeviceQueueIndex)
         return false;
     }
 
+    // the header shares the buffer with the data, so the layout must be free
+    m_MergeableBuffers = m_Context->bUseMergedBuffers && m_Context->bAnyLayout;
+
     PrepareReceiveBuffers();
 
     m_nReusedRxBuffersLimit = m_Context->NetMaxReceiveBuffers / 4 + 1;
@@ -113,9 +142,27 @@ int CParaNdisRX::PrepareReceiveBuffers()
     UINT i;
     DEBUG_ENTRY(4);
 
+    if (m_MergeableBuffers)
+    {
+        // the largest packet plus the header, and one spare buffer
+        m_MaxMergedBuffers = (USHORT)((m_Context->MaxPacketSize.nMaxDataSizeHwRx +
+            m_Context->nVirtioHeaderSize) / PAGE_SIZE + 2);
+
+        // in the worst case every block is only a single page
+        m_MaxPoolBlocks = m_Context->NetMaxReceiveBuffers;
+        m_PoolBlocks = (tCompletePhysicalAddress *)ParaNdis_AllocateMemory(m_Context,
+            sizeof(*m_PoolBlocks) * m_MaxPoolBlocks);
+        if (m_PoolBlocks == NULL)
+        {
+            DPrintf(0, "[%s] Falling back to the max-size buffers\n", __FUNCTION__);
+            m_MergeableBuffers = false;
+        }
+    }
+
     for (i = 0; i < m_Context->NetMaxReceiveBuffers; ++i)
     {
-        pRxNetDescriptor pBuffersDescriptor = CreateRxDescriptorOnInit();
+        pRxNetDescriptor pBuffersDescriptor = m_MergeableBuffers ?
+            CreateMergeableRxDescriptorOnInit() : CreateRxDescriptorOnInit();
         if (!pBuffersDescriptor) break;
 
         pBuffersDescriptor->Queue = this;
@@ -132,7 +179,8 @@ int CParaNdisRX::PrepareReceiveBuffers()
     }
     /* TODO - NetMaxReceiveBuffers should take into account all queues */
     m_Context->NetMaxReceiveBuffers = m_NetNofReceiveBuffers;
-    DPrintf(0, "[%s] MaxReceiveBuffers %d\n", __FUNCTION__, m_Context->NetMaxReceiveBuffers);
+    DPrintf(0, "[%s] MaxReceiveBuffers %d, %s buffers (%d blocks)\n", __FUNCTION__,
+        m_Context->NetMaxReceiveBuffers, m_MergeableBuffers ? "mergeable" : "max-size", m_NumPoolBlocks);
     m_Reinsert = true;
 
     return nRet;
@@ -203,16 +251,139 @@ error_exit:
     return NULL;
 }
 
+bool CParaNdisRX::AllocatePoolFragment(tCompletePhysicalAddress *pFragment)
+{
+    tCompletePhysicalAddress *pBlock = m_NumPoolBlocks ? &m_PoolBlocks[m_NumPoolBlocks - 1] : NULL;
+
+    if (pBlock == NULL || m_PoolBlockOffset >= pBlock->size)
+    {
+        if (m_NumPoolBlocks == m_MaxPoolBlocks)
+        {
+            return false;
+        }
+
+        pBlock = &m_PoolBlocks[m_NumPoolBlocks];
+        ULONG ulBlockSize = PARANDIS_RX_POOL_BLOCK_SIZE;
+        while (!ParaNdis_InitialAllocatePhysicalMemory(m_Context, ulBlockSize, pBlock))
+        {
+            // Retry with half the pages
+            if (ulBlockSize == PAGE_SIZE)
+                return false;
+            else
+                ulBlockSize /= 2;
+        }
+        m_NumPoolBlocks++;
+        m_PoolBlockOffset = 0;
+    }
+
+    pFragment->Virtual = RtlOffsetToPointer(pBlock->Virtual, m_PoolBlockOffset);
+    pFragment->Physical.QuadPart = pBlock->Physical.QuadPart + m_PoolBlockOffset;
+    pFragment->size = PAGE_SIZE;
+    m_PoolBlockOffset += PAGE_SIZE;
+
+    return true;
+}
+
+void CParaNdisRX::ReturnPoolFragment(const tCompletePhysicalAddress *pFragment)
+{
+    //Descriptors are created one by one on init, so a failed one holds the
+    //last fragment of the pool and the offset can simply step back
+    tCompletePhysicalAddress *pBlock = &m_PoolBlocks[m_NumPoolBlocks - 1];
+
+    if (m_PoolBlockOffset >= PAGE_SIZE &&
+        pFragment->Virtual == RtlOffsetToPointer(pBlock->Virtual, m_PoolBlockOffset - PAGE_SIZE))
+    {
+        m_PoolBlockOffset -= PAGE_SIZE;
+    }
+}
+
+void CParaNdisRX::FreePool()
+{
+    if (m_PoolBlocks == NULL)
+    {
+        return;
+    }
+
+    for (ULONG i = 0; i < m_NumPoolBlocks; i++)
+    {
+        ParaNdis_FreePhysicalMemory(m_Context, &m_PoolBlocks[i]);
+    }
+    NdisFreeMemory(m_PoolBlocks, 0, 0);
+    m_PoolBlocks = NULL;
+    m_NumPoolBlocks = 0;
+}
+
+pRxNetDescriptor CParaNdisRX::CreateMergeableRxDescriptorOnInit()
+{
+    //Mergeable buffer is a single pool fragment, the virtio header is followed by the data.
+    //The views array also receives the fragments of the other buffers of a merged packet.
+    ULONG ulNumViews = PARANDIS_FIRST_RX_DATA_PAGE + m_MaxMergedBuffers;
+    tCompletePhysicalAddress Fragment;
+
+    if (!AllocatePoolFragment(&Fragment)) return NULL;
+
+    pRxNetDescriptor p = (pRxNetDescriptor)ParaNdis_AllocateMemory(m_Context, sizeof(*p));
+    if (p == NULL)
+    {
+        ReturnPoolFragment(&Fragment);
+        return NULL;
+    }
+
+    NdisZeroMemory(p, sizeof(*p));
+    p->MergeableBuffer = TRUE;
+
+    p->BufferSGArray = (struct VirtIOBufferDescriptor *)
+        ParaNdis_AllocateMemory(m_Context, sizeof(*p->BufferSGArray));
+    if (p->BufferSGArray == NULL) goto error_exit;
+
+    p->PhysicalPages = (tCompletePhysicalAddress *)
+        ParaNdis_AllocateMemory(m_Context, sizeof(*p->PhysicalPages) * ulNumViews);
+    if (p->PhysicalPages == NULL) goto error_exit;
+
+    p->BufferSGArray[0].physAddr = Fragment.Physical;
+    p->BufferSGArray[0].length = Fragment.size;
+    p->BufferSGLength = 1;
+
+    p->PhysicalPages[0] = Fragment;
+    p->PhysicalPages[0].size = m_Context->nVirtioHeaderSize;
+    p->PhysicalPages[PARANDIS_FIRST_RX_DATA_PAGE].Virtual =
+        RtlOffsetToPointer(Fragment.Virtual, m_Context->nVirtioHeaderSize);
+    p->PhysicalPages[PARANDIS_FIRST_RX_DATA_PAGE].Physical.QuadPart =
+        Fragment.Physical.QuadPart + m_Context->nVirtioHeaderSize;
+    p->PhysicalPages[PARANDIS_FIRST_RX_DATA_PAGE].size = Fragment.size - m_Context->nVirtioHeaderSize;
+
+    //The data part starts the packet, the whole fragment continues it
+    p->Holder = NdisAllocateMdl(m_Context->MiniportHandle,
+        p->PhysicalPages[PARANDIS_FIRST_RX_DATA_PAGE].Virtual,
+        p->PhysicalPages[PARANDIS_FIRST_RX_DATA_PAGE].size);
+    if (p->Holder == NULL) goto error_exit;
+    NDIS_MDL_LINKAGE(p->Holder) = NULL;
+
+    p->MergedHolder = NdisAllocateMdl(m_Context->MiniportHandle, Fragment.Virtual, Fragment.size);
+    if (p->MergedHolder == NULL) goto error_exit;
+    NDIS_MDL_LINKAGE(p->MergedHolder) = NULL;
+
+    return p;
+
+error_exit:
+    //The descriptor does not own the fragment, it goes back to the pool
+    ParaNdis_FreeRxBufferDescriptor(m_Context, p);
+    ReturnPoolFragment(&Fragment);
+    return NULL;
+}
+
 /* TODO - make it method in pRXNetDescriptor */
 BOOLEAN CParaNdisRX::AddRxBufferToQueue(pRxNetDescriptor pBufferDescriptor)
 {
+    bool bUseIndirect = m_Context->bUseIndirect && !pBufferDescriptor->MergeableBuffer;
+
     return 0 <= pBufferDescriptor->Queue->m_VirtQueue.AddBuf(
         pBufferDescriptor->BufferSGArray,
         0,
         pBufferDescriptor->BufferSGLength,
         pBufferDescriptor,
-        m_Context->bUseIndirect ? pBufferDescriptor->IndirectArea.Virtual : NULL,
-        m_Context->bUseIndirect ? pBufferDescriptor->IndirectArea.Physical.QuadPart : 0);
+        bUseIndirect ? pBufferDescriptor->IndirectArea.Virtual : NULL,
+        bUseIndirect ? pBufferDescriptor->IndirectArea.Physical.QuadPart : 0);
 }
 
 void CParaNdisRX::FreeRxDescriptorsFromList()
@@ -225,6 +396,24 @@ void CParaNdisRX::FreeRxDescriptorsFromList()
 }
 
 void CParaNdisRX::ReuseReceiveBufferNoLock(pRxNetDescriptor pBuffersDescriptor)
+{
+    // the buffers of a merged packet go back to the ring one by one
+    while (pBuffersDescriptor != NULL)
+    {
+        pRxNetDescriptor pNext = pBuffersDescriptor->MergedNext;
+
+        if (pBuffersDescriptor->MergeableBuffer)
+        {
+            pBuffersDescriptor->MergedNext = NULL;
+            NDIS_MDL_LINKAGE(pBuffersDescriptor->Holder) = NULL;
+            NDIS_MDL_LINKAGE(pBuffersDescriptor->MergedHolder) = NULL;
+        }
+        ReuseOneReceiveBufferNoLock(pBuffersDescriptor);
+        pBuffersDescriptor = pNext;
+    }
+}
+
+void CParaNdisRX::ReuseOneReceiveBufferNoLock(pRxNetDescriptor pBuffersDescriptor)
 {
     DEBUG_ENTRY(4);
 
@@ -298,25 +487,89 @@ static FORCEINLINE BOOLEAN ParaNdis_PerformPacketAnalysis(
     return TRUE;
 }
 
+/* Fetches the rest of the buffers of the packet started by pHead and chains them
+   to it. The buffers are always consumed, even when the packet is dropped. */
+bool CParaNdisRX::MergeReceiveBuffers(pRxNetDescriptor pHead, unsigned int *pnFullLength, ULONG *pnFetched)
+{
+    auto pHeader = (virtio_net_hdr_mrg_rxbuf *)pHead->PhysicalPages[0].Virtual;
+    USHORT nBuffers = pHeader->num_buffers;
+    bool bResult = nBuffers != 0 && nBuffers <= m_MaxMergedBuffers;
+    pRxNetDescriptor pLast = pHead;
+    PMDL pLastMdl = pHead->Holder;
+    ULONG ulViewIndex = PARANDIS_FIRST_RX_DATA_PAGE + 1;
+
+    for (USHORT i = 1; i < nBuffers; i++)
+    {
+        unsigned int nLength;
+        pRxNetDescriptor pBuffer = (pRxNetDescriptor)m_VirtQueue.GetBuf(&nLength);
+
+        if (pBuffer == NULL)
+        {
+            DPrintf(0, "[%s] Only %d of %d merged buffers used\n", __FUNCTION__, i, nBuffers);
+            return false;
+        }
+
+        RemoveEntryList(&pBuffer->listEntry);
+        m_NetNofReceiveBuffers--;
+        (*pnFetched)++;
+
+        pLast->MergedNext = pBuffer;
+        pLast = pBuffer;
+
+        if (bResult)
+        {
+            tCompletePhysicalAddress *pView = &pHead->PhysicalPages[ulViewIndex++];
+            pView->Virtual = pBuffer->PhysicalPages[0].Virtual;
+            pView->Physical = pBuffer->PhysicalPages[0].Physical;
+            pView->size = pBuffer->BufferSGArray[0].length;
+
+            NDIS_MDL_LINKAGE(pLastMdl) = pBuffer->MergedHolder;
+            pLastMdl = pBuffer->MergedHolder;
+
+            *pnFullLength += nLength;
+        }
+    }
+
+    if (!bResult)
+    {
+        DPrintf(0, "[%s] Dropping packet of %d buffers\n", __FUNCTION__, nBuffers);
+    }
+    return bResult;
+}
+
 VOID CParaNdisRX::ProcessRxRing(CCHAR nCurrCpuReceiveQueue)
 {
     pRxNetDescriptor pBufferDescriptor;
     unsigned int nFullLength;
+    ULONG nFetched = 0;
+    LIST_ENTRY UnclassifiedBuffers;
 
-#ifndef PARANDIS_SUPPORT_RSS
+#ifdef PARANDIS_SUPPORT_RSS
+    // Packets of other CPUs are staged per target queue and published
+    // at the end of the pass, with one lock and one DPC per target
+    LIST_ENTRY StagedBuffers[PARANDIS_RSS_MAX_RECEIVE_QUEUES];
+    PROCESSOR_NUMBER StagedTargets[PARANDIS_RSS_MAX_RECEIVE_QUEUES];
+    ULONG StagedQueues = 0;
+    C_ASSERT(PARANDIS_RSS_MAX_RECEIVE_QUEUES <= sizeof(StagedQueues) * 8);
+#else
     UNREFERENCED_PARAMETER(nCurrCpuReceiveQueue);
 #endif
 
+    InitializeListHead(&UnclassifiedBuffers);
+
     TDPCSpinLocker autoLock(m_Lock);
 
     while (NULL != (pBufferDescriptor = (pRxNetDescriptor)m_VirtQueue.GetBuf(&nFullLength)))
     {
         RemoveEntryList(&pBufferDescriptor->listEntry);
         m_NetNofReceiveBuffers--;
+        nFetched++;
 
         BOOLEAN packetAnalysisRC;
 
-        packetAnalysisRC = ParaNdis_PerformPacketAnalysis(
+        packetAnalysisRC = (!m_MergeableBuffers ||
+            MergeReceiveBuffers(pBufferDescriptor, &nFullLength, &nFetched)) &&
+            ParaNdis_PerformPacketAnalysis(
 #if PARANDIS_SUPPORT_RSS
             &m_Context->RSSParameters,
 #endif
@@ -329,14 +582,14 @@ VOID CParaNdisRX::ProcessRxRing(CCHAR nCurrCpuReceiveQueue)
         if (!packetAnalysisRC)
         {
             pBufferDescriptor->Queue->ReuseReceiveBufferNoLock(pBufferDescriptor);
-            m_Context->Statistics.ifInErrors++;
-            m_Context->Statistics.ifInDiscards++;
+            PPARANDIS_CPU_STATISTICS pStatistics = ParaNdis_CPUStatistics(m_Context);
+            pStatistics->ifInErrors++;
+            pStatistics->ifInDiscards++;
             continue;
         }
 
 #ifdef PARANDIS_SUPPORT_RSS
         CCHAR nTargetReceiveQueueNum;
-        GROUP_AFFINITY TargetAffinity;
         PROCESSOR_NUMBER TargetProcessor;
 
         nTargetReceiveQueueNum = ParaNdis_GetScalingDataForPacket(
@@ -346,22 +599,46 @@ VOID CParaNdisRX::ProcessRxRing(CCHAR nCurrCpuReceiveQueue)
 
         if (nTargetReceiveQueueNum == PARANDIS_RECEIVE_UNCLASSIFIED_PACKET)
         {
-            ParaNdis_ReceiveQueueAddBuffer(&m_UnclassifiedPacketsQueue, pBufferDescriptor);
+            InsertTailList(&UnclassifiedBuffers, &pBufferDescriptor->ReceiveQueueListEntry);
         }
         else
         {
-            ParaNdis_ReceiveQueueAddBuffer(&m_Context->ReceiveQueues[nTargetReceiveQueueNum], pBufferDescriptor);
-
-            if (nTargetReceiveQueueNum != nCurrCpuReceiveQueue)
+            if (!(StagedQueues & (1 << nTargetReceiveQueueNum)))
             {
-                ParaNdis_ProcessorNumberToGroupAffinity(&TargetAffinity, &TargetProcessor);
-                ParaNdis_QueueRSSDpc(m_Context, m_messageIndex, &TargetAffinity);
+                StagedQueues |= 1 << nTargetReceiveQueueNum;
+                InitializeListHead(&StagedBuffers[nTargetReceiveQueueNum]);
+                StagedTargets[nTargetReceiveQueueNum] = TargetProcessor;
             }
+            InsertTailList(&StagedBuffers[nTargetReceiveQueueNum], &pBufferDescriptor->ReceiveQueueListEntry);
         }
 #else
-       ParaNdis_ReceiveQueueAddBuffer(&m_UnclassifiedPacketsQueue, pBufferDescriptor);
+        InsertTailList(&UnclassifiedBuffers, &pBufferDescriptor->ReceiveQueueListEntry);
 #endif
     }
+
+    ParaNdis_ReceiveQueueAddBuffers(&m_UnclassifiedPacketsQueue, &UnclassifiedBuffers);
+
+#ifdef PARANDIS_SUPPORT_RSS
+    for (CCHAR i = 0; StagedQueues != 0; i++, StagedQueues >>= 1)
+    {
+        if (!(StagedQueues & 1))
+        {
+            continue;
+        }
+
+        ParaNdis_ReceiveQueueAddBuffers(&m_Context->ReceiveQueues[i], &StagedBuffers[i]);
+
+        if (i != nCurrCpuReceiveQueue)
+        {
+            GROUP_AFFINITY TargetAffinity;
+
+            ParaNdis_ProcessorNumberToGroupAffinity(&TargetAffinity, &StagedTargets[i]);
+            ParaNdis_QueueRSSDpc(m_Context, m_messageIndex, &TargetAffinity);
+        }
+    }
+#endif
+
+    m_VirtQueue.CountDPC(nFetched);
 }
 
 void CParaNdisRX::PopulateQueue()
@@ -421,7 +698,9 @@ VOID ParaNdis_ResetRxClassification(PARANDIS_ADAPTER *pContext)
         {
             PLIST_ENTRY pListEntry = RemoveHeadList(&pCurrQueue->BuffersList);
             pRxNetDescriptor pBufferDescriptor = CONTAINING_RECORD(pListEntry, RxNetDescriptor, ReceiveQueueListEntry);
-            ParaNdis_ReceiveQueueAddBuffer(&pBufferDescriptor->Queue->UnclassifiedPacketsQueue(), pBufferDescriptor);
+            NdisInterlockedInsertTailList(&pBufferDescriptor->Queue->UnclassifiedPacketsQueue().BuffersList,
+                &pBufferDescriptor->ReceiveQueueListEntry,
+                &pBufferDescriptor->Queue->UnclassifiedPacketsQueue().Lock);
         }
 
         NdisReleaseSpinLock(&pCurrQueue->Lock);
@@ -49,10 +49,25 @@ private:
 
     PARANDIS_RECEIVE_QUEUE m_UnclassifiedPacketsQueue;
 
+    /* Mergeable RX buffers: the ring is filled with page-sized fragments
+       of the pool and big packets are received into several of them */
+    bool m_MergeableBuffers = false;
+    USHORT m_MaxMergedBuffers = 0;
+    tCompletePhysicalAddress *m_PoolBlocks = nullptr;
+    ULONG m_NumPoolBlocks = 0;
+    ULONG m_MaxPoolBlocks = 0;
+    ULONG m_PoolBlockOffset = 0;
+
     void ReuseReceiveBufferNoLock(pRxNetDescriptor pBuffersDescriptor);
+    void ReuseOneReceiveBufferNoLock(pRxNetDescriptor pBuffersDescriptor);
 private:
     int PrepareReceiveBuffers();
     pRxNetDescriptor CreateRxDescriptorOnInit();
+    pRxNetDescriptor CreateMergeableRxDescriptorOnInit();
+    bool AllocatePoolFragment(tCompletePhysicalAddress *pFragment);
+    void ReturnPoolFragment(const tCompletePhysicalAddress *pFragment);
+    void FreePool();
+    bool MergeReceiveBuffers(pRxNetDescriptor pHead, unsigned int *pnFullLength, ULONG *pnFetched);
 };
 
 #ifdef PARANDIS_SUPPORT_RSS
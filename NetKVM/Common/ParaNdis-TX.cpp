@@ -694,10 +694,11 @@ bool CParaNdisTX::DoPendingTasks(CNBL *nblHolder)
 
     DoWithTXLock([&]()
     {
-        m_VirtQueue.ProcessTXCompletions(nbToFree);
+        UINT nCompleted = m_VirtQueue.ProcessTXCompletions(nbToFree);
 
         if (bFromDpc)
         {
+            m_VirtQueue.CountDPC(nCompleted);
             m_DpcWaiting.Release();
         }
 
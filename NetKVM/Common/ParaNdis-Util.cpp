@@ -109,6 +109,17 @@ ULONG ParaNdis_GetSystemCPUCount()
     return nProcessors;
 }
 
+ULONG ParaNdis_GetMaximumCPUCount()
+{
+#if NDIS_SUPPORT_NDIS620
+    return KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+#elif NDIS_SUPPORT_NDIS6
+    return KeQueryMaximumProcessorCount();
+#else
+#error not supported
+#endif
+}
+
 void Parandis_UtilOnly_Trace(LONG level, LPCSTR s1, LPCSTR s2)
 {
     if (!s2)
@@ -743,6 +743,9 @@ ULONG ParaNdis_GetIndexFromAffinity(KAFFINITY affinity);
 
 ULONG ParaNdis_GetSystemCPUCount();
 
+// includes the processors that may be hot-added later
+ULONG ParaNdis_GetMaximumCPUCount();
+
 // returns system-wide CPU index in multi-group environment
 // returns regular CPU number in single-group environment
 ULONG FORCEINLINE ParaNdis_GetCurrentCPUIndex()
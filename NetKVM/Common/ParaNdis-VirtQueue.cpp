@@ -177,6 +177,7 @@ CTXVirtQueue::~CTXVirtQueue()
 
 void CTXVirtQueue::KickQueueOnOverflow()
 {
+    m_Statistics.RingFull++;
     EnableInterruptsDelayed();
 
     if (m_DoKickOnNoBuffer)
@@ -191,31 +192,31 @@ void CTXVirtQueue::UpdateTXStats(const CNB &NB, CTXDescriptor &Descriptor)
     auto &HeadersArea = Descriptor.HeadersAreaAccessor();
     PVOID EthHeader = HeadersArea.EthHeader();
 
-    //TODO: Statistics must be atomic
     auto BytesSent = NB.GetDataLength();
     auto NBL = NB.GetParentNBL();
+    auto Statistics = ParaNdis_CPUStatistics(m_Context);
 
-    m_Context->Statistics.ifHCOutOctets += BytesSent;
+    Statistics->ifHCOutOctets += BytesSent;
 
     if (ETH_IS_BROADCAST(EthHeader))
     {
-        m_Context->Statistics.ifHCOutBroadcastOctets += BytesSent;
-        m_Context->Statistics.ifHCOutBroadcastPkts++;
+        Statistics->ifHCOutBroadcastOctets += BytesSent;
+        Statistics->ifHCOutBroadcastPkts++;
     }
     else if (ETH_IS_MULTICAST(EthHeader))
     {
-        m_Context->Statistics.ifHCOutMulticastOctets += BytesSent;
-        m_Context->Statistics.ifHCOutMulticastPkts++;
+        Statistics->ifHCOutMulticastOctets += BytesSent;
+        Statistics->ifHCOutMulticastPkts++;
     }
     else
     {
-        m_Context->Statistics.ifHCOutUcastOctets += BytesSent;
-        m_Context->Statistics.ifHCOutUcastPkts++;
+        Statistics->ifHCOutUcastOctets += BytesSent;
+        Statistics->ifHCOutUcastPkts++;
     }
 
     if (NBL->IsLSO())
     {
-        m_Context->extraStatistics.framesLSO++;
+        Statistics->framesLSO++;
 
         auto EthHeaders = Descriptor.HeadersAreaAccessor().EthHeadersAreaVA();
         auto TCPHdr = reinterpret_cast<TCPHeader *>(RtlOffsetToPointer(EthHeaders, NBL->TCPHeaderOffset()));
@@ -224,7 +225,7 @@ void CTXVirtQueue::UpdateTXStats(const CNB &NB, CTXDescriptor &Descriptor)
     }
     else if (NBL->IsTcpCSO() || NBL->IsUdpCSO())
     {
-        m_Context->extraStatistics.framesCSOffload++;
+        Statistics->framesCSOffload++;
     }
 }
 
@@ -307,12 +308,14 @@ UINT CTXVirtQueue::ReleaseTransmitBuffers(CRawCNBList& listDone)
 }
 
 //TODO: Needs review
-void CTXVirtQueue::ProcessTXCompletions(CRawCNBList& listDone, bool bKill)
+UINT CTXVirtQueue::ProcessTXCompletions(CRawCNBList& listDone, bool bKill)
 {
+    UINT nCompleted = 0;
+
     if (m_Descriptors.GetCount() < m_TotalDescriptors)
     {
         if (!bKill && !m_Killed)
-            ReleaseTransmitBuffers(listDone);
+            nCompleted = ReleaseTransmitBuffers(listDone);
         else
         {
             LPCSTR func = __FUNCTION__;
@@ -324,6 +327,8 @@ void CTXVirtQueue::ProcessTXCompletions(CRawCNBList& listDone, bool bKill)
             });
         }
     }
+
+    return nCompleted;
 }
 
 void CTXVirtQueue::Shutdown()
@@ -12,6 +12,7 @@ extern "C"
 
 #include "ParaNdis-Util.h"
 #include "virtio_net.h"
+#include "QueueStatistics.h"
 
 class CNB;
 class CTXVirtQueue;
@@ -153,7 +154,9 @@ public:
         , m_Index(0xFFFFFFFF)
         , m_IODevice(NULL)
         , m_CanTouchHardware(true)
-    {}
+    {
+        NdisZeroMemory(&m_Statistics, sizeof(m_Statistics));
+    }
 
     virtual ~CVirtQueue()
     {
@@ -201,19 +204,58 @@ public:
         void *data,
         void *va_indirect,
         ULONGLONG phys_indirect)
-    { return virtqueue_add_buf(m_VirtQueue, sg, out_num, in_num, data, 
-          va_indirect, phys_indirect); }
+    {
+        int res = virtqueue_add_buf(m_VirtQueue, sg, out_num, in_num, data,
+            va_indirect, phys_indirect);
+        if (res < 0)
+        {
+            m_Statistics.RingFull++;
+        }
+        return res;
+    }
 
     void* GetBuf(unsigned int *len)
     { return virtqueue_get_buf(m_VirtQueue, len); }
 
     //TODO: Needs review / temporary
     void Kick()
-    { virtqueue_kick(m_VirtQueue); }
+    {
+        if (virtqueue_kick_prepare(m_VirtQueue))
+        {
+            virtqueue_notify(m_VirtQueue);
+            m_Statistics.Kicks++;
+        }
+    }
 
     //TODO: Needs review / temporary
     void KickAlways()
-    { virtqueue_notify(m_VirtQueue); }
+    {
+        virtqueue_notify(m_VirtQueue);
+        m_Statistics.Kicks++;
+    }
+
+    // Called under the queue lock by the DPC that drained the ring
+    void CountDPC(ULONG Packets)
+    {
+        m_Statistics.DPCs++;
+        m_Statistics.DPCPackets += Packets;
+        if (Packets > m_Statistics.MaxDPCPackets)
+        {
+            m_Statistics.MaxDPCPackets = Packets;
+        }
+    }
+
+    void GetStatistics(NETKVM_QUEUE_STATISTICS &Statistics)
+    {
+        Statistics = m_Statistics;
+        Statistics.Index = m_Index;
+        Statistics.RingSize = m_VirtQueue ? GetRingSize() : 0;
+    }
+
+    void ResetStatistics()
+    {
+        NdisZeroMemory(&m_Statistics, sizeof(m_Statistics));
+    }
 
     bool Restart()
     {
@@ -240,6 +282,7 @@ public:
 
 protected:
     NDIS_HANDLE m_DrvHandle;
+    NETKVM_QUEUE_STATISTICS m_Statistics;
 
 private:
     bool AllocateQueueMemory();
@@ -276,7 +319,7 @@ public:
 
     SubmitTxPacketResult SubmitPacket(CNB &NB);
 
-    void ProcessTXCompletions(CRawCNBList& listDone, bool bKill = false);
+    UINT ProcessTXCompletions(CRawCNBList& listDone, bool bKill = false);
     bool Alive()
     { return !m_Killed; }
 
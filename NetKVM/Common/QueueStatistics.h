@@ -0,0 +1,78 @@
+/*
+ * This file contains definitions of the per-queue statistics, common
+ * between the NDIS driver and the user mode tools reading them.
+ *
+ * Included in NetKVM NDIS kernel driver for Windows.
+ * Included in NetKVM CoInstaller (netsh helper).
+ *
+ * Copyright (c) 2026 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met :
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and / or other materials provided with the distribution.
+ * 3. Neither the names of the copyright holders nor the names of their contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef PARANDIS_QUEUE_STATISTICS_H
+#define PARANDIS_QUEUE_STATISTICS_H
+
+/* Query only OID, returns NETKVM_QUEUES_STATISTICS.
+   Can be queried from user mode with IOCTL_NDIS_QUERY_GLOBAL_STATS. */
+#define OID_VENDOR_3                    0xff010203
+
+/* Query only OID, returns a snapshot of the virtqueue event trace
+   (VIRTIO_TRACE_HEADER and the per CPU records, see virtio_trace.h).
+   Fails unless the trace was enabled with the VirtioTraceRecords
+   registry parameter. */
+#define OID_VENDOR_4                    0xff010204
+
+#define NETKVM_QUEUES_STATISTICS_VERSION 1
+
+typedef enum _tagNetKvmQueueType
+{
+    NETKVM_QUEUE_RX,
+    NETKVM_QUEUE_TX,
+    NETKVM_QUEUE_CX,
+} NETKVM_QUEUE_TYPE;
+
+typedef struct _tagNetKvmQueueStatistics
+{
+    ULONG       Index;          // virtqueue index
+    ULONG       Type;           // NETKVM_QUEUE_TYPE
+    ULONG       RingSize;
+    ULONG       MaxDPCPackets;  // most packets handled in a single DPC
+    ULONGLONG   DPCs;           // DPCs that processed the queue
+    ULONGLONG   DPCPackets;     // packets handled by these DPCs
+    ULONGLONG   Kicks;          // notifications sent to the device
+    ULONGLONG   RingFull;       // buffers not posted because the ring was full
+} NETKVM_QUEUE_STATISTICS, *PNETKVM_QUEUE_STATISTICS;
+
+typedef struct _tagNetKvmQueuesStatistics
+{
+    ULONG       Version;        // NETKVM_QUEUES_STATISTICS_VERSION
+    ULONG       NumberOfQueues;
+    NETKVM_QUEUE_STATISTICS Queues[1];
+} NETKVM_QUEUES_STATISTICS, *PNETKVM_QUEUES_STATISTICS;
+
+#define NETKVM_QUEUES_STATISTICS_SIZE(n) \
+    (FIELD_OFFSET(NETKVM_QUEUES_STATISTICS, Queues) + (n) * sizeof(NETKVM_QUEUE_STATISTICS))
+
+#endif
@@ -166,7 +166,12 @@ struct CPUPathBundle : public CPlacementAllocatable {
 
 #define VIRTIO_NET_INVALID_INTERRUPT_STATUS     0xFF
 
-#define PARANDIS_MULTICAST_LIST_SIZE        32
+#define PARANDIS_MULTICAST_LIST_SIZE        256
+// must be a power of 2
+#define PARANDIS_MULTICAST_HASH_SIZE        256
+#define PARANDIS_MULTICAST_NO_ENTRY         0xFFFF
+// larger lists put the device into all-multicast mode and are filtered by the driver
+#define PARANDIS_DEVICE_MULTICAST_LIST_SIZE 64
 #define PARANDIS_MEMORY_TAG                 '5muQ'
 #define PARANDIS_DEFAULT_LINK_SPEED         10000000000  // 10Gbps link speed
 #define PARANDIS_MIN_LSO_SEGMENTS           2
@@ -300,8 +305,13 @@ typedef struct _tagLinkProperties
 
 typedef struct _tagMulticastData
 {
+    // the first two fields are the MAC table sent to the device
     ULONG                   nofMulticastEntries;
     UCHAR                   MulticastList[ETH_ALEN * PARANDIS_MULTICAST_LIST_SIZE];
+    // hash of the list for the RX path: first entry of each bucket and the
+    // next entry of the same bucket, as indices in MulticastList
+    USHORT                  HashHeads[PARANDIS_MULTICAST_HASH_SIZE];
+    USHORT                  HashNext[PARANDIS_MULTICAST_LIST_SIZE];
 }tMulticastData;
 
 typedef struct _tagNET_PACKET_INFO
@@ -357,11 +367,52 @@ struct _tagRxNetDescriptor {
     tCompletePhysicalAddress       IndirectArea;
     tPacketHolderType              Holder;
 
+    /* Mergeable RX buffers: the descriptor is one fragment of the RX page pool,
+       PhysicalPages[0] and PhysicalPages[1] are the header and data parts of it.
+       When the packet spans several buffers, the views of the others are appended
+       to the PhysicalPages of the first one and their MergedHolder MDLs are
+       chained after its Holder. */
+    BOOLEAN                        MergeableBuffer;
+    PMDL                           MergedHolder;
+    pRxNetDescriptor               MergedNext;
+
     NET_PACKET_INFO PacketInfo;
 
     CParaNdisRX*                   Queue;
 };
 
+/* Counters updated on the data path. Each CPU has its own block in a
+   separate cache line, so the DPCs of different queues never write to
+   the same memory. The blocks are summed up by ParaNdis_GetStatistics
+   when the statistics are queried. */
+typedef struct _tagPARANDIS_CPU_STATISTICS
+{
+    ULONG64 ifInDiscards;
+    ULONG64 ifInErrors;
+    ULONG64 ifHCInOctets;
+    ULONG64 ifHCInUcastPkts;
+    ULONG64 ifHCInMulticastPkts;
+    ULONG64 ifHCInBroadcastPkts;
+    ULONG64 ifHCOutOctets;
+    ULONG64 ifHCOutUcastPkts;
+    ULONG64 ifHCOutMulticastPkts;
+    ULONG64 ifHCOutBroadcastPkts;
+    ULONG64 ifHCInUcastOctets;
+    ULONG64 ifHCInMulticastOctets;
+    ULONG64 ifHCInBroadcastOctets;
+    ULONG64 ifHCOutUcastOctets;
+    ULONG64 ifHCOutMulticastOctets;
+    ULONG64 ifHCOutBroadcastOctets;
+
+    ULONG framesCSOffload;
+    ULONG framesLSO;
+    ULONG framesRxPriority;
+    ULONG framesRxCSHwOK;
+    ULONG framesFilteredOut;
+    ULONG framesCoalescedHost;
+    ULONG framesCoalescedWindows;
+} PARANDIS_CPU_STATISTICS, *PPARANDIS_CPU_STATISTICS;
+
 typedef struct _tagPARANDIS_ADAPTER
 {
     NDIS_HANDLE             DriverHandle;
@@ -406,6 +457,7 @@ typedef struct _tagPARANDIS_ADAPTER
     ULONG                   ulCurrentVlansFilterSet;
     tMulticastData          MulticastData;
     UINT                    uNumberOfHandledRXPacketsInDPC;
+    ULONG                   ulVirtioTraceRecords;
     LONG                    counterDPCInside;
     ULONG                   ulPriorityVlanSetting;
     ULONG                   VlanId;
@@ -426,18 +478,13 @@ typedef struct _tagPARANDIS_ADAPTER
 
     CGuestAnnouncePackets    guestAnnouncePackets;
 
-    /* send part */
+    /* header and the counters not maintained per CPU */
     NDIS_STATISTICS_INFO    Statistics;
-    struct
-    {
-        ULONG framesCSOffload;
-        ULONG framesLSO;
-        ULONG framesRxPriority;
-        ULONG framesRxCSHwOK;
-        ULONG framesFilteredOut;
-        ULONG framesCoalescedHost;
-        ULONG framesCoalescedWindows;
-    } extraStatistics;
+    /* per CPU data path counters, ulCPUStatisticsStride bytes apart */
+    PVOID                   pCPUStatisticsAllocation;
+    PVOID                   pCPUStatistics;
+    ULONG                   nCPUStatistics;
+    ULONG                   ulCPUStatisticsStride;
 
     /* initial number of free Tx descriptor(from cfg) - max number of available Tx descriptors */
     UINT                    maxFreeTxDescriptors;
@@ -512,6 +559,18 @@ typedef struct _tagPARANDIS_ADAPTER
 
 typedef BOOLEAN _Function_class_(MINIPORT_SYNCHRONIZE_INTERRUPT) (*tSynchronizedProcedure)(PVOID context);
 
+/* Must be called at DISPATCH_LEVEL, so the current CPU owns the block.
+   There is a block for every processor the system can have, including
+   the ones hot-added after the initialization. */
+FORCEINLINE PPARANDIS_CPU_STATISTICS ParaNdis_CPUStatistics(PARANDIS_ADAPTER *pContext)
+{
+    return (PPARANDIS_CPU_STATISTICS)RtlOffsetToPointer(pContext->pCPUStatistics,
+        ParaNdis_GetCurrentCPUIndex() * pContext->ulCPUStatisticsStride);
+}
+
+void ParaNdis_GetStatistics(PARANDIS_ADAPTER *pContext, PPARANDIS_CPU_STATISTICS pTotal);
+void ParaNdis_ResetExtraStatistics(PARANDIS_ADAPTER *pContext);
+
 BOOLEAN FORCEINLINE IsValidVlanId(PARANDIS_ADAPTER *pContext, ULONG VlanID)
 {
     return pContext->VlanId == 0 || pContext->VlanId == VlanID;
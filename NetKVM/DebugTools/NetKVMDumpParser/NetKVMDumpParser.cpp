@@ -30,7 +30,11 @@
 #include "stdafx.h"
 #include "NetKVMDumpParser.h"
 #include "..\..\Common\DebugData.h"
+#include "..\..\..\VirtIO\virtio_trace.h"
 #include <sal.h>
+#include <vector>
+#include <map>
+#include <algorithm>
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -578,6 +582,184 @@ static void ParseHistoryEntry(LONGLONG basetime, tBugCheckHistoryDataEntry *phis
     }
 }
 
+#define TRACE_HISTOGRAM_BUCKETS 40
+
+typedef struct _tagTraceQueueSummary
+{
+    ULONG   Adds;
+    ULONG   Kicks;
+    ULONG   Interrupts;
+    ULONG   Completions;
+    ULONG   Unmatched;      // completed requests added before the trace window
+    ULONG64 TotalNs;
+    ULONG64 MinNs;
+    ULONG64 MaxNs;
+    ULONG   Histogram[TRACE_HISTOGRAM_BUCKETS];   // [i] counts latencies of 2^i..2^(i+1)-1 ns
+}tTraceQueueSummary;
+
+static bool CompareTraceRecords(const VIRTIO_TRACE_RECORD& a, const VIRTIO_TRACE_RECORD& b)
+{
+    return a.Timestamp < b.Timestamp;
+}
+
+static bool ValidateVirtioTrace(const VIRTIO_TRACE_HEADER *ph, ULONG size)
+{
+    if (size < sizeof(*ph) || ph->Signature != VIRTIO_TRACE_SIGNATURE)
+    {
+        PRINT("Not a virtqueue event trace");
+        return false;
+    }
+    if (ph->Version != VIRTIO_TRACE_VERSION || ph->HeaderSize < sizeof(*ph) ||
+        ph->RecordSize < sizeof(VIRTIO_TRACE_RECORD) || !ph->NumberOfCpus || !ph->RecordsPerCpu ||
+        ph->CpuBlockSize < sizeof(VIRTIO_TRACE_CPU) + (ULONG64)ph->RecordsPerCpu * ph->RecordSize ||
+        ph->HeaderSize + (ULONG64)ph->NumberOfCpus * ph->CpuBlockSize > size)
+    {
+        PRINT("Unsupported trace: version %d, %d CPUs of %d records(%d bytes), %d bytes available",
+            ph->Version, ph->NumberOfCpus, ph->RecordsPerCpu, ph->RecordSize, size);
+        return false;
+    }
+    return true;
+}
+
+/* Pairs ADD_BUF and GET_BUF records of the same request (queue and cookie)
+   and prints per-queue latency histograms. The per-CPU rings wrap at
+   different moments, so only the time window all of them still cover is
+   decoded, otherwise the requests added on a busy CPU would look lost. */
+static void ParseVirtioTrace(const VIRTIO_TRACE_HEADER *ph, ULONG size)
+{
+    if (!ValidateVirtioTrace(ph, size))
+    {
+        return;
+    }
+
+    std::vector<VIRTIO_TRACE_RECORD> records;
+    ULONG64 windowStart = 0;
+    for (ULONG cpu = 0; cpu < ph->NumberOfCpus; ++cpu)
+    {
+        const UCHAR *pBlock = (const UCHAR *)ph + ph->HeaderSize + (ULONG64)cpu * ph->CpuBlockSize;
+        const VIRTIO_TRACE_CPU *pCpu = (const VIRTIO_TRACE_CPU *)pBlock;
+        ULONG64 oldest = 0;
+        for (ULONG i = 0; i < ph->RecordsPerCpu; ++i)
+        {
+            const VIRTIO_TRACE_RECORD *pr = (const VIRTIO_TRACE_RECORD *)
+                (pBlock + sizeof(VIRTIO_TRACE_CPU) + (ULONG64)i * ph->RecordSize);
+            if (!pr->Timestamp) continue;
+            records.push_back(*pr);
+            if (!oldest || pr->Timestamp < oldest) oldest = pr->Timestamp;
+        }
+        if ((ULONG)pCpu->Next > ph->RecordsPerCpu && oldest > windowStart)
+        {
+            windowStart = oldest;
+        }
+    }
+    if (records.empty())
+    {
+        PRINT("The trace is empty");
+        return;
+    }
+    std::sort(records.begin(), records.end(), CompareTraceRecords);
+
+    ULONG64 ticksPerSecond = ph->TicksPerSecond ? ph->TicksPerSecond : 1;
+    std::map<USHORT, tTraceQueueSummary> queues;
+    std::map<std::pair<USHORT, ULONG64>, ULONG64> pending;
+    ULONG skipped = 0;
+    for (size_t i = 0; i < records.size(); ++i)
+    {
+        const VIRTIO_TRACE_RECORD& r = records[i];
+        if (r.Timestamp < windowStart)
+        {
+            skipped++;
+            continue;
+        }
+        tTraceQueueSummary& q = queues[r.Queue];
+        switch (r.Event)
+        {
+            case VIRTIO_TRACE_ADD_BUF:
+                q.Adds++;
+                pending[std::make_pair(r.Queue, r.Cookie)] = r.Timestamp;
+                break;
+            case VIRTIO_TRACE_KICK:
+                q.Kicks++;
+                break;
+            case VIRTIO_TRACE_INTERRUPT:
+                q.Interrupts++;
+                break;
+            case VIRTIO_TRACE_GET_BUF:
+            {
+                auto it = pending.find(std::make_pair(r.Queue, r.Cookie));
+                if (it == pending.end())
+                {
+                    q.Unmatched++;
+                    break;
+                }
+                ULONG64 ns = (ULONG64)((double)(r.Timestamp - it->second) * 1000000000.0 / ticksPerSecond);
+                pending.erase(it);
+                ULONG bucket = 0;
+                while (bucket < TRACE_HISTOGRAM_BUCKETS - 1 && (ns >> (bucket + 1))) bucket++;
+                q.Histogram[bucket]++;
+                if (!q.Completions || ns < q.MinNs) q.MinNs = ns;
+                if (ns > q.MaxNs) q.MaxNs = ns;
+                q.TotalNs += ns;
+                q.Completions++;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    double spanMs = (double)(records.back().Timestamp - max(records.front().Timestamp, windowStart)) * 1000.0 / ticksPerSecond;
+    PRINT(PRINT_SEPARATOR);
+    PRINT("Virtqueue trace: %d CPUs, %d records per CPU, %I64u ticks per second",
+        ph->NumberOfCpus, ph->RecordsPerCpu, ph->TicksPerSecond);
+    PRINT("%d records over %.3f ms, %d older records skipped", (ULONG)records.size() - skipped, spanMs, skipped);
+    for (auto it = queues.begin(); it != queues.end(); ++it)
+    {
+        const tTraceQueueSummary& q = it->second;
+        if (it->first == VIRTIO_TRACE_NO_QUEUE)
+        {
+            PRINT("Device: %d interrupts", q.Interrupts);
+            continue;
+        }
+        PRINT("Queue %d: %d added, %d kicks, %d interrupts, %d completed(%d unmatched)",
+            it->first, q.Adds, q.Kicks, q.Interrupts, q.Completions + q.Unmatched, q.Unmatched);
+        if (!q.Completions) continue;
+        PRINT("\tlatency min %I64u ns, avg %I64u ns, max %I64u ns",
+            q.MinNs, q.TotalNs / q.Completions, q.MaxNs);
+        for (ULONG b = 0; b < TRACE_HISTOGRAM_BUCKETS; ++b)
+        {
+            if (!q.Histogram[b]) continue;
+            PRINT("\t%12I64u ns and more: %8d (%5.1f%%)",
+                1ULL << b, q.Histogram[b], q.Histogram[b] * 100.0 / q.Completions);
+        }
+    }
+    PRINT(PRINT_SEPARATOR);
+}
+
+static BOOL ParseTraceFile(LPCTSTR filename)
+{
+    BOOL bDone = FALSE;
+    FILE *f = fopen(filename, "rb");
+    if (!f)
+    {
+        return FALSE;
+    }
+    ULONG signature = 0;
+    if (fread(&signature, sizeof(signature), 1, f) == 1 && signature == VIRTIO_TRACE_SIGNATURE &&
+        !fseek(f, 0, SEEK_END))
+    {
+        long size = ftell(f);
+        std::vector<UCHAR> buffer(size > 0 ? size : 0);
+        if (size > 0 && !fseek(f, 0, SEEK_SET) && fread(&buffer[0], 1, size, f) == (size_t)size)
+        {
+            ParseVirtioTrace((const VIRTIO_TRACE_HEADER *)&buffer[0], (ULONG)size);
+            bDone = TRUE;
+        }
+    }
+    fclose(f);
+    return bDone;
+}
+
 void tDumpParser::ParseCrashData(tBugCheckStaticDataHeader *ph, ULONG64 databuffer, ULONG bytesRead, BOOL bWithSymbols)
 {
     UINT i;
@@ -599,6 +781,36 @@ void tDumpParser::ParseCrashData(tBugCheckStaticDataHeader *ph, ULONG64 databuff
                 PRINT(PRINT_SEPARATOR);
             }
         }
+        else if (ph->PerNicDataVersion == 1)
+        {
+            tBugCheckPerNicDataContent_V1 *pndc = (tBugCheckPerNicDataContent_V1 *)(ph->PerNicData - databuffer + (PUCHAR)ph);
+            pndc += i;
+            if (pndc->Context)
+            {
+                LONGLONG diffInt = (ph->qCrashTime.QuadPart - pndc->LastInterruptTimeStamp.QuadPart) / 10;
+                LONGLONG diffTx = (ph->qCrashTime.QuadPart - pndc->LastTxCompletionTimeStamp.QuadPart) / 10;
+                PRINT(PRINT_SEPARATOR);
+                PRINT("Context %I64X:", pndc->Context);
+                PRINT("\tLastInterrupt %I64d us before crash", diffInt);
+                PRINT("\tLast Tx complete %I64d us before crash", diffTx);
+                PRINT("\tWaiting <unknown> packets, %d free buffers", pndc->nofReadyTxBuffers);
+                if (pndc->VirtioTrace && pndc->VirtioTraceSize)
+                {
+                    PRINT("\tVirtqueue trace at %I64X(%d bytes)", pndc->VirtioTrace, pndc->VirtioTraceSize);
+                    std::vector<UCHAR> trace(pndc->VirtioTraceSize);
+                    ULONG traceRead = 0;
+                    if (S_OK == DataSpaces->ReadVirtual(pndc->VirtioTrace, &trace[0], pndc->VirtioTraceSize, &traceRead))
+                    {
+                        ParseVirtioTrace((const VIRTIO_TRACE_HEADER *)&trace[0], traceRead);
+                    }
+                    else
+                    {
+                        PRINT("\tThe trace is not present in the dump");
+                    }
+                }
+                PRINT(PRINT_SEPARATOR);
+            }
+        }
         else
         {
             PRINT("Unsupported per-NIC data version %d", ph->PerNicDataVersion);
@@ -888,7 +1100,8 @@ int ParseDumpFile(int argc, TCHAR* argv[])
 #ifdef UNDER_DEBUGGING
         fputs("UNDER_DEBUGGING, the output is redirected to debugger", f);
 #endif
-        if (!Parser.LoadFile(argv[1])) PRINT("Failed to load dump file %s", argv[1]);
+        // a trace saved with "netsh netkvm savetrace" is decoded without the debugger engine
+        if (!ParseTraceFile(argv[1]) && !Parser.LoadFile(argv[1])) PRINT("Failed to load dump file %s", argv[1]);
         if (f) fclose(f);
     }
     else
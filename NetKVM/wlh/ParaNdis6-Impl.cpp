@@ -323,6 +323,7 @@ static BOOLEAN MiniportMSIInterrupt(
 	}
 
     path->SetLastInterruptTimestamp(pContext->LastInterruptTimeStamp);
+    virtio_trace_event(&pContext->IODevice, (u16)path->getQueueIndex(), VIRTIO_TRACE_INTERRUPT, MessageId, NULL);
 
     path->DisableInterrupts();
 
@@ -817,7 +818,7 @@ VOID NBLSet8021QInfo(PPARANDIS_ADAPTER pContext, PNET_BUFFER_LIST pNBL, PNET_PAC
         qInfo.TagHeader.VlanId = pPacketInfo->Vlan.VlanId;
 
     if(qInfo.Value != NULL)
-        pContext->extraStatistics.framesRxPriority++;
+        ParaNdis_CPUStatistics(pContext)->framesRxPriority++;
 
     NET_BUFFER_LIST_INFO(pNBL, Ieee8021QNetBufferListInfo) = qInfo.Value;
 }
@@ -971,12 +972,12 @@ tPacketIndicationType ParaNdis_PrepareReceivedPacket(
                 {
                     *pnCoalescedSegmentsCount = pHeader->hdr.rsc_ext_num_packets;
                     nDupAcks = pHeader->hdr.rsc_ext_num_dupacks;
-                    pContext->extraStatistics.framesCoalescedWindows++;
+                    ParaNdis_CPUStatistics(pContext)->framesCoalescedWindows++;
                 }
                 else
                 {
                     *pnCoalescedSegmentsCount = PktGetTCPCoalescedSegmentsCount(pContext, pPacketInfo, pHeader->hdr.gso_size);
-                    pContext->extraStatistics.framesCoalescedHost++;
+                    ParaNdis_CPUStatistics(pContext)->framesCoalescedHost++;
                 }
                 NBLSetRSCInfo(pContext, pNBL, pPacketInfo, *pnCoalescedSegmentsCount, 0);
                 // according to the spec the device does not calculate TCP checksum
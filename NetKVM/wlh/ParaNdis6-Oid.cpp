@@ -33,6 +33,7 @@
 #include "kdebugprint.h"
 #include "ParaNdis_DebugHistory.h"
 #include "netkvmmof.h"
+#include "QueueStatistics.h"
 #include "Trace.h"
 #ifdef NETKVM_WPP_ENABLED
 #include "ParaNdis6-Oid.tmh"
@@ -199,6 +200,8 @@ OIDENTRYPROC(OID_TCP_OFFLOAD_PARAMETERS,        0,0,0, ohfSet | ohfSetMoreOK | o
 OIDENTRYPROC(OID_OFFLOAD_ENCAPSULATION,         0,0,0, ohfQuerySet, OnSetOffloadEncapsulation),
 OIDENTRYPROC(OID_VENDOR_1,                      0,0,0, ohfQueryStat | ohfSet | ohfSetMoreOK, OnSetVendorSpecific1),
 OIDENTRYPROC(OID_VENDOR_2,                      0,0,0, ohfQueryStat | ohfSet | ohfSetMoreOK, OnSetVendorSpecific2),
+OIDENTRY(OID_VENDOR_3,                          0,0,0, ohfQueryStat     ),
+OIDENTRY(OID_VENDOR_4,                          0,0,0, ohfQueryStat     ),
 
 #if PARANDIS_SUPPORT_RSS
     OIDENTRYPROC(OID_GEN_RECEIVE_SCALE_PARAMETERS,  0,0,0, ohfSet | ohfSetMoreOK, RSSSetParameters),
@@ -271,6 +274,8 @@ static NDIS_OID SupportedOids[] =
         OID_GEN_SUPPORTED_GUIDS,
         OID_VENDOR_1,
         OID_VENDOR_2,
+        OID_VENDOR_3,
+        OID_VENDOR_4,
 #endif
         OID_OFFLOAD_ENCAPSULATION,
         OID_TCP_OFFLOAD_PARAMETERS,
@@ -391,10 +396,67 @@ static NDIS_STATUS OnSetVendorSpecific2(PARANDIS_ADAPTER *pContext, tOidDesc *pO
     NDIS_STATUS status;
     UNREFERENCED_PARAMETER(pContext);
     status = ParaNdis_OidSetCopy(pOid, &dummy, sizeof(dummy));
-    RtlZeroMemory(&pContext->extraStatistics, sizeof(pContext->extraStatistics));
+    ParaNdis_ResetExtraStatistics(pContext);
     return status;
 }
 
+static PNETKVM_QUEUES_STATISTICS QueryQueuesStatistics(PARANDIS_ADAPTER *pContext, PULONG pulSize)
+{
+    ULONG nQueues = pContext->bCXPathCreated ? 1 : 0;
+    for (UINT i = 0; i < pContext->nPathBundles; i++)
+    {
+        nQueues += pContext->pPathBundles[i].rxCreated ? 1 : 0;
+        nQueues += pContext->pPathBundles[i].txCreated ? 1 : 0;
+    }
+
+    ULONG ulSize = NETKVM_QUEUES_STATISTICS_SIZE(max(nQueues, 1));
+    auto pStatistics = (PNETKVM_QUEUES_STATISTICS)ParaNdis_AllocateMemory(pContext, ulSize);
+    if (!pStatistics)
+    {
+        return NULL;
+    }
+    NdisZeroMemory(pStatistics, ulSize);
+    pStatistics->Version = NETKVM_QUEUES_STATISTICS_VERSION;
+
+    PNETKVM_QUEUE_STATISTICS pQueue = pStatistics->Queues;
+    for (UINT i = 0; i < pContext->nPathBundles; i++)
+    {
+        if (pContext->pPathBundles[i].rxCreated)
+        {
+            pContext->pPathBundles[i].rxPath.GetQueueStatistics(*pQueue);
+            pQueue->Type = NETKVM_QUEUE_RX;
+            pQueue++;
+        }
+        if (pContext->pPathBundles[i].txCreated)
+        {
+            pContext->pPathBundles[i].txPath.GetQueueStatistics(*pQueue);
+            pQueue->Type = NETKVM_QUEUE_TX;
+            pQueue++;
+        }
+    }
+    if (pContext->bCXPathCreated)
+    {
+        pContext->CXPath.GetQueueStatistics(*pQueue);
+        pQueue->Type = NETKVM_QUEUE_CX;
+    }
+    pStatistics->NumberOfQueues = nQueues;
+
+    *pulSize = ulSize;
+    return pStatistics;
+}
+
+static PVOID QueryVirtioTrace(PARANDIS_ADAPTER *pContext, PULONG pulSize)
+{
+    ULONG ulSize = virtio_trace_size(&pContext->IODevice);
+    PVOID pTrace = ParaNdis_AllocateMemory(pContext, ulSize);
+    if (!pTrace)
+    {
+        return NULL;
+    }
+    *pulSize = virtio_trace_copy(&pContext->IODevice, pTrace, ulSize);
+    return pTrace;
+}
+
 /*****************************************************************
 Handles NDIS6 specific OID, all the rest handled by common handler
 *****************************************************************/
@@ -411,7 +473,9 @@ static NDIS_STATUS ParaNdis_OidQuery(PARANDIS_ADAPTER *pContext, tOidDesc *pOid)
 #if PARANDIS_SUPPORT_RSC
         NDIS_RSC_STATISTICS_INFO                RSCStatistics;
 #endif
+        NDIS_STATISTICS_INFO                    Statistics;
     } u;
+    PARANDIS_CPU_STATISTICS Statistics;
     NDIS_STATUS  status = NDIS_STATUS_SUCCESS;
     PVOID pInfo  = NULL;
     ULONG ulSize = 0;
@@ -422,8 +486,26 @@ static NDIS_STATUS ParaNdis_OidQuery(PARANDIS_ADAPTER *pContext, tOidDesc *pOid)
     switch(pOid->Oid)
     {
         case OID_GEN_STATISTICS:
-            pInfo  = &pContext->Statistics;
-            ulSize = sizeof(pContext->Statistics);
+            ParaNdis_GetStatistics(pContext, &Statistics);
+            u.Statistics = pContext->Statistics;
+            u.Statistics.ifInDiscards = Statistics.ifInDiscards;
+            u.Statistics.ifInErrors = Statistics.ifInErrors;
+            u.Statistics.ifHCInOctets = Statistics.ifHCInOctets;
+            u.Statistics.ifHCInUcastPkts = Statistics.ifHCInUcastPkts;
+            u.Statistics.ifHCInMulticastPkts = Statistics.ifHCInMulticastPkts;
+            u.Statistics.ifHCInBroadcastPkts = Statistics.ifHCInBroadcastPkts;
+            u.Statistics.ifHCOutOctets = Statistics.ifHCOutOctets;
+            u.Statistics.ifHCOutUcastPkts = Statistics.ifHCOutUcastPkts;
+            u.Statistics.ifHCOutMulticastPkts = Statistics.ifHCOutMulticastPkts;
+            u.Statistics.ifHCOutBroadcastPkts = Statistics.ifHCOutBroadcastPkts;
+            u.Statistics.ifHCInUcastOctets = Statistics.ifHCInUcastOctets;
+            u.Statistics.ifHCInMulticastOctets = Statistics.ifHCInMulticastOctets;
+            u.Statistics.ifHCInBroadcastOctets = Statistics.ifHCInBroadcastOctets;
+            u.Statistics.ifHCOutUcastOctets = Statistics.ifHCOutUcastOctets;
+            u.Statistics.ifHCOutMulticastOctets = Statistics.ifHCOutMulticastOctets;
+            u.Statistics.ifHCOutBroadcastOctets = Statistics.ifHCOutBroadcastOctets;
+            pInfo  = &u.Statistics;
+            ulSize = sizeof(u.Statistics);
             break;
         case OID_GEN_SUPPORTED_GUIDS:
 #if NDIS_SUPPORT_NDIS61
@@ -438,12 +520,40 @@ static NDIS_STATUS ParaNdis_OidQuery(PARANDIS_ADAPTER *pContext, tOidDesc *pOid)
         case OID_VENDOR_2:
             pInfo = &wmiStatistics;
             ulSize = sizeof(wmiStatistics);
-            wmiStatistics.txChecksumOffload = pContext->extraStatistics.framesCSOffload;
-            wmiStatistics.txLargeOffload = pContext->extraStatistics.framesLSO;
-            wmiStatistics.rxPriority = pContext->extraStatistics.framesRxPriority;
-            wmiStatistics.rxChecksumOK = pContext->extraStatistics.framesRxCSHwOK;
-            wmiStatistics.rxCoalescedWin = pContext->extraStatistics.framesCoalescedWindows;
-            wmiStatistics.rxCoalescedHost = pContext->extraStatistics.framesCoalescedHost;
+            ParaNdis_GetStatistics(pContext, &Statistics);
+            wmiStatistics.txChecksumOffload = Statistics.framesCSOffload;
+            wmiStatistics.txLargeOffload = Statistics.framesLSO;
+            wmiStatistics.rxPriority = Statistics.framesRxPriority;
+            wmiStatistics.rxChecksumOK = Statistics.framesRxCSHwOK;
+            wmiStatistics.rxCoalescedWin = Statistics.framesCoalescedWindows;
+            wmiStatistics.rxCoalescedHost = Statistics.framesCoalescedHost;
+            break;
+        case OID_VENDOR_3:
+            pInfo = QueryQueuesStatistics(pContext, &ulSize);
+            if (pInfo)
+            {
+                bFreeInfo = TRUE;
+            }
+            else
+            {
+                status = NDIS_STATUS_RESOURCES;
+            }
+            break;
+        case OID_VENDOR_4:
+            if (!virtio_trace_size(&pContext->IODevice))
+            {
+                status = NDIS_STATUS_NOT_SUPPORTED;
+                break;
+            }
+            pInfo = QueryVirtioTrace(pContext, &ulSize);
+            if (pInfo)
+            {
+                bFreeInfo = TRUE;
+            }
+            else
+            {
+                status = NDIS_STATUS_RESOURCES;
+            }
             break;
 
         case OID_GEN_INTERRUPT_MODERATION:
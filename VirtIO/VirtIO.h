@@ -10,6 +10,26 @@ struct VirtIOBufferDescriptor {
     ULONG length;
 };
 
+/* Indirect table that stays with one driver request slot and is reused by
+ * every request submitted from it. The entries that are the same for each
+ * request (e.g. the request header and the status byte) are written once
+ * by virtqueue_init_indirect_table, virtqueue_add_buf_table then only fills
+ * in the data entries of the request. Head entries are device-readable and
+ * come first, tail entries are device-writable and come last.
+ */
+#define VIRTQUEUE_INDIRECT_MAX_FIXED 4
+
+struct virtqueue_indirect_table {
+    void *va;                   /* the table, physically contiguous */
+    ULONGLONG pa;
+    u16 max_entries;            /* capacity in descriptors */
+    u16 num_head;
+    u16 num_tail;
+    u16 head_next;              /* split ring: where the last head entry links to */
+    u32 tail_len;               /* device-writable bytes in the tail */
+    struct VirtIOBufferDescriptor tail[VIRTQUEUE_INDIRECT_MAX_FIXED];
+};
+
 typedef int (*proc_virtqueue_add_buf)(
     struct virtqueue *vq,
     struct scatterlist sg[],
@@ -19,6 +39,19 @@ typedef int (*proc_virtqueue_add_buf)(
     void *va_indirect,
     ULONGLONG phys_indirect);
 
+typedef void (*proc_virtqueue_init_indirect_table)(
+    struct virtqueue *vq,
+    struct virtqueue_indirect_table *table,
+    struct scatterlist head[]);
+
+typedef int (*proc_virtqueue_add_buf_table)(
+    struct virtqueue *vq,
+    struct virtqueue_indirect_table *table,
+    struct scatterlist sg[],
+    unsigned int out_num,
+    unsigned int in_num,
+    void *opaque);
+
 typedef bool(*proc_virtqueue_kick_prepare)(struct virtqueue *vq);
 
 typedef void(*proc_virtqueue_kick_always)(struct virtqueue *vq);
@@ -39,6 +72,11 @@ typedef BOOLEAN(*proc_virtqueue_has_buf)(struct virtqueue *vq);
 
 typedef void(*proc_virtqueue_shutdown)(struct virtqueue *vq);
 
+typedef u32(*proc_virtqueue_notification_data)(struct virtqueue *vq);
+
+/* Deferred kicks are coalesced into one notification, but at most this many */
+#define VIRTQUEUE_MAX_DEFERRED_KICKS 32
+
 /* Represents one virtqueue; only data pointed to by the vring structure is exposed to the host */
 struct virtqueue {
     VirtIODevice *vdev;
@@ -48,6 +86,8 @@ struct virtqueue {
     void         *avail_va;
     void         *used_va;
     proc_virtqueue_add_buf add_buf;
+    proc_virtqueue_init_indirect_table init_indirect_table;
+    proc_virtqueue_add_buf_table add_buf_table;
     proc_virtqueue_kick_prepare kick_prepare;
     proc_virtqueue_kick_always kick_always;
     proc_virtqueue_get_buf get_buf;
@@ -58,6 +98,8 @@ struct virtqueue {
     proc_virtqueue_is_interrupt_enabled is_interrupt_enabled;
     proc_virtqueue_has_buf has_buf;
     proc_virtqueue_shutdown shutdown;
+    proc_virtqueue_notification_data notification_data;
+    unsigned int num_deferred_kicks;
 };
 
 static inline int virtqueue_add_buf(
@@ -69,7 +111,48 @@ static inline int virtqueue_add_buf(
     void *va_indirect,
     ULONGLONG phys_indirect)
 {
-    return vq->add_buf(vq, sg, out_num, in_num, opaque, va_indirect, phys_indirect);
+    int ret = vq->add_buf(vq, sg, out_num, in_num, opaque, va_indirect, phys_indirect);
+    if (vq->vdev->trace && ret >= 0) {
+        virtio_trace_event(vq->vdev, (u16)vq->index, VIRTIO_TRACE_ADD_BUF, out_num + in_num, opaque);
+    }
+    return ret;
+}
+
+/* Prepares a reusable indirect table, returns 0 on success, negative number
+ * on error. head and tail may be NULL when num_head or num_tail is 0. The
+ * table belongs to the queue it was prepared for, its layout differs
+ * between split and packed rings.
+ */
+int virtqueue_init_indirect_table(
+    struct virtqueue *vq,
+    struct virtqueue_indirect_table *table,
+    void *va,
+    ULONGLONG pa,
+    unsigned int max_entries,
+    struct scatterlist head[],
+    unsigned int num_head,
+    struct scatterlist tail[],
+    unsigned int num_tail);
+
+/* Adds a request through a prepared indirect table, sg holds only the data
+ * entries (out_num device-readable followed by in_num device-writable).
+ * The table must not be reused before the request is returned by
+ * virtqueue_get_buf. Same return values and locking as virtqueue_add_buf.
+ */
+static inline int virtqueue_add_buf_table(
+    struct virtqueue *vq,
+    struct virtqueue_indirect_table *table,
+    struct scatterlist sg[],
+    unsigned int out_num,
+    unsigned int in_num,
+    void *opaque)
+{
+    int ret = vq->add_buf_table(vq, table, sg, out_num, in_num, opaque);
+    if (vq->vdev->trace && ret >= 0) {
+        virtio_trace_event(vq->vdev, (u16)vq->index, VIRTIO_TRACE_ADD_BUF,
+            table->num_head + out_num + in_num + table->num_tail, opaque);
+    }
+    return ret;
 }
 
 static inline bool virtqueue_kick_prepare(struct virtqueue *vq)
@@ -84,7 +167,11 @@ static inline void virtqueue_kick_always(struct virtqueue *vq)
 
 static inline void *virtqueue_get_buf(struct virtqueue *vq, unsigned int *len)
 {
-    return vq->get_buf(vq, len);
+    void *opaque = vq->get_buf(vq, len);
+    if (vq->vdev->trace && opaque) {
+        virtio_trace_event(vq->vdev, (u16)vq->index, VIRTIO_TRACE_GET_BUF, *len, opaque);
+    }
+    return opaque;
 }
 
 static inline void virtqueue_disable_cb(struct virtqueue *vq)
@@ -125,4 +212,12 @@ static inline void virtqueue_shutdown(struct virtqueue *vq)
 void virtqueue_notify(struct virtqueue *vq);
 void virtqueue_kick(struct virtqueue *vq);
 
+/* Kick for submission bursts: pass more = true after a buffer that will be
+ * followed by others right away and more = false after the last one. The
+ * device is notified once per burst (and after every
+ * VIRTQUEUE_MAX_DEFERRED_KICKS deferred calls, so it is never starved).
+ * Same locking rules as virtqueue_kick.
+ */
+void virtqueue_kick_deferred(struct virtqueue *vq, bool more);
+
 #endif /* _LINUX_VIRTIO_H */
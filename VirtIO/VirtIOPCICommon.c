@@ -81,6 +81,11 @@ void virtio_device_shutdown(VirtIODevice *vdev)
         mem_free_nonpaged_block(vdev, vdev->info);
         vdev->info = NULL;
     }
+    if (vdev->trace_block) {
+        vdev->trace = NULL;
+        mem_free_nonpaged_block(vdev, vdev->trace_block);
+        vdev->trace_block = NULL;
+    }
 }
 
 u8 virtio_get_status(VirtIODevice *vdev)
@@ -123,6 +128,8 @@ NTSTATUS virtio_set_features(VirtIODevice *vdev, u64 features)
 
     vdev->event_suppression_enabled = virtio_is_feature_enabled(features, VIRTIO_RING_F_EVENT_IDX);
     vdev->packed_ring = virtio_is_feature_enabled(features, VIRTIO_F_RING_PACKED);
+    vdev->notification_data = virtio_is_feature_enabled(features, VIRTIO_F_NOTIFICATION_DATA);
+    vdev->in_order = virtio_is_feature_enabled(features, VIRTIO_F_IN_ORDER);
 
     status = vdev->device->set_features(vdev, features);
     if (!NT_SUCCESS(status)) {
@@ -351,7 +358,11 @@ u16 virtio_set_queue_vector(struct virtqueue *vq, u16 vector)
 
 u8 virtio_read_isr_status(VirtIODevice *vdev)
 {
-    return ioread8(vdev, vdev->isr);
+    u8 isr = ioread8(vdev, vdev->isr);
+    if (vdev->trace) {
+        virtio_trace_event(vdev, VIRTIO_TRACE_NO_QUEUE, VIRTIO_TRACE_INTERRUPT, isr, NULL);
+    }
+    return isr;
 }
 
 int virtio_get_bar_index(PPCI_COMMON_HEADER pPCIHeader, PHYSICAL_ADDRESS BasePA)
@@ -392,6 +403,12 @@ int virtio_get_bar_index(PPCI_COMMON_HEADER pPCIHeader, PHYSICAL_ADDRESS BasePA)
  */
 bool vp_notify(struct virtqueue *vq)
 {
+    if (vq->vdev->notification_data) {
+        /* the queue's selector and its next available position */
+        iowrite32(vq->vdev, vq->notification_data(vq), vq->notification_addr);
+        DPrintf(6, "virtio: vp_notify vq->index = %x\n", vq->index);
+        return true;
+    }
     /* we write the queue's selector into the notification register to
      * signal the other end */
     iowrite16(vq->vdev, (unsigned short)vq->index, vq->notification_addr);
@@ -401,6 +418,9 @@ bool vp_notify(struct virtqueue *vq)
 
 void virtqueue_notify(struct virtqueue *vq)
 {
+    if (vq->vdev->trace) {
+        virtio_trace_event(vq->vdev, (u16)vq->index, VIRTIO_TRACE_KICK, 0, NULL);
+    }
     vq->notification_cb(vq);
 }
 
@@ -410,3 +430,46 @@ void virtqueue_kick(struct virtqueue *vq)
         virtqueue_notify(vq);
     }
 }
+
+void virtqueue_kick_deferred(struct virtqueue *vq, bool more)
+{
+    /* kick_prepare resets the counter */
+    if (more && ++vq->num_deferred_kicks < VIRTQUEUE_MAX_DEFERRED_KICKS) {
+        return;
+    }
+    virtqueue_kick(vq);
+}
+
+int virtqueue_init_indirect_table(
+    struct virtqueue *vq,
+    struct virtqueue_indirect_table *table,
+    void *va,
+    ULONGLONG pa,
+    unsigned int max_entries,
+    struct scatterlist head[],
+    unsigned int num_head,
+    struct scatterlist tail[],
+    unsigned int num_tail)
+{
+    unsigned int i;
+
+    if (va == NULL || max_entries == 0 || max_entries > MAXUSHORT ||
+        num_tail > VIRTQUEUE_INDIRECT_MAX_FIXED ||
+        num_head + num_tail > max_entries) {
+        return -EINVAL;
+    }
+
+    RtlZeroMemory(table, sizeof(*table));
+    table->va = va;
+    table->pa = pa;
+    table->max_entries = (u16)max_entries;
+    table->num_head = (u16)num_head;
+    table->num_tail = (u16)num_tail;
+    for (i = 0; i < num_tail; i++) {
+        table->tail[i] = tail[i];
+        table->tail_len += tail[i].length;
+    }
+
+    vq->init_indirect_table(vq, table, head);
+    return 0;
+}
@@ -290,6 +290,7 @@ static NTSTATUS vio_modern_setup_vq(struct virtqueue **queue,
     struct virtqueue *vq;
     void *vq_addr;
     u16 off;
+    u32 notify_size;
     unsigned long ring_size, heap_size;
     NTSTATUS status;
 
@@ -341,9 +342,11 @@ static NTSTATUS vio_modern_setup_vq(struct virtqueue **queue,
     iowrite64_twopart(vdev, mem_get_physical_address(vdev, vq->used_va),
         &cfg->queue_used_lo, &cfg->queue_used_hi);
 
+    /* notification data is a 32-bit write, the queue index alone is 16-bit */
+    notify_size = vdev->notification_data ? 4 : 2;
     if (vdev->notify_base) {
         /* offset should not wrap */
-        if ((u64)off * vdev->notify_offset_multiplier + 2
+        if ((u64)off * vdev->notify_offset_multiplier + notify_size
             > vdev->notify_len) {
             DPrintf(0,
                 "%p: bad notification offset %u (x %u) "
@@ -358,8 +361,8 @@ static NTSTATUS vio_modern_setup_vq(struct virtqueue **queue,
             off * vdev->notify_offset_multiplier);
     } else {
         vq->notification_addr = vio_modern_map_capability(vdev,
-            vdev->notify_map_cap, 2, 2,
-            off * vdev->notify_offset_multiplier, 2,
+            vdev->notify_map_cap, notify_size, notify_size,
+            off * vdev->notify_offset_multiplier, notify_size,
             NULL);
     }
 
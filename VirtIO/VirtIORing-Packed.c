@@ -113,8 +113,11 @@ struct vring_desc_state_packed {
     u16 num;			/* Descriptor list length. */
     u16 next;			/* The next desc state in a list. */
     u16 last;			/* The last desc state in a list. */
+    u32 in_len;			/* Device-writable bytes, VIRTIO_F_IN_ORDER only. */
 };
 
+#define VRING_NO_BATCH  0xFFFFFFFF
+
 struct virtqueue_packed {
     struct virtqueue vq;
     /* Number we've added since last sync. */
@@ -149,6 +152,12 @@ struct virtqueue_packed {
         /* Per-descriptor state. */
         struct vring_desc_state_packed *desc_state;
     } packed;
+    /* VIRTIO_F_IN_ORDER: the buffer id is the ring position of its first
+     * descriptor, so ids are recycled in ring order without the free list.
+     * batch_last_id/len is the used descriptor covering the current batch. */
+    bool in_order;
+    u32 batch_last_id;
+    u32 batch_last_len;
     struct vring_desc_state_packed desc_states[];
 };
 
@@ -168,6 +177,52 @@ unsigned long vring_size_packed(unsigned int num, unsigned long align)
     return res;
 }
 
+/* Adds a buffer consisting of one descriptor pointing to an indirect table
+ * of len bytes, the caller checks there is a free descriptor */
+static void add_indirect_desc_packed(
+    struct virtqueue_packed *vq,
+    ULONGLONG phys_indirect,
+    u32 len,
+    u32 in_len,
+    void *opaque)
+{
+    u16 head = vq->packed.next_avail_idx;
+    u16 id = vq->in_order ? head : (u16)vq->free_head;
+
+    BUG_ON(id >= vq->packed.vring.num);
+
+    vq->packed.vring.desc[head].addr = phys_indirect;
+    vq->packed.vring.desc[head].len = len;
+    vq->packed.vring.desc[head].id = id;
+
+    KeMemoryBarrier();
+    vq->packed.vring.desc[head].flags = VRING_DESC_F_INDIRECT | vq->avail_used_flags;
+
+    DPrintf(5, "Added buffer head %i to Q%d\n", head, vq->vq.index);
+    head++;
+    if (head >= vq->packed.vring.num) {
+        head = 0;
+        vq->packed.avail_wrap_counter ^= 1;
+        vq->avail_used_flags ^=
+            1 << VRING_PACKED_DESC_F_AVAIL |
+            1 << VRING_PACKED_DESC_F_USED;
+    }
+    vq->packed.next_avail_idx = head;
+    /* We're using some buffers from the free list. */
+    vq->num_free -= 1;
+    vq->num_added += 1;
+
+    if (!vq->in_order) {
+        vq->free_head = vq->packed.desc_state[id].next;
+    }
+
+    /* Store token and indirect buffer state. */
+    vq->packed.desc_state[id].num = 1;
+    vq->packed.desc_state[id].data = opaque;
+    vq->packed.desc_state[id].last = id;
+    vq->packed.desc_state[id].in_len = in_len;
+}
+
 static int virtqueue_add_buf_packed(
     struct virtqueue *_vq,    /* the queue */
     struct scatterlist sg[], /* sg array of length out + in */
@@ -184,46 +239,24 @@ static int virtqueue_add_buf_packed(
 
     descs_used = out + in;
     head = vq->packed.next_avail_idx;
-    id = (u16)vq->free_head;
+    id = vq->in_order ? head : (u16)vq->free_head;
 
     BUG_ON(descs_used == 0);
     BUG_ON(id >= vq->packed.vring.num);
 
     if (va_indirect && vq->num_free > 0) {
+        u32 in_len = 0;
         desc = va_indirect;
         for (i = 0; i < descs_used; i++) {
             desc[i].flags = i < out ? 0 : VRING_DESC_F_WRITE;
             desc[i].addr = sg[i].physAddr.QuadPart;
             desc[i].len = sg[i].length;
+            if (i >= out) {
+                in_len += sg[i].length;
+            }
         }
-        vq->packed.vring.desc[head].addr = phys_indirect;
-        vq->packed.vring.desc[head].len = descs_used * sizeof(struct vring_packed_desc);
-        vq->packed.vring.desc[head].id = id;
-
-        KeMemoryBarrier();
-        vq->packed.vring.desc[head].flags = VRING_DESC_F_INDIRECT | vq->avail_used_flags;
-
-        DPrintf(5, "Added buffer head %i to Q%d\n", head, vq->vq.index);
-        head++;
-        if (head >= vq->packed.vring.num) {
-            head = 0;
-            vq->packed.avail_wrap_counter ^= 1;
-            vq->avail_used_flags ^=
-                1 << VRING_PACKED_DESC_F_AVAIL |
-                1 << VRING_PACKED_DESC_F_USED;
-        }
-        vq->packed.next_avail_idx = head;
-        /* We're using some buffers from the free list. */
-        vq->num_free -= 1;
-        vq->num_added += 1;
-
-        vq->free_head = vq->packed.desc_state[id].next;
-
-        /* Store token and indirect buffer state. */
-        vq->packed.desc_state[id].num = 1;
-        vq->packed.desc_state[id].data = opaque;
-        vq->packed.desc_state[id].last = id;
-
+        add_indirect_desc_packed(vq, phys_indirect,
+            descs_used * sizeof(struct vring_packed_desc), in_len, opaque);
     } else {
         unsigned int n;
         u16 curr, prev, head_flags;
@@ -269,13 +302,22 @@ static int virtqueue_add_buf_packed(
 
         /* Update free pointer */
         vq->packed.next_avail_idx = i;
-        vq->free_head = curr;
+        if (!vq->in_order) {
+            vq->free_head = curr;
+        }
 
         /* Store token. */
         vq->packed.desc_state[id].num = (u16)descs_used;
         vq->packed.desc_state[id].data = opaque;
         vq->packed.desc_state[id].last = prev;
 
+        if (vq->in_order) {
+            vq->packed.desc_state[id].in_len = 0;
+            for (n = out; n < descs_used; n++) {
+                vq->packed.desc_state[id].in_len += sg[n].length;
+            }
+        }
+
         /*
          * A driver MUST NOT make the first descriptor in the list
          * available before all subsequent descriptors comprising
@@ -291,6 +333,70 @@ static int virtqueue_add_buf_packed(
     return 0;
 }
 
+/* Writes the data and tail entries of a request into a reusable indirect
+ * table and adds it to the queue. Packed indirect tables are read in order,
+ * the head entries stay at the start of the table, the data entries follow
+ * them and the tail entries are copied right after the data.
+ */
+static int virtqueue_add_buf_table_packed(
+    struct virtqueue *_vq,                  /* the queue */
+    struct virtqueue_indirect_table *table, /* prepared by virtqueue_init_indirect_table */
+    struct scatterlist sg[],                /* data entries, sg array of length out + in */
+    unsigned int out,                       /* number of driver->device data entries */
+    unsigned int in,                        /* number of device->driver data entries */
+    void *opaque)                           /* later returned from virtqueue_get_buf */
+{
+    struct virtqueue_packed *vq = packedvq(_vq);
+    struct vring_packed_desc *desc = (struct vring_packed_desc *)table->va + table->num_head;
+    unsigned int descs_used = table->num_head + out + in + table->num_tail;
+    u32 in_len = table->tail_len;
+    unsigned int i;
+
+    if (descs_used == 0 || descs_used > table->max_entries) {
+        return -EINVAL;
+    }
+    if (vq->num_free == 0) {
+        return -ENOSPC;
+    }
+
+    for (i = 0; i < out + in; i++) {
+        desc[i].flags = i < out ? 0 : VRING_DESC_F_WRITE;
+        desc[i].addr = sg[i].physAddr.QuadPart;
+        desc[i].len = sg[i].length;
+        if (i >= out) {
+            in_len += sg[i].length;
+        }
+    }
+    desc += out + in;
+    for (i = 0; i < table->num_tail; i++) {
+        desc[i].flags = VRING_DESC_F_WRITE;
+        desc[i].addr = table->tail[i].physAddr.QuadPart;
+        desc[i].len = table->tail[i].length;
+    }
+
+    add_indirect_desc_packed(vq, table->pa,
+        descs_used * sizeof(struct vring_packed_desc), in_len, opaque);
+    return 0;
+}
+
+/* Writes the head entries of a reusable indirect table */
+static void virtqueue_init_indirect_table_packed(
+    struct virtqueue *_vq,
+    struct virtqueue_indirect_table *table,
+    struct scatterlist head[])
+{
+    struct vring_packed_desc *desc = (struct vring_packed_desc *)table->va;
+    u16 i;
+
+    UNREFERENCED_PARAMETER(_vq);
+
+    for (i = 0; i < table->num_head; i++) {
+        desc[i].flags = 0;
+        desc[i].addr = head[i].physAddr.QuadPart;
+        desc[i].len = head[i].length;
+    }
+}
+
 static void detach_buf_packed(struct virtqueue_packed *vq, unsigned int id)
 {
     struct vring_desc_state_packed *state = &vq->packed.desc_state[id];
@@ -314,7 +420,13 @@ static void *virtqueue_detach_unused_buf_packed(struct virtqueue *_vq)
             continue;
         /* detach_buf clears data, so grab it now. */
         buf = vq->packed.desc_state[i].data;
-        detach_buf_packed(vq, i);
+        if (vq->in_order) {
+            /* the free list is not used, the queue is reset afterwards */
+            vq->packed.desc_state[i].data = NULL;
+            vq->num_free += vq->packed.desc_state[i].num;
+        } else {
+            detach_buf_packed(vq, i);
+        }
         return buf;
     }
     /* That should have freed everything. */
@@ -395,6 +507,10 @@ static bool virtqueue_enable_cb_packed(struct virtqueue *_vq)
     struct virtqueue_packed *vq = packedvq(_vq);
     unsigned last_used_idx = virtqueue_enable_cb_prepare_packed(vq);
 
+    if (vq->batch_last_id != VRING_NO_BATCH) {
+        /* the rest of an in-order batch is used but not written back */
+        return false;
+    }
     return !virtqueue_poll_packed(vq, (u16)last_used_idx);
 }
 
@@ -444,6 +560,9 @@ static bool virtqueue_enable_cb_delayed_packed(struct virtqueue *_vq)
      */
     KeMemoryBarrier();
 
+    if (vq->batch_last_id != VRING_NO_BATCH) {
+        return false;
+    }
     if (is_used_desc_packed(vq,
         vq->last_used_idx,
         vq->packed.used_wrap_counter)) {
@@ -537,10 +656,78 @@ static void *virtqueue_get_buf_packed(
     return ret;
 }
 
+/* VIRTIO_F_IN_ORDER version of virtqueue_get_buf_packed. The device may
+ * write a single used descriptor for a batch, carrying the id of the last
+ * buffer in it, at the position of the first one. Buffers are returned
+ * oldest first and recycled by descriptor count.
+ */
+static void *virtqueue_get_buf_packed_in_order(
+    struct virtqueue *_vq, /* the queue */
+    unsigned int *len)    /* number of bytes returned by the device */
+{
+    struct virtqueue_packed *vq = packedvq(_vq);
+    struct vring_desc_state_packed *state;
+    u16 id = vq->last_used_idx;
+    void *ret;
+
+    if (vq->batch_last_id == VRING_NO_BATCH) {
+        if (!more_used_packed(vq)) {
+            DPrintf(6, "%s: No more buffers in queue\n", __FUNCTION__);
+            return NULL;
+        }
+
+        /* Only get used elements after they have been exposed by host. */
+        KeMemoryBarrier();
+
+        vq->batch_last_id = vq->packed.vring.desc[id].id;
+        vq->batch_last_len = vq->packed.vring.desc[id].len;
+        if (vq->batch_last_id >= vq->packed.vring.num) {
+            BAD_RING(vq, "id %u out of range\n", vq->batch_last_id);
+            vq->batch_last_id = VRING_NO_BATCH;
+            return NULL;
+        }
+    }
+
+    state = &vq->packed.desc_state[id];
+    if (!state->data) {
+        BAD_RING(vq, "id %u is not a head!\n", id);
+        return NULL;
+    }
+    if (vq->batch_last_id == id) {
+        *len = vq->batch_last_len;
+        vq->batch_last_id = VRING_NO_BATCH;
+    } else {
+        /* not reported by the device, it used the whole writable part */
+        *len = state->in_len;
+    }
+
+    ret = state->data;
+    state->data = NULL;
+    vq->num_free += state->num;
+
+    vq->last_used_idx += state->num;
+    if (vq->last_used_idx >= vq->packed.vring.num) {
+        vq->last_used_idx -= (u16)vq->packed.vring.num;
+        vq->packed.used_wrap_counter ^= 1;
+    }
+
+    /* Within a batch last_used_idx is behind the device, only
+     * publish the event position once the batch is consumed. */
+    if (vq->batch_last_id == VRING_NO_BATCH &&
+        vq->packed.event_flags_shadow == VRING_PACKED_EVENT_FLAG_DESC) {
+        vq->packed.vring.driver->off_wrap = vq->last_used_idx |
+            ((u16)vq->packed.used_wrap_counter <<
+                VRING_PACKED_EVENT_F_WRAP_CTR);
+        KeMemoryBarrier();
+    }
+
+    return ret;
+}
+
 static BOOLEAN virtqueue_has_buf_packed(struct virtqueue *_vq)
 {
     struct virtqueue_packed *vq = packedvq(_vq);
-    return more_used_packed(vq);
+    return vq->batch_last_id != VRING_NO_BATCH || more_used_packed(vq);
 }
 
 static bool virtqueue_kick_prepare_packed(struct virtqueue *_vq)
@@ -565,6 +752,7 @@ static bool virtqueue_kick_prepare_packed(struct virtqueue *_vq)
     old = vq->packed.next_avail_idx - vq->num_added;
     new = vq->packed.next_avail_idx;
     vq->num_added = 0;
+    _vq->num_deferred_kicks = 0;
 
     snapshot.value32 = *(u32 *)vq->packed.vring.device;
     flags = snapshot.flags;
@@ -591,9 +779,18 @@ static void virtqueue_kick_always_packed(struct virtqueue *_vq)
     struct virtqueue_packed *vq = packedvq(_vq);
     KeMemoryBarrier();
     vq->num_added = 0;
+    _vq->num_deferred_kicks = 0;
     virtqueue_notify(_vq);
 }
 
+/* Returns the VIRTIO_F_NOTIFICATION_DATA value: next descriptor offset and the avail wrap counter */
+static u32 virtqueue_notification_data_packed(struct virtqueue *_vq)
+{
+    struct virtqueue_packed *vq = packedvq(_vq);
+    return VIRTIO_NOTIFICATION_DATA(_vq->index, vq->packed.next_avail_idx,
+        vq->packed.avail_wrap_counter);
+}
+
 /* Initializes a new virtqueue using already allocated memory */
 struct virtqueue *vring_new_virtqueue_packed(
     unsigned int index,                 /* virtqueue index */
@@ -630,6 +827,8 @@ struct virtqueue *vring_new_virtqueue_packed(
     vq->packed.next_avail_idx = 0;
     vq->packed.event_flags_shadow = 0;
     vq->packed.desc_state = vq->desc_states;
+    vq->in_order = vdev->in_order;
+    vq->batch_last_id = VRING_NO_BATCH;
 
     RtlZeroMemory(vq->packed.desc_state, num * sizeof(*vq->packed.desc_state));
     for (i = 0; i < num - 1; i++) {
@@ -637,15 +836,18 @@ struct virtqueue *vring_new_virtqueue_packed(
     }
 
     vq->vq.add_buf = virtqueue_add_buf_packed;
+    vq->vq.init_indirect_table = virtqueue_init_indirect_table_packed;
+    vq->vq.add_buf_table = virtqueue_add_buf_table_packed;
     vq->vq.detach_unused_buf = virtqueue_detach_unused_buf_packed;
     vq->vq.disable_cb = virtqueue_disable_cb_packed;
     vq->vq.enable_cb = virtqueue_enable_cb_packed;
     vq->vq.enable_cb_delayed = virtqueue_enable_cb_delayed_packed;
-    vq->vq.get_buf = virtqueue_get_buf_packed;
+    vq->vq.get_buf = vq->in_order ? virtqueue_get_buf_packed_in_order : virtqueue_get_buf_packed;
     vq->vq.has_buf = virtqueue_has_buf_packed;
     vq->vq.is_interrupt_enabled = virtqueue_is_interrupt_enabled_packed;
     vq->vq.kick_always = virtqueue_kick_always_packed;
     vq->vq.kick_prepare = virtqueue_kick_prepare_packed;
     vq->vq.shutdown = virtqueue_shutdown_packed;
+    vq->vq.notification_data = virtqueue_notification_data_packed;
     return &vq->vq;
 }
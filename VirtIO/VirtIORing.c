@@ -174,6 +174,14 @@ static inline int vring_need_event(__u16 event_idx, __u16 new_idx, __u16 old)
     return (__u16)(new_idx - event_idx - 1) < (__u16)(new_idx - old);
 }
 
+/* Per-head state only used with VIRTIO_F_IN_ORDER */
+struct vring_desc_state_split {
+    u32 in_len;         /* device-writable bytes, reported for batched buffers */
+    u16 num;            /* descriptors in the chain */
+};
+
+#define VRING_NO_BATCH  0xFFFFFFFF
+
 struct virtqueue_split {
     struct virtqueue vq;
     struct vring vring;
@@ -185,6 +193,14 @@ struct virtqueue_split {
     unsigned int num_added_since_kick;
     u16 first_unused;
     u16 last_used;
+    /* VIRTIO_F_IN_ORDER: descriptors are handed out and come back in
+     * ring order, next_used is the head of the oldest outstanding buffer
+     * and batch_last_id/len is the used element covering the current batch */
+    bool in_order;
+    u16 next_used;
+    u32 batch_last_id;
+    u32 batch_last_len;
+    struct vring_desc_state_split *desc_state;
     void *opaque[];
 };
 
@@ -221,6 +237,37 @@ static inline void put_unused_desc_chain(struct virtqueue_split *vq, u16 idx)
     vq->first_unused = start;
 }
 
+/* Takes one descriptor and points it to an indirect table of len bytes */
+static inline u16 add_indirect_desc_split(
+    struct virtqueue_split *vq,
+    ULONGLONG phys_indirect,
+    u32 len,
+    void *opaque)
+{
+    u16 idx = get_unused_desc(vq);
+
+    vq->vring.desc[idx].flags = VIRTQ_DESC_F_INDIRECT;
+    vq->vring.desc[idx].addr = phys_indirect;
+    vq->vring.desc[idx].len = len;
+
+    vq->opaque[idx] = opaque;
+    if (vq->in_order) {
+        vq->desc_state[idx].num = 1;
+    }
+    return idx;
+}
+
+/* Writes the first descriptor of a buffer into the available ring */
+static inline void make_avail_split(struct virtqueue_split *vq, u16 idx)
+{
+    struct vring *vring = &vq->vring;
+
+    vring->avail->ring[DESC_INDEX(vring->num, vq->master_vring_avail.idx)] = idx;
+    KeMemoryBarrier();
+    vring->avail->idx = ++vq->master_vring_avail.idx;
+    vq->num_added_since_kick++;
+}
+
 /* Adds a buffer to a virtqueue, returns 0 on success, negative number on error */
 static int virtqueue_add_buf_split(
     struct virtqueue *_vq,    /* the queue */
@@ -249,12 +296,7 @@ static int virtqueue_add_buf_split(
         }
         desc[i - 1].flags &= ~VIRTQ_DESC_F_NEXT;
 
-        idx = get_unused_desc(vq);
-        vq->vring.desc[idx].flags = VIRTQ_DESC_F_INDIRECT;
-        vq->vring.desc[idx].addr = phys_indirect;
-        vq->vring.desc[idx].len = i * sizeof(struct vring_desc);
-
-        vq->opaque[idx] = opaque;
+        idx = add_indirect_desc_split(vq, phys_indirect, i * sizeof(struct vring_desc), opaque);
     } else {
         u16 last_idx;
 
@@ -288,17 +330,120 @@ static int virtqueue_add_buf_split(
             vring->desc[last_idx].next = vq->first_unused;
         }
         vring->desc[last_idx].flags &= ~VIRTQ_DESC_F_NEXT;
+        if (vq->in_order) {
+            vq->desc_state[idx].num = (u16)(out + in);
+        }
     }
 
-    /* Write the first descriptor into the available ring */
-    vring->avail->ring[DESC_INDEX(vring->num, vq->master_vring_avail.idx)] = idx;
-    KeMemoryBarrier();
-    vring->avail->idx = ++vq->master_vring_avail.idx;
-    vq->num_added_since_kick++;
+    if (vq->in_order) {
+        u32 in_len = 0;
+        for (i = out; i < out + in; i++) {
+            in_len += sg[i].length;
+        }
+        vq->desc_state[idx].in_len = in_len;
+    }
+
+    make_avail_split(vq, idx);
+    return 0;
+}
+
+/* Writes the data entries of a request into a reusable indirect table and
+ * adds it to the queue. The table is laid out as head entries from index 0,
+ * data entries right after them and tail entries at the very end, linked
+ * by next, so the head and the tail never move. Per request only the data
+ * entries and, when the number of data entries drops to or from zero, the
+ * link of the last head entry are written.
+ */
+static int virtqueue_add_buf_table_split(
+    struct virtqueue *_vq,                  /* the queue */
+    struct virtqueue_indirect_table *table, /* prepared by virtqueue_init_indirect_table */
+    struct scatterlist sg[],                /* data entries, sg array of length out + in */
+    unsigned int out,                       /* number of driver->device data entries */
+    unsigned int in,                        /* number of device->driver data entries */
+    void *opaque)                           /* later returned from virtqueue_get_buf */
+{
+    struct virtqueue_split *vq = splitvq(_vq);
+    struct vring_desc *desc = (struct vring_desc *)table->va;
+    u16 data = table->num_head;
+    u16 tail = (u16)(table->max_entries - table->num_tail);
+    u16 head_next;
+    unsigned int i;
+    u16 idx;
+
+    if (out + in > (unsigned int)(tail - data) ||
+        (data == 0 && out + in == 0 && tail != 0)) {
+        return -EINVAL;
+    }
+    if (vq->num_unused == 0) {
+        return -ENOSPC;
+    }
+
+    for (i = 0; i < out + in; i++) {
+        desc[data + i].addr = sg[i].physAddr.QuadPart;
+        desc[data + i].len = sg[i].length;
+        desc[data + i].flags = (i < out ? 0 : VIRTQ_DESC_F_WRITE) | VIRTQ_DESC_F_NEXT;
+        desc[data + i].next = (u16)(data + i + 1);
+    }
+    if (out + in) {
+        if (table->num_tail) {
+            desc[data + i - 1].next = tail;
+        } else {
+            desc[data + i - 1].flags &= ~VIRTQ_DESC_F_NEXT;
+        }
+        head_next = data;
+    } else {
+        head_next = table->num_tail ? tail : table->max_entries;
+    }
+    if (data && head_next != table->head_next) {
+        desc[data - 1].flags = head_next < table->max_entries ? VIRTQ_DESC_F_NEXT : 0;
+        desc[data - 1].next = head_next < table->max_entries ? head_next : 0;
+        table->head_next = head_next;
+    }
 
+    idx = add_indirect_desc_split(vq, table->pa, table->max_entries * sizeof(struct vring_desc), opaque);
+    if (vq->in_order) {
+        u32 in_len = table->tail_len;
+        for (i = out; i < out + in; i++) {
+            in_len += sg[i].length;
+        }
+        vq->desc_state[idx].in_len = in_len;
+    }
+
+    make_avail_split(vq, idx);
     return 0;
 }
 
+/* Writes the head and tail entries of a reusable indirect table */
+static void virtqueue_init_indirect_table_split(
+    struct virtqueue *_vq,
+    struct virtqueue_indirect_table *table,
+    struct scatterlist head[])
+{
+    struct vring_desc *desc = (struct vring_desc *)table->va;
+    u16 tail = (u16)(table->max_entries - table->num_tail);
+    u16 i;
+
+    UNREFERENCED_PARAMETER(_vq);
+
+    for (i = 0; i < table->num_head; i++) {
+        desc[i].addr = head[i].physAddr.QuadPart;
+        desc[i].len = head[i].length;
+        desc[i].flags = VIRTQ_DESC_F_NEXT;
+        desc[i].next = (u16)(i + 1);
+    }
+    table->head_next = table->num_head;
+
+    for (i = 0; i < table->num_tail; i++) {
+        desc[tail + i].addr = table->tail[i].physAddr.QuadPart;
+        desc[tail + i].len = table->tail[i].length;
+        desc[tail + i].flags = VIRTQ_DESC_F_WRITE | VIRTQ_DESC_F_NEXT;
+        desc[tail + i].next = (u16)(tail + i + 1);
+    }
+    if (table->num_tail) {
+        desc[table->max_entries - 1].flags &= ~VIRTQ_DESC_F_NEXT;
+    }
+}
+
 /* Gets the opaque pointer associated with a returned buffer, or NULL if no buffer is available */
 static void *virtqueue_get_buf_split(
     struct virtqueue *_vq, /* the queue */
@@ -334,6 +479,54 @@ static void *virtqueue_get_buf_split(
     return opaque;
 }
 
+/* VIRTIO_F_IN_ORDER version of virtqueue_get_buf_split. The device may
+ * report a batch of buffers with one used element carrying the id of the
+ * last buffer in the batch and advance used->idx by the batch size. The
+ * buffers are returned oldest first and their descriptors are recycled by
+ * count, the free list is never touched since it stays in ring order.
+ */
+static void *virtqueue_get_buf_split_in_order(
+    struct virtqueue *_vq, /* the queue */
+    unsigned int *len)    /* number of bytes returned by the device */
+{
+    struct virtqueue_split *vq = splitvq(_vq);
+    void *opaque;
+    u16 head = vq->next_used;
+
+    if (vq->last_used == (int)vq->vring.used->idx) {
+        /* No descriptor index in the used ring */
+        return NULL;
+    }
+    KeMemoryBarrier();
+
+    if (vq->batch_last_id == VRING_NO_BATCH) {
+        u16 idx = DESC_INDEX(vq->vring.num, vq->last_used);
+        vq->batch_last_id = vq->vring.used->ring[idx].id;
+        vq->batch_last_len = vq->vring.used->ring[idx].len;
+    }
+    if (vq->batch_last_id == head) {
+        *len = vq->batch_last_len;
+        vq->batch_last_id = VRING_NO_BATCH;
+    } else {
+        /* not reported by the device, it used the whole writable part */
+        *len = vq->desc_state[head].in_len;
+    }
+
+    opaque = vq->opaque[head];
+    vq->opaque[head] = NULL;
+    vq->num_unused += vq->desc_state[head].num;
+    vq->next_used = DESC_INDEX(vq->vring.num, head + vq->desc_state[head].num);
+
+    vq->last_used++;
+    if (_vq->vdev->event_suppression_enabled && virtqueue_is_interrupt_enabled(_vq)) {
+        vring_used_event(&vq->vring) = vq->last_used;
+        KeMemoryBarrier();
+    }
+
+    ASSERT(opaque != NULL);
+    return opaque;
+}
+
 /* Returns true if at least one returned buffer is available, false otherwise */
 static BOOLEAN virtqueue_has_buf_split(struct virtqueue *_vq)
 {
@@ -354,6 +547,7 @@ static bool virtqueue_kick_prepare_split(struct virtqueue *_vq)
     old = (u16)(vq->master_vring_avail.idx - vq->num_added_since_kick);
     new = vq->master_vring_avail.idx;
     vq->num_added_since_kick = 0;
+    _vq->num_deferred_kicks = 0;
 
     if (_vq->vdev->event_suppression_enabled) {
         return wrap_around || (bool)vring_need_event(vring_avail_event(&vq->vring), new, old);
@@ -368,9 +562,18 @@ static void virtqueue_kick_always_split(struct virtqueue *_vq)
     struct virtqueue_split *vq = splitvq(_vq);
     KeMemoryBarrier();
     vq->num_added_since_kick = 0;
+    _vq->num_deferred_kicks = 0;
     virtqueue_notify(_vq);
 }
 
+/* Returns the VIRTIO_F_NOTIFICATION_DATA value, the avail index is both next_off and next_wrap */
+static u32 virtqueue_notification_data_split(struct virtqueue *_vq)
+{
+    struct virtqueue_split *vq = splitvq(_vq);
+    u16 idx = vq->master_vring_avail.idx;
+    return VIRTIO_NOTIFICATION_DATA(_vq->index, idx, idx & 0x8000);
+}
+
 /* Enables interrupts on a virtqueue and returns false if the queue has at least one returned
  * buffer available to be fetched by virtqueue_get_buf, true otherwise */
 static bool virtqueue_enable_cb_split(struct virtqueue *_vq)
@@ -469,6 +672,35 @@ static void *virtqueue_detach_unused_buf_split(struct virtqueue *_vq)
     return opaque;
 }
 
+/* VIRTIO_F_IN_ORDER version of virtqueue_detach_unused_buf_split. Putting
+ * chains back on the free list would break its ring order, so the buffers
+ * are detached oldest first and recycled by count like in get_buf. Once
+ * all are detached next_used meets first_unused again. Only valid after the
+ * device has been reset: a running device may still complete the buffers
+ * detached here, and its used ring would then disagree with next_used.
+ */
+static void *virtqueue_detach_unused_buf_split_in_order(struct virtqueue *_vq)
+{
+    struct virtqueue_split *vq = splitvq(_vq);
+    u16 head = vq->next_used;
+    void *opaque;
+
+    if (vq->num_unused == vq->vring.num) {
+        return NULL;
+    }
+
+    opaque = vq->opaque[head];
+    vq->opaque[head] = NULL;
+    vq->num_unused += vq->desc_state[head].num;
+    vq->next_used = DESC_INDEX(vq->vring.num, head + vq->desc_state[head].num);
+    /* a used batch in progress may cover the detached buffer */
+    vq->batch_last_id = VRING_NO_BATCH;
+    vq->vring.avail->idx = --vq->master_vring_avail.idx;
+
+    ASSERT(opaque != NULL);
+    return opaque;
+}
+
 /* Returns the size of the virtqueue structure including
  * additional size for per-descriptor data */
 unsigned int vring_control_block_size(u16 qsize, bool packed)
@@ -479,6 +711,7 @@ unsigned int vring_control_block_size(u16 qsize, bool packed)
     }
     res = sizeof(struct virtqueue_split);
     res += sizeof(void *) * qsize;
+    res += sizeof(struct vring_desc_state_split) * qsize;
     return res;
 }
 
@@ -500,33 +733,42 @@ struct virtqueue *vring_new_virtqueue_split(
         return NULL;
     }
 
-    RtlZeroMemory(vq, sizeof(*vq) + num * sizeof(void *));
+    RtlZeroMemory(vq, sizeof(*vq) + num * (sizeof(void *) + sizeof(struct vring_desc_state_split)));
 
     vring_init(&vq->vring, num, pages, vring_align);
     vq->vq.vdev = vdev;
     vq->vq.notification_cb = notify;
     vq->vq.index = index;
+    vq->desc_state = (struct vring_desc_state_split *)&vq->opaque[num];
+    vq->in_order = vdev->in_order;
+    vq->batch_last_id = VRING_NO_BATCH;
 
-    /* Build a linked list of unused descriptors */
+    /* Build a linked list of unused descriptors. With VIRTIO_F_IN_ORDER
+     * it is never reordered, so it also is the ring order the spec asks for */
     vq->num_unused = num;
     vq->first_unused = 0;
     for (i = 0; i < num - 1; i++) {
         vq->vring.desc[i].flags = VIRTQ_DESC_F_NEXT;
         vq->vring.desc[i].next = i + 1;
     }
+    vq->vring.desc[num - 1].next = 0;
     vq->vq.avail_va = vq->vring.avail;
     vq->vq.used_va = vq->vring.used;
     vq->vq.add_buf = virtqueue_add_buf_split;
-    vq->vq.detach_unused_buf = virtqueue_detach_unused_buf_split;
+    vq->vq.init_indirect_table = virtqueue_init_indirect_table_split;
+    vq->vq.add_buf_table = virtqueue_add_buf_table_split;
+    vq->vq.detach_unused_buf = vq->in_order ?
+        virtqueue_detach_unused_buf_split_in_order : virtqueue_detach_unused_buf_split;
     vq->vq.disable_cb = virtqueue_disable_cb_split;
     vq->vq.enable_cb = virtqueue_enable_cb_split;
     vq->vq.enable_cb_delayed = virtqueue_enable_cb_delayed_split;
-    vq->vq.get_buf = virtqueue_get_buf_split;
+    vq->vq.get_buf = vq->in_order ? virtqueue_get_buf_split_in_order : virtqueue_get_buf_split;
     vq->vq.has_buf = virtqueue_has_buf_split;
     vq->vq.is_interrupt_enabled = virtqueue_is_interrupt_enabled_split;
     vq->vq.kick_always = virtqueue_kick_always_split;
     vq->vq.kick_prepare = virtqueue_kick_prepare_split;
     vq->vq.shutdown = virtqueue_shutdown_split;
+    vq->vq.notification_data = virtqueue_notification_data_split;
     return &vq->vq;
 }
 
@@ -540,7 +782,11 @@ void vring_transport_features(
     for (i = VIRTIO_TRANSPORT_F_START; i < VIRTIO_TRANSPORT_F_END; i++) {
         if (i != VIRTIO_RING_F_INDIRECT_DESC &&
             i != VIRTIO_RING_F_EVENT_IDX &&
-            i != VIRTIO_F_VERSION_1) {
+            i != VIRTIO_F_VERSION_1 &&
+            i != VIRTIO_F_IOMMU_PLATFORM &&
+            i != VIRTIO_F_RING_PACKED &&
+            i != VIRTIO_F_IN_ORDER &&
+            i != VIRTIO_F_NOTIFICATION_DATA) {
             virtio_feature_disable(*features, i);
         }
     }
@@ -0,0 +1,187 @@
+/*
+ * Virtqueue event trace
+ *
+ * Copyright (c) 2026 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met :
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and / or other materials provided with the distribution.
+ * 3. Neither the names of the copyright holders nor the names of their contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "osdep.h"
+#include "virtio_pci.h"
+#include "virtio.h"
+#include "kdebugprint.h"
+#include "virtio_pci_common.h"
+
+#define VIRTIO_TRACE_MIN_RECORDS    64
+#define VIRTIO_TRACE_MAX_RECORDS    (1 << 20)
+
+/* Writers only take a slot in the block of their CPU with an interlocked
+ * increment, which keeps them safe against preemption by a DPC or an ISR on
+ * the same CPU and against a passive level thread migrating in between. No
+ * lock is taken and no cache line is shared with other CPUs.
+ */
+static __inline ULONGLONG trace_timestamp(void)
+{
+#if defined(_M_IX86) || defined(_M_AMD64)
+    return __rdtsc();
+#else
+    return (ULONGLONG)KeQueryPerformanceCounter(NULL).QuadPart;
+#endif
+}
+
+static __inline ULONG trace_current_cpu(void)
+{
+#if NTDDI_VERSION >= NTDDI_WIN7
+    return KeGetCurrentProcessorNumberEx(NULL);
+#else
+    return KeGetCurrentProcessorNumber();
+#endif
+}
+
+static ULONG trace_max_cpus(void)
+{
+#if NTDDI_VERSION >= NTDDI_WIN7
+    return KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+#elif NTDDI_VERSION >= NTDDI_VISTA
+    return KeQueryMaximumProcessorCount();
+#else
+    return (ULONG)KeNumberProcessors;
+#endif
+}
+
+/* Measures the timestamp frequency against the performance counter, the
+ * TSC is assumed to be invariant as it is on any host KVM migrates between */
+static ULONGLONG trace_ticks_per_second(void)
+{
+    LARGE_INTEGER frequency, start, end;
+    ULONGLONG tsc_start, tsc_end;
+
+    start = KeQueryPerformanceCounter(&frequency);
+#if defined(_M_IX86) || defined(_M_AMD64)
+    tsc_start = trace_timestamp();
+    KeStallExecutionProcessor(1000);
+    tsc_end = trace_timestamp();
+    end = KeQueryPerformanceCounter(NULL);
+    if (end.QuadPart > start.QuadPart) {
+        return (tsc_end - tsc_start) * (ULONGLONG)frequency.QuadPart /
+            (ULONGLONG)(end.QuadPart - start.QuadPart);
+    }
+#else
+    UNREFERENCED_PARAMETER(start);
+    UNREFERENCED_PARAMETER(end);
+    UNREFERENCED_PARAMETER(tsc_start);
+    UNREFERENCED_PARAMETER(tsc_end);
+#endif
+    return (ULONGLONG)frequency.QuadPart;
+}
+
+NTSTATUS virtio_trace_enable(VirtIODevice *vdev, ULONG records_per_cpu)
+{
+    PVIRTIO_TRACE_HEADER trace = vdev->trace_block;
+    ULONG records = VIRTIO_TRACE_MIN_RECORDS;
+    ULONG cpus = trace_max_cpus();
+    ULONGLONG size;
+
+    if (trace == NULL) {
+        while (records < VIRTIO_TRACE_MAX_RECORDS && records * 2 <= records_per_cpu) {
+            records *= 2;
+        }
+        size = sizeof(VIRTIO_TRACE_HEADER) +
+            (ULONGLONG)cpus * (sizeof(VIRTIO_TRACE_CPU) + records * sizeof(VIRTIO_TRACE_RECORD));
+        if (size > MAXULONG) {
+            return STATUS_INVALID_PARAMETER;
+        }
+        trace = (PVIRTIO_TRACE_HEADER)mem_alloc_nonpaged_block(vdev, (size_t)size);
+        if (trace == NULL) {
+            DPrintf(0, "%s: no memory for %u records on %u CPUs\n", __FUNCTION__, records, cpus);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        RtlZeroMemory(trace, (size_t)size);
+        trace->Signature = VIRTIO_TRACE_SIGNATURE;
+        trace->Version = VIRTIO_TRACE_VERSION;
+        trace->HeaderSize = sizeof(VIRTIO_TRACE_HEADER);
+        trace->NumberOfCpus = cpus;
+        trace->RecordsPerCpu = records;
+        trace->RecordSize = sizeof(VIRTIO_TRACE_RECORD);
+        trace->CpuBlockSize = sizeof(VIRTIO_TRACE_CPU) + records * sizeof(VIRTIO_TRACE_RECORD);
+        trace->TicksPerSecond = trace_ticks_per_second();
+        vdev->trace_block = trace;
+    }
+
+    DPrintf(0, "%s: %u records on %u CPUs, %I64u ticks per second\n", __FUNCTION__,
+        trace->RecordsPerCpu, trace->NumberOfCpus, trace->TicksPerSecond);
+    KeMemoryBarrier();
+    vdev->trace = trace;
+    return STATUS_SUCCESS;
+}
+
+void virtio_trace_disable(VirtIODevice *vdev)
+{
+    vdev->trace = NULL;
+}
+
+ULONG virtio_trace_size(VirtIODevice *vdev)
+{
+    PVIRTIO_TRACE_HEADER trace = vdev->trace_block;
+    return trace ? VIRTIO_TRACE_SIZE(trace) : 0;
+}
+
+ULONG virtio_trace_copy(VirtIODevice *vdev, void *buffer, ULONG length)
+{
+    PVIRTIO_TRACE_HEADER trace = vdev->trace_block;
+    ULONG size = trace ? VIRTIO_TRACE_SIZE(trace) : 0;
+
+    if (size == 0 || length < size) {
+        return 0;
+    }
+    /* records being written at this moment may come out torn, the rest of
+     * the snapshot is consistent */
+    RtlCopyMemory(buffer, trace, size);
+    return size;
+}
+
+void virtio_trace_event(VirtIODevice *vdev, u16 queue, u8 event, u32 value, void *cookie)
+{
+    PVIRTIO_TRACE_HEADER trace = vdev->trace;
+    PVIRTIO_TRACE_CPU block;
+    PVIRTIO_TRACE_RECORD record;
+    ULONG cpu, slot;
+
+    if (trace == NULL) {
+        return;
+    }
+    cpu = trace_current_cpu();
+    if (cpu >= trace->NumberOfCpus) {
+        cpu %= trace->NumberOfCpus;
+    }
+    block = VIRTIO_TRACE_CPU_BLOCK(trace, cpu);
+    slot = (ULONG)(InterlockedIncrement(&block->Next) - 1) & (trace->RecordsPerCpu - 1);
+    record = VIRTIO_TRACE_CPU_RECORDS(trace, cpu) + slot;
+
+    record->Timestamp = trace_timestamp();
+    record->Cookie = (ULONGLONG)(ULONG_PTR)cookie;
+    record->Value = value;
+    record->Queue = queue;
+    record->Event = event;
+}
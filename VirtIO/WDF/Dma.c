@@ -37,11 +37,105 @@
 static EVT_WDF_OBJECT_CONTEXT_DESTROY OnDmaTransactionDestroy;
 static EVT_WDF_PROGRAM_DMA            OnDmaTransactionProgramDma;
 
+/* Lookups take the index lock shared so that concurrent address
+ * translations on the data path do not serialize on each other.
+ * Shared spinlocks are not available before Windows 7, there both
+ * flavors fall back to DmaSpinlock. Never nest this lock with DmaSpinlock.
+ */
+static KIRQL DmaIndexLock(PVIRTIO_WDF_DRIVER pWdfDriver, BOOLEAN bExclusive)
+{
+#if NTDDI_VERSION >= NTDDI_WIN7
+    if (bExclusive) {
+        return ExAcquireSpinLockExclusive(&pWdfDriver->DmaIndexLock);
+    }
+    return ExAcquireSpinLockShared(&pWdfDriver->DmaIndexLock);
+#else
+    UNREFERENCED_PARAMETER(bExclusive);
+    WdfSpinLockAcquire(pWdfDriver->DmaSpinlock);
+    return DISPATCH_LEVEL;
+#endif
+}
+
+static void DmaIndexUnlock(PVIRTIO_WDF_DRIVER pWdfDriver, BOOLEAN bExclusive, KIRQL irql)
+{
+#if NTDDI_VERSION >= NTDDI_WIN7
+    if (bExclusive) {
+        ExReleaseSpinLockExclusive(&pWdfDriver->DmaIndexLock, irql);
+    } else {
+        ExReleaseSpinLockShared(&pWdfDriver->DmaIndexLock, irql);
+    }
+#else
+    UNREFERENCED_PARAMETER(bExclusive);
+    UNREFERENCED_PARAMETER(irql);
+    WdfSpinLockRelease(pWdfDriver->DmaSpinlock);
+#endif
+}
+
+#define DMA_INDEX_INITIAL_CAPACITY  32
+
+/* Called at PASSIVE_LEVEL, grows the entry array when it is full */
+static BOOLEAN DmaIndexAdd(PVIRTIO_WDF_DRIVER pWdfDriver, const VIRTIO_WDF_DMA_INDEX_ENTRY *pEntry)
+{
+    PVIRTIO_WDF_DMA_INDEX pIndex = &pWdfDriver->MemoryBlockIndex;
+    while (TRUE) {
+        NTSTATUS status;
+        WDF_OBJECT_ATTRIBUTES attr;
+        WDFMEMORY memory, unused;
+        PVOID buffer;
+        BOOLEAN b;
+        ULONG capacity;
+        KIRQL irql = DmaIndexLock(pWdfDriver, TRUE);
+        if (pIndex->Count < pIndex->Capacity) {
+            b = DmaIndexInsert(pIndex, pEntry);
+            DmaIndexUnlock(pWdfDriver, TRUE, irql);
+            return b;
+        }
+        capacity = pIndex->Capacity ? pIndex->Capacity * 2 : DMA_INDEX_INITIAL_CAPACITY;
+        DmaIndexUnlock(pWdfDriver, TRUE, irql);
+
+        WDF_OBJECT_ATTRIBUTES_INIT(&attr);
+        attr.ParentObject = pWdfDriver->MemoryBlockCollection;
+        status = WdfMemoryCreate(&attr, NonPagedPool, pWdfDriver->MemoryTag,
+            capacity * sizeof(VIRTIO_WDF_DMA_INDEX_ENTRY), &memory, &buffer);
+        if (!NT_SUCCESS(status)) {
+            DPrintf(0, "%s FAILED(%d entries) %X\n", __FUNCTION__, capacity, status);
+            return FALSE;
+        }
+
+        irql = DmaIndexLock(pWdfDriver, TRUE);
+        if (capacity > pIndex->Capacity) {
+            DmaIndexRelocate(pIndex, buffer, capacity);
+            unused = pWdfDriver->MemoryBlockIndexMemory;
+            pWdfDriver->MemoryBlockIndexMemory = memory;
+        } else {
+            /* somebody else has grown the index meanwhile */
+            unused = memory;
+        }
+        DmaIndexUnlock(pWdfDriver, TRUE, irql);
+        if (unused) {
+            WdfObjectDelete(unused);
+        }
+    }
+}
+
+/* Drops the entry of a block found by other means than the index */
+static void DmaIndexForget(PVIRTIO_WDF_DRIVER pWdfDriver, PVIRTIO_WDF_MEMORY_BLOCK_CONTEXT context)
+{
+    PVIRTIO_WDF_DMA_INDEX_ENTRY entry;
+    KIRQL irql = DmaIndexLock(pWdfDriver, TRUE);
+    entry = DmaIndexLookup(&pWdfDriver->MemoryBlockIndex, (ULONG_PTR)context->pVirtualAddress);
+    if (entry && entry->Owner == context->WdfBuffer) {
+        DmaIndexRemove(&pWdfDriver->MemoryBlockIndex, entry);
+    }
+    DmaIndexUnlock(pWdfDriver, TRUE, irql);
+}
+
 static void *AllocateCommonBuffer(PVIRTIO_WDF_DRIVER pWdfDriver, size_t size, ULONG groupTag)
 {
     NTSTATUS status;
     WDFCOMMONBUFFER commonBuffer;
     PVIRTIO_WDF_MEMORY_BLOCK_CONTEXT context;
+    VIRTIO_WDF_DMA_INDEX_ENTRY entry;
     WDF_OBJECT_ATTRIBUTES attr;
     WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attr, VIRTIO_WDF_MEMORY_BLOCK_CONTEXT);
 
@@ -53,13 +147,6 @@ static void *AllocateCommonBuffer(PVIRTIO_WDF_DRIVER pWdfDriver, size_t size, UL
     if (!NT_SUCCESS(status)) {
         return NULL;
     }
-    WdfSpinLockAcquire(pWdfDriver->DmaSpinlock);
-    status = WdfCollectionAdd(pWdfDriver->MemoryBlockCollection, commonBuffer);
-    if (!NT_SUCCESS(status)) {
-        WdfObjectDelete(commonBuffer);
-        WdfSpinLockRelease(pWdfDriver->DmaSpinlock);
-        return NULL;
-    }
     context = GetMemoryBlockContext(commonBuffer);
     context->WdfBuffer = commonBuffer;
     context->Length = size;
@@ -67,9 +154,28 @@ static void *AllocateCommonBuffer(PVIRTIO_WDF_DRIVER pWdfDriver, size_t size, UL
     context->pVirtualAddress = WdfCommonBufferGetAlignedVirtualAddress(commonBuffer);
     context->groupTag = groupTag;
     context->bToBeDeleted = FALSE;
-    WdfSpinLockRelease(pWdfDriver->DmaSpinlock);
     RtlZeroMemory(context->pVirtualAddress, size);
 
+    WdfSpinLockAcquire(pWdfDriver->DmaSpinlock);
+    status = WdfCollectionAdd(pWdfDriver->MemoryBlockCollection, commonBuffer);
+    WdfSpinLockRelease(pWdfDriver->DmaSpinlock);
+    if (!NT_SUCCESS(status)) {
+        WdfObjectDelete(commonBuffer);
+        return NULL;
+    }
+
+    entry.VaStart = (ULONG_PTR)context->pVirtualAddress;
+    entry.VaEnd = entry.VaStart + size;
+    entry.PhysicalAddress = context->PhysicalAddress.QuadPart;
+    entry.Owner = commonBuffer;
+    if (!DmaIndexAdd(pWdfDriver, &entry)) {
+        WdfSpinLockAcquire(pWdfDriver->DmaSpinlock);
+        WdfCollectionRemove(pWdfDriver->MemoryBlockCollection, commonBuffer);
+        WdfSpinLockRelease(pWdfDriver->DmaSpinlock);
+        WdfObjectDelete(commonBuffer);
+        return NULL;
+    }
+
     DPrintf(1, "%s done %p@%I64x(tag %08X), size 0x%x\n", __FUNCTION__,
         context->pVirtualAddress,
         context->PhysicalAddress.QuadPart,
@@ -93,34 +199,25 @@ static BOOLEAN FindCommonBuffer(
 {
     BOOLEAN b = FALSE;
     ULONG_PTR va = (ULONG_PTR)p;
-    ULONG i, n;
+    ULONG n = 0;
     WDFOBJECT obj = NULL;
-    WdfSpinLockAcquire(pWdfDriver->DmaSpinlock);
-    n = WdfCollectionGetCount(pWdfDriver->MemoryBlockCollection);
-    for (i = 0; i < n; ++i) {
-        obj = WdfCollectionGetItem(pWdfDriver->MemoryBlockCollection, i);
-        if (!obj) {
-            break;
-        }
-        PVIRTIO_WDF_MEMORY_BLOCK_CONTEXT context = GetMemoryBlockContext(obj);
-        if (context->bToBeDeleted && !bRemoval) {
-            continue;
-        }
-        ULONG_PTR currentVaStart = (ULONG_PTR)context->pVirtualAddress;
-        if (va >= currentVaStart && va < (currentVaStart + context->Length)) {
-            *ppa = context->PhysicalAddress;
-            *pOffset = va - currentVaStart;
-            b = TRUE;
-            if (bRemoval) {
-                b = *pOffset == 0;
-                if (b) {
-                    context->bToBeDeleted = TRUE;
-                }
+    PVIRTIO_WDF_DMA_INDEX_ENTRY entry;
+    KIRQL irql = DmaIndexLock(pWdfDriver, bRemoval);
+    entry = DmaIndexLookup(&pWdfDriver->MemoryBlockIndex, va);
+    if (entry) {
+        ppa->QuadPart = entry->PhysicalAddress;
+        *pOffset = va - entry->VaStart;
+        b = TRUE;
+        if (bRemoval) {
+            b = *pOffset == 0;
+            if (b) {
+                obj = entry->Owner;
+                DmaIndexRemove(&pWdfDriver->MemoryBlockIndex, entry);
+                n = pWdfDriver->MemoryBlockIndex.Count;
             }
-            break;
         }
     }
-    WdfSpinLockRelease(pWdfDriver->DmaSpinlock);
+    DmaIndexUnlock(pWdfDriver, bRemoval, irql);
     if (!b) {
         DPrintf(0, "%s(%s) FAILED!\n", __FUNCTION__, bRemoval ? "Remove" : "Locate");
     }
@@ -132,9 +229,12 @@ static BOOLEAN FindCommonBuffer(
             WdfSpinLockRelease(pWdfDriver->DmaSpinlock);
 
             WdfObjectDelete(obj);
-            DPrintf(1, "%s %p freed (%d common buffers)\n", __FUNCTION__, va, n - 1);
+            DPrintf(1, "%s %p freed (%d common buffers)\n", __FUNCTION__, va, n);
         }
         else {
+            /* already gone from the index, stays in the collection until
+             * the device goes away or its tag is freed */
+            GetMemoryBlockContext(obj)->bToBeDeleted = TRUE;
             DPrintf(0, "%s %p marked for deletion\n", __FUNCTION__, va);
         }
     }
@@ -190,6 +290,9 @@ static BOOLEAN FindCommonBufferByTag(
     if (b) {
         DPrintf(1, "%s %p (tag %08X) freed (%d common buffers)\n", __FUNCTION__,
             context->pVirtualAddress, tag, n - 1);
+        if (!context->bToBeDeleted) {
+            DmaIndexForget(pWdfDriver, context);
+        }
         WdfSpinLockAcquire(pWdfDriver->DmaSpinlock);
         WdfCollectionRemove(pWdfDriver->MemoryBlockCollection, obj);
         WdfSpinLockRelease(pWdfDriver->DmaSpinlock);
@@ -219,12 +322,94 @@ static void FreeSlicedBlock(PVIRTIO_DMA_MEMORY_SLICED p)
 {
     size_t offset;
     FindCommonBuffer(p->drv, p->va, &p->pa, &offset, TRUE);
+    if (p->magazines) {
+        ExFreePoolWithTag(p->magazines, p->drv->MemoryTag);
+    }
     ExFreePoolWithTag(p, p->drv->MemoryTag);
 }
 
+/* Must be called at DISPATCH_LEVEL, returns NULL if magazines are off */
+static PVIRTIO_DMA_SLICE_MAGAZINE CurrentMagazine(PVIRTIO_DMA_MEMORY_SLICED p)
+{
+#if NTDDI_VERSION >= NTDDI_WIN7
+    ULONG cpu = KeGetCurrentProcessorNumberEx(NULL);
+#else
+    ULONG cpu = KeGetCurrentProcessorNumber();
+#endif
+    if (cpu >= p->nMagazines) {
+        return NULL;
+    }
+    return &p->magazines[cpu];
+}
+
+/* Called under p->lock */
+static void ReturnSliceToBitmap(PVIRTIO_DMA_MEMORY_SLICED p, ULONG index)
+{
+    if (!RtlTestBit(&p->bitmap, index)) {
+        DPrintf(0, "%s: bit %d is NOT set\n", __FUNCTION__, index);
+        return;
+    }
+    RtlClearBit(&p->bitmap, index);
+}
+
+/* Called under p->lock when the bitmap is exhausted: the free slices
+ * cached by all CPUs go back to the bitmap, so a CPU never fails
+ * while free slices sit in magazines. Returns the index of a slice or
+ * MAXULONG */
+static ULONG DrainMagazines(PVIRTIO_DMA_MEMORY_SLICED p)
+{
+    ULONG i;
+
+    for (i = 0; i < p->nMagazines; i++) {
+        PVIRTIO_DMA_SLICE_MAGAZINE mag = &p->magazines[i];
+        KeAcquireSpinLockAtDpcLevel(&mag->lock);
+        while (mag->count) {
+            ReturnSliceToBitmap(p, mag->index[--mag->count]);
+        }
+        KeReleaseSpinLockFromDpcLevel(&mag->lock);
+    }
+    return RtlFindClearBitsAndSet(&p->bitmap, 1, 0);
+}
+
+/* Lock order: p->lock, then the lock of a magazine */
 static PVOID AllocateSlice(PVIRTIO_DMA_MEMORY_SLICED p, PHYSICAL_ADDRESS *ppa)
 {
-    ULONG offset, index = RtlFindClearBitsAndSet(&p->bitmap, 1, 0);
+    ULONG offset, index = MAXULONG;
+    PVIRTIO_DMA_SLICE_MAGAZINE mag;
+    KIRQL irql;
+
+    KeRaiseIrql(DISPATCH_LEVEL, &irql);
+    mag = CurrentMagazine(p);
+    if (mag) {
+        KeAcquireSpinLockAtDpcLevel(&mag->lock);
+        if (mag->count) {
+            index = mag->index[--mag->count];
+        }
+        KeReleaseSpinLockFromDpcLevel(&mag->lock);
+    }
+    if (index == MAXULONG) {
+        KeAcquireSpinLockAtDpcLevel(&p->lock);
+        index = RtlFindClearBitsAndSet(&p->bitmap, 1, 0);
+        if (index >= p->bitmap.SizeOfBitMap && p->nMagazines) {
+            /* the slices are scarce, do not cache them again */
+            index = DrainMagazines(p);
+        } else if (mag && index < p->bitmap.SizeOfBitMap) {
+            /* refill the magazine up to the half, so that the next
+             * returns have room without going back to the bitmap */
+            KeAcquireSpinLockAtDpcLevel(&mag->lock);
+            while (mag->count < p->magazineSize / 2) {
+                ULONG cached = RtlFindClearBitsAndSet(&p->bitmap, 1, index);
+                if (cached >= p->bitmap.SizeOfBitMap) {
+                    break;
+                }
+                mag->index[mag->count++] = cached;
+            }
+            KeReleaseSpinLockFromDpcLevel(&mag->lock);
+        }
+        KeReleaseSpinLockFromDpcLevel(&p->lock);
+    }
+    KeLowerIrql(irql);
+
     if (index >= p->bitmap.SizeOfBitMap) {
         return NULL;
     }
@@ -235,10 +420,17 @@ static PVOID AllocateSlice(PVIRTIO_DMA_MEMORY_SLICED p, PHYSICAL_ADDRESS *ppa)
 
 static void FreeSlice(PVIRTIO_DMA_MEMORY_SLICED p, PVOID va)
 {
-    PHYSICAL_ADDRESS pa;
-    size_t offset;
-    if (!FindCommonBuffer(p->drv, va, &pa, &offset, FALSE)) {
-        DPrintf(0, "%s: block with va %p not found\n", __FUNCTION__, va);
+    PVIRTIO_DMA_SLICE_MAGAZINE mag;
+    ULONG_PTR offset = (ULONG_PTR)va - (ULONG_PTR)p->va;
+    ULONG index;
+    BOOLEAN cached = FALSE;
+    KIRQL irql;
+
+    /* the slice index comes straight from the address, the block
+     * is contiguous and the index lookup is not needed */
+    if ((ULONG_PTR)va < (ULONG_PTR)p->va ||
+        offset >= (ULONG_PTR)p->slice * p->bitmap.SizeOfBitMap) {
+        DPrintf(0, "%s: va %p does not belong to block %p\n", __FUNCTION__, va, p->va);
         return;
     }
     if (offset % p->slice) {
@@ -246,12 +438,32 @@ static void FreeSlice(PVIRTIO_DMA_MEMORY_SLICED p, PVOID va)
             (ULONG)offset, p->slice);
         return;
     }
-    ULONG index = (ULONG)(offset / p->slice);
-    if (!RtlTestBit(&p->bitmap, index)) {
-        DPrintf(0, "%s: bit %d is NOT set\n", __FUNCTION__, index);
-        return;
+    index = (ULONG)(offset / p->slice);
+
+    KeRaiseIrql(DISPATCH_LEVEL, &irql);
+    mag = CurrentMagazine(p);
+    if (mag) {
+        KeAcquireSpinLockAtDpcLevel(&mag->lock);
+        if (mag->count < p->magazineSize) {
+            mag->index[mag->count++] = index;
+            cached = TRUE;
+        }
+        KeReleaseSpinLockFromDpcLevel(&mag->lock);
     }
-    RtlClearBit(&p->bitmap, index);
+    if (!cached) {
+        KeAcquireSpinLockAtDpcLevel(&p->lock);
+        ReturnSliceToBitmap(p, index);
+        if (mag) {
+            /* flush the full magazine down to the half */
+            KeAcquireSpinLockAtDpcLevel(&mag->lock);
+            while (mag->count > p->magazineSize / 2) {
+                ReturnSliceToBitmap(p, mag->index[--mag->count]);
+            }
+            KeReleaseSpinLockFromDpcLevel(&mag->lock);
+        }
+        KeReleaseSpinLockFromDpcLevel(&p->lock);
+    }
+    KeLowerIrql(irql);
 }
 
 PVIRTIO_DMA_MEMORY_SLICED VirtIOWdfDeviceAllocDmaMemorySliced(
@@ -261,6 +473,7 @@ PVIRTIO_DMA_MEMORY_SLICED VirtIOWdfDeviceAllocDmaMemorySliced(
 {
     PVIRTIO_WDF_DRIVER pWdfDriver = vdev->DeviceContext;
     size_t allocSize = sizeof(VIRTIO_DMA_MEMORY_SLICED) + (blockSize / sliceSize) / 8 + sizeof(ULONG);
+    ULONG nSlices = (ULONG)blockSize / sliceSize, nCPUs;
     PVIRTIO_DMA_MEMORY_SLICED p = ExAllocatePoolWithTag(NonPagedPool, allocSize, pWdfDriver->MemoryTag);
     if (!p) {
         return NULL;
@@ -274,7 +487,36 @@ PVIRTIO_DMA_MEMORY_SLICED VirtIOWdfDeviceAllocDmaMemorySliced(
     }
     p->slice = sliceSize;
     p->drv = pWdfDriver;
-    RtlInitializeBitMap(&p->bitmap, p->bitmap_buffer, (ULONG)blockSize / sliceSize);
+    KeInitializeSpinLock(&p->lock);
+    RtlInitializeBitMap(&p->bitmap, p->bitmap_buffer, nSlices);
+
+#if NTDDI_VERSION >= NTDDI_WIN7
+    nCPUs = KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+#elif NTDDI_VERSION >= NTDDI_VISTA
+    nCPUs = KeQueryMaximumProcessorCount();
+#else
+    nCPUs = (ULONG)KeNumberProcessors;
+#endif
+    nCPUs = max(1, nCPUs);
+    /* the magazines together may hold at most half of the slices, so
+     * that draining them on exhaustion stays rare */
+    p->magazineSize = min(VIRTIO_DMA_SLICE_MAGAZINE_SIZE, nSlices / (2 * nCPUs));
+    if (p->magazineSize >= 2) {
+        /* one cache line per CPU, the lines must not be shared */
+        p->magazines = ExAllocatePoolWithTag(NonPagedPoolCacheAligned,
+            nCPUs * sizeof(VIRTIO_DMA_SLICE_MAGAZINE), pWdfDriver->MemoryTag);
+    }
+    if (p->magazines) {
+        ULONG i;
+        RtlZeroMemory(p->magazines, nCPUs * sizeof(VIRTIO_DMA_SLICE_MAGAZINE));
+        for (i = 0; i < nCPUs; i++) {
+            KeInitializeSpinLock(&p->magazines[i].lock);
+        }
+        p->nMagazines = nCPUs;
+    }
+    DPrintf(1, "%s %d slices of %d, %d magazines of %d\n", __FUNCTION__,
+        nSlices, sliceSize, p->nMagazines, p->magazineSize);
+
     p->return_slice = FreeSlice;
     p->get_slice = AllocateSlice;
     p->destroy   = FreeSlicedBlock;
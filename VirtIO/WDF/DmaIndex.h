@@ -0,0 +1,112 @@
+/*
+ * Address-ordered index of DMA common buffers
+ *
+ * Copyright (c) 2016-2017 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met :
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and / or other materials provided with the distribution.
+ * 3. Neither the names of the copyright holders nor the names of their contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#pragma once
+
+/* Common buffers never overlap, so an array sorted by start address is
+ * enough to resolve any address inside a block with a binary search.
+ * The index does not allocate and does not lock, the owner provides the
+ * entry array (see Dma.c) and the synchronization. It only depends on
+ * the basic Windows types so the user-mode benchmark can include it too.
+ */
+typedef struct virtio_wdf_dma_index_entry {
+    ULONG_PTR           VaStart;
+    ULONG_PTR           VaEnd;          /* exclusive */
+    ULONGLONG           PhysicalAddress;
+    PVOID               Owner;
+} VIRTIO_WDF_DMA_INDEX_ENTRY, *PVIRTIO_WDF_DMA_INDEX_ENTRY;
+
+typedef struct virtio_wdf_dma_index {
+    PVIRTIO_WDF_DMA_INDEX_ENTRY Entries;
+    ULONG                       Count;
+    ULONG                       Capacity;
+} VIRTIO_WDF_DMA_INDEX, *PVIRTIO_WDF_DMA_INDEX;
+
+/* Returns the number of entries starting at or below va */
+static __inline ULONG DmaIndexUpperBound(const VIRTIO_WDF_DMA_INDEX *pIndex, ULONG_PTR va)
+{
+    ULONG lo = 0, hi = pIndex->Count;
+    while (lo < hi) {
+        ULONG mid = lo + (hi - lo) / 2;
+        if (pIndex->Entries[mid].VaStart <= va) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static __inline PVIRTIO_WDF_DMA_INDEX_ENTRY DmaIndexLookup(const VIRTIO_WDF_DMA_INDEX *pIndex, ULONG_PTR va)
+{
+    ULONG i = DmaIndexUpperBound(pIndex, va);
+    if (i && va < pIndex->Entries[i - 1].VaEnd) {
+        return &pIndex->Entries[i - 1];
+    }
+    return NULL;
+}
+
+/* Fails if the index is full or the range overlaps an existing entry */
+static __inline BOOLEAN DmaIndexInsert(PVIRTIO_WDF_DMA_INDEX pIndex, const VIRTIO_WDF_DMA_INDEX_ENTRY *pEntry)
+{
+    ULONG i;
+    if (pIndex->Count >= pIndex->Capacity || pEntry->VaEnd <= pEntry->VaStart) {
+        return FALSE;
+    }
+    i = DmaIndexUpperBound(pIndex, pEntry->VaStart);
+    if (i && pIndex->Entries[i - 1].VaEnd > pEntry->VaStart) {
+        return FALSE;
+    }
+    if (i < pIndex->Count && pIndex->Entries[i].VaStart < pEntry->VaEnd) {
+        return FALSE;
+    }
+    RtlMoveMemory(&pIndex->Entries[i + 1], &pIndex->Entries[i],
+        (pIndex->Count - i) * sizeof(pIndex->Entries[0]));
+    pIndex->Entries[i] = *pEntry;
+    pIndex->Count++;
+    return TRUE;
+}
+
+/* pEntry must be a pointer returned by DmaIndexLookup under the same lock */
+static __inline void DmaIndexRemove(PVIRTIO_WDF_DMA_INDEX pIndex, PVIRTIO_WDF_DMA_INDEX_ENTRY pEntry)
+{
+    ULONG i = (ULONG)(pEntry - pIndex->Entries);
+    RtlMoveMemory(&pIndex->Entries[i], &pIndex->Entries[i + 1],
+        (pIndex->Count - i - 1) * sizeof(pIndex->Entries[0]));
+    pIndex->Count--;
+}
+
+/* Moves the index to a larger entry array, the caller frees the old one */
+static __inline void DmaIndexRelocate(PVIRTIO_WDF_DMA_INDEX pIndex, PVIRTIO_WDF_DMA_INDEX_ENTRY pEntries, ULONG Capacity)
+{
+    if (pIndex->Count) {
+        RtlCopyMemory(pEntries, pIndex->Entries, pIndex->Count * sizeof(pIndex->Entries[0]));
+    }
+    pIndex->Entries = pEntries;
+    pIndex->Capacity = Capacity;
+}
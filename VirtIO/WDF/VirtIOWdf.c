@@ -134,6 +134,9 @@ NTSTATUS VirtIOWdfSetDriverFeatures(PVIRTIO_WDF_DRIVER pWdfDriver,
     if (virtio_is_feature_enabled(uDeviceFeatures, VIRTIO_F_IOMMU_PLATFORM)) {
         virtio_feature_enable(uFeatures, VIRTIO_F_IOMMU_PLATFORM);
     }
+    if (virtio_is_feature_enabled(uDeviceFeatures, VIRTIO_F_NOTIFICATION_DATA)) {
+        virtio_feature_enable(uFeatures, VIRTIO_F_NOTIFICATION_DATA);
+    }
 
     if ((uDeviceFeatures & uPrivateFeaturesOn) != uPrivateFeaturesOn) {
         DPrintf(0, "%s(%s) FAILED features %I64X != %I64X\n", __FUNCTION__,
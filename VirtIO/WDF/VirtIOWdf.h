@@ -33,6 +33,7 @@
 
 #include <wdf.h>
 #include "virtio_pci.h"
+#include "DmaIndex.h"
 
 /* Configures a virtqueue, see VirtIOWdfInitQueues. */
 typedef struct virtio_wdf_queue_param {
@@ -61,6 +62,11 @@ typedef struct virtio_wdf_driver {
     WDFDMAENABLER           DmaEnabler;
     WDFCOLLECTION           MemoryBlockCollection;
     WDFSPINLOCK             DmaSpinlock;
+    /* address lookup for the blocks in MemoryBlockCollection,
+     * DmaIndexLock is an EX_SPIN_LOCK on Windows 7 and up */
+    VIRTIO_WDF_DMA_INDEX    MemoryBlockIndex;
+    WDFMEMORY               MemoryBlockIndexMemory;
+    volatile LONG           DmaIndexLock;
     BOOLEAN                 bLegacyMode;
     
 } VIRTIO_WDF_DRIVER, *PVIRTIO_WDF_DRIVER;
@@ -89,9 +95,12 @@ NTSTATUS VirtIOWdfInitialize(PVIRTIO_WDF_DRIVER pWdfDriver,
  * the same features are automatically negotiated.
  * If the driver does not have any specific requirements for features
  * it may skip call to VirtIOWdfSetDriverFeatures, then features
- * VIRTIO_F_VERSION_1, VIRTIO_F_ANY_LAYOUT, VIRTIO_F_IOMMU_PLATFORM
- * are negotiated automatically according to device deatures upon
+ * VIRTIO_F_VERSION_1, VIRTIO_F_ANY_LAYOUT, VIRTIO_F_IOMMU_PLATFORM,
+ * VIRTIO_F_NOTIFICATION_DATA are negotiated automatically according to device deatures upon
  * call to VirtIOWdfInitQueues or VirtIOWdfInitQueuesCB
+ * VIRTIO_F_IN_ORDER is never negotiated automatically. A driver may pass it in
+ * uPrivateFeaturesOn when the device offers it, and only if it detaches unused
+ * buffers (virtqueue_detach_unused_buf) after the device has been reset.
  */
 ULONGLONG VirtIOWdfGetDeviceFeatures(PVIRTIO_WDF_DRIVER pWdfDriver);
 NTSTATUS VirtIOWdfSetDriverFeatures(PVIRTIO_WDF_DRIVER pWdfDriver,
@@ -201,6 +210,12 @@ BOOLEAN VirtIOWdfDeviceDmaTxAsync(VirtIODevice *vdev,
 /* <= DISPATCH transaction = VIRTIO_DMA_TRANSACTION_PARAMS.transaction */
 void VirtIOWdfDeviceDmaTxComplete(VirtIODevice *vdev, WDFDMATRANSACTION transaction);
 
+/* Common buffer carved into fixed-size slices. get_slice and return_slice
+ * may be called concurrently at IRQL <= DISPATCH without any external lock:
+ * each CPU keeps a small magazine of free slices and only goes to the
+ * shared bitmap when its magazine runs empty or full. get_slice fails only
+ * after the magazines of all CPUs were drained back into the bitmap.
+ */
 typedef struct virtio_dma_memory_sliced
 {
     PVOID                (*get_slice)(struct virtio_dma_memory_sliced *, PHYSICAL_ADDRESS *ppa);
@@ -210,6 +225,10 @@ typedef struct virtio_dma_memory_sliced
     PHYSICAL_ADDRESS     pa;
     PVIRTIO_WDF_DRIVER   drv;
     PVOID                va;
+    KSPIN_LOCK           lock;
+    struct virtio_dma_slice_magazine *magazines;
+    ULONG                nMagazines;
+    ULONG                magazineSize;
     RTL_BITMAP           bitmap;
     ULONG                slice;
     ULONG                bitmap_buffer[1];
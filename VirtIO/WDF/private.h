@@ -83,6 +83,18 @@ typedef struct virtio_wdf_memory_block_context {
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(VIRTIO_WDF_MEMORY_BLOCK_CONTEXT, GetMemoryBlockContext)
 
+/* Per-CPU cache of free slice indices of a VIRTIO_DMA_MEMORY_SLICED,
+ * one cache line each. Touched at DISPATCH_LEVEL under its own lock, which
+ * only its CPU takes, except when a starving CPU drains all magazines.
+ */
+#define VIRTIO_DMA_SLICE_MAGAZINE_SIZE  13
+
+typedef struct DECLSPEC_CACHEALIGN virtio_dma_slice_magazine {
+    KSPIN_LOCK          lock;
+    ULONG               count;
+    ULONG               index[VIRTIO_DMA_SLICE_MAGAZINE_SIZE];
+} VIRTIO_DMA_SLICE_MAGAZINE, *PVIRTIO_DMA_SLICE_MAGAZINE;
+
 typedef struct virtio_wdf_dma_transaction_context {
     VIRTIO_DMA_TRANSACTION_PARAMS   parameters;
     VirtIOWdfDmaTransactionCallback callback;
@@ -0,0 +1,252 @@
+// dma-index-bench.cpp : checks DmaIndex.h against a linear reference and
+// compares lookup cost with the collection scan it replaced in Dma.c.
+//
+// Blocks are laid out at random page-aligned addresses with random sizes,
+// lookups hit random offsets inside random blocks, as GetPhysicalAddress
+// and FreeSlice do.
+//
+// Windows: built by dma-index-bench.vcxproj.
+// Linux: g++ -O2 -I.. dma-index-bench.cpp
+//
+// Usage: dma-index-bench [-b blocks] [-n lookups] [-s seed]
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+typedef unsigned long ULONG;
+typedef uintptr_t ULONG_PTR;
+typedef unsigned long long ULONGLONG;
+typedef void * PVOID;
+typedef unsigned char BOOLEAN;
+#define TRUE 1
+#define FALSE 0
+#define __inline inline
+#define RtlMoveMemory(d, s, l) memmove((d), (s), (l))
+#define RtlCopyMemory(d, s, l) memcpy((d), (s), (l))
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "DmaIndex.h"
+
+#define PAGE_SIZE 4096
+
+struct BENCH_CONFIG
+{
+    ULONG blocks;
+    ULONG lookups;
+    ULONG seed;
+};
+
+// Stand-in for the memory block contexts that FindCommonBuffer used to walk
+struct BLOCK
+{
+    ULONG_PTR va;
+    size_t length;
+    ULONGLONG pa;
+    BOOLEAN toBeDeleted;
+};
+
+static ULONG Random(ULONGLONG * state)
+{
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (ULONG)(*state >> 33);
+}
+
+static double Seconds()
+{
+#ifdef _WIN32
+    LARGE_INTEGER now, freq;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&freq);
+    return (double)now.QuadPart / freq.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+#endif
+}
+
+// Same walk as the original FindCommonBuffer for a lookup
+static const BLOCK * LinearFind(const BLOCK * blocks, ULONG n, ULONG_PTR va)
+{
+    for (ULONG i = 0; i < n; ++i)
+    {
+        if (blocks[i].toBeDeleted)
+            continue;
+        if (va >= blocks[i].va && va < blocks[i].va + blocks[i].length)
+            return &blocks[i];
+    }
+    return NULL;
+}
+
+static bool ParseArgs(int argc, char ** argv, BENCH_CONFIG * config)
+{
+    config->blocks = 256;
+    config->lookups = 4000000;
+    config->seed = 1;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (i + 1 >= argc)
+            return false;
+        ULONG value = (ULONG)strtoul(argv[i + 1], NULL, 0);
+        if (!strcmp(argv[i], "-b"))
+            config->blocks = value;
+        else if (!strcmp(argv[i], "-n"))
+            config->lookups = value;
+        else if (!strcmp(argv[i], "-s"))
+            config->seed = value;
+        else
+            return false;
+        ++i;
+    }
+    return config->blocks > 0 && config->lookups > 0;
+}
+
+int main(int argc, char ** argv)
+{
+    BENCH_CONFIG config;
+    if (!ParseArgs(argc, argv, &config))
+    {
+        printf("Usage: %s [-b blocks] [-n lookups] [-s seed]\n", argv[0]);
+        return 1;
+    }
+
+    ULONGLONG state = config.seed;
+    BLOCK * blocks = (BLOCK *)calloc(config.blocks, sizeof(BLOCK));
+    ULONG_PTR * probes = (ULONG_PTR *)malloc(config.lookups * sizeof(ULONG_PTR));
+    VIRTIO_WDF_DMA_INDEX index;
+    memset(&index, 0, sizeof(index));
+    index.Capacity = config.blocks;
+    index.Entries = (PVIRTIO_WDF_DMA_INDEX_ENTRY)malloc(config.blocks * sizeof(VIRTIO_WDF_DMA_INDEX_ENTRY));
+    if (!blocks || !probes || !index.Entries)
+    {
+        printf("Out of memory\n");
+        return 1;
+    }
+
+    // disjoint blocks of 1..16 pages in a shuffled order with gaps between them
+    ULONG_PTR next = (ULONG_PTR)0x10000000;
+    for (ULONG i = 0; i < config.blocks; ++i)
+    {
+        blocks[i].length = (size_t)(1 + Random(&state) % 16) * PAGE_SIZE;
+        blocks[i].va = next;
+        blocks[i].pa = 0x100000000ULL + (ULONGLONG)i * 0x100000;
+        next += blocks[i].length + (ULONG_PTR)(Random(&state) % 4) * PAGE_SIZE;
+    }
+    for (ULONG i = config.blocks - 1; i > 0; --i)
+    {
+        ULONG j = Random(&state) % (i + 1);
+        BLOCK tmp = blocks[i];
+        blocks[i] = blocks[j];
+        blocks[j] = tmp;
+    }
+
+    ULONG errors = 0;
+    for (ULONG i = 0; i < config.blocks; ++i)
+    {
+        VIRTIO_WDF_DMA_INDEX_ENTRY entry;
+        entry.VaStart = blocks[i].va;
+        entry.VaEnd = blocks[i].va + blocks[i].length;
+        entry.PhysicalAddress = blocks[i].pa;
+        entry.Owner = &blocks[i];
+        if (!DmaIndexInsert(&index, &entry))
+            ++errors;
+        // an overlapping range must be refused
+        entry.VaStart += PAGE_SIZE / 2;
+        entry.VaEnd += PAGE_SIZE / 2;
+        if (DmaIndexInsert(&index, &entry))
+            ++errors;
+    }
+
+    for (ULONG i = 0; i < config.lookups; ++i)
+    {
+        const BLOCK * b = &blocks[Random(&state) % config.blocks];
+        probes[i] = b->va + Random(&state) % (b->length + PAGE_SIZE);
+    }
+
+    // correctness: every probe resolves to the same block both ways
+    ULONG misses = 0;
+    for (ULONG i = 0; i < config.lookups && i < 100000; ++i)
+    {
+        const BLOCK * expected = LinearFind(blocks, config.blocks, probes[i]);
+        PVIRTIO_WDF_DMA_INDEX_ENTRY found = DmaIndexLookup(&index, probes[i]);
+        if ((found ? (const BLOCK *)found->Owner : NULL) != expected)
+            ++errors;
+        if (!expected)
+            ++misses;
+    }
+
+    // remove every other block and check again
+    for (ULONG i = 0; i < config.blocks; i += 2)
+    {
+        PVIRTIO_WDF_DMA_INDEX_ENTRY found = DmaIndexLookup(&index, blocks[i].va);
+        if (!found || found->Owner != &blocks[i])
+        {
+            ++errors;
+            continue;
+        }
+        DmaIndexRemove(&index, found);
+        blocks[i].toBeDeleted = TRUE;
+    }
+    for (ULONG i = 0; i < config.lookups && i < 100000; ++i)
+    {
+        const BLOCK * expected = LinearFind(blocks, config.blocks, probes[i]);
+        PVIRTIO_WDF_DMA_INDEX_ENTRY found = DmaIndexLookup(&index, probes[i]);
+        if ((found ? (const BLOCK *)found->Owner : NULL) != expected)
+            ++errors;
+    }
+    for (ULONG i = 0; i < config.blocks; i += 2)
+    {
+        VIRTIO_WDF_DMA_INDEX_ENTRY entry;
+        entry.VaStart = blocks[i].va;
+        entry.VaEnd = blocks[i].va + blocks[i].length;
+        entry.PhysicalAddress = blocks[i].pa;
+        entry.Owner = &blocks[i];
+        if (!DmaIndexInsert(&index, &entry))
+            ++errors;
+        blocks[i].toBeDeleted = FALSE;
+    }
+
+    // timing, the checksum keeps the compiler from dropping the lookups
+    ULONGLONG sum = 0;
+    double start = Seconds();
+    for (ULONG i = 0; i < config.lookups; ++i)
+    {
+        const BLOCK * b = LinearFind(blocks, config.blocks, probes[i]);
+        if (b)
+            sum += b->pa + (probes[i] - b->va);
+    }
+    double linear = Seconds() - start;
+
+    ULONGLONG sumIndex = 0;
+    start = Seconds();
+    for (ULONG i = 0; i < config.lookups; ++i)
+    {
+        PVIRTIO_WDF_DMA_INDEX_ENTRY e = DmaIndexLookup(&index, probes[i]);
+        if (e)
+            sumIndex += e->PhysicalAddress + (probes[i] - e->VaStart);
+    }
+    double indexed = Seconds() - start;
+
+    if (sum != sumIndex)
+        ++errors;
+
+    printf("%lu blocks, %lu lookups (%lu%% outside any block)\n",
+        (unsigned long)config.blocks, (unsigned long)config.lookups,
+        (unsigned long)(misses * 100ULL / (config.lookups < 100000 ? config.lookups : 100000)));
+    printf("linear scan: %8.2f ns/lookup\n", linear * 1e9 / config.lookups);
+    printf("index:       %8.2f ns/lookup\n", indexed * 1e9 / config.lookups);
+    printf("%lu errors\n", (unsigned long)errors);
+
+    free(index.Entries);
+    free(probes);
+    free(blocks);
+    return errors ? 1 : 0;
+}
@@ -46,11 +46,11 @@
 /* virtio library features bits */
 
 
-/* Some virtio feature bits (currently bits 28 through 31) are reserved for the
+/* Some virtio feature bits (currently bits 28 through 41) are reserved for the
  * transport being used (eg. virtio_ring), the rest are per-device feature
  * bits. */
 #define VIRTIO_TRANSPORT_F_START        28
-#define VIRTIO_TRANSPORT_F_END          32
+#define VIRTIO_TRANSPORT_F_END          42
 
 /* Do we get callbacks when the ring is completely used, even if we've
  * suppressed them? */
@@ -67,6 +67,22 @@
 /* This feature indicates support for the packed virtqueue layout. */
 #define VIRTIO_F_RING_PACKED            34
 
+/* The device uses buffers in the same order in which they have been made
+ * available and may report a batch of them with a single used element. */
+#define VIRTIO_F_IN_ORDER               35
+
+/* The driver passes the next available position with each notification,
+ * so the device does not need to read the avail ring index on a kick. */
+#define VIRTIO_F_NOTIFICATION_DATA      38
+
+/* The 32-bit notification value: vqn in bits 0-15, next_off in bits 16-30,
+ * next_wrap in bit 31. For split rings next_off and next_wrap together
+ * are the 16-bit avail index. */
+#define VIRTIO_NOTIFICATION_DATA(vqn, next_off, next_wrap) \
+    ((unsigned long)(unsigned short)(vqn) | \
+     ((unsigned long)((next_off) & 0x7fff) << 16) | \
+     ((unsigned long)((next_wrap) ? 1 : 0) << 31))
+
 // if this number is not equal to desc size, queue creation fails
 #define SIZE_OF_SINGLE_INDIRECT_DESC    16
 
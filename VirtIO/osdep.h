@@ -17,6 +17,7 @@
 #include <ntddk.h>
 
 #define ENOSPC 1
+#define EINVAL 2
 
 #if !defined(__cplusplus) && !defined(bool)
 // Important note: in MSFT C++ bool length is 1 bytes
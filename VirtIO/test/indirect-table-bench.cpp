@@ -0,0 +1,626 @@
+// indirect-table-bench.cpp : compares the two ways the library fills
+// indirect descriptor tables, measuring the bytes and cache lines written
+// into the table per request and the time it takes.
+//
+// "rewrite" submits with virtqueue_add_buf and an indirect area, which
+// builds the whole table for every request. "table" submits with
+// virtqueue_add_buf_table through a table prepared once per slot by
+// virtqueue_init_indirect_table. Both run the library itself: VirtIORing.c,
+// VirtIORing-Packed.c and VirtIOPCICommon.c are built into the benchmark
+// (see ntddk.h in this directory), on a split and on a packed queue in real
+// ring memory. A device side takes every request off the ring, walks its
+// indirect table and returns it, the walk must yield the same buffer list
+// for both methods.
+//
+// The bytes written are found with a twin queue that gets the same
+// requests while its tables hold the bitwise complement of the tables of
+// the first queue. A byte the library wrote is the same in both afterwards,
+// every other byte differs.
+//
+// Request shapes: blk (header + data + status byte), scsi (request + data
+// + response) and net (virtio-net header + fragments, no tail).
+//
+// Windows: built by indirect-table-bench.vcxproj.
+//
+// Usage: indirect-table-bench [-n requests] [-d max data entries] [-s seed]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// only types and macros, kept out of the extern "C" block for Windows.h
+#include "ntddk.h"
+
+extern "C" {
+#include "osdep.h"
+#include "virtio_pci.h"
+#include "VirtIO.h"
+#include "kdebugprint.h"
+#include "virtio_ring.h"
+#include "virtio_pci_common.h"
+#include "windows\virtio_ring_allocation.h"
+}
+
+#define DESC_F_NEXT     1
+#define DESC_F_WRITE    2
+#define DESC_F_INDIRECT 4
+#define DESC_F_AVAIL    (1 << 7)
+#define DESC_F_USED     (1 << 15)
+
+#define RING_SIZE       16
+#define TABLE_ENTRIES   256
+#define TABLE_BYTES     (TABLE_ENTRIES * 16)
+#define LINE_BYTES      64
+
+// virtq_desc and pvirtq_desc of the virtio spec, as the device reads them
+struct DEVICE_SPLIT_DESC
+{
+    ULONGLONG addr;
+    ULONG len;
+    USHORT flags;
+    USHORT next;
+};
+
+struct DEVICE_PACKED_DESC
+{
+    ULONGLONG addr;
+    ULONG len;
+    USHORT id;
+    USHORT flags;
+};
+
+struct SHAPE
+{
+    const char * name;
+    ULONG headLen;              // 0 when there is no head entry
+    ULONG tailLen;              // 0 when there is no tail entry
+    bool dataIn;                // reads: the data is device-writable
+};
+
+struct BENCH_CONFIG
+{
+    unsigned int requests;
+    unsigned int maxData;
+    unsigned int seed;
+};
+
+struct BENCH_RESULT
+{
+    unsigned long long bytes;
+    unsigned long long lines;
+    double seconds;
+};
+
+// What the device sees: the flattened buffer list
+struct WALK
+{
+    unsigned int n;
+    ULONGLONG pa[TABLE_ENTRIES];
+    ULONG len[TABLE_ENTRIES];
+    bool write[TABLE_ENTRIES];
+};
+
+struct BENCH_QUEUE
+{
+    bool packed;
+    void * pages;
+    void * control;
+    struct virtqueue * vq;
+    // device side: next avail entry (split) or descriptor (packed)
+    USHORT next;
+    bool wrap;
+    // one indirect area per slot for each method
+    UCHAR * rewrite[RING_SIZE];
+    UCHAR * slot[RING_SIZE];
+    struct virtqueue_indirect_table table[RING_SIZE];
+};
+
+static const unsigned long RingAlign = SMP_CACHE_BYTES;
+
+// kdebugprint.h, no debug output in the benchmark
+int virtioDebugLevel;
+int bDebugPrint;
+tDebugPrintFunc VirtioDebugPrintProc;
+
+// VirtIOPCICommon.c references the transports and the trace, the benchmark
+// builds its queues itself and never enables tracing
+NTSTATUS vio_legacy_initialize(VirtIODevice *)
+{
+    return STATUS_DEVICE_NOT_CONNECTED;
+}
+
+NTSTATUS vio_modern_initialize(VirtIODevice *)
+{
+    return STATUS_DEVICE_NOT_CONNECTED;
+}
+
+void virtio_trace_event(VirtIODevice *, u16, u8, u32, void *)
+{
+}
+
+// the device is polled, the queues are never kicked
+static void NoNotify(struct virtqueue *)
+{
+}
+
+static unsigned int Random(unsigned long long * state)
+{
+    *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (unsigned int)(*state >> 33);
+}
+
+static double Seconds()
+{
+    LARGE_INTEGER now, freq;
+    QueryPerformanceCounter(&now);
+    QueryPerformanceFrequency(&freq);
+    return (double)now.QuadPart / freq.QuadPart;
+}
+
+static void QueueDestroy(BENCH_QUEUE * q)
+{
+    for (unsigned int i = 0; i < RING_SIZE; i++)
+    {
+        _aligned_free(q->rewrite[i]);
+        _aligned_free(q->slot[i]);
+    }
+    _aligned_free(q->pages);
+    _aligned_free(q->control);
+    memset(q, 0, sizeof(*q));
+}
+
+static bool QueueCreate(BENCH_QUEUE * q, VirtIODevice * vdev, bool packed)
+{
+    memset(q, 0, sizeof(*q));
+    q->packed = packed;
+    q->wrap = true;
+
+    unsigned long ringBytes = vring_size(RING_SIZE, RingAlign, packed);
+    unsigned int controlBytes = vring_control_block_size(RING_SIZE, packed);
+    q->pages = _aligned_malloc(ringBytes, PAGE_SIZE);
+    q->control = _aligned_malloc(controlBytes, SMP_CACHE_BYTES);
+    bool ok = q->pages && q->control;
+    for (unsigned int i = 0; i < RING_SIZE; i++)
+    {
+        q->rewrite[i] = (UCHAR *)_aligned_malloc(TABLE_BYTES, LINE_BYTES);
+        q->slot[i] = (UCHAR *)_aligned_malloc(TABLE_BYTES, LINE_BYTES);
+        ok = ok && q->rewrite[i] && q->slot[i];
+    }
+    if (!ok)
+    {
+        QueueDestroy(q);
+        return false;
+    }
+    memset(q->pages, 0, ringBytes);
+    memset(q->control, 0, controlBytes);
+
+    if (packed)
+        q->vq = vring_new_virtqueue_packed(0, RING_SIZE, RingAlign, vdev, q->pages, NoNotify, q->control);
+    else
+        q->vq = vring_new_virtqueue_split(0, RING_SIZE, RingAlign, vdev, q->pages, NoNotify, q->control);
+    return q->vq != NULL;
+}
+
+static bool WalkTable(const UCHAR * va, ULONG len, bool packed, WALK * walk)
+{
+    unsigned int max = len / 16;
+    walk->n = 0;
+    if (packed)
+    {
+        const DEVICE_PACKED_DESC * desc = (const DEVICE_PACKED_DESC *)va;
+        for (unsigned int i = 0; i < max; i++)
+        {
+            walk->pa[i] = desc[i].addr;
+            walk->len[i] = desc[i].len;
+            walk->write[i] = (desc[i].flags & DESC_F_WRITE) != 0;
+        }
+        walk->n = max;
+        return true;
+    }
+
+    // follow next from entry 0, like QEMU does for indirect tables
+    const DEVICE_SPLIT_DESC * desc = (const DEVICE_SPLIT_DESC *)va;
+    unsigned int i = 0;
+    while (true)
+    {
+        if (i >= max || walk->n >= max)
+            return false;
+        walk->pa[walk->n] = desc[i].addr;
+        walk->len[walk->n] = desc[i].len;
+        walk->write[walk->n] = (desc[i].flags & DESC_F_WRITE) != 0;
+        walk->n++;
+        if (!(desc[i].flags & DESC_F_NEXT))
+            return true;
+        i = desc[i].next;
+    }
+}
+
+// Device side: takes the next request, walks it when asked to and returns
+// it to the driver
+static bool DeviceTake(BENCH_QUEUE * q, WALK * walk)
+{
+    ULONGLONG addr;
+    ULONG len;
+    USHORT flags;
+
+    if (q->packed)
+    {
+        volatile DEVICE_PACKED_DESC * desc = (volatile DEVICE_PACKED_DESC *)q->pages + q->next;
+        flags = desc->flags;
+        if (!!(flags & DESC_F_AVAIL) != q->wrap || !!(flags & DESC_F_USED) == q->wrap)
+            return false;
+        MemoryBarrier();
+        addr = desc->addr;
+        len = desc->len;
+        if (walk && !WalkTable((const UCHAR *)(ULONG_PTR)addr, len, true, walk))
+            return false;
+        desc->len = 0;
+        MemoryBarrier();
+        desc->flags = q->wrap ? DESC_F_AVAIL | DESC_F_USED : 0;
+        if (++q->next == RING_SIZE)
+        {
+            q->next = 0;
+            q->wrap = !q->wrap;
+        }
+    }
+    else
+    {
+        // desc[num], then avail flags, idx, ring[num] and used_event, then
+        // used flags, idx, ring[num] on the next aligned address
+        ULONG_PTR avail = (ULONG_PTR)q->pages + 16 * RING_SIZE;
+        ULONG_PTR used = (avail + sizeof(USHORT) * (3 + RING_SIZE) + RingAlign - 1) & ~((ULONG_PTR)RingAlign - 1);
+        volatile USHORT * availIdx = (volatile USHORT *)avail + 1;
+        volatile USHORT * availRing = (volatile USHORT *)avail + 2;
+        volatile USHORT * usedIdx = (volatile USHORT *)used + 1;
+        volatile ULONG * usedRing = (volatile ULONG *)(used + 4);
+
+        if (*availIdx == q->next)
+            return false;
+        MemoryBarrier();
+        USHORT head = availRing[q->next % RING_SIZE];
+        if (head >= RING_SIZE)
+            return false;
+        volatile DEVICE_SPLIT_DESC * desc = (volatile DEVICE_SPLIT_DESC *)q->pages + head;
+        flags = desc->flags;
+        addr = desc->addr;
+        len = desc->len;
+        if (walk && !WalkTable((const UCHAR *)(ULONG_PTR)addr, len, false, walk))
+            return false;
+        USHORT idx = *usedIdx;
+        usedRing[2 * (idx % RING_SIZE)] = head;
+        usedRing[2 * (idx % RING_SIZE) + 1] = 0;
+        MemoryBarrier();
+        *usedIdx = (USHORT)(idx + 1);
+        q->next++;
+    }
+    return (flags & DESC_F_INDIRECT) != 0;
+}
+
+// The device returns the request, the driver must get back what it added
+static bool Complete(BENCH_QUEUE * q, void * opaque, WALK * walk)
+{
+    unsigned int len;
+    return DeviceTake(q, walk) && virtqueue_get_buf(q->vq, &len) == opaque;
+}
+
+static void Invert(UCHAR * dst, const UCHAR * src)
+{
+    for (unsigned int i = 0; i < TABLE_BYTES; i++)
+        dst[i] = (UCHAR)~src[i];
+}
+
+// Bytes equal in a table and its twin, written by the library
+static void Account(const UCHAR * a, const UCHAR * b, BENCH_RESULT * result)
+{
+    for (unsigned int line = 0; line < TABLE_BYTES; line += LINE_BYTES)
+    {
+        unsigned int bytes = 0;
+        for (unsigned int i = line; i < line + LINE_BYTES; i++)
+            bytes += a[i] == b[i];
+        result->bytes += bytes;
+        result->lines += bytes != 0;
+    }
+}
+
+static void TableInit(BENCH_QUEUE * q, unsigned int slot, const SHAPE * shape, unsigned int maxData,
+                      struct VirtIOBufferDescriptor * head, struct VirtIOBufferDescriptor * tail)
+{
+    unsigned int numHead = shape->headLen ? 1 : 0;
+    unsigned int numTail = shape->tailLen ? 1 : 0;
+    memset(q->slot[slot], 0, TABLE_BYTES);
+    virtqueue_init_indirect_table(q->vq, &q->table[slot], q->slot[slot], (ULONGLONG)(ULONG_PTR)q->slot[slot],
+        numHead + maxData + numTail, head, numHead, tail, numTail);
+}
+
+static int SubmitRewrite(BENCH_QUEUE * q, unsigned int slot, struct VirtIOBufferDescriptor * sg,
+                         unsigned int out, unsigned int in, void * opaque)
+{
+    return virtqueue_add_buf(q->vq, sg, out, in, opaque, q->rewrite[slot], (ULONGLONG)(ULONG_PTR)q->rewrite[slot]);
+}
+
+static int SubmitTable(BENCH_QUEUE * q, unsigned int slot, struct VirtIOBufferDescriptor * data,
+                       unsigned int out, unsigned int in, void * opaque)
+{
+    return virtqueue_add_buf_table(q->vq, &q->table[slot], data, out, in, opaque);
+}
+
+static bool SameWalk(const WALK * a, const WALK * b)
+{
+    if (a->n != b->n)
+        return false;
+    for (unsigned int i = 0; i < a->n; i++)
+    {
+        if (a->pa[i] != b->pa[i] || a->len[i] != b->len[i] || a->write[i] != b->write[i])
+            return false;
+    }
+    return true;
+}
+
+// Builds the request list of one shape, data holds maxData entries per request
+static unsigned int * MakeRequests(const BENCH_CONFIG * config, struct VirtIOBufferDescriptor * data)
+{
+    unsigned long long state = config->seed;
+    unsigned int * numData = (unsigned int *)malloc(config->requests * sizeof(unsigned int));
+    if (!numData)
+        return NULL;
+    for (unsigned int r = 0; r < config->requests; r++)
+    {
+        numData[r] = 1 + Random(&state) % config->maxData;
+        for (unsigned int i = 0; i < config->maxData; i++)
+        {
+            data[r * config->maxData + i].physAddr.QuadPart = 0x100000000LL + (LONGLONG)Random(&state) * 4096;
+            data[r * config->maxData + i].length = 512 + Random(&state) % 4096;
+        }
+    }
+    return numData;
+}
+
+static unsigned int RunShape(const BENCH_CONFIG * config, const SHAPE * shape, bool packed,
+                             struct VirtIOBufferDescriptor * data, const unsigned int * numData,
+                             BENCH_RESULT * rewrite, BENCH_RESULT * patched)
+{
+    unsigned int errors = 0;
+    struct VirtIOBufferDescriptor head, tail, sg[TABLE_ENTRIES];
+    unsigned int numHead = shape->headLen ? 1 : 0;
+    unsigned int numTail = shape->tailLen ? 1 : 0;
+    VirtIODevice vdev;
+    BENCH_QUEUE a, b;
+    WALK expected, actual;
+
+    memset(rewrite, 0, sizeof(*rewrite));
+    memset(patched, 0, sizeof(*patched));
+    memset(&vdev, 0, sizeof(vdev));
+    head.physAddr.QuadPart = 0x10000;
+    head.length = shape->headLen;
+    tail.physAddr.QuadPart = 0x20000;
+    tail.length = shape->tailLen;
+
+    if (!QueueCreate(&a, &vdev, packed) || !QueueCreate(&b, &vdev, packed))
+    {
+        QueueDestroy(&a);
+        return 1;
+    }
+    for (unsigned int s = 0; s < RING_SIZE; s++)
+    {
+        TableInit(&a, s, shape, config->maxData, &head, &tail);
+        TableInit(&b, s, shape, config->maxData, &head, &tail);
+    }
+
+    // correctness pass with accounting, slot 0 on both queues
+    for (unsigned int r = 0; r < config->requests; r++)
+    {
+        struct VirtIOBufferDescriptor * d = &data[r * config->maxData];
+        void * opaque = (void *)(ULONG_PTR)(r + 1);
+        unsigned int n = numData[r];
+        unsigned int out = shape->dataIn ? 0 : n;
+        unsigned int in = shape->dataIn ? n : 0;
+
+        unsigned int k = 0;
+        if (numHead)
+            sg[k++] = head;
+        for (unsigned int i = 0; i < n; i++)
+            sg[k++] = d[i];
+        if (numTail)
+            sg[k++] = tail;
+
+        Invert(b.rewrite[0], a.rewrite[0]);
+        if (SubmitRewrite(&a, 0, sg, numHead + out, in + numTail, opaque) < 0 ||
+            SubmitRewrite(&b, 0, sg, numHead + out, in + numTail, opaque) < 0)
+        {
+            ++errors;
+            break;
+        }
+        Account(a.rewrite[0], b.rewrite[0], rewrite);
+        if (!Complete(&a, opaque, &expected) || !Complete(&b, opaque, NULL) || expected.n != k)
+            ++errors;
+
+        Invert(b.slot[0], a.slot[0]);
+        if (SubmitTable(&a, 0, d, out, in, opaque) < 0 || SubmitTable(&b, 0, d, out, in, opaque) < 0)
+        {
+            ++errors;
+            break;
+        }
+        Account(a.slot[0], b.slot[0], patched);
+        if (!Complete(&a, opaque, &actual) || !Complete(&b, opaque, NULL))
+            ++errors;
+
+        if (!SameWalk(&expected, &actual))
+            ++errors;
+    }
+
+    // timing pass, a ring full of requests is submitted at a time and the
+    // device side is not timed
+    for (int method = 0; method < 2; method++)
+    {
+        BENCH_RESULT * result = method ? patched : rewrite;
+        unsigned int r = 0;
+        while (r < config->requests)
+        {
+            unsigned int first = r;
+            double start = Seconds();
+            for (unsigned int s = 0; s < RING_SIZE && r < config->requests; s++, r++)
+            {
+                struct VirtIOBufferDescriptor * d = &data[r * config->maxData];
+                void * opaque = (void *)(ULONG_PTR)(r + 1);
+                unsigned int n = numData[r];
+                if (method)
+                {
+                    SubmitTable(&a, s, d, shape->dataIn ? 0 : n, shape->dataIn ? n : 0, opaque);
+                }
+                else
+                {
+                    unsigned int k = 0;
+                    if (numHead)
+                        sg[k++] = head;
+                    for (unsigned int i = 0; i < n; i++)
+                        sg[k++] = d[i];
+                    if (numTail)
+                        sg[k++] = tail;
+                    unsigned int out = numHead + (shape->dataIn ? 0 : n);
+                    SubmitRewrite(&a, s, sg, out, k - out, opaque);
+                }
+            }
+            result->seconds += Seconds() - start;
+            for (; first < r; first++)
+            {
+                if (!Complete(&a, (void *)(ULONG_PTR)(first + 1), NULL))
+                    ++errors;
+            }
+        }
+    }
+
+    QueueDestroy(&a);
+    QueueDestroy(&b);
+    return errors;
+}
+
+// The corner cases of the split layout: no data, no head, no tail
+static unsigned int CheckCorners()
+{
+    struct VirtIOBufferDescriptor head, tail, data[2];
+    VirtIODevice vdev;
+    BENCH_QUEUE q;
+    WALK walk;
+    unsigned int errors = 0;
+    void * opaque = &walk;
+
+    memset(&vdev, 0, sizeof(vdev));
+    if (!QueueCreate(&q, &vdev, false))
+        return 1;
+    struct virtqueue_indirect_table * table = &q.table[0];
+    ULONGLONG pa = (ULONGLONG)(ULONG_PTR)q.slot[0];
+    head.physAddr.QuadPart = 0x1000;
+    head.length = 16;
+    tail.physAddr.QuadPart = 0x2000;
+    tail.length = 1;
+    data[0].physAddr.QuadPart = 0x3000;
+    data[0].length = 512;
+    data[1].physAddr.QuadPart = 0x4000;
+    data[1].length = 512;
+
+    virtqueue_init_indirect_table(q.vq, table, q.slot[0], pa, 8, &head, 1, &tail, 1);
+    // header + status only, then back to a data request
+    if (virtqueue_add_buf_table(q.vq, table, data, 0, 0, opaque) < 0 ||
+        !Complete(&q, opaque, &walk) || walk.n != 2 || walk.pa[1] != 0x2000)
+        ++errors;
+    if (virtqueue_add_buf_table(q.vq, table, data, 2, 0, opaque) < 0 ||
+        !Complete(&q, opaque, &walk) || walk.n != 4 || walk.pa[1] != 0x3000)
+        ++errors;
+    // too many data entries
+    if (virtqueue_add_buf_table(q.vq, table, data, 7, 0, opaque) != -EINVAL)
+        ++errors;
+
+    // no tail: the last head entry ends the chain when there is no data
+    virtqueue_init_indirect_table(q.vq, table, q.slot[0], pa, 8, &head, 1, NULL, 0);
+    if (virtqueue_add_buf_table(q.vq, table, data, 0, 0, opaque) < 0 ||
+        !Complete(&q, opaque, &walk) || walk.n != 1)
+        ++errors;
+    if (virtqueue_add_buf_table(q.vq, table, data, 1, 1, opaque) < 0 ||
+        !Complete(&q, opaque, &walk) || walk.n != 3 || !walk.write[2])
+        ++errors;
+
+    // no head: the chain must start at entry 0, so some data is required
+    virtqueue_init_indirect_table(q.vq, table, q.slot[0], pa, 8, NULL, 0, &tail, 1);
+    if (virtqueue_add_buf_table(q.vq, table, data, 0, 0, opaque) != -EINVAL)
+        ++errors;
+    if (virtqueue_add_buf_table(q.vq, table, data, 0, 2, opaque) < 0 ||
+        !Complete(&q, opaque, &walk) || walk.n != 3 || walk.pa[2] != 0x2000)
+        ++errors;
+
+    QueueDestroy(&q);
+    return errors;
+}
+
+static bool ParseArgs(int argc, char ** argv, BENCH_CONFIG * config)
+{
+    config->requests = 1000000;
+    config->maxData = 4;
+    config->seed = 1;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (i + 1 >= argc)
+            return false;
+        unsigned int value = (unsigned int)strtoul(argv[i + 1], NULL, 0);
+        if (!strcmp(argv[i], "-n"))
+            config->requests = value;
+        else if (!strcmp(argv[i], "-d"))
+            config->maxData = value;
+        else if (!strcmp(argv[i], "-s"))
+            config->seed = value;
+        else
+            return false;
+        ++i;
+    }
+    return config->requests && config->maxData && config->maxData <= TABLE_ENTRIES - 2;
+}
+
+int main(int argc, char ** argv)
+{
+    static const SHAPE shapes[] =
+    {
+        { "blk write", 16, 1, false },
+        { "blk read", 16, 1, true },
+        { "scsi read", 51, 108, true },
+        { "net tx", 12, 0, false },
+    };
+    BENCH_CONFIG config;
+    if (!ParseArgs(argc, argv, &config))
+    {
+        printf("Usage: %s [-n requests] [-d max data entries] [-s seed]\n", argv[0]);
+        return 1;
+    }
+
+    struct VirtIOBufferDescriptor * data = (struct VirtIOBufferDescriptor *)malloc(
+        (size_t)config.requests * config.maxData * sizeof(struct VirtIOBufferDescriptor));
+    unsigned int * numData = data ? MakeRequests(&config, data) : NULL;
+    if (!numData)
+    {
+        printf("Out of memory\n");
+        return 1;
+    }
+
+    unsigned int errors = CheckCorners();
+
+    printf("%u requests, 1..%u data entries each\n", config.requests, config.maxData);
+    printf("%-10s %-7s %-8s %12s %12s %10s\n", "shape", "ring", "method", "bytes/req", "lines/req", "ns/req");
+    for (size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++)
+    {
+        for (int packed = 0; packed < 2; packed++)
+        {
+            BENCH_RESULT rewrite, patched;
+            errors += RunShape(&config, &shapes[s], packed != 0, data, numData, &rewrite, &patched);
+            printf("%-10s %-7s %-8s %12.1f %12.2f %10.2f\n", shapes[s].name, packed ? "packed" : "split", "rewrite",
+                (double)rewrite.bytes / config.requests, (double)rewrite.lines / config.requests,
+                rewrite.seconds * 1e9 / config.requests);
+            printf("%-10s %-7s %-8s %12.1f %12.2f %10.2f\n", "", "", "table",
+                (double)patched.bytes / config.requests, (double)patched.lines / config.requests,
+                patched.seconds * 1e9 / config.requests);
+        }
+    }
+
+    printf("%u errors\n", errors);
+    free(numData);
+    free(data);
+    return errors ? 1 : 0;
+}
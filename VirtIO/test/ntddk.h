@@ -0,0 +1,72 @@
+// ntddk.h : user mode stand-in for the kernel header, so the test programs
+// can build the ring code of the library (VirtIORing.c, VirtIORing-Packed.c
+// and VirtIOPCICommon.c) unchanged. The test directory comes first in the
+// include path of the test projects, osdep.h picks this file up instead of
+// the WDK one.
+//
+// Only what the ring code uses is defined here, nothing in the tests talks
+// to real hardware.
+
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#define WIN32_NO_STATUS
+#include <Windows.h>
+#undef WIN32_NO_STATUS
+#include <ntstatus.h>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+typedef LONG NTSTATUS;
+
+#ifndef NT_SUCCESS
+#define NT_SUCCESS(Status) (((NTSTATUS)(Status)) >= 0)
+#endif
+
+#ifndef PAGE_SIZE
+#define PAGE_SIZE 0x1000
+#endif
+
+#ifndef MAXUSHORT
+#define MAXUSHORT 0xffff
+#endif
+
+#define ASSERT(exp) assert(exp)
+
+#define KeMemoryBarrier() MemoryBarrier()
+#define KeBugCheck(code) abort()
+
+typedef LARGE_INTEGER PHYSICAL_ADDRESS, *PPHYSICAL_ADDRESS;
+
+// virtio_get_bar_index only looks at the header type and the BARs
+#define PCI_TYPE0_ADDRESSES             6
+#define PCI_MULTIFUNCTION               0x80
+#define PCI_DEVICE_TYPE                 0x00
+#define PCI_ADDRESS_IO_SPACE            0x00000001
+#define PCI_ADDRESS_MEMORY_TYPE_MASK    0x00000006
+#define PCI_TYPE_64BIT                  0x00000004
+#define PCI_ADDRESS_IO_ADDRESS_MASK     0xfffffffc
+#define PCI_ADDRESS_MEMORY_ADDRESS_MASK 0xfffffff0
+#define PCI_CAPABILITY_ID_VENDOR_SPECIFIC 0x09
+
+typedef struct _PCI_COMMON_HEADER {
+    USHORT  VendorID;
+    USHORT  DeviceID;
+    USHORT  Command;
+    USHORT  Status;
+    UCHAR   RevisionID;
+    UCHAR   ProgIf;
+    UCHAR   SubClass;
+    UCHAR   BaseClass;
+    UCHAR   CacheLineSize;
+    UCHAR   LatencyTimer;
+    UCHAR   HeaderType;
+    UCHAR   BIST;
+    union {
+        struct {
+            ULONG BaseAddresses[PCI_TYPE0_ADDRESSES];
+        } type0;
+    } u;
+} PCI_COMMON_HEADER, *PPCI_COMMON_HEADER;
@@ -0,0 +1,342 @@
+// virtio-ring-sim.cpp : split ring driver/device simulator with a fake
+// notify region, counting the notifications (VM exits on real hardware)
+// and the avail index reads the device does to find out what was kicked.
+//
+// The driver side is the library itself: VirtIORing.c, VirtIORing-Packed.c
+// and VirtIOPCICommon.c are built into the simulator (see ntddk.h in this
+// directory) and run on real ring memory. The queue is notified through
+// vp_notify, whose register writes land in the fake notify region. The
+// device wakes up `lag` driver steps after a notification, consumes
+// everything it knows about and re-arms avail_event before going idle, like
+// the QEMU virtqueue code does with EVENT_IDX.
+//
+// Each run is repeated for the four combinations of notification data
+// on/off and per-buffer/deferred kick.
+//
+// Windows: built by virtio-ring-sim.vcxproj.
+//
+// Usage: virtio-ring-sim [-n buffers] [-q ring size] [-b burst] [-l lag] [-x exit ns]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// only types and macros, kept out of the extern "C" block for Windows.h
+#include "ntddk.h"
+
+extern "C" {
+#include "osdep.h"
+#include "virtio_pci.h"
+#include "VirtIO.h"
+#include "kdebugprint.h"
+#include "virtio_ring.h"
+#include "virtio_pci_common.h"
+#include "windows\virtio_ring_allocation.h"
+}
+
+struct SIM_CONFIG
+{
+    unsigned int buffers;
+    unsigned int ringSize;
+    unsigned int burst;
+    unsigned int lag;
+    unsigned int exitNs;
+};
+
+struct SIM_RESULT
+{
+    unsigned int notifies;
+    unsigned int availReads;
+    unsigned int wakeups;
+    unsigned int errors;
+};
+
+// The device side of the split ring, laid out as in the virtio spec
+struct SIM_DEVICE
+{
+    unsigned int num;
+    volatile USHORT * availIdx;
+    volatile USHORT * availRing;
+    volatile USHORT * usedIdx;
+    volatile ULONG * usedRing;      // id, len pairs
+    volatile USHORT * availEvent;   // EVENT_IDX, written by the device
+    USHORT lastAvail;
+    unsigned int wakeAt;            // 0 when idle
+};
+
+static const unsigned int QueueIndex = 1;
+static const unsigned long RingAlign = SMP_CACHE_BYTES;
+
+// the notify capability of the queue, written by vp_notify
+static volatile ULONG NotifyRegion;
+static SIM_RESULT * CurrentResult;
+
+// kdebugprint.h, no debug output in the simulator
+int virtioDebugLevel;
+int bDebugPrint;
+tDebugPrintFunc VirtioDebugPrintProc;
+
+// VirtIOPCICommon.c references the transports and the trace, the simulator
+// builds its queue itself and never enables tracing
+NTSTATUS vio_legacy_initialize(VirtIODevice *)
+{
+    return STATUS_DEVICE_NOT_CONNECTED;
+}
+
+NTSTATUS vio_modern_initialize(VirtIODevice *)
+{
+    return STATUS_DEVICE_NOT_CONNECTED;
+}
+
+void virtio_trace_event(VirtIODevice *, u16, u8, u32, void *)
+{
+}
+
+static void WriteWord(ULONG_PTR ulRegister, u16 wValue)
+{
+    // the queue index alone leaves the upper half of the region alone
+    *(volatile USHORT *)ulRegister = wValue;
+}
+
+static void WriteDword(ULONG_PTR ulRegister, u32 ulValue)
+{
+    *(volatile ULONG *)ulRegister = ulValue;
+}
+
+static void Notify(struct virtqueue * vq)
+{
+    vp_notify(vq);
+    ++CurrentResult->notifies;
+}
+
+static void DeviceInit(SIM_DEVICE * dev, void * pages, unsigned int num)
+{
+    // desc[num], then avail flags, idx, ring[num] and used_event, then used
+    // flags, idx, ring[num] and avail_event on the next aligned address
+    ULONG_PTR avail = (ULONG_PTR)pages + 16 * num;
+    ULONG_PTR used = (avail + sizeof(USHORT) * (3 + num) + RingAlign - 1) & ~((ULONG_PTR)RingAlign - 1);
+
+    memset(dev, 0, sizeof(*dev));
+    dev->num = num;
+    dev->availIdx = (volatile USHORT *)avail + 1;
+    dev->availRing = (volatile USHORT *)avail + 2;
+    dev->usedIdx = (volatile USHORT *)used + 1;
+    dev->usedRing = (volatile ULONG *)(used + 4);
+    dev->availEvent = (volatile USHORT *)(used + 4 + 8 * num);
+}
+
+// Device side of a notification: where does the new work end?
+static USHORT DeviceKnownAvail(SIM_DEVICE * dev, bool notificationData, SIM_RESULT * result)
+{
+    if (notificationData)
+    {
+        ULONG data = NotifyRegion;
+        if ((data & 0xffff) != QueueIndex)
+            ++result->errors;
+        return (USHORT)(data >> 16);
+    }
+    if ((USHORT)NotifyRegion != QueueIndex)
+        ++result->errors;
+    ++result->availReads;
+    return *dev->availIdx;
+}
+
+static void DeviceRun(SIM_DEVICE * dev, bool notificationData, SIM_RESULT * result)
+{
+    USHORT avail = DeviceKnownAvail(dev, notificationData, result);
+    ++result->wakeups;
+    while (true)
+    {
+        USHORT used = *dev->usedIdx;
+        for (; dev->lastAvail != avail; ++dev->lastAvail, ++used)
+        {
+            USHORT head = dev->availRing[dev->lastAvail & (dev->num - 1)];
+            if (head >= dev->num)
+                ++result->errors;
+            dev->usedRing[2 * (used & (dev->num - 1))] = head;
+            dev->usedRing[2 * (used & (dev->num - 1)) + 1] = 0;
+        }
+        MemoryBarrier();
+        *dev->usedIdx = used;
+        // re-arm and re-check before going idle, one read in every mode
+        *dev->availEvent = dev->lastAvail;
+        MemoryBarrier();
+        ++result->availReads;
+        if (*dev->availIdx == dev->lastAvail)
+            break;
+        avail = *dev->availIdx;
+    }
+    dev->wakeAt = 0;
+}
+
+static SIM_RESULT Simulate(const SIM_CONFIG * config, bool notificationData, bool deferred)
+{
+    SIM_RESULT result;
+    SIM_DEVICE dev;
+    VirtIODevice vdev;
+    VirtIOSystemOps ops;
+    memset(&result, 0, sizeof(result));
+    memset(&vdev, 0, sizeof(vdev));
+    memset(&ops, 0, sizeof(ops));
+    CurrentResult = &result;
+    NotifyRegion = 0;
+
+    ops.vdev_write_word = WriteWord;
+    ops.vdev_write_dword = WriteDword;
+    vdev.system = &ops;
+    // what virtio_set_features does for a device offering both features
+    vdev.event_suppression_enabled = true;
+    vdev.notification_data = notificationData;
+
+    unsigned long ringBytes = vring_size(config->ringSize, RingAlign, false);
+    void * pages = _aligned_malloc(ringBytes, PAGE_SIZE);
+    void * control = _aligned_malloc(vring_control_block_size((u16)config->ringSize, false), SMP_CACHE_BYTES);
+    if (!pages || !control)
+    {
+        ++result.errors;
+        _aligned_free(pages);
+        _aligned_free(control);
+        return result;
+    }
+    memset(pages, 0, ringBytes);
+
+    struct virtqueue * vq = vring_new_virtqueue_split(QueueIndex, config->ringSize, RingAlign,
+        &vdev, pages, Notify, control);
+    vq->notification_addr = (void *)&NotifyRegion;
+    DeviceInit(&dev, pages, config->ringSize);
+
+    unsigned int step = 0, added = 0, completed = 0;
+    while (added < config->buffers)
+    {
+        ++step;
+        unsigned int notifiesBefore = result.notifies;
+        unsigned int len;
+        void * opaque;
+
+        while ((opaque = virtqueue_get_buf(vq, &len)) != NULL)
+        {
+            if ((ULONG_PTR)opaque != completed + 1)
+                ++result.errors;
+            ++completed;
+        }
+
+        struct VirtIOBufferDescriptor sg;
+        sg.physAddr.QuadPart = (LONGLONG)(added + 1) * PAGE_SIZE;
+        sg.length = 64;
+        if (virtqueue_add_buf(vq, &sg, 1, 0, (void *)(ULONG_PTR)(added + 1), NULL, 0) >= 0)
+        {
+            ++added;
+            bool more = (added % config->burst) != 0 && added < config->buffers;
+            if (deferred)
+                virtqueue_kick_deferred(vq, more);
+            else
+                virtqueue_kick(vq);
+        }
+        else
+        {
+            // ring full, whatever was deferred has to go now
+            virtqueue_kick(vq);
+        }
+
+        if (result.notifies != notifiesBefore && !dev.wakeAt)
+            dev.wakeAt = step + config->lag;
+        if (dev.wakeAt && step >= dev.wakeAt)
+            DeviceRun(&dev, notificationData, &result);
+    }
+
+    // drain
+    virtqueue_kick(vq);
+    if (dev.lastAvail != *dev.availIdx)
+        DeviceRun(&dev, notificationData, &result);
+    unsigned int len;
+    void * opaque;
+    while ((opaque = virtqueue_get_buf(vq, &len)) != NULL)
+    {
+        if ((ULONG_PTR)opaque != completed + 1)
+            ++result.errors;
+        ++completed;
+    }
+    if (completed != added || virtqueue_detach_unused_buf(vq) != NULL)
+        ++result.errors;
+
+    _aligned_free(pages);
+    _aligned_free(control);
+    return result;
+}
+
+static bool ParseArgs(int argc, char ** argv, SIM_CONFIG * config)
+{
+    config->buffers = 1000000;
+    config->ringSize = 256;
+    config->burst = 16;
+    config->lag = 4;
+    config->exitNs = 1500;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (i + 1 >= argc)
+            return false;
+        unsigned int value = (unsigned int)strtoul(argv[i + 1], NULL, 0);
+        if (!strcmp(argv[i], "-n"))
+            config->buffers = value;
+        else if (!strcmp(argv[i], "-q"))
+            config->ringSize = value;
+        else if (!strcmp(argv[i], "-b"))
+            config->burst = value;
+        else if (!strcmp(argv[i], "-l"))
+            config->lag = value;
+        else if (!strcmp(argv[i], "-x"))
+            config->exitNs = value;
+        else
+            return false;
+        ++i;
+    }
+    return config->buffers && config->ringSize && config->ringSize <= 32768 &&
+        !(config->ringSize & (config->ringSize - 1)) && config->burst;
+}
+
+// The encoding the library uses for both ring layouts
+static unsigned int CheckEncoding()
+{
+    unsigned int errors = 0;
+    if ((unsigned int)VIRTIO_NOTIFICATION_DATA(3, 0x8005, 0x8005 & 0x8000) != 0x80050003)
+        ++errors;
+    if ((unsigned int)VIRTIO_NOTIFICATION_DATA(0xffff, 0x7fff, 0) != 0x7fffffff)
+        ++errors;
+    if ((unsigned int)VIRTIO_NOTIFICATION_DATA(0, 0x10, 1) != 0x80100000)
+        ++errors;
+    return errors;
+}
+
+int main(int argc, char ** argv)
+{
+    SIM_CONFIG config;
+    if (!ParseArgs(argc, argv, &config))
+    {
+        printf("Usage: %s [-n buffers] [-q ring size] [-b burst] [-l lag] [-x exit ns]\n", argv[0]);
+        return 1;
+    }
+
+    unsigned int errors = CheckEncoding();
+
+    printf("%u buffers, ring %u, burst %u, device lag %u steps, %u ns per notification\n",
+        config.buffers, config.ringSize, config.burst, config.lag, config.exitNs);
+    printf("%-10s %-10s %10s %10s %10s %12s\n",
+        "notify", "kick", "notifies", "avail rd", "wakeups", "exit ns/buf");
+
+    for (int nd = 0; nd < 2; ++nd)
+    {
+        for (int deferred = 0; deferred < 2; ++deferred)
+        {
+            SIM_RESULT result = Simulate(&config, nd != 0, deferred != 0);
+            errors += result.errors;
+            printf("%-10s %-10s %10u %10u %10u %12.1f\n",
+                nd ? "data" : "index", deferred ? "deferred" : "per-buf",
+                result.notifies, result.availReads, result.wakeups,
+                (double)result.notifies * config.exitNs / config.buffers);
+        }
+    }
+
+    printf("%u errors\n", errors);
+    return errors ? 1 : 0;
+}
@@ -41,6 +41,7 @@
 
 #include "linux/types.h"
 #include "linux/virtio_config.h"
+#include "virtio_trace.h"
 
 #ifndef VIRTIO_PCI_NO_LEGACY
 
@@ -247,6 +248,12 @@ struct virtio_device
     // true if the VIRTIO_F_RING_PACKED feature flag has been negotiated
     bool packed_ring;
 
+    // true if the VIRTIO_F_NOTIFICATION_DATA feature flag has been negotiated
+    bool notification_data;
+
+    // true if the VIRTIO_F_IN_ORDER feature flag has been negotiated
+    bool in_order;
+
     // internal device operations, implemented separately for legacy and modern
     const struct virtio_device_ops *device;
 
@@ -276,6 +283,12 @@ struct virtio_device
     // are used, or to an external allocation otherwise
     VirtIOQueueInfo *info;
     VirtIOQueueInfo inline_info[MAX_QUEUES_PER_DEVICE_DEFAULT];
+
+    // the event trace while it is enabled, NULL otherwise
+    PVIRTIO_TRACE_HEADER volatile trace;
+
+    // the event trace memory, kept until virtio_device_shutdown once allocated
+    PVIRTIO_TRACE_HEADER trace_block;
 };
 
 /* Driver API: device init and shutdown
@@ -382,6 +395,23 @@ u16 virtio_set_queue_vector(struct virtqueue *vq, u16 vector);
 
 u8 virtio_read_isr_status(VirtIODevice *vdev);
 
+/* Driver API: event tracing
+ * virtio_trace_enable starts recording add_buf, kick, interrupt and get_buf events
+ * of all queues with their timestamps in a per-CPU binary ring (see virtio_trace.h),
+ * records_per_cpu is rounded down to a power of 2. The memory is allocated on the
+ * first call and kept, so it is also found in crash dumps, until virtio_device_shutdown.
+ * virtio_trace_disable stops recording, virtio_trace_copy takes a snapshot of the
+ * trace and returns the number of bytes copied or 0 if the buffer is too small, the
+ * size needed is returned by virtio_trace_size. virtio_trace_event records an event
+ * seen by the driver, e.g. an MSI-X interrupt. Enable and disable are called at
+ * PASSIVE_LEVEL, the others at any IRQL up to DIRQL.
+ */
+NTSTATUS virtio_trace_enable(VirtIODevice *vdev, ULONG records_per_cpu);
+void virtio_trace_disable(VirtIODevice *vdev);
+ULONG virtio_trace_size(VirtIODevice *vdev);
+ULONG virtio_trace_copy(VirtIODevice *vdev, void *buffer, ULONG length);
+void virtio_trace_event(VirtIODevice *vdev, u16 queue, u8 event, u32 value, void *cookie);
+
 /* Driver API: miscellaneous helpers
  * virtio_get_bar_index returns the corresponding BAR index given its physical address.
  * This tends to be useful to all drivers since Windows doesn't provide reliable BAR
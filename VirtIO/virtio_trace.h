@@ -0,0 +1,90 @@
+/*
+ * Binary format of the virtqueue event trace
+ *
+ * Shared by the VirtIO library (VirtIOTrace.c) and the user mode tools
+ * decoding the trace, so it only uses basic Windows types.
+ *
+ * Copyright (c) 2026 Red Hat, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met :
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and / or other materials provided with the distribution.
+ * 3. Neither the names of the copyright holders nor the names of their contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+#ifndef _VIRTIO_TRACE_H
+#define _VIRTIO_TRACE_H
+
+/* The trace is one block: the header, then one CPU block per processor.
+ * A CPU block is a VIRTIO_TRACE_CPU followed by RecordsPerCpu records used
+ * as a ring, events are written to the block of the processor they happen
+ * on. Records that were never written have a zero Timestamp, a decoder
+ * collects the others from all CPU blocks and sorts them by Timestamp.
+ */
+#define VIRTIO_TRACE_SIGNATURE      0x43525456 /* "VTRC" */
+#define VIRTIO_TRACE_VERSION        1
+
+/* Queue of events not related to a single queue */
+#define VIRTIO_TRACE_NO_QUEUE       0xFFFF
+
+typedef enum _VIRTIO_TRACE_EVENT {
+    VIRTIO_TRACE_ADD_BUF = 1,   /* Value: descriptors (out + in), Cookie: the request */
+    VIRTIO_TRACE_KICK,          /* the device was notified */
+    VIRTIO_TRACE_INTERRUPT,     /* Value: ISR status or MSI-X message number */
+    VIRTIO_TRACE_GET_BUF,       /* Value: bytes written by the device, Cookie: the request */
+} VIRTIO_TRACE_EVENT;
+
+typedef struct _VIRTIO_TRACE_RECORD {
+    ULONGLONG   Timestamp;      /* TicksPerSecond units, TSC on x86 and x64 */
+    ULONGLONG   Cookie;         /* opaque value of the request */
+    ULONG       Value;
+    USHORT      Queue;          /* virtqueue index */
+    UCHAR       Event;          /* VIRTIO_TRACE_EVENT */
+    UCHAR       Reserved;
+} VIRTIO_TRACE_RECORD, *PVIRTIO_TRACE_RECORD;
+
+typedef struct _VIRTIO_TRACE_CPU {
+    volatile LONG Next;         /* records ever written, the next slot is Next % RecordsPerCpu */
+    ULONG       Reserved[15];   /* one cache line per CPU */
+} VIRTIO_TRACE_CPU, *PVIRTIO_TRACE_CPU;
+
+typedef struct _VIRTIO_TRACE_HEADER {
+    ULONG       Signature;      /* VIRTIO_TRACE_SIGNATURE */
+    ULONG       Version;        /* VIRTIO_TRACE_VERSION */
+    ULONG       HeaderSize;     /* offset of the first CPU block */
+    ULONG       NumberOfCpus;
+    ULONG       RecordsPerCpu;  /* power of 2 */
+    ULONG       RecordSize;
+    ULONG       CpuBlockSize;   /* offset between CPU blocks */
+    ULONG       Reserved;
+    ULONGLONG   TicksPerSecond; /* frequency of the record timestamps */
+    ULONGLONG   Reserved2[4];
+} VIRTIO_TRACE_HEADER, *PVIRTIO_TRACE_HEADER;
+
+#define VIRTIO_TRACE_SIZE(h) \
+    ((h)->HeaderSize + (h)->NumberOfCpus * (h)->CpuBlockSize)
+
+#define VIRTIO_TRACE_CPU_BLOCK(h, cpu) \
+    ((PVIRTIO_TRACE_CPU)((PUCHAR)(h) + (h)->HeaderSize + (cpu) * (h)->CpuBlockSize))
+
+#define VIRTIO_TRACE_CPU_RECORDS(h, cpu) \
+    ((PVIRTIO_TRACE_RECORD)(VIRTIO_TRACE_CPU_BLOCK(h, cpu) + 1))
+
+#endif /* _VIRTIO_TRACE_H */
@@ -0,0 +1,80 @@
+#ifndef _VIRTIO_POLL_H
+#define _VIRTIO_POLL_H
+
+/* Hybrid polling of a request queue, shared by the Storport miniports.
+ * The CPU that put a request in the ring spins on the used ring for about
+ * twice as long as the queue has recently taken to complete one, at most
+ * the budget, and the miniport completes what it finds without waiting for
+ * the interrupt and the DPC. A queue slower than the budget is only polled
+ * every VIRTIO_POLL_PROBE_INTERVAL submissions, to notice when it gets
+ * faster. Needs storport.h and virtio_ring.h.
+ */
+
+#define VIRTIO_POLL_PROBE_INTERVAL  64
+
+typedef struct _VIRTIO_POLL_QUEUE {
+    ULONGLONG             avg_ticks;    /* completion latency seen by polling */
+    ULONG                 skipped;      /* submissions since the last poll */
+} VIRTIO_POLL_QUEUE, *PVIRTIO_POLL_QUEUE;
+
+#if (NTDDI_VERSION > NTDDI_WIN7)
+/* Returns FALSE if the queue is not polled this time, otherwise how long
+ * to spin in *Limit. The caller then disables the queue callbacks under its
+ * queue lock and calls VirtioPollSpin.
+ */
+static FORCEINLINE BOOLEAN
+VirtioPollBegin(
+    IN PVIRTIO_POLL_QUEUE Poll,
+    IN ULONGLONG BudgetTicks,
+    OUT PULONGLONG Limit
+)
+{
+    if (Poll->avg_ticks > BudgetTicks &&
+        ++Poll->skipped < VIRTIO_POLL_PROBE_INTERVAL) {
+        return FALSE;
+    }
+    Poll->skipped = 0;
+    *Limit = BudgetTicks;
+    if (Poll->avg_ticks != 0 && Poll->avg_ticks * 2 < *Limit) {
+        *Limit = Poll->avg_ticks * 2;
+    }
+    return TRUE;
+}
+
+/* Spins until the device has used a buffer or Limit ticks have passed and
+ * folds the time into the queue average. The caller completes the requests
+ * and arms the callbacks again afterwards, whether anything was found or not.
+ */
+static FORCEINLINE VOID
+VirtioPollSpin(
+    IN PVOID DeviceExtension,
+    IN PVIRTIO_POLL_QUEUE Poll,
+    IN struct virtqueue *vq,
+    IN ULONGLONG BudgetTicks,
+    IN ULONGLONG Limit
+)
+{
+    LARGE_INTEGER start, now;
+    ULONGLONG elapsed;
+    BOOLEAN found;
+
+    StorPortQueryPerformanceCounter(DeviceExtension, NULL, &start);
+    for (;;) {
+        found = virtqueue_has_buf(vq);
+        StorPortQueryPerformanceCounter(DeviceExtension, NULL, &now);
+        elapsed = (ULONGLONG)(now.QuadPart - start.QuadPart);
+        if (found || elapsed >= Limit) {
+            break;
+        }
+        YieldProcessor();
+    }
+
+    /* a miss counts as twice the budget, a few in a row stop the polling */
+    if (!found) {
+        elapsed = BudgetTicks * 2;
+    }
+    Poll->avg_ticks = Poll->avg_ticks ? Poll->avg_ticks - Poll->avg_ticks / 8 + elapsed / 8 : elapsed;
+}
+#endif
+
+#endif /* _VIRTIO_POLL_H */
@@ -27,8 +27,13 @@ NTSTATUS IVSHMEMCreateDevice(_Inout_ PWDFDEVICE_INIT DeviceInit)
     WdfDeviceInitSetPnpPowerEventCallbacks(DeviceInit, &pnpPowerCallbacks);
 
     WDF_FILEOBJECT_CONFIG fileConfig;
+    WDF_OBJECT_ATTRIBUTES fileAttributes;
     WDF_FILEOBJECT_CONFIG_INIT(&fileConfig, NULL, NULL, IVSHMEMEvtDeviceFileCleanup);
-    WdfDeviceInitSetFileObjectConfig(DeviceInit, &fileConfig, WDF_NO_OBJECT_ATTRIBUTES);
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&fileAttributes, FILE_CONTEXT);
+    WdfDeviceInitSetFileObjectConfig(DeviceInit, &fileConfig, &fileAttributes);
+
+    // mappings are created in the address space of the calling process
+    WdfDeviceInitSetIoInCallerContextCallback(DeviceInit, IVSHMEMEvtIoInCallerContext);
 
     status = WdfDeviceCreate(&DeviceInit, &deviceAttributes, &device);
 
@@ -43,6 +48,13 @@ NTSTATUS IVSHMEMCreateDevice(_Inout_ PWDFDEVICE_INIT DeviceInit)
     KeInitializeSpinLock(&deviceContext->eventListLock);
     InitializeListHead(&deviceContext->eventList);
 
+    status = WdfWaitLockCreate(WDF_NO_OBJECT_ATTRIBUTES, &deviceContext->mapLock);
+    if (!NT_SUCCESS(status))
+    {
+        DEBUG_ERROR("%s", "Call to WdfWaitLockCreate failed");
+        return status;
+    }
+
     status = WdfDeviceCreateDeviceInterface(device, &GUID_DEVINTERFACE_IVSHMEM, NULL);
 
     if (!NT_SUCCESS(status))
@@ -92,6 +104,16 @@ PVOID IVSHMEMMmMapIoSpace(
 }
 
 
+// called with mapLock held
+VOID IVSHMEMShmemRelease(_In_ PIVSHMEMShmemRef ShmemRef)
+{
+    if (--ShmemRef->refs > 0)
+        return;
+
+    IoFreeMdl(ShmemRef->mdl);
+    ExFreePoolWithTag(ShmemRef, 'fRmS');
+}
+
 NTSTATUS IVSHMEMEvtDevicePrepareHardware(_In_ WDFDEVICE Device, _In_ WDFCMRESLIST ResourcesRaw, _In_ WDFCMRESLIST ResourcesTranslated)
 {
     PAGED_CODE();
@@ -104,6 +126,7 @@ NTSTATUS IVSHMEMEvtDevicePrepareHardware(_In_ WDFDEVICE Device, _In_ WDFCMRESLIS
 #endif
     NTSTATUS result = STATUS_SUCCESS;
     int memIndex = 0;
+    PMDL shmemMDL = NULL;
 
     const ULONG resCount = WdfCmResourceListGetCount(ResourcesTranslated);
     for (ULONG i = 0; i < resCount; ++i)
@@ -175,17 +198,17 @@ NTSTATUS IVSHMEMEvtDevicePrepareHardware(_In_ WDFDEVICE Device, _In_ WDFCMRESLIS
                 DEBUG_INFO("memIndex = %d pa = %llx (%llx) size = %lx (%lx)", memIndex, descriptor->u.Memory.Start.QuadPart, deviceContext->shmemAddr.PhysicalAddress.QuadPart, descriptor->u.Memory.Length, deviceContext->shmemAddr.NumberOfBytes);
 
 #if (NTDDI_VERSION >= NTDDI_WIN8)
-                result = MmAllocateMdlForIoSpace(&deviceContext->shmemAddr, 1, &deviceContext->shmemMDL);
+                result = MmAllocateMdlForIoSpace(&deviceContext->shmemAddr, 1, &shmemMDL);
 #else
                 deviceContext->shmemAddr.VirtualAddress = MmMapIoSpace(deviceContext->shmemAddr.PhysicalAddress, deviceContext->shmemAddr.NumberOfBytes, MmNonCached);
                 if (deviceContext->shmemAddr.VirtualAddress) {
-                    deviceContext->shmemMDL = IoAllocateMdl(deviceContext->shmemAddr.VirtualAddress, (ULONG)deviceContext->shmemAddr.NumberOfBytes, FALSE, FALSE, NULL);
-                    if (!deviceContext->shmemMDL) {
+                    shmemMDL = IoAllocateMdl(deviceContext->shmemAddr.VirtualAddress, (ULONG)deviceContext->shmemAddr.NumberOfBytes, FALSE, FALSE, NULL);
+                    if (!shmemMDL) {
                         DEBUG_INFO("%s", "Call to IoAllocateMdl failed");
                         result = STATUS_INSUFFICIENT_RESOURCES;
                     }
-
-                    MmBuildMdlForNonPagedPool(deviceContext->shmemMDL);
+                    else
+                        MmBuildMdlForNonPagedPool(shmemMDL);
                 }
                 else {
                     DEBUG_INFO("%s", "Call to MmMapIoSpace failed");
@@ -198,7 +221,7 @@ NTSTATUS IVSHMEMEvtDevicePrepareHardware(_In_ WDFDEVICE Device, _In_ WDFCMRESLIS
                     break;
                 }
             }
-            DEBUG_INFO("memIndex = %d va = %p mdl = %p", memIndex, deviceContext->shmemAddr.VirtualAddress, deviceContext->shmemMDL);
+            DEBUG_INFO("memIndex = %d va = %p mdl = %p", memIndex, deviceContext->shmemAddr.VirtualAddress, shmemMDL);
             ++memIndex;
             continue;
         }
@@ -233,16 +256,35 @@ NTSTATUS IVSHMEMEvtDevicePrepareHardware(_In_ WDFDEVICE Device, _In_ WDFCMRESLIS
 
     if (NT_SUCCESS(result))
     {
-        if (!deviceContext->shmemMDL) {
+        if (!shmemMDL) {
             DEBUG_ERROR("%s", "shmemMDL == NULL");
             result = STATUS_DEVICE_HARDWARE_ERROR;
         }
         else
         {
-            DEBUG_INFO("Shared Memory: %llx, %lx bytes", deviceContext->shmemAddr.PhysicalAddress.QuadPart, deviceContext->shmemAddr.NumberOfBytes);
-            DEBUG_INFO("Interrupts   : %d", deviceContext->interruptsUsed);
+            deviceContext->shmemRef = (PIVSHMEMShmemRef)ExAllocatePoolWithTag(IVSHMEM_NONPAGED_POOL,
+                sizeof(IVSHMEMShmemRef), 'fRmS');
+            if (!deviceContext->shmemRef)
+            {
+                DEBUG_ERROR("%s", "Failed to allocate the shared memory reference");
+                result = STATUS_INSUFFICIENT_RESOURCES;
+            }
+            else
+            {
+                deviceContext->shmemRef->mdl  = shmemMDL;
+                deviceContext->shmemRef->refs = 1;
+                shmemMDL = NULL;
+
+                DEBUG_INFO("Shared Memory: %llx, %lx bytes", deviceContext->shmemAddr.PhysicalAddress.QuadPart, deviceContext->shmemAddr.NumberOfBytes);
+                DEBUG_INFO("Interrupts   : %d", deviceContext->interruptsUsed);
+            }
         }
     }
+
+    // not handed over to shmemRef
+    if (shmemMDL)
+        IoFreeMdl(shmemMDL);
+
     DEBUG_INFO("%s result 0x%x", __FUNCTION__, result);
     return result;
 }
@@ -255,22 +297,22 @@ NTSTATUS IVSHMEMEvtDeviceReleaseHardware(_In_ WDFDEVICE Device, _In_ WDFCMRESLIS
     PDEVICE_CONTEXT deviceContext;
     deviceContext = DeviceGetContext(Device);
 
-    if (deviceContext->devRegisters)
+    // user mode mappings belong to the file objects, they are released in
+    // IVSHMEMEvtDeviceFileCleanup in the context of the owning process and
+    // keep the shared memory MDL alive until then
+    WdfWaitLockAcquire(deviceContext->mapLock, NULL);
+    if (deviceContext->shmemRef)
     {
-        MmUnmapIoSpace(deviceContext->devRegisters, sizeof(PIVSHMEMDeviceRegisters));
-    }
-
-    if (deviceContext->shmemMap)
-    {
-        MmUnmapLockedPages(deviceContext->shmemMap, deviceContext->shmemMDL);
-        deviceContext->shmemMap = NULL;
+        IVSHMEMShmemRelease(deviceContext->shmemRef);
+        deviceContext->shmemRef = NULL;
     }
 
-    if (deviceContext->shmemMDL)
+    if (deviceContext->devRegisters)
     {
-        IoFreeMdl(deviceContext->shmemMDL);
-        deviceContext->shmemMDL = NULL;
+        MmUnmapIoSpace(deviceContext->devRegisters, sizeof(PIVSHMEMDeviceRegisters));
+        deviceContext->devRegisters = NULL;
     }
+    WdfWaitLockRelease(deviceContext->mapLock);
 
     if (deviceContext->interrupts)
     {
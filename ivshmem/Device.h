@@ -34,14 +34,22 @@ typedef struct _MM_PHYSICAL_ADDRESS_LIST {
 } MM_PHYSICAL_ADDRESS_LIST, *PMM_PHYSICAL_ADDRESS_LIST;
 #endif
 
+// the MDL of the shared memory stays alive until the hardware is released
+// and every handle that maps it has unmapped it, refs is protected by mapLock
+typedef struct IVSHMEMShmemRef
+{
+    PMDL mdl;  // memory descriptor list of the shared memory
+    LONG refs; // one for the device while it owns the hardware, one per mapping
+}
+IVSHMEMShmemRef, *PIVSHMEMShmemRef;
+
 typedef struct _DEVICE_CONTEXT
 {
     PIVSHMEMDeviceRegisters devRegisters; // the device registers (BAR0)
 
     MM_PHYSICAL_ADDRESS_LIST   shmemAddr;               // physical address of the shared memory (BAR2)
-    PMDL                       shmemMDL;                // memory discriptor list of the shared memory
-    PVOID                      shmemMap;                // memory mapping of the shared memory
-    WDFFILEOBJECT              owner;                   // the file object that currently owns the mapping
+    PIVSHMEMShmemRef           shmemRef;                // the shared memory MDL, NULL once the hardware is released
+    WDFWAITLOCK                mapLock;                 // serializes the mapping requests of all the file objects
     UINT16                     interruptCount;          // the number of interrupt entries allocated
     UINT16                     interruptsUsed;          // the number of interrupt entries used
     WDFINTERRUPT              *interrupts;              // interrupts for this device
@@ -56,6 +64,19 @@ DEVICE_CONTEXT, *PDEVICE_CONTEXT;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DEVICE_CONTEXT, DeviceGetContext)
 
+// every open handle may map its own window of the shared memory
+typedef struct _FILE_CONTEXT
+{
+    PIVSHMEMShmemRef shmemRef; // reference on the shared memory MDL held by the mapping
+    PMDL             shmemMDL; // shmemRef->mdl or a partial MDL describing the window
+    PVOID            shmemMap; // user mode mapping of the window in the owning process
+    UINT64           offset;   // offset of the window in the shared memory
+    UINT64           size;     // size of the window
+}
+FILE_CONTEXT, *PFILE_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(FILE_CONTEXT, FileGetContext)
+
 NTSTATUS IVSHMEMCreateDevice(_Inout_ PWDFDEVICE_INIT DeviceInit);
 
 EVT_WDF_DEVICE_PREPARE_HARDWARE IVSHMEMEvtDevicePrepareHardware;
@@ -65,4 +86,6 @@ EVT_WDF_DEVICE_D0_EXIT IVSHMEMEvtD0Exit;
 EVT_WDF_INTERRUPT_ISR IVSHMEMInterruptISR;
 EVT_WDF_INTERRUPT_DPC IVSHMEMInterruptDPC;
 
+VOID IVSHMEMShmemRelease(_In_ PIVSHMEMShmemRef ShmemRef);
+
 EXTERN_C_END
@@ -13,21 +13,35 @@ typedef UINT64 IVSHMEM_SIZE;
 
 /*
     This structure is for use with the IOCTL_IVSHMEM_REQUEST_MMAP IOCTL
+
+    Every handle can hold one mapping, handles from different processes may
+    map disjoint or overlapping windows of the memory at the same time.
 */
 typedef struct IVSHMEM_MMAP_CONFIG
 {
-    UINT8 cacheMode; // the caching mode of the mapping, see IVSHMEM_CACHE_* for options
+    UINT8        cacheMode; // the caching mode of the mapping, see IVSHMEM_CACHE_* for options
+    IVSHMEM_SIZE offset;    // offset of the window to map, must be page aligned
+    IVSHMEM_SIZE size;      // size of the window to map, 0 maps up to the end of the memory
 }
 IVSHMEM_MMAP_CONFIG, *PIVSHMEM_MMAP_CONFIG;
 
+/*
+    Original IOCTL_IVSHMEM_REQUEST_MMAP input, maps the whole memory
+*/
+typedef struct IVSHMEM_MMAP_CONFIG_V1
+{
+    UINT8 cacheMode; // the caching mode of the mapping, see IVSHMEM_CACHE_* for options
+}
+IVSHMEM_MMAP_CONFIG_V1, *PIVSHMEM_MMAP_CONFIG_V1;
+
 /*
     This structure is for use with the IOCTL_IVSHMEM_REQUEST_MMAP IOCTL
 */
 typedef struct IVSHMEM_MMAP
 {
     IVSHMEM_PEERID peerID;  // our peer id
-    IVSHMEM_SIZE   size;    // the size of the memory region
-    PVOID          ptr;     // pointer to the memory region
+    IVSHMEM_SIZE   size;    // the size of the mapped window
+    PVOID          ptr;     // pointer to the mapped window
     UINT16         vectors; // the number of vectors available
 }
 IVSHMEM_MMAP, *PIVSHMEM_MMAP;
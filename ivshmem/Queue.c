@@ -75,6 +75,58 @@ NTSTATUS IVSHMEMQueueInitialize(_In_ WDFDEVICE Device)
     return status;
 }
 
+// mapping and unmapping must run in the address space of the process that owns the mapping
+VOID
+IVSHMEMEvtIoInCallerContext(
+    _In_ WDFDEVICE  Device,
+    _In_ WDFREQUEST Request
+)
+{
+    PDEVICE_CONTEXT deviceContext = DeviceGetContext(Device);
+    WDF_REQUEST_PARAMETERS params;
+    size_t bytesReturned = 0;
+    NTSTATUS status;
+
+    WDF_REQUEST_PARAMETERS_INIT(&params);
+    WdfRequestGetParameters(Request, &params);
+
+    if (params.Type != WdfRequestTypeDeviceControl ||
+        (params.Parameters.DeviceIoControl.IoControlCode != IOCTL_IVSHMEM_REQUEST_MMAP &&
+         params.Parameters.DeviceIoControl.IoControlCode != IOCTL_IVSHMEM_RELEASE_MMAP))
+    {
+        status = WdfDeviceEnqueueRequest(Device, Request);
+        if (!NT_SUCCESS(status))
+            WdfRequestComplete(Request, status);
+        return;
+    }
+
+    WdfWaitLockAcquire(deviceContext->mapLock, NULL);
+    if (params.Parameters.DeviceIoControl.IoControlCode == IOCTL_IVSHMEM_REQUEST_MMAP)
+    {
+        // the hardware may be gone while handles are still open
+        if (!deviceContext->shmemRef)
+            status = STATUS_DEVICE_NOT_READY;
+        // revision 0 devices have to wait until the shared memory has been provided to the vm
+        else if (deviceContext->devRegisters->ivProvision < 0)
+        {
+            DEBUG_INFO("Device not ready yet, ivProvision = %d", deviceContext->devRegisters->ivProvision);
+            status = STATUS_DEVICE_NOT_READY;
+        }
+        else
+            status = ioctl_request_mmap(deviceContext,
+                params.Parameters.DeviceIoControl.InputBufferLength,
+                params.Parameters.DeviceIoControl.OutputBufferLength,
+                Request, &bytesReturned);
+    }
+    else
+    {
+        status = ioctl_release_mmap(deviceContext, Request, &bytesReturned);
+    }
+    WdfWaitLockRelease(deviceContext->mapLock);
+
+    WdfRequestCompleteWithInformation(Request, status, bytesReturned);
+}
+
 VOID
 IVSHMEMEvtIoDeviceControl(
     _In_ WDFQUEUE Queue,
@@ -107,13 +159,7 @@ IVSHMEMEvtIoDeviceControl(
             status = ioctl_request_size(deviceContext, OutputBufferLength, Request, &bytesReturned);
             break;
 
-        case IOCTL_IVSHMEM_REQUEST_MMAP:
-            status = ioctl_request_mmap(deviceContext, InputBufferLength, OutputBufferLength, Request, &bytesReturned);
-            break;
-
-        case IOCTL_IVSHMEM_RELEASE_MMAP:
-            status = ioctl_release_mmap(deviceContext, Request, &bytesReturned);
-            break;
+        // IOCTL_IVSHMEM_REQUEST_MMAP and IOCTL_IVSHMEM_RELEASE_MMAP are handled in IVSHMEMEvtIoInCallerContext
 
         case IOCTL_IVSHMEM_RING_DOORBELL:
             status = ioctl_ring_doorbell(deviceContext, InputBufferLength, Request, &bytesReturned);
@@ -140,6 +186,26 @@ IVSHMEMEvtIoStop(
     return;
 }
 
+// called with mapLock held in the context of the process that owns the mapping
+static VOID unmap_file(const PFILE_CONTEXT FileContext)
+{
+    if (!FileContext->shmemMap)
+        return;
+
+    MmUnmapLockedPages(FileContext->shmemMap, FileContext->shmemMDL);
+    if (FileContext->shmemMDL != FileContext->shmemRef->mdl)
+        IoFreeMdl(FileContext->shmemMDL);
+
+    // frees the shared memory MDL if the hardware was released meanwhile
+    IVSHMEMShmemRelease(FileContext->shmemRef);
+
+    FileContext->shmemRef = NULL;
+    FileContext->shmemMap = NULL;
+    FileContext->shmemMDL = NULL;
+    FileContext->offset   = 0;
+    FileContext->size     = 0;
+}
+
 VOID IVSHMEMEvtDeviceFileCleanup(_In_ WDFFILEOBJECT FileObject)
 {
     PDEVICE_CONTEXT deviceContext = DeviceGetContext(WdfFileObjectGetDevice(FileObject));
@@ -169,15 +235,9 @@ VOID IVSHMEMEvtDeviceFileCleanup(_In_ WDFFILEOBJECT FileObject)
     }
     KeReleaseSpinLock(&deviceContext->eventListLock, oldIRQL);
 
-    if (!deviceContext->shmemMap)
-        return;
-
-    if (deviceContext->owner != FileObject)
-        return;
-
-    MmUnmapLockedPages(deviceContext->shmemMap, deviceContext->shmemMDL);
-    deviceContext->shmemMap = NULL;
-    deviceContext->owner    = NULL;
+    WdfWaitLockAcquire(deviceContext->mapLock, NULL);
+    unmap_file(FileGetContext(FileObject));
+    WdfWaitLockRelease(deviceContext->mapLock);
 }
 
 static NTSTATUS ioctl_request_peerid(
@@ -238,11 +298,13 @@ static NTSTATUS ioctl_request_mmap(
     size_t              * BytesReturned
 )
 {
-    // only one mapping at a time is allowed
-    if (DeviceContext->shmemMap)
+    const PFILE_CONTEXT fileContext = FileGetContext(WdfRequestGetFileObject(Request));
+
+    // only one mapping per handle is allowed
+    if (fileContext->shmemMap)
         return STATUS_DEVICE_ALREADY_ATTACHED;
   
-    if (InputBufferLength != sizeof(IVSHMEM_MMAP_CONFIG))
+    if (InputBufferLength != sizeof(IVSHMEM_MMAP_CONFIG) && InputBufferLength != sizeof(IVSHMEM_MMAP_CONFIG_V1))
     {
         DEBUG_ERROR("IOCTL_IVSHMEM_MMAP: Invalid input size, expected %u but got %u", sizeof(IVSHMEM_MMAP_CONFIG), InputBufferLength);
         return STATUS_INVALID_BUFFER_SIZE;
@@ -254,7 +316,25 @@ static NTSTATUS ioctl_request_mmap(
         DEBUG_ERROR("%s", "IOCTL_IVSHMEM_MMAP: Failed to retrieve the input buffer");
         return STATUS_INVALID_USER_BUFFER;
     }
-  
+
+    // the original config has no window and maps everything
+    const UINT64 shmemSize = DeviceContext->shmemAddr.NumberOfBytes;
+    UINT64 offset = 0;
+    UINT64 size   = shmemSize;
+    if (InputBufferLength == sizeof(IVSHMEM_MMAP_CONFIG))
+    {
+        offset = in->offset;
+        size   = in->size ? in->size : shmemSize - min(offset, shmemSize);
+    }
+
+    // an MDL describes at most 4GB minus a page
+    if ((offset & (PAGE_SIZE - 1)) || !size || offset >= shmemSize || size > shmemSize - offset ||
+        size > (UINT64)MAXULONG + 1 - PAGE_SIZE)
+    {
+        DEBUG_ERROR("IOCTL_IVSHMEM_MMAP: Invalid window, offset %llx size %llx", offset, size);
+        return STATUS_INVALID_PARAMETER;
+    }
+
     MEMORY_CACHING_TYPE cacheType;
     switch (in->cacheMode)
     {
@@ -287,10 +367,26 @@ static NTSTATUS ioctl_request_mmap(
         return STATUS_INVALID_USER_BUFFER;
     }
   
+    // windows get a partial MDL so each process maps only the pages it asked for
+    const PIVSHMEMShmemRef shmemRef = DeviceContext->shmemRef;
+    PMDL mdl = shmemRef->mdl;
+    if (size != shmemSize)
+    {
+        PVOID va = (PUCHAR)MmGetMdlVirtualAddress(shmemRef->mdl) + offset;
+        mdl = IoAllocateMdl(va, (ULONG)size, FALSE, FALSE, NULL);
+        if (!mdl)
+        {
+            DEBUG_ERROR("%s", "IOCTL_IVSHMEM_REQUEST_MMAP: Call to IoAllocateMdl failed");
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        IoBuildPartialMdl(shmemRef->mdl, mdl, va, (ULONG)size);
+    }
+
+    PVOID map = NULL;
     __try
     {
-        DeviceContext->shmemMap = MmMapLockedPagesSpecifyCache(
-          DeviceContext->shmemMDL,
+        map = MmMapLockedPagesSpecifyCache(
+          mdl,
           UserMode,
           cacheType,
           NULL,
@@ -301,23 +397,30 @@ static NTSTATUS ioctl_request_mmap(
     __except (EXCEPTION_EXECUTE_HANDLER)
     {
         DEBUG_ERROR("%s", "IOCTL_IVSHMEM_REQUEST_MMAP: Exception trying to map pages");
-        return STATUS_DRIVER_INTERNAL_ERROR;
+        map = NULL;
     }
   
-    if (!DeviceContext->shmemMap)
+    if (!map)
     {
         DEBUG_ERROR("%s", "IOCTL_IVSHMEM_REQUEST_MMAP: shmemMap is NULL");
+        if (mdl != shmemRef->mdl)
+            IoFreeMdl(mdl);
         return STATUS_DRIVER_INTERNAL_ERROR;
     }
   
-    DeviceContext->owner = WdfRequestGetFileObject(Request);
+    ++shmemRef->refs;
+    fileContext->shmemRef = shmemRef;
+    fileContext->shmemMDL = mdl;
+    fileContext->shmemMap = map;
+    fileContext->offset   = offset;
+    fileContext->size     = size;
   #ifdef _WIN64
     if (is32Bit)
     {
         PIVSHMEM_MMAP32 out = (PIVSHMEM_MMAP32)buffer;
         out->peerID  = (UINT16)DeviceContext->devRegisters->ivProvision;
-        out->size    = (UINT64)DeviceContext->shmemAddr.NumberOfBytes;
-        out->ptr     = PtrToUint(DeviceContext->shmemMap);
+        out->size    = size;
+        out->ptr     = PtrToUint(map);
         out->vectors = DeviceContext->interruptsUsed;
     }
     else
@@ -325,8 +428,8 @@ static NTSTATUS ioctl_request_mmap(
     {
         PIVSHMEM_MMAP out = (PIVSHMEM_MMAP)buffer;
         out->peerID  = (UINT16)DeviceContext->devRegisters->ivProvision;
-        out->size    = (UINT64)DeviceContext->shmemAddr.NumberOfBytes;
-        out->ptr     = DeviceContext->shmemMap;
+        out->size    = size;
+        out->ptr     = map;
         out->vectors = DeviceContext->interruptsUsed;
     }
     
@@ -340,23 +443,18 @@ static NTSTATUS ioctl_release_mmap(
     size_t              * BytesReturned
 )
 {
-    // ensure the mapping exists
-    if (!DeviceContext->shmemMap)
+    UNREFERENCED_PARAMETER(DeviceContext);
+
+    const PFILE_CONTEXT fileContext = FileGetContext(WdfRequestGetFileObject(Request));
+
+    // ensure the mapping of this handle exists
+    if (!fileContext->shmemMap)
     {
         DEBUG_ERROR("%s", "IOCTL_IVSHMEM_RELEASE_MMAP: not mapped");
         return STATUS_INVALID_DEVICE_REQUEST;
     }
   
-    // ensure someone else other then the owner doesn't attempt to release the mapping
-    if (DeviceContext->owner != WdfRequestGetFileObject(Request))
-    {
-        DEBUG_ERROR("%s", "IOCTL_IVSHMEM_RELEASE_MMAP: Invalid owner");
-        return STATUS_INVALID_HANDLE;
-    }
-  
-    MmUnmapLockedPages(DeviceContext->shmemMap, DeviceContext->shmemMDL);
-    DeviceContext->shmemMap = NULL;
-    DeviceContext->owner    = NULL;
+    unmap_file(fileContext);
     *BytesReturned = 0;
     return STATUS_SUCCESS;
 }
@@ -368,8 +466,8 @@ static NTSTATUS ioctl_ring_doorbell(
     size_t              * BytesReturned
 )
 {
-    // ensure someone else other then the owner doesn't attempt to trigger IRQs
-    if (DeviceContext->owner != WdfRequestGetFileObject(Request))
+    // only handles that map the memory may trigger IRQs
+    if (!FileGetContext(WdfRequestGetFileObject(Request))->shmemMap)
     {
         DEBUG_ERROR("%s", "IOCTL_IVSHMEM_RING_DOORBELL: Invalid owner");
         return STATUS_INVALID_HANDLE;
@@ -403,8 +501,8 @@ static NTSTATUS ioctl_register_event(
     size_t              * BytesReturned
 )
 {
-    // ensure someone else other then the owner isn't attempting to register events
-    if (DeviceContext->owner != WdfRequestGetFileObject(Request))
+    // only handles that map the memory may register events
+    if (!FileGetContext(WdfRequestGetFileObject(Request))->shmemMap)
     {
         DEBUG_ERROR("%s", "IOCTL_IVSHMEM_REGISTER_EVENT: Invalid owner");
         return STATUS_INVALID_HANDLE;
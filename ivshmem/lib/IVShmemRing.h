@@ -0,0 +1,342 @@
+#pragma once
+
+/*
+    Single-producer/single-consumer message ring on top of IVSHMEM memory.
+
+    The shared region holds an IVSHMEM_SPSC_RING_SHARED header followed by
+    slotCount slots of slotSize bytes each; every slot starts with a UINT32
+    payload length. head and tail are free running counters, each written
+    by one side only and kept in its own cache line next to the waiting flag
+    that side checks after publishing, so the fast path never bounces a line
+    between the producer and the consumer. Both sides also cache the last
+    seen peer index and only reload it when the ring looks full/empty.
+
+    Doorbell suppression: a side that is about to sleep sets its waiting
+    flag, issues a full barrier and checks the ring once more. The other
+    side publishes its index, issues a full barrier and rings the doorbell
+    only if the flag is set, clearing it by exchange so one sleep costs at
+    most one IOCTL_IVSHMEM_RING_DOORBELL. Batching several messages per
+    IVShmemRingPublish/IVShmemRingRelease coalesces the notifications further.
+
+    The header is plain C and builds for POSIX too, so two processes sharing
+    a memfd can stand in for the peer.
+*/
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <stdint.h>
+#include <string.h>
+typedef uint8_t  UINT8;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef int32_t  LONG;
+typedef int      BOOL;
+#ifndef TRUE
+#define TRUE  1
+#define FALSE 0
+#endif
+#endif
+
+#define IVSHMEM_RING_MAGIC      0x474E5249 // 'IRNG'
+#define IVSHMEM_RING_CACHE_LINE 64
+
+#if defined(_MSC_VER)
+#define IVSHMEM_RING_ALIGN __declspec(align(IVSHMEM_RING_CACHE_LINE))
+#define IVSHMEM_RING_INLINE static __forceinline
+#else
+#define IVSHMEM_RING_ALIGN __attribute__((aligned(IVSHMEM_RING_CACHE_LINE)))
+#define IVSHMEM_RING_INLINE static inline __attribute__((always_inline))
+#endif
+
+#if defined(_MSC_VER) && (defined(_M_ARM) || defined(_M_ARM64))
+#define IVSHMEM_RING_LOAD_ACQUIRE(p)     ReadAcquire(p)
+#define IVSHMEM_RING_STORE_RELEASE(p, v) WriteRelease(p, v)
+#define IVSHMEM_RING_FENCE()             MemoryBarrier()
+#define IVSHMEM_RING_EXCHANGE(p, v)      InterlockedExchange(p, v)
+#elif defined(_MSC_VER)
+// x86/x64 only reorder stores after loads, a compiler barrier is enough here
+IVSHMEM_RING_INLINE LONG IVShmemRingLoadAcquire(volatile LONG * p)
+{
+    LONG v = *p;
+    _ReadWriteBarrier();
+    return v;
+}
+IVSHMEM_RING_INLINE void IVShmemRingStoreRelease(volatile LONG * p, LONG v)
+{
+    _ReadWriteBarrier();
+    *p = v;
+}
+#define IVSHMEM_RING_LOAD_ACQUIRE(p)     IVShmemRingLoadAcquire(p)
+#define IVSHMEM_RING_STORE_RELEASE(p, v) IVShmemRingStoreRelease(p, v)
+#define IVSHMEM_RING_FENCE()             MemoryBarrier()
+#define IVSHMEM_RING_EXCHANGE(p, v)      InterlockedExchange(p, v)
+#else
+#define IVSHMEM_RING_LOAD_ACQUIRE(p)     __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define IVSHMEM_RING_STORE_RELEASE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define IVSHMEM_RING_FENCE()             __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define IVSHMEM_RING_EXCHANGE(p, v)      __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST)
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+    Shared ring header, lives at the start of the ring memory
+*/
+typedef struct IVSHMEM_SPSC_RING_SHARED
+{
+    // set up by IVShmemRingInit and constant afterwards
+    IVSHMEM_RING_ALIGN struct
+    {
+        volatile LONG magic;
+        UINT32        slotCount; // power of two
+        UINT32        slotSize;  // bytes per slot, including the length field
+    } info;
+
+    // head is written by the producer, the flag by a sleeping consumer
+    IVSHMEM_RING_ALIGN struct
+    {
+        volatile LONG head;            // next slot the producer fills
+        volatile LONG consumerWaiting; // consumer sleeps until head moves
+    } prod;
+
+    // tail is written by the consumer, the flag by a sleeping producer
+    IVSHMEM_RING_ALIGN struct
+    {
+        volatile LONG tail;            // next slot the consumer reads
+        volatile LONG producerWaiting; // producer sleeps until tail moves
+    } cons;
+}
+IVSHMEM_SPSC_RING_SHARED, *PIVSHMEM_SPSC_RING_SHARED;
+
+// rings the doorbell of the peer, e.g. with IOCTL_IVSHMEM_RING_DOORBELL
+typedef void (*IVSHMEM_RING_NOTIFY)(void * context);
+
+/*
+    Process local view of a ring, one per side
+*/
+typedef struct IVSHMEM_SPSC_RING
+{
+    PIVSHMEM_SPSC_RING_SHARED shared;
+    UINT8              * slots;
+    UINT32               mask;
+    UINT32               slotSize;
+    UINT32               index;      // producer: unpublished head, consumer: unreleased tail
+    UINT32               published;  // last index made visible to the peer
+    UINT32               peerIndex;  // cached copy of the peer index
+    IVSHMEM_RING_NOTIFY  notify;
+    void               * notifyContext;
+    UINT64               notifications; // doorbells rung by this side
+}
+IVSHMEM_SPSC_RING, *PIVSHMEM_SPSC_RING;
+
+IVSHMEM_RING_INLINE UINT64 IVShmemRingSize(UINT32 slotCount, UINT32 slotSize)
+{
+    return sizeof(IVSHMEM_SPSC_RING_SHARED) + (UINT64)slotCount * slotSize;
+}
+
+IVSHMEM_RING_INLINE UINT32 IVShmemRingMaxPayload(const IVSHMEM_SPSC_RING * ring)
+{
+    return ring->slotSize - sizeof(UINT32);
+}
+
+// the geometry lives in shared memory, Attach must not trust what the peer wrote
+IVSHMEM_RING_INLINE BOOL IVShmemRingValidGeometry(UINT64 size, UINT32 slotCount, UINT32 slotSize)
+{
+    return slotCount && !(slotCount & (slotCount - 1)) &&
+        slotSize >= 2 * sizeof(UINT32) && !(slotSize & (sizeof(UINT64) - 1)) &&
+        size >= IVShmemRingSize(slotCount, slotSize);
+}
+
+/*
+    Formats the ring memory, done once by the side that creates the channel
+    before the peer attaches.
+*/
+IVSHMEM_RING_INLINE BOOL IVShmemRingInit(void * mem, UINT64 size, UINT32 slotCount, UINT32 slotSize)
+{
+    PIVSHMEM_SPSC_RING_SHARED shared = (PIVSHMEM_SPSC_RING_SHARED)mem;
+
+    if (((UINT64)(size_t)mem & (IVSHMEM_RING_CACHE_LINE - 1)) ||
+        !IVShmemRingValidGeometry(size, slotCount, slotSize))
+        return FALSE;
+
+    memset(shared, 0, sizeof(*shared));
+    shared->info.slotCount = slotCount;
+    shared->info.slotSize  = slotSize;
+
+    // the peer checks the magic before anything else
+    IVSHMEM_RING_STORE_RELEASE(&shared->info.magic, IVSHMEM_RING_MAGIC);
+    return TRUE;
+}
+
+/*
+    Attaches either side of a ring formatted by IVShmemRingInit. notify may
+    be NULL if the peer always polls.
+*/
+IVSHMEM_RING_INLINE BOOL IVShmemRingAttach(PIVSHMEM_SPSC_RING ring, void * mem, UINT64 size,
+    BOOL producer, IVSHMEM_RING_NOTIFY notify, void * notifyContext)
+{
+    PIVSHMEM_SPSC_RING_SHARED shared = (PIVSHMEM_SPSC_RING_SHARED)mem;
+    UINT32 slotCount, slotSize;
+
+    if (size < sizeof(*shared) ||
+        IVSHMEM_RING_LOAD_ACQUIRE(&shared->info.magic) != IVSHMEM_RING_MAGIC)
+        return FALSE;
+
+    // read once, the peer may rewrite the header after we checked it
+    slotCount = *(volatile UINT32 *)&shared->info.slotCount;
+    slotSize  = *(volatile UINT32 *)&shared->info.slotSize;
+    if (!IVShmemRingValidGeometry(size, slotCount, slotSize))
+        return FALSE;
+
+    memset(ring, 0, sizeof(*ring));
+    ring->shared        = shared;
+    ring->slots         = (UINT8 *)(shared + 1);
+    ring->mask          = slotCount - 1;
+    ring->slotSize      = slotSize;
+    ring->notify        = notify;
+    ring->notifyContext = notifyContext;
+
+    if (producer)
+    {
+        ring->index     = (UINT32)IVSHMEM_RING_LOAD_ACQUIRE(&shared->prod.head);
+        ring->peerIndex = (UINT32)IVSHMEM_RING_LOAD_ACQUIRE(&shared->cons.tail);
+    }
+    else
+    {
+        ring->index     = (UINT32)IVSHMEM_RING_LOAD_ACQUIRE(&shared->cons.tail);
+        ring->peerIndex = (UINT32)IVSHMEM_RING_LOAD_ACQUIRE(&shared->prod.head);
+    }
+    ring->published = ring->index;
+    return TRUE;
+}
+
+// rings the doorbell if the peer announced it is going to sleep
+IVSHMEM_RING_INLINE void IVShmemRingKick(PIVSHMEM_SPSC_RING ring, volatile LONG * waiting)
+{
+    // orders the index store before the flag load, pairs with PrepareWait
+    IVSHMEM_RING_FENCE();
+    if (*waiting && IVSHMEM_RING_EXCHANGE(waiting, 0) && ring->notify)
+    {
+        ring->notify(ring->notifyContext);
+        ++ring->notifications;
+    }
+}
+
+/*
+    Producer side
+*/
+
+// returns the payload of the next free slot or NULL if the ring is full
+IVSHMEM_RING_INLINE void * IVShmemRingAlloc(PIVSHMEM_SPSC_RING ring)
+{
+    if (ring->index - ring->peerIndex > ring->mask)
+    {
+        ring->peerIndex = (UINT32)IVSHMEM_RING_LOAD_ACQUIRE(&ring->shared->cons.tail);
+        if (ring->index - ring->peerIndex > ring->mask)
+            return NULL;
+    }
+
+    return ring->slots + (size_t)(ring->index & ring->mask) * ring->slotSize + sizeof(UINT32);
+}
+
+// queues the slot returned by IVShmemRingAlloc, the consumer sees it after IVShmemRingPublish
+IVSHMEM_RING_INLINE void IVShmemRingCommit(PIVSHMEM_SPSC_RING ring, UINT32 length)
+{
+    *(UINT32 *)(ring->slots + (size_t)(ring->index & ring->mask) * ring->slotSize) = length;
+    ++ring->index;
+}
+
+IVSHMEM_RING_INLINE void IVShmemRingPublish(PIVSHMEM_SPSC_RING ring)
+{
+    if (ring->published == ring->index)
+        return;
+
+    IVSHMEM_RING_STORE_RELEASE(&ring->shared->prod.head, (LONG)ring->index);
+    ring->published = ring->index;
+    IVShmemRingKick(ring, &ring->shared->prod.consumerWaiting);
+}
+
+/*
+    Returns TRUE if the producer may sleep until the consumer rings its
+    doorbell, FALSE if space showed up meanwhile.
+*/
+IVSHMEM_RING_INLINE BOOL IVShmemRingProducerPrepareWait(PIVSHMEM_SPSC_RING ring)
+{
+    IVSHMEM_RING_STORE_RELEASE(&ring->shared->cons.producerWaiting, 1);
+    IVSHMEM_RING_FENCE();
+
+    ring->peerIndex = (UINT32)IVSHMEM_RING_LOAD_ACQUIRE(&ring->shared->cons.tail);
+    if (ring->index - ring->peerIndex <= ring->mask)
+    {
+        IVSHMEM_RING_EXCHANGE(&ring->shared->cons.producerWaiting, 0);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/*
+    Consumer side
+*/
+
+// returns the payload of the next filled slot or NULL if the ring is empty,
+// a length the peer set past the end of the slot is clamped to the slot
+IVSHMEM_RING_INLINE const void * IVShmemRingPeek(PIVSHMEM_SPSC_RING ring, UINT32 * length)
+{
+    const UINT8 * slot;
+
+    if (ring->index == ring->peerIndex)
+    {
+        ring->peerIndex = (UINT32)IVSHMEM_RING_LOAD_ACQUIRE(&ring->shared->prod.head);
+        if (ring->index == ring->peerIndex)
+            return NULL;
+    }
+
+    slot = ring->slots + (size_t)(ring->index & ring->mask) * ring->slotSize;
+
+    // the length is written by the peer, never let it reach past the slot
+    *length = *(const volatile UINT32 *)slot;
+    if (*length > IVShmemRingMaxPayload(ring))
+        *length = IVShmemRingMaxPayload(ring);
+    return slot + sizeof(UINT32);
+}
+
+// drops the slot returned by IVShmemRingPeek, the producer reuses it after IVShmemRingRelease
+IVSHMEM_RING_INLINE void IVShmemRingConsume(PIVSHMEM_SPSC_RING ring)
+{
+    ++ring->index;
+}
+
+IVSHMEM_RING_INLINE void IVShmemRingRelease(PIVSHMEM_SPSC_RING ring)
+{
+    if (ring->published == ring->index)
+        return;
+
+    IVSHMEM_RING_STORE_RELEASE(&ring->shared->cons.tail, (LONG)ring->index);
+    ring->published = ring->index;
+    IVShmemRingKick(ring, &ring->shared->cons.producerWaiting);
+}
+
+/*
+    Returns TRUE if the consumer may sleep until the producer rings its
+    doorbell, FALSE if data showed up meanwhile.
+*/
+IVSHMEM_RING_INLINE BOOL IVShmemRingConsumerPrepareWait(PIVSHMEM_SPSC_RING ring)
+{
+    IVSHMEM_RING_STORE_RELEASE(&ring->shared->prod.consumerWaiting, 1);
+    IVSHMEM_RING_FENCE();
+
+    ring->peerIndex = (UINT32)IVSHMEM_RING_LOAD_ACQUIRE(&ring->shared->prod.head);
+    if (ring->index != ring->peerIndex)
+    {
+        IVSHMEM_RING_EXCHANGE(&ring->shared->prod.consumerWaiting, 0);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,468 @@
+// ivshmem-ring-bench.cpp : throughput and doorbell count of the IVShmemRing channel.
+//
+// Windows: maps the IVSHMEM device and runs the consumer in a second thread,
+// doorbells go through IOCTL_IVSHMEM_RING_DOORBELL to our own peer id
+// (vector 0 wakes the consumer, vector 1 the producer).
+//
+// Linux: two processes sharing a memfd stand in for the peers, doorbells are
+// eventfd writes. Build with: g++ -O2 -I../lib ivshmem-ring-bench.cpp
+//
+// Usage: ivshmem-ring-bench [-n messages] [-s payload] [-c slots] [-b batch] [-a]
+//   -a rings the doorbell for every message, as a hand-rolled protocol would
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <winioctl.h>
+#include <SetupAPI.h>
+#include "..\Public.h"
+#else
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/IVShmemRing.h"
+
+struct BENCH_CONFIG
+{
+	UINT64 messages;
+	UINT32 payload;
+	UINT32 slots;
+	UINT32 batch;
+	bool   alwaysNotify;
+};
+
+struct BENCH_RESULT
+{
+	UINT64 doorbells;
+	UINT64 sleeps;
+	UINT64 errors;
+};
+
+// one doorbell towards each side
+struct BENCH_PEER
+{
+	void (*notify)(void * context);
+	void * notifyContext;
+	void (*wait)(void * context);
+	void * waitContext;
+};
+
+static void RunProducer(void * mem, UINT64 size, const BENCH_CONFIG * config, const BENCH_PEER * peer, BENCH_RESULT * result)
+{
+	IVSHMEM_SPSC_RING ring;
+	UINT64 seq = 0;
+
+	if (!IVShmemRingAttach(&ring, mem, size, TRUE, peer->notify, peer->notifyContext))
+	{
+		++result->errors;
+		return;
+	}
+
+	while (seq < config->messages)
+	{
+		UINT32 n;
+		for (n = 0; n < config->batch && seq < config->messages; ++n)
+		{
+			UINT8 * slot = (UINT8 *)IVShmemRingAlloc(&ring);
+			if (!slot)
+				break;
+
+			memcpy(slot, &seq, sizeof(seq));
+			IVShmemRingCommit(&ring, config->payload);
+			++seq;
+
+			if (config->alwaysNotify)
+			{
+				IVShmemRingPublish(&ring);
+				peer->notify(peer->notifyContext);
+				++result->doorbells;
+			}
+		}
+
+		IVShmemRingPublish(&ring);
+
+		if (n == 0 && IVShmemRingProducerPrepareWait(&ring))
+		{
+			peer->wait(peer->waitContext);
+			++result->sleeps;
+		}
+	}
+
+	result->doorbells += ring.notifications;
+}
+
+static void RunConsumer(void * mem, UINT64 size, const BENCH_CONFIG * config, const BENCH_PEER * peer, BENCH_RESULT * result)
+{
+	IVSHMEM_SPSC_RING ring;
+	UINT64 seq = 0;
+
+	if (!IVShmemRingAttach(&ring, mem, size, FALSE, peer->notify, peer->notifyContext))
+	{
+		++result->errors;
+		return;
+	}
+
+	while (seq < config->messages)
+	{
+		UINT32 n;
+		for (n = 0; n < config->batch; ++n)
+		{
+			UINT32 length;
+			UINT64 value;
+			const UINT8 * slot = (const UINT8 *)IVShmemRingPeek(&ring, &length);
+			if (!slot)
+				break;
+
+			memcpy(&value, slot, sizeof(value));
+			if (value != seq || length != config->payload)
+				++result->errors;
+
+			IVShmemRingConsume(&ring);
+			++seq;
+		}
+
+		IVShmemRingRelease(&ring);
+
+		if (n == 0 && IVShmemRingConsumerPrepareWait(&ring))
+		{
+			peer->wait(peer->waitContext);
+			++result->sleeps;
+		}
+	}
+
+	result->doorbells += ring.notifications;
+}
+
+static void PrintResult(const char * side, const BENCH_CONFIG * config, const BENCH_RESULT * result, double seconds)
+{
+	printf("%-8s: %.3f s, %.2f Mmsg/s, %.1f MB/s, doorbells: %llu (%.2f per 1000 msgs), sleeps: %llu, errors: %llu\n",
+		side, seconds,
+		config->messages / seconds / 1e6,
+		(double)config->messages * config->payload / seconds / (1024 * 1024),
+		(unsigned long long)result->doorbells,
+		result->doorbells * 1000.0 / config->messages,
+		(unsigned long long)result->sleeps,
+		(unsigned long long)result->errors);
+}
+
+static bool ParseArgs(int argc, char ** argv, BENCH_CONFIG * config)
+{
+	config->messages     = 10000000;
+	config->payload      = 64;
+	config->slots        = 1024;
+	config->batch        = 32;
+	config->alwaysNotify = false;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (!strcmp(argv[i], "-a"))
+			config->alwaysNotify = true;
+		else if (i + 1 < argc && !strcmp(argv[i], "-n"))
+			config->messages = strtoull(argv[++i], NULL, 0);
+		else if (i + 1 < argc && !strcmp(argv[i], "-s"))
+			config->payload = (UINT32)strtoul(argv[++i], NULL, 0);
+		else if (i + 1 < argc && !strcmp(argv[i], "-c"))
+			config->slots = (UINT32)strtoul(argv[++i], NULL, 0);
+		else if (i + 1 < argc && !strcmp(argv[i], "-b"))
+			config->batch = (UINT32)strtoul(argv[++i], NULL, 0);
+		else
+			return false;
+	}
+
+	return config->messages && config->batch && config->payload >= sizeof(UINT64);
+}
+
+static UINT32 SlotSize(const BENCH_CONFIG * config)
+{
+	// length field plus payload, rounded up to 8 bytes
+	return (UINT32)((sizeof(UINT32) + config->payload + 7) & ~7);
+}
+
+#ifdef _WIN32
+
+struct WIN_DOORBELL
+{
+	HANDLE       devHandle;
+	IVSHMEM_RING ring;
+};
+
+struct WIN_CONSUMER
+{
+	void               * mem;
+	UINT64               size;
+	const BENCH_CONFIG * config;
+	BENCH_PEER           peer;
+	BENCH_RESULT         result;
+	double               seconds;
+};
+
+static void WinNotify(void * context)
+{
+	WIN_DOORBELL * doorbell = (WIN_DOORBELL *)context;
+	IVSHMEM_RING ring = doorbell->ring;
+	DWORD returned;
+
+	DeviceIoControl(doorbell->devHandle, IOCTL_IVSHMEM_RING_DOORBELL, &ring, sizeof(ring), NULL, 0, &returned, NULL);
+}
+
+static void WinWait(void * context)
+{
+	WaitForSingleObject((HANDLE)context, INFINITE);
+}
+
+static double WinSeconds(LARGE_INTEGER start)
+{
+	LARGE_INTEGER now, freq;
+	QueryPerformanceCounter(&now);
+	QueryPerformanceFrequency(&freq);
+	return (double)(now.QuadPart - start.QuadPart) / freq.QuadPart;
+}
+
+static DWORD WINAPI WinConsumerThread(LPVOID param)
+{
+	WIN_CONSUMER * consumer = (WIN_CONSUMER *)param;
+	LARGE_INTEGER start;
+
+	QueryPerformanceCounter(&start);
+	RunConsumer(consumer->mem, consumer->size, consumer->config, &consumer->peer, &consumer->result);
+	consumer->seconds = WinSeconds(start);
+	return 0;
+}
+
+static HANDLE WinOpenDevice()
+{
+	HANDLE devHandle = INVALID_HANDLE_VALUE;
+	HDEVINFO deviceInfoSet = SetupDiGetClassDevs(&GUID_DEVINTERFACE_IVSHMEM, NULL, NULL, DIGCF_PRESENT | DIGCF_DEVICEINTERFACE);
+	SP_DEVICE_INTERFACE_DATA deviceInterfaceData;
+	PSP_DEVICE_INTERFACE_DETAIL_DATA infData;
+	DWORD reqSize = 0;
+
+	ZeroMemory(&deviceInterfaceData, sizeof(deviceInterfaceData));
+	deviceInterfaceData.cbSize = sizeof(deviceInterfaceData);
+
+	if (SetupDiEnumDeviceInterfaces(deviceInfoSet, NULL, &GUID_DEVINTERFACE_IVSHMEM, 0, &deviceInterfaceData))
+	{
+		SetupDiGetDeviceInterfaceDetail(deviceInfoSet, &deviceInterfaceData, NULL, 0, &reqSize, NULL);
+		infData = (PSP_DEVICE_INTERFACE_DETAIL_DATA)malloc(reqSize);
+		if (infData)
+		{
+			infData->cbSize = sizeof(SP_DEVICE_INTERFACE_DETAIL_DATA);
+			if (SetupDiGetDeviceInterfaceDetail(deviceInfoSet, &deviceInterfaceData, infData, reqSize, NULL, NULL))
+				devHandle = CreateFile(infData->DevicePath, 0, 0, NULL, OPEN_EXISTING, 0, 0);
+			free(infData);
+		}
+	}
+
+	SetupDiDestroyDeviceInfoList(deviceInfoSet);
+	return devHandle;
+}
+
+int main(int argc, char ** argv)
+{
+	BENCH_CONFIG config;
+	if (!ParseArgs(argc, argv, &config))
+	{
+		printf("Usage: %s [-n messages] [-s payload] [-c slots] [-b batch] [-a]\n", argv[0]);
+		return 1;
+	}
+
+	HANDLE devHandle = WinOpenDevice();
+	if (devHandle == INVALID_HANDLE_VALUE)
+	{
+		printf("Unable to open the IVSHMEM device\n");
+		return 1;
+	}
+
+	IVSHMEM_PEERID peerID = 0;
+	IVSHMEM_MMAP_CONFIG mapConfig;
+	IVSHMEM_MMAP map;
+	DWORD returned;
+
+	ZeroMemory(&mapConfig, sizeof(mapConfig));
+	mapConfig.cacheMode = IVSHMEM_CACHE_CACHED;
+	ZeroMemory(&map, sizeof(map));
+	if (!DeviceIoControl(devHandle, IOCTL_IVSHMEM_REQUEST_PEERID, NULL, 0, &peerID, sizeof(peerID), &returned, NULL) ||
+		!DeviceIoControl(devHandle, IOCTL_IVSHMEM_REQUEST_MMAP, &mapConfig, sizeof(mapConfig), &map, sizeof(map), &returned, NULL))
+	{
+		printf("Unable to map the shared memory: 0x%x\n", GetLastError());
+		CloseHandle(devHandle);
+		return 1;
+	}
+
+	if (map.vectors < 2 || map.size < IVShmemRingSize(config.slots, SlotSize(&config)) ||
+		!IVShmemRingInit(map.ptr, map.size, config.slots, SlotSize(&config)))
+	{
+		printf("The device needs 2 vectors and %llu bytes of shared memory\n",
+			(unsigned long long)IVShmemRingSize(config.slots, SlotSize(&config)));
+		CloseHandle(devHandle);
+		return 1;
+	}
+
+	// vector 0 wakes the consumer, vector 1 the producer
+	IVSHMEM_EVENT event[2];
+	WIN_DOORBELL doorbell[2];
+	for (UINT16 i = 0; i < 2; ++i)
+	{
+		event[i].vector = i;
+		event[i].event = CreateEvent(NULL, FALSE, FALSE, NULL);
+		event[i].singleShot = FALSE;
+		if (!event[i].event ||
+			!DeviceIoControl(devHandle, IOCTL_IVSHMEM_REGISTER_EVENT, &event[i], sizeof(event[i]), NULL, 0, &returned, NULL))
+		{
+			printf("Unable to register the event for vector %u\n", i);
+			CloseHandle(devHandle);
+			return 1;
+		}
+
+		doorbell[i].devHandle = devHandle;
+		doorbell[i].ring.peerID = peerID;
+		doorbell[i].ring.vector = i;
+	}
+
+	WIN_CONSUMER consumer;
+	ZeroMemory(&consumer, sizeof(consumer));
+	consumer.mem = map.ptr;
+	consumer.size = map.size;
+	consumer.config = &config;
+	consumer.peer.notify = WinNotify;
+	consumer.peer.notifyContext = &doorbell[1];
+	consumer.peer.wait = WinWait;
+	consumer.peer.waitContext = event[0].event;
+
+	BENCH_PEER producerPeer;
+	producerPeer.notify = WinNotify;
+	producerPeer.notifyContext = &doorbell[0];
+	producerPeer.wait = WinWait;
+	producerPeer.waitContext = event[1].event;
+
+	BENCH_RESULT result;
+	ZeroMemory(&result, sizeof(result));
+
+	LARGE_INTEGER start;
+	QueryPerformanceCounter(&start);
+
+	HANDLE thread = CreateThread(NULL, 0, WinConsumerThread, &consumer, 0, NULL);
+	if (!thread)
+	{
+		printf("Unable to start the consumer thread\n");
+		CloseHandle(devHandle);
+		return 1;
+	}
+
+	RunProducer(map.ptr, map.size, &config, &producerPeer, &result);
+	double seconds = WinSeconds(start);
+
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+
+	PrintResult("producer", &config, &result, seconds);
+	PrintResult("consumer", &config, &consumer.result, consumer.seconds);
+
+	DeviceIoControl(devHandle, IOCTL_IVSHMEM_RELEASE_MMAP, NULL, 0, NULL, 0, &returned, NULL);
+	CloseHandle(devHandle);
+	CloseHandle(event[0].event);
+	CloseHandle(event[1].event);
+
+	return (result.errors || consumer.result.errors) ? 1 : 0;
+}
+
+#else
+
+static void EventfdNotify(void * context)
+{
+	uint64_t value = 1;
+	if (write((int)(intptr_t)context, &value, sizeof(value)) != sizeof(value))
+		perror("write");
+}
+
+static void EventfdWait(void * context)
+{
+	uint64_t value;
+	if (read((int)(intptr_t)context, &value, sizeof(value)) != sizeof(value))
+		perror("read");
+}
+
+static double Seconds(const struct timespec * start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char ** argv)
+{
+	BENCH_CONFIG config;
+	if (!ParseArgs(argc, argv, &config))
+	{
+		printf("Usage: %s [-n messages] [-s payload] [-c slots] [-b batch] [-a]\n", argv[0]);
+		return 1;
+	}
+
+	UINT64 size = IVShmemRingSize(config.slots, SlotSize(&config));
+	int memFd = memfd_create("ivshmem-ring-bench", 0);
+	if (memFd < 0 || ftruncate(memFd, (off_t)size) < 0)
+	{
+		perror("memfd");
+		return 1;
+	}
+
+	void * mem = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, memFd, 0);
+	if (mem == MAP_FAILED || !IVShmemRingInit(mem, size, config.slots, SlotSize(&config)))
+	{
+		printf("Unable to set up the ring\n");
+		return 1;
+	}
+
+	// wakeConsumer is rung by the producer and the other way round
+	int wakeConsumer = eventfd(0, 0);
+	int wakeProducer = eventfd(0, 0);
+	if (wakeConsumer < 0 || wakeProducer < 0)
+	{
+		perror("eventfd");
+		return 1;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	BENCH_RESULT result;
+	memset(&result, 0, sizeof(result));
+
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		perror("fork");
+		return 1;
+	}
+
+	if (pid == 0)
+	{
+		// the peer only shares the memfd mapping with the parent
+		BENCH_PEER peer = { EventfdNotify, (void *)(intptr_t)wakeProducer, EventfdWait, (void *)(intptr_t)wakeConsumer };
+		RunConsumer(mem, size, &config, &peer, &result);
+		PrintResult("consumer", &config, &result, Seconds(&start));
+		fflush(stdout);
+		_exit(result.errors ? 1 : 0);
+	}
+
+	BENCH_PEER peer = { EventfdNotify, (void *)(intptr_t)wakeConsumer, EventfdWait, (void *)(intptr_t)wakeProducer };
+	RunProducer(mem, size, &config, &peer, &result);
+	PrintResult("producer", &config, &result, Seconds(&start));
+
+	int status = 0;
+	waitpid(pid, &status, 0);
+
+	munmap(mem, (size_t)size);
+	close(memFd);
+
+	return (result.errors || !WIFEXITED(status) || WEXITSTATUS(status)) ? 1 : 0;
+}
+
+#endif
@@ -102,6 +102,7 @@ int main()
 
 		TEST_START("IOCTL_IVSHMEM_REQUEST_MMAP");
 		IVSHMEM_MMAP_CONFIG config;
+		ZeroMemory(&config, sizeof(IVSHMEM_MMAP_CONFIG));
 		config.cacheMode = IVSHMEM_CACHE_NONCACHED;
 		IVSHMEM_MMAP map;
 		ZeroMemory(&map, sizeof(IVSHMEM_MMAP));
@@ -125,23 +126,60 @@ int main()
 		TEST_PASS();
 
 		TEST_START("Mapping more then once fails");
-		if (DeviceIoControl(devHandle, IOCTL_IVSHMEM_REQUEST_MMAP, NULL, 0, &map, sizeof(IVSHMEM_MMAP), &ulReturnedLength, NULL))
+		if (DeviceIoControl(devHandle, IOCTL_IVSHMEM_REQUEST_MMAP, &config, sizeof(IVSHMEM_MMAP_CONFIG), &map, sizeof(IVSHMEM_MMAP), &ulReturnedLength, NULL))
 		{
 			TEST_FAIL("mapping succeeded, this should not happen!");
 			break;
 		}
 		TEST_PASS();
 
-		TEST_START("Mapping from another handle fails");
+		TEST_START("Partial write-combined mapping from another handle");
 		HANDLE devHandle2 = CreateFile(infData->DevicePath, 0, 0, NULL, OPEN_EXISTING, 0, 0);
-		if (!devHandle2)
+		if (devHandle2 == INVALID_HANDLE_VALUE)
 		{
 			TEST_FAIL("Failed to open second handle");
 			break;
 		}
-		if (DeviceIoControl(devHandle, IOCTL_IVSHMEM_REQUEST_MMAP, NULL, 0, &map, sizeof(IVSHMEM_MMAP), &ulReturnedLength, NULL))
+		IVSHMEM_MMAP_CONFIG config2;
+		config2.cacheMode = IVSHMEM_CACHE_WRITECOMBINED;
+		config2.offset    = size > 4096 ? 4096 : 0;
+		config2.size      = 0;
+		IVSHMEM_MMAP map2;
+		ZeroMemory(&map2, sizeof(IVSHMEM_MMAP));
+		if (!DeviceIoControl(devHandle2, IOCTL_IVSHMEM_REQUEST_MMAP, &config2, sizeof(IVSHMEM_MMAP_CONFIG), &map2, sizeof(IVSHMEM_MMAP), &ulReturnedLength, NULL))
+		{
+			TEST_FAIL("DeviceIoControl");
+			CloseHandle(devHandle2);
+			break;
+		}
+		if (!map2.ptr || map2.size != size - config2.offset)
+		{
+			TEST_FAIL("Incorrect window returned");
+			CloseHandle(devHandle2);
+			break;
+		}
+		((volatile unsigned char *)map2.ptr)[0] = 0x55;
+		if (((volatile unsigned char *)map.ptr)[config2.offset] != 0x55)
+		{
+			TEST_FAIL("Windows do not alias the same memory");
+			CloseHandle(devHandle2);
+			break;
+		}
+		CloseHandle(devHandle2);
+		TEST_PASS();
+
+		TEST_START("Unaligned window fails");
+		devHandle2 = CreateFile(infData->DevicePath, 0, 0, NULL, OPEN_EXISTING, 0, 0);
+		if (devHandle2 == INVALID_HANDLE_VALUE)
+		{
+			TEST_FAIL("Failed to open second handle");
+			break;
+		}
+		config2.offset = 1;
+		if (DeviceIoControl(devHandle2, IOCTL_IVSHMEM_REQUEST_MMAP, &config2, sizeof(IVSHMEM_MMAP_CONFIG), &map2, sizeof(IVSHMEM_MMAP), &ulReturnedLength, NULL))
 		{
 			TEST_FAIL("mapping succeeded, this should not happen!");
+			CloseHandle(devHandle2);
 			break;
 		}
 		CloseHandle(devHandle2);
@@ -174,7 +212,7 @@ int main()
 			TEST_FAIL("Failed to re-open handle");
 			break;
 		}
-		if (!DeviceIoControl(devHandle, IOCTL_IVSHMEM_REQUEST_MMAP, NULL, 0, &map, sizeof(IVSHMEM_MMAP), &ulReturnedLength, NULL))
+		if (!DeviceIoControl(devHandle, IOCTL_IVSHMEM_REQUEST_MMAP, &config, sizeof(IVSHMEM_MMAP_CONFIG), &map, sizeof(IVSHMEM_MMAP), &ulReturnedLength, NULL))
 		{
 			TEST_FAIL("Mapping failed!");
 			break;
@@ -190,7 +228,7 @@ int main()
 			TEST_FAIL("Failed to re-open handle");
 			break;
 		}
-		if (!DeviceIoControl(devHandle, IOCTL_IVSHMEM_REQUEST_MMAP, NULL, 0, &map, sizeof(IVSHMEM_MMAP), &ulReturnedLength, NULL))
+		if (!DeviceIoControl(devHandle, IOCTL_IVSHMEM_REQUEST_MMAP, &config, sizeof(IVSHMEM_MMAP_CONFIG), &map, sizeof(IVSHMEM_MMAP), &ulReturnedLength, NULL))
 		{
 			TEST_FAIL("Mapping failed!");
 			break;
@@ -56,10 +56,44 @@ typedef struct _VIRTIO_AUDIO_FORMAT {
 #define IOCTL_VIOAUDIO_SET_VOLUME              CTL_CODE(FILE_DEVICE_UNKNOWN, 0x810, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define IOCTL_VIOAUDIO_SET_MUTE                CTL_CODE(FILE_DEVICE_UNKNOWN, 0x811, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define IOCTL_VIOAUDIO_GET_MUTE                CTL_CODE(FILE_DEVICE_UNKNOWN, 0x812, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_VIOAUDIO_MAP_RING                CTL_CODE(FILE_DEVICE_UNKNOWN, 0x813, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_VIOAUDIO_UNMAP_RING              CTL_CODE(FILE_DEVICE_UNKNOWN, 0x814, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+typedef struct _VIRTIO_AUDIO_RING_CONFIG {
+    UINT32 period_bytes;
+    UINT32 periods;
+}VIRTIO_AUDIO_RING_CONFIG, *PVIRTIO_AUDIO_RING_CONFIG;
+
+typedef struct _VIRTIO_AUDIO_RING {
+    UINT32 size;
+    UINT32 period_bytes;
+    volatile LONG write_pos;
+    volatile LONG read_pos;
+    volatile LONG overruns;
+    UINT32 reserved;
+    UINT8  data[1];
+}VIRTIO_AUDIO_RING, *PVIRTIO_AUDIO_RING;
+
+typedef struct _VIRTIO_AUDIO_RING_MAPPING {
+    PVOID ring;
+    PVOID period_event;
+}VIRTIO_AUDIO_RING_MAPPING, *PVIRTIO_AUDIO_RING_MAPPING;
+
+#define VIRTIO_AUDIO_RING_FILL(r) \
+    ((UINT32)((r)->write_pos - (r)->read_pos + 2 * (r)->size) % (2 * (r)->size))
+
+// 10 ms periods, 8 of them in the ring
+#define VIO_RING_PERIODS_PER_SEC    100
+#define VIO_RING_PERIODS            8
 
 CVioSaveData::CVioSaveData(_In_ PUNICODE_STRING RegistryPath) :
     CSaveBackend(RegistryPath),
-    m_DevObj(NULL)
+    m_DevObj(NULL),
+    m_FileObj(NULL),
+    m_fCapture(FALSE),
+    m_Ring(NULL),
+    m_RingEvent(NULL),
+    m_RingSilence(0)
 {
 }
 
@@ -69,6 +103,13 @@ CVioSaveData::~CVioSaveData()
         // FileClose();
     }
 
+    UnmapRing();
+
+    // closes our handle to VioAudio, which also drops anything mapped with it
+    if (m_FileObj) {
+        ObDereferenceObject(m_FileObj);
+    }
+
     if (m_DevObj) {
         ObDereferenceObject(m_DevObj);
     }
@@ -82,6 +123,8 @@ NTSTATUS CVioSaveData::Initialize(ULONG StreamId, BOOL fCaptrue)
 
     UNREFERENCED_PARAMETER(StreamId);
 
+    m_fCapture = fCaptrue;
+
     ntStatus = IoGetDeviceInterfaces(
         &GUID_DEVINTERFACE_VioAudio,
         NULL,
@@ -116,6 +159,7 @@ NTSTATUS CVioSaveData::Initialize(ULONG StreamId, BOOL fCaptrue)
                 ntStatus = ObReferenceObjectByPointer(devObj, FILE_ALL_ACCESS, NULL, KernelMode);
                 if (!NT_SUCCESS(ntStatus)) {
                     DPF_ENTER(("VioAudioSaveData: ObReferenceObjectByPointer Successed with status 0x%08x\n", ntStatus));
+                    ObDereferenceObject(fileObj);
                     continue;
                 }
 
@@ -130,6 +174,7 @@ NTSTATUS CVioSaveData::Initialize(ULONG StreamId, BOOL fCaptrue)
                     );
                 if (!m_FileName.Buffer) {
                     ObDereferenceObject(devObj);
+                    ObDereferenceObject(fileObj);
                     ntStatus = STATUS_INSUFFICIENT_RESOURCES;
 
                     DPF(D_TERSE, ("[Could not allocate memory for FileName]"));
@@ -140,6 +185,8 @@ NTSTATUS CVioSaveData::Initialize(ULONG StreamId, BOOL fCaptrue)
                 RtlUnicodeStringCopy(&m_FileName, &objName);
 
                 m_DevObj = devObj;
+                // VioAudio ties the playback ring to this file object
+                m_FileObj = fileObj;
 
                 DPF_ENTER(("VioAudioSaveData: IoGetDeviceObjectPointer Successed with status 0x%08x\n", ntStatus));
                 break;
@@ -209,6 +256,8 @@ DWORD CVioSaveData::IoCtrlTo(DWORD CtrlCode, PVOID InBuffer, DWORD InSize)
     );
 
     if (irp) {
+        IoGetNextIrpStackLocation(irp)->FileObject = m_FileObj;
+
         if (IoCallDriver(m_DevObj, irp) == STATUS_PENDING) {
             KeWaitForSingleObject(&event, Executive, KernelMode, FALSE, NULL);
         }
@@ -226,6 +275,147 @@ DWORD CVioSaveData::IoCtrlTo(DWORD CtrlCode, PVOID InBuffer, DWORD InSize)
     return 0;
 }
 
+DWORD CVioSaveData::IoCtrl(DWORD CtrlCode, PVOID InBuffer, DWORD InSize, PVOID OutBuffer, DWORD OutSize)
+{
+    IO_STATUS_BLOCK ioStatus = { 0 };
+    KEVENT event;
+    PIRP irp;
+
+    if (!m_DevObj) {
+        DPF_ENTER(("VioAudioSaveData: the device object is null\n"));
+        return 0;
+    }
+
+    KeInitializeEvent(&event, NotificationEvent, FALSE);
+
+    irp = IoBuildDeviceIoControlRequest(
+        CtrlCode,
+        m_DevObj,
+        InBuffer, InSize,
+        OutBuffer, OutSize,
+        FALSE,
+        &event,
+        &ioStatus
+    );
+
+    if (irp) {
+        IoGetNextIrpStackLocation(irp)->FileObject = m_FileObj;
+
+        if (IoCallDriver(m_DevObj, irp) == STATUS_PENDING) {
+            KeWaitForSingleObject(&event, Executive, KernelMode, FALSE, NULL);
+        }
+
+        if (ioStatus.Status == 0) {
+            return ioStatus.Information;
+        }
+        else {
+            DPF_ENTER(("VioAudioSaveData: IRP for %u failed with status 0x%08x\n", CtrlCode, ioStatus.Status));
+        }
+    }
+    else {
+        DPF_ENTER(("VioAudioSaveData: Failed to get the IRP for %u\n", CtrlCode));
+    }
+
+    return 0;
+}
+
+NTSTATUS CVioSaveData::MapRing(IN PWAVEFORMATEX pWaveFormat)
+{
+    VIRTIO_AUDIO_RING_CONFIG  config = { 0 };
+    VIRTIO_AUDIO_RING_MAPPING mapping = { 0 };
+    ULONG blockAlign = max(pWaveFormat->nBlockAlign, 1);
+
+    UnmapRing();
+
+    // whole frames only, so a period never splits a sample
+    config.period_bytes = pWaveFormat->nAvgBytesPerSec / VIO_RING_PERIODS_PER_SEC;
+    config.period_bytes -= config.period_bytes % blockAlign;
+    config.period_bytes = max(config.period_bytes, blockAlign);
+    config.periods = VIO_RING_PERIODS;
+
+    if (IoCtrl(IOCTL_VIOAUDIO_MAP_RING, &config, sizeof(config), &mapping, sizeof(mapping)) != sizeof(mapping)) {
+        DPF_ENTER(("VioAudioSaveData: no playback ring, sending the data by IRP\n"));
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    m_RingSilence = (pWaveFormat->wBitsPerSample == 8) ? 0x80 : 0;
+    m_RingEvent = (PKEVENT)mapping.period_event;
+    m_Ring = (PVIRTIO_AUDIO_RING)mapping.ring;
+
+    DPF_ENTER(("VioAudioSaveData: playback ring of %u periods of %u bytes\n",
+        config.periods, config.period_bytes));
+
+    return STATUS_SUCCESS;
+}
+
+void CVioSaveData::UnmapRing()
+{
+    if (!m_Ring) {
+        return;
+    }
+
+    DPF_ENTER(("VioAudioSaveData: unmapping the playback ring, %ld bytes dropped\n", m_Ring->overruns));
+
+    m_Ring = NULL;
+    m_RingEvent = NULL;
+
+    IoCtrlTo(IOCTL_VIOAUDIO_UNMAP_RING, NULL, 0);
+}
+
+// Copies the data into the playback ring, silence if pData is NULL, and wakes
+// up VioAudio once a period is complete. Whatever does not fit is dropped.
+ULONG CVioSaveData::RingWrite(PBYTE pData, ULONG ulDataSize)
+{
+    PVIRTIO_AUDIO_RING ring = m_Ring;
+    UINT32 room, offset, chunk, copied = 0;
+    UINT32 start, pos;
+
+    room = ring->size - VIRTIO_AUDIO_RING_FILL(ring);
+    if (ulDataSize > room) {
+        InterlockedExchangeAdd(&ring->overruns, (LONG)(ulDataSize - room));
+        ulDataSize = room;
+    }
+
+    start = pos = (UINT32)ring->write_pos;
+    while (copied < ulDataSize) {
+        offset = pos % ring->size;
+        chunk = min(ulDataSize - copied, ring->size - offset);
+
+        if (pData) {
+            RtlCopyMemory(ring->data + offset, pData + copied, chunk);
+        } else {
+            RtlFillMemory(ring->data + offset, chunk, m_RingSilence);
+        }
+
+        copied += chunk;
+        pos = (pos + chunk) % (2 * ring->size);
+    }
+
+    // publishes the data before the new position
+    InterlockedExchange(&ring->write_pos, (LONG)pos);
+
+    if ((start % ring->period_bytes) + ulDataSize >= ring->period_bytes) {
+        KeSetEvent(m_RingEvent, IO_NO_INCREMENT, FALSE);
+    }
+
+    return ulDataSize;
+}
+
+// Pads the last period with silence so that VioAudio sends it.
+void CVioSaveData::RingFlush()
+{
+    UINT32 tail;
+
+    if (!m_Ring) {
+        return;
+    }
+
+    tail = (UINT32)m_Ring->write_pos % m_Ring->period_bytes;
+    if (tail) {
+        RingWrite(NULL, m_Ring->period_bytes - tail);
+    }
+}
+
 DWORD CVioSaveData::IoCtrlFrom(DWORD CtrlCode, PVOID OutBuffer, DWORD OutSize)
 {
     IO_STATUS_BLOCK ioStatus = { 0 };
@@ -250,6 +440,8 @@ DWORD CVioSaveData::IoCtrlFrom(DWORD CtrlCode, PVOID OutBuffer, DWORD OutSize)
     );
 
     if (irp) {
+        IoGetNextIrpStackLocation(irp)->FileObject = m_FileObj;
+
         if (IoCallDriver(m_DevObj, irp) == STATUS_PENDING) {
             KeWaitForSingleObject(&event, Executive, KernelMode, FALSE, NULL);
         }
@@ -284,6 +476,10 @@ NTSTATUS CVioSaveData::SetDataFormat(IN  PWAVEFORMATEX pWaveFormat)
 
     IoCtrlTo(IOCTL_VIOAUDIO_SET_FORMAT, &audioFormat, sizeof(audioFormat));
 
+    if (!m_fCapture) {
+        MapRing(pWaveFormat);
+    }
+
     return ntStatus;
 }
 
@@ -298,6 +494,11 @@ NTSTATUS CVioSaveData::SetState
         return STATUS_SUCCESS;
     }
 
+    if (NewState != KSSTATE_RUN) {
+        // the host only gets whole periods
+        RingFlush();
+    }
+
     IoCtrlTo(IOCTL_VIOAUDIO_SET_STATE, &iState, sizeof(iState));
 
     return STATUS_SUCCESS;
@@ -435,6 +636,8 @@ DWORD CVioSaveData::FileRead
     );
 
     if (irp) {
+        IoGetNextIrpStackLocation(irp)->FileObject = m_FileObj;
+
         if (IoCallDriver(m_DevObj, irp) == STATUS_PENDING) {
             KIRQL oldIrql;
 
@@ -465,6 +668,11 @@ DWORD CVioSaveData::FileRead
 
 NTSTATUS CVioSaveData::FileWrite(PBYTE pData, ULONG ulDataSize)
 {
+    if (m_Ring) {
+        RingWrite(pData, ulDataSize);
+        return STATUS_SUCCESS;
+    }
+
     return CSaveBackend::FileWrite(pData, ulDataSize);
 }
 
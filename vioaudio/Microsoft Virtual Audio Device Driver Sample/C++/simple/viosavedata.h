@@ -12,6 +12,13 @@ typedef CVioSaveData *PCVioSaveData;
 class CVioSaveData : public CSaveBackend {
 protected:
     PDEVICE_OBJECT              m_DevObj;
+    PFILE_OBJECT                m_FileObj;
+    BOOL                        m_fCapture;
+
+    // playback ring shared with VioAudio, NULL if not mapped
+    struct _VIRTIO_AUDIO_RING  *m_Ring;
+    PKEVENT                     m_RingEvent;
+    UCHAR                       m_RingSilence;
 public:
     CVioSaveData(_In_ PUNICODE_STRING RegistryPath);
     ~CVioSaveData();
@@ -76,6 +83,21 @@ protected:
     DWORD                       IoCtrlFrom(
         DWORD CtrlCode, PVOID OutBuffer, DWORD OutSize
     );
+    DWORD                       IoCtrl(
+        DWORD CtrlCode, PVOID InBuffer, DWORD InSize, PVOID OutBuffer, DWORD OutSize
+    );
+
+    NTSTATUS                    MapRing(
+        IN  PWAVEFORMATEX       pWaveFormat
+    );
+    void                        UnmapRing(
+    );
+    ULONG                       RingWrite(
+        _In_reads_bytes_opt_(ulDataSize) PBYTE pData,
+        _In_                            ULONG   ulDataSize
+    );
+    void                        RingFlush(
+    );
 };
 
 #endif
\ No newline at end of file
@@ -101,6 +101,15 @@ typedef struct _DEVICE_CONTEXT {
 
     SINGLE_LIST_ENTRY       WriteBuffersList;
 
+    // playback ring shared with the miniport, WakeUpThread is its period
+    // event; the fields below are protected by TxQueueLock
+    PVIRTIO_AUDIO_RING      PlaybackRing;
+    PUCHAR                  RingPeriodBusy;     // period is with the host
+    ULONG                   RingPostPos;        // next byte to post, modulo 2 * size
+    BOOLEAN                 RingMapped;
+    WDFFILEOBJECT           RingOwner;          // file the ring is mapped through
+    BOOLEAN                 RingStalled;        // TX queue was full when posting
+
 } DEVICE_CONTEXT, *PDEVICE_CONTEXT;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DEVICE_CONTEXT, DeviceGetContext);
@@ -277,6 +286,34 @@ VioAudioProcessInputBuffers(
     IN PDEVICE_CONTEXT DeviceContext
 );
 
+NTSTATUS
+VioAudioMapRing(
+    IN PDEVICE_CONTEXT DeviceContext,
+    IN PVIRTIO_AUDIO_RING_CONFIG Config,
+    IN WDFFILEOBJECT FileObject
+);
+
+NTSTATUS
+VioAudioUnmapRing(
+    IN PDEVICE_CONTEXT DeviceContext,
+    IN WDFFILEOBJECT FileObject
+);
+
+VOID
+VioAudioFreeRing(
+    IN PDEVICE_CONTEXT DeviceContext
+);
+
+VOID
+VioAudioResetRing(
+    IN PDEVICE_CONTEXT DeviceContext
+);
+
+VOID
+VioAudioPostRingPeriods(
+    IN PDEVICE_CONTEXT DeviceContext
+);
+
 BOOLEAN
 VioAudioReclaimConsumedBuffers(
     IN PDEVICE_CONTEXT DeviceContext
@@ -370,6 +407,11 @@ VioAudioDeviceClose(
     IN WDFFILEOBJECT FileObject
 );
 
+VOID
+VioAudioDeviceCleanup(
+    IN WDFFILEOBJECT FileObject
+);
+
 EXTERN_C_END
 
 #endif  // _PROTOTYPES_H_
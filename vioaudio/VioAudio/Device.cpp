@@ -51,7 +51,8 @@ VioAudioRoutine(
                 break;
             }
             else {
-
+                // the miniport completed a period or the TX queue has room
+                VioAudioPostRingPeriods(devCtx);
             }
         }
     }
@@ -267,6 +268,7 @@ VioAudioEvtDeviceD0Exit(
     WdfSpinLockRelease(devCtx->RxQueueLock);
 
     VioAudioReclaimConsumedBuffers(devCtx);
+    VioAudioResetRing(devCtx);
 
     VioAudioDrainQueue(devCtx->RxVirtQueue);
 
@@ -333,7 +335,7 @@ VioAudioEvtDeviceContextCleanup(
 
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_INIT, "--> %s\n", __FUNCTION__);
 
-    UNREFERENCED_PARAMETER(devCtx);
+    VioAudioFreeRing(devCtx);
 }
 
 static
@@ -424,7 +426,7 @@ Return Value:
         &fileConfig,
         VioAudioDeviceCreate,
         VioAudioDeviceClose,
-        WDF_NO_EVENT_CALLBACK
+        VioAudioDeviceCleanup
     );
 
     WdfDeviceInitSetFileObjectConfig(
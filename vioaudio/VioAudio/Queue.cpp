@@ -101,6 +101,80 @@ static NTSTATUS ioctl_send_data(
 }
 #pragma warning (pop)
 
+static NTSTATUS ioctl_map_ring(
+    const PDEVICE_CONTEXT DeviceContext,
+    const size_t          OutputBufferLength,
+    const WDFREQUEST      Request,
+    size_t              * BytesReturned
+)
+{
+    PVIRTIO_AUDIO_RING_CONFIG  config = NULL;
+    PVIRTIO_AUDIO_RING_MAPPING mapping = NULL;
+    VIRTIO_AUDIO_RING_CONFIG   ringConfig;
+    NTSTATUS                   status = STATUS_SUCCESS;
+
+    UNREFERENCED_PARAMETER(OutputBufferLength);
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_QUEUE, "%!FUNC! Entry");
+
+    // the ring is handed out by its kernel address
+    if (WdfRequestGetRequestorMode(Request) != KernelMode) {
+        return STATUS_ACCESS_DENIED;
+    }
+
+    status = WdfRequestRetrieveInputBuffer(Request, sizeof(*config), (PVOID *)&config, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, TRACE_QUEUE, "Could not get request memory buffer %!STATUS!\n",
+            status);
+        return STATUS_INVALID_USER_BUFFER;
+    }
+
+    // input and output share the system buffer
+    ringConfig = *config;
+
+    status = WdfRequestRetrieveOutputBuffer(Request, sizeof(*mapping), (PVOID *)&mapping, NULL);
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, TRACE_QUEUE, "Failed to retrieve the output buffer %!STATUS!\n",
+            status);
+        return STATUS_INVALID_USER_BUFFER;
+    }
+
+    // only a file object can be cleaned up, the ring must belong to one
+    if (WdfRequestGetFileObject(Request) == NULL) {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    status = VioAudioMapRing(DeviceContext, &ringConfig, WdfRequestGetFileObject(Request));
+    if (!NT_SUCCESS(status)) {
+        TraceEvents(TRACE_LEVEL_ERROR, TRACE_QUEUE, "Could not map the playback ring %!STATUS!\n",
+            status);
+        return status;
+    }
+
+    mapping->ring = DeviceContext->PlaybackRing;
+    mapping->period_event = &DeviceContext->WakeUpThread;
+
+    if (BytesReturned) {
+        *BytesReturned = sizeof(*mapping);
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, TRACE_QUEUE, "%!FUNC! Exit");
+
+    return STATUS_SUCCESS;
+}
+
+static NTSTATUS ioctl_unmap_ring(
+    const PDEVICE_CONTEXT DeviceContext,
+    const WDFREQUEST      Request
+)
+{
+    if (WdfRequestGetRequestorMode(Request) != KernelMode) {
+        return STATUS_ACCESS_DENIED;
+    }
+
+    return VioAudioUnmapRing(DeviceContext, WdfRequestGetFileObject(Request));
+}
+
 static NTSTATUS ioctl_set_format(
     const PDEVICE_CONTEXT DeviceContext,
     const size_t          OutputBufferLength,
@@ -492,6 +566,12 @@ Return Value:
     case IOCTL_VIOAUDIO_SET_MUTE:
         status = ioctl_send_event(deviceContext, OutputBufferLength, Request, &bytesReturned, VIRTIO_AUDIO_DEVICE_SET_MUTE);
         break;
+    case IOCTL_VIOAUDIO_MAP_RING:
+        status = ioctl_map_ring(deviceContext, OutputBufferLength, Request, &bytesReturned);
+        break;
+    case IOCTL_VIOAUDIO_UNMAP_RING:
+        status = ioctl_unmap_ring(deviceContext, Request);
+        break;
     default:
         break;
     }
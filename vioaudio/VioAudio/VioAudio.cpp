@@ -396,5 +396,20 @@ VioAudioDeviceClose(
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_PNP, "%!FUNC! Exit");
 }
 
+VOID
+VioAudioDeviceCleanup(
+    IN WDFFILEOBJECT FileObject
+)
+{
+    PDEVICE_CONTEXT deviceContext = DeviceGetContext(WdfFileObjectGetDevice(FileObject));
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_PNP, "%!FUNC! Entry");
+
+    // the playback ring dies with the file that mapped it
+    VioAudioUnmapRing(deviceContext, FileObject);
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_PNP, "%!FUNC! Exit");
+}
+
 
 #endif // !_VIO_AUDIO_H_
@@ -247,6 +247,240 @@ size_t VioAudioSendWriteBufferEntry(
     return Length;
 }
 
+// Largest playback ring the miniport can map.
+#define VIOAUDIO_RING_MAX_SIZE (1024 * 1024)
+
+NTSTATUS
+VioAudioMapRing(
+    IN PDEVICE_CONTEXT DeviceContext,
+    IN PVIRTIO_AUDIO_RING_CONFIG Config,
+    IN WDFFILEOBJECT FileObject
+)
+{
+    PVIRTIO_AUDIO_RING ring, oldRing;
+    PUCHAR busy, oldBusy;
+    UINT32 periodBytes = Config->period_bytes;
+    UINT32 periods = Config->periods;
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_QUEUEING,
+        "--> %s period_bytes: %u periods: %u\n", __FUNCTION__, periodBytes, periods);
+
+    // a period goes to the host as one buffer, page by page
+    if (periodBytes == 0 || periods < 2 ||
+        BYTES_TO_PAGES(periodBytes) + 1 > QUEUE_DESCRIPTORS ||
+        periods > VIOAUDIO_RING_MAX_SIZE / periodBytes) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    ring = (PVIRTIO_AUDIO_RING)ExAllocatePoolWithTag(NonPagedPool,
+        FIELD_OFFSET(VIRTIO_AUDIO_RING, data) + periodBytes * periods,
+        VIOAUDIO_MGMT_POOL_TAG);
+    busy = (PUCHAR)ExAllocatePoolWithTag(NonPagedPool, periods,
+        VIOAUDIO_MGMT_POOL_TAG);
+    if (ring == NULL || busy == NULL) {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_QUEUEING, "Failed to allocate the playback ring.\n");
+        if (ring != NULL) {
+            ExFreePoolWithTag(ring, VIOAUDIO_MGMT_POOL_TAG);
+        }
+        if (busy != NULL) {
+            ExFreePoolWithTag(busy, VIOAUDIO_MGMT_POOL_TAG);
+        }
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    RtlZeroMemory(ring, FIELD_OFFSET(VIRTIO_AUDIO_RING, data));
+    RtlZeroMemory(busy, periods);
+    ring->size = periodBytes * periods;
+    ring->period_bytes = periodBytes;
+
+    WdfSpinLockAcquire(DeviceContext->TxQueueLock);
+
+    oldRing = DeviceContext->PlaybackRing;
+    oldBusy = DeviceContext->RingPeriodBusy;
+    if (DeviceContext->RingMapped ||
+        (oldRing != NULL && (ULONG)oldRing->read_pos != DeviceContext->RingPostPos)) {
+        // someone else has the ring mapped, or the host still has periods
+        // of the old ring
+        WdfSpinLockRelease(DeviceContext->TxQueueLock);
+        ExFreePoolWithTag(ring, VIOAUDIO_MGMT_POOL_TAG);
+        ExFreePoolWithTag(busy, VIOAUDIO_MGMT_POOL_TAG);
+        return STATUS_DEVICE_BUSY;
+    }
+
+    DeviceContext->PlaybackRing = ring;
+    DeviceContext->RingPeriodBusy = busy;
+    DeviceContext->RingPostPos = 0;
+    DeviceContext->RingMapped = TRUE;
+    DeviceContext->RingOwner = FileObject;
+    DeviceContext->RingStalled = FALSE;
+
+    WdfSpinLockRelease(DeviceContext->TxQueueLock);
+
+    if (oldRing != NULL) {
+        ExFreePoolWithTag(oldRing, VIOAUDIO_MGMT_POOL_TAG);
+        ExFreePoolWithTag(oldBusy, VIOAUDIO_MGMT_POOL_TAG);
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_QUEUEING, "<-- %s\n", __FUNCTION__);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+VioAudioUnmapRing(
+    IN PDEVICE_CONTEXT DeviceContext,
+    IN WDFFILEOBJECT FileObject
+)
+{
+    NTSTATUS status = STATUS_INVALID_DEVICE_STATE;
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_QUEUEING, "<--> %s\n", __FUNCTION__);
+
+    // periods with the host still point into the ring, so it is only freed
+    // by the next map or with the device
+    WdfSpinLockAcquire(DeviceContext->TxQueueLock);
+    if (DeviceContext->RingMapped && DeviceContext->RingOwner == FileObject) {
+        DeviceContext->RingMapped = FALSE;
+        DeviceContext->RingOwner = NULL;
+        status = STATUS_SUCCESS;
+    }
+    WdfSpinLockRelease(DeviceContext->TxQueueLock);
+
+    return status;
+}
+
+VOID
+VioAudioFreeRing(
+    IN PDEVICE_CONTEXT DeviceContext
+)
+{
+    if (DeviceContext->PlaybackRing != NULL) {
+        ExFreePoolWithTag(DeviceContext->PlaybackRing, VIOAUDIO_MGMT_POOL_TAG);
+        ExFreePoolWithTag(DeviceContext->RingPeriodBusy, VIOAUDIO_MGMT_POOL_TAG);
+        DeviceContext->PlaybackRing = NULL;
+        DeviceContext->RingPeriodBusy = NULL;
+    }
+    DeviceContext->RingMapped = FALSE;
+    DeviceContext->RingOwner = NULL;
+}
+
+VOID
+VioAudioResetRing(
+    IN PDEVICE_CONTEXT DeviceContext
+)
+{
+    PVIRTIO_AUDIO_RING ring;
+
+    // the host is gone, whatever it did not return is lost
+    WdfSpinLockAcquire(DeviceContext->TxQueueLock);
+    ring = DeviceContext->PlaybackRing;
+    if (ring != NULL) {
+        RtlZeroMemory(DeviceContext->RingPeriodBusy, ring->size / ring->period_bytes);
+        InterlockedExchange(&ring->read_pos, (LONG)DeviceContext->RingPostPos);
+        DeviceContext->RingStalled = FALSE;
+    }
+    WdfSpinLockRelease(DeviceContext->TxQueueLock);
+}
+
+VOID
+VioAudioPostRingPeriods(
+    IN PDEVICE_CONTEXT DeviceContext
+)
+{
+    struct VirtIOBufferDescriptor sg[QUEUE_DESCRIPTORS];
+    struct virtqueue *vq = DeviceContext->TxVirtQueue;
+    PVIRTIO_AUDIO_RING ring;
+    PUCHAR period, va;
+    ULONG offset, length, posted = 0;
+    int out, prepared = 0;
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_QUEUEING, "--> %s\n", __FUNCTION__);
+
+    WdfSpinLockAcquire(DeviceContext->TxQueueLock);
+
+    ring = DeviceContext->PlaybackRing;
+    while (vq != NULL && ring != NULL && DeviceContext->RingMapped &&
+        (UINT32)(ring->write_pos - (LONG)DeviceContext->RingPostPos + 2 * ring->size) %
+        (2 * ring->size) >= ring->period_bytes) {
+
+        // the data of the period is in place once write_pos is seen
+        KeMemoryBarrier();
+
+        offset = DeviceContext->RingPostPos % ring->size;
+        if (DeviceContext->RingPeriodBusy[offset / ring->period_bytes]) {
+            break;
+        }
+
+        period = ring->data + offset;
+        va = period;
+        length = ring->period_bytes;
+        out = 0;
+        while (length > 0) {
+            sg[out].physAddr = MmGetPhysicalAddress(va);
+            sg[out].length = min(length, PAGE_SIZE - BYTE_OFFSET(va));
+
+            va += sg[out].length;
+            length -= sg[out].length;
+            out += 1;
+        }
+
+        if (virtqueue_add_buf(vq, sg, out, 0, period, NULL, 0) < 0) {
+            // VioAudioReclaimConsumedBuffers wakes us up again
+            DeviceContext->RingStalled = TRUE;
+            break;
+        }
+
+        DeviceContext->RingPeriodBusy[offset / ring->period_bytes] = TRUE;
+        DeviceContext->RingPostPos = (DeviceContext->RingPostPos + ring->period_bytes) %
+            (2 * ring->size);
+        posted++;
+    }
+
+    if (posted) {
+        prepared = virtqueue_kick_prepare(vq);
+    }
+
+    WdfSpinLockRelease(DeviceContext->TxQueueLock);
+
+    if (prepared) {
+        // notify can run without the lock held
+        virtqueue_notify(vq);
+    }
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_QUEUEING, "<-- %s posted: %u\n", __FUNCTION__, posted);
+}
+
+// Called with TxQueueLock held. Returns TRUE if Buffer is a period of the
+// playback ring.
+static
+BOOLEAN
+VioAudioReclaimRingPeriodLocked(
+    IN PDEVICE_CONTEXT DeviceContext,
+    IN PVOID Buffer
+)
+{
+    PVIRTIO_AUDIO_RING ring = DeviceContext->PlaybackRing;
+    ULONG pos;
+
+    if (ring == NULL || (PUCHAR)Buffer < ring->data ||
+        (PUCHAR)Buffer >= ring->data + ring->size) {
+        return FALSE;
+    }
+
+    DeviceContext->RingPeriodBusy[((PUCHAR)Buffer - ring->data) / ring->period_bytes] = FALSE;
+
+    // periods may come back out of order, read_pos only moves over the
+    // ones the host is done with
+    pos = (ULONG)ring->read_pos;
+    while (pos != DeviceContext->RingPostPos &&
+        !DeviceContext->RingPeriodBusy[(pos % ring->size) / ring->period_bytes]) {
+        pos = (pos + ring->period_bytes) % (2 * ring->size);
+    }
+    InterlockedExchange(&ring->read_pos, (LONG)pos);
+
+    return TRUE;
+}
+
 
 VOID 
 VioAudioProcessInputBuffers(
@@ -312,7 +546,7 @@ VioAudioReclaimConsumedBuffers(
     PVOID buffer;
     UINT len;
     struct virtqueue *vq = DeviceContext->TxVirtQueue;
-    BOOLEAN ret;
+    BOOLEAN ret, ringWakeUp = FALSE;
 
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_QUEUEING, "--> %s\n", __FUNCTION__);
 
@@ -320,6 +554,11 @@ VioAudioReclaimConsumedBuffers(
 
     if (vq) {
         while ((buffer = virtqueue_get_buf(vq, &len)) != NULL) {
+            if (VioAudioReclaimRingPeriodLocked(DeviceContext, buffer)) {
+                DeviceContext->TxVqFull = FALSE;
+                continue;
+            }
+
             iter = &DeviceContext->WriteBuffersList;
 
             while (iter->Next != NULL) {
@@ -356,8 +595,18 @@ VioAudioReclaimConsumedBuffers(
 
     ret = DeviceContext->TxVqFull;
 
+    if (DeviceContext->RingStalled) {
+        DeviceContext->RingStalled = FALSE;
+        ringWakeUp = TRUE;
+    }
+
     WdfSpinLockRelease(DeviceContext->TxQueueLock);
 
+    if (ringWakeUp) {
+        // there is room in the TX queue for the periods left in the ring
+        KeSetEvent(&DeviceContext->WakeUpThread, IO_NO_INCREMENT, FALSE);
+    }
+
     // no need to hold the lock to complete requests and free buffers
     while ((iter = PopEntryList(&ReclaimedList)) != NULL) {
         PWRITE_BUFFER_ENTRY entry = CONTAINING_RECORD(iter,
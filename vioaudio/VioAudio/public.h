@@ -69,5 +69,38 @@ typedef struct _VIRTIO_AUDIO_FORMAT {
 #define IOCTL_VIOAUDIO_SET_VOLUME              CTL_CODE(FILE_DEVICE_UNKNOWN, 0x810, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define IOCTL_VIOAUDIO_SET_MUTE                CTL_CODE(FILE_DEVICE_UNKNOWN, 0x811, METHOD_BUFFERED, FILE_ANY_ACCESS)
 #define IOCTL_VIOAUDIO_GET_MUTE                CTL_CODE(FILE_DEVICE_UNKNOWN, 0x812, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_VIOAUDIO_MAP_RING                CTL_CODE(FILE_DEVICE_UNKNOWN, 0x813, METHOD_BUFFERED, FILE_ANY_ACCESS)
+#define IOCTL_VIOAUDIO_UNMAP_RING              CTL_CODE(FILE_DEVICE_UNKNOWN, 0x814, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+//
+// Playback ring shared between the audio miniport and VioAudio, for kernel
+// mode callers only. The miniport writes PCM data at write_pos and sets the
+// period event once a period is complete; the VioAudio worker posts every
+// complete period to the TX virtqueue straight from the ring and moves
+// read_pos when the host returns it. Both positions run modulo 2 * size so
+// that a full ring and an empty ring differ.
+//
+typedef struct _VIRTIO_AUDIO_RING_CONFIG {
+    UINT32 period_bytes;
+    UINT32 periods;
+}VIRTIO_AUDIO_RING_CONFIG, *PVIRTIO_AUDIO_RING_CONFIG;
+
+typedef struct _VIRTIO_AUDIO_RING {
+    UINT32 size;                // period_bytes * periods
+    UINT32 period_bytes;
+    volatile LONG write_pos;    // written by the miniport
+    volatile LONG read_pos;     // written by VioAudio
+    volatile LONG overruns;     // bytes the miniport dropped on a full ring
+    UINT32 reserved;
+    UINT8  data[1];
+}VIRTIO_AUDIO_RING, *PVIRTIO_AUDIO_RING;
+
+typedef struct _VIRTIO_AUDIO_RING_MAPPING {
+    PVOID ring;                 // PVIRTIO_AUDIO_RING
+    PVOID period_event;         // PKEVENT
+}VIRTIO_AUDIO_RING_MAPPING, *PVIRTIO_AUDIO_RING_MAPPING;
+
+#define VIRTIO_AUDIO_RING_FILL(r) \
+    ((UINT32)((r)->write_pos - (r)->read_pos + 2 * (r)->size) % (2 * (r)->size))
 
 #endif // VIO_AUDIO_PUBLIC_H_
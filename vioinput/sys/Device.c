@@ -407,6 +407,7 @@ VIOInputEvtDeviceReleaseHardware(
             pClass->CleanupFunc(pClass);
         }
         VIOInputFree(&pClass->pHidReport);
+        VIOInputFree(&pClass->pReportQueue);
         VIOInputFree(&pClass);
     }
     pContext->uNumOfClasses = 0;
@@ -483,7 +484,7 @@ VIOInputFillEventQueue(PINPUT_DEVICE pContext)
         }
 
         WdfSpinLockAcquire(pContext->EventQLock);
-        status = VIOInputAddInBuf(pContext->EventQ, buf, pa);
+        status = VIOInputAddInBuf(pContext->EventQ, buf, pa, TRUE);
         WdfSpinLockRelease(pContext->EventQLock);
         if (!NT_SUCCESS(status))
         {
@@ -500,7 +501,8 @@ VIOInputAddBuf(
     IN struct virtqueue *vq,
     IN PVIRTIO_INPUT_EVENT buf,
     IN PHYSICAL_ADDRESS pa,
-    IN BOOLEAN out)
+    IN BOOLEAN out,
+    IN BOOLEAN kick)
 {
     NTSTATUS  status = STATUS_SUCCESS;
     struct VirtIOBufferDescriptor sg;
@@ -526,7 +528,10 @@ VIOInputAddBuf(
         status = STATUS_INSUFFICIENT_RESOURCES;
     }
 
-    virtqueue_kick(vq);
+    if (kick)
+    {
+        virtqueue_kick(vq);
+    }
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_QUEUEING, "<-- %s\n", __FUNCTION__);
     return status;
 }
@@ -535,9 +540,10 @@ NTSTATUS
 VIOInputAddInBuf(
     IN struct virtqueue *vq,
     IN PVIRTIO_INPUT_EVENT buf,
-    IN PHYSICAL_ADDRESS pa)
+    IN PHYSICAL_ADDRESS pa,
+    IN BOOLEAN kick)
 {
-    return VIOInputAddBuf(vq, buf, pa, FALSE);
+    return VIOInputAddBuf(vq, buf, pa, FALSE, kick);
 }
 
 NTSTATUS
@@ -547,7 +553,7 @@ VIOInputAddOutBuf(
     IN PHYSICAL_ADDRESS pa)
 {
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_QUEUEING, "%s %p\n", __FUNCTION__, buf);
-    return VIOInputAddBuf(vq, buf, pa, TRUE);
+    return VIOInputAddBuf(vq, buf, pa, TRUE, TRUE);
 }
 
 NTSTATUS
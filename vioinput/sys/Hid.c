@@ -38,6 +38,9 @@
 #include "Hid.tmh"
 #endif
 
+// HID read requests completed per round of CompleteHIDQueueRequests
+#define HID_COMPLETE_BATCH 16
+
 
 //
 // HID descriptor based on this structure is returned by the mini driver in response
@@ -123,6 +126,9 @@ EvtIoDeviceControl(
         if (NT_SUCCESS(status))
         {
             completeRequest = FALSE;
+
+            // there may be reports queued already
+            CompleteHIDQueueRequests(pContext);
         }
         else
         {
@@ -175,13 +181,13 @@ EvtIoDeviceControl(
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_IOCTLS, "<-- %s\n", __FUNCTION__);
 }
 
+// Called with EventQLock held
 static VOID
-CompleteHIDQueueRequest(
+QueueHIDReport(
     PINPUT_DEVICE pContext,
     PINPUT_CLASS_COMMON pClass)
 {
-    WDFREQUEST request;
-    NTSTATUS status;
+    ULONG uTail;
 
     if (!pClass->bDirty)
     {
@@ -189,19 +195,94 @@ CompleteHIDQueueRequest(
         return;
     }
 
-    status = WdfIoQueueRetrieveNextRequest(pContext->HidQueue, &request);
-    if (NT_SUCCESS(status))
+    if (pClass->uReportQueueCount == HID_REPORT_QUEUE_DEPTH)
     {
-        status = RequestCopyFromBuffer(
-            request,
-            pClass->pHidReport,
-            pClass->cbHidReportSize);
-        WdfRequestComplete(request, status);
-        if (NT_SUCCESS(status))
+        // nobody is reading, the oldest report goes
+        pClass->uReportQueueHead = (pClass->uReportQueueHead + 1) % HID_REPORT_QUEUE_DEPTH;
+        pClass->uReportQueueCount--;
+        pClass->uReportsDropped++;
+    }
+
+    uTail = (pClass->uReportQueueHead + pClass->uReportQueueCount) % HID_REPORT_QUEUE_DEPTH;
+    RtlCopyMemory(
+        pClass->pReportQueue + uTail * pClass->cbHidReportSize,
+        pClass->pHidReport,
+        pClass->cbHidReportSize);
+    pClass->uReportQueueSeq[uTail] = pContext->uReportSequence++;
+    pClass->uReportQueueCount++;
+    pClass->bDirty = FALSE;
+}
+
+// Completes pending HID read requests with the queued reports, the oldest
+// report of all classes first. Takes EventQLock to pair the requests with the
+// reports and completes them after dropping it, hidclass may send the next
+// read from the completion routine on the same CPU.
+VOID
+CompleteHIDQueueRequests(
+    PINPUT_DEVICE pContext)
+{
+    PINPUT_CLASS_COMMON pClass, pOldest;
+    WDFREQUEST request;
+    WDFREQUEST requests[HID_COMPLETE_BATCH];
+    NTSTATUS statuses[HID_COMPLETE_BATCH];
+    NTSTATUS status;
+    ULONG count, i;
+
+    do
+    {
+        count = 0;
+
+        WdfSpinLockAcquire(pContext->EventQLock);
+        while (count < HID_COMPLETE_BATCH)
         {
-            pClass->bDirty = FALSE;
+            pOldest = NULL;
+            for (i = 0; i < pContext->uNumOfClasses; i++)
+            {
+                pClass = pContext->InputClasses[i];
+                if (pClass->uReportQueueCount == 0)
+                {
+                    continue;
+                }
+                if (pOldest == NULL ||
+                    (LONG)(pClass->uReportQueueSeq[pClass->uReportQueueHead] -
+                           pOldest->uReportQueueSeq[pOldest->uReportQueueHead]) < 0)
+                {
+                    pOldest = pClass;
+                }
+            }
+            if (pOldest == NULL)
+            {
+                // all reports sent
+                break;
+            }
+
+            status = WdfIoQueueRetrieveNextRequest(pContext->HidQueue, &request);
+            if (!NT_SUCCESS(status))
+            {
+                // no request waiting, the reports stay queued
+                break;
+            }
+
+            status = RequestCopyFromBuffer(
+                request,
+                pOldest->pReportQueue + pOldest->uReportQueueHead * pOldest->cbHidReportSize,
+                pOldest->cbHidReportSize);
+            if (NT_SUCCESS(status))
+            {
+                pOldest->uReportQueueHead = (pOldest->uReportQueueHead + 1) % HID_REPORT_QUEUE_DEPTH;
+                pOldest->uReportQueueCount--;
+            }
+            requests[count] = request;
+            statuses[count] = status;
+            ++count;
         }
-    }
+        WdfSpinLockRelease(pContext->EventQLock);
+
+        for (i = 0; i < count; i++)
+        {
+            WdfRequestComplete(requests[i], statuses[i]);
+        }
+    } while (count == HID_COMPLETE_BATCH);
 }
 
 VOID
@@ -222,10 +303,10 @@ ProcessInputEvent(
 
     if (pEvent->type == EV_SYN)
     {
-        // send report(s) up
+        // queue report(s) to be sent up, CompleteHIDQueueRequests sends them
         for (i = 0; i < pContext->uNumOfClasses; i++)
         {
-            CompleteHIDQueueRequest(pContext, pContext->InputClasses[i]);
+            QueueHIDReport(pContext, pContext->InputClasses[i]);
         }
     }
 
@@ -605,6 +686,18 @@ RegisterClass(
         }
     }
 
+    // allocate the ring of reports waiting to be read
+    if (pClass->pReportQueue == NULL)
+    {
+        pClass->pReportQueue = VIOInputAlloc(HID_REPORT_QUEUE_DEPTH * pClass->cbHidReportSize);
+        if (pClass->pReportQueue == NULL)
+        {
+            // the class is not registered, nobody else frees the report
+            VIOInputFree(&pClass->pHidReport);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
     // insert the class into our array
     pContext->InputClasses[pContext->uNumOfClasses++] = pClass;
     return STATUS_SUCCESS;
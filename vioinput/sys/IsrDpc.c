@@ -144,23 +144,34 @@ VIOInputQueuesInterruptDpc(
     PVIRTIO_INPUT_EVENT pEvent;
     PVIRTIO_INPUT_EVENT_WITH_REQUEST pEventReq;
     UINT len;
+    ULONG added = 0;
 
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_DPC, "--> %s\n", __FUNCTION__);
 
     WdfSpinLockAcquire(pContext->EventQLock);
     while ((pEvent = virtqueue_get_buf(pContext->EventQ, &len)) != NULL)
     {
-        // translate event to a HID report and complete a pending HID request
+        // translate event to a HID report, queued on EV_SYN
         ProcessInputEvent(pContext, pEvent);
 
         // add the buffer back to the queue
         VIOInputAddInBuf(
             pContext->EventQ,
             pEvent,
-            VirtIOWdfDeviceGetPhysicalAddress(&pContext->VDevice.VIODevice, pEvent));
+            VirtIOWdfDeviceGetPhysicalAddress(&pContext->VDevice.VIODevice, pEvent),
+            FALSE);
+        ++added;
+    }
+    if (added)
+    {
+        // one notification for the whole batch
+        virtqueue_kick(pContext->EventQ);
     }
     WdfSpinLockRelease(pContext->EventQLock);
 
+    // hand the queued reports to the pending HID requests
+    CompleteHIDQueueRequests(pContext);
+
     WdfSpinLockAcquire(pContext->StatusQLock);
     while ((pEventReq = virtqueue_get_buf(pContext->StatusQ, &len)) != NULL)
     {
@@ -68,6 +68,9 @@ typedef struct virtio_input_event
 
 struct _tagInputDevice;
 
+// reports kept per input class while no HID read request is pending
+#define HID_REPORT_QUEUE_DEPTH 32
+
 typedef struct _tagInputClassCommon
 {
 // the first byte of a HID report is always report ID
@@ -83,6 +86,17 @@ typedef struct _tagInputClassCommon
     // the HID report is dirty and should be sent up
     BOOLEAN bDirty;
 
+    // ring of reports taken at EV_SYN and waiting for a HID read request,
+    // HID_REPORT_QUEUE_DEPTH entries of cbHidReportSize bytes each
+    PUCHAR pReportQueue;
+    ULONG uReportQueueHead;
+    ULONG uReportQueueCount;
+    // device wide sequence number of each queued report, keeps the order
+    // between classes
+    ULONG uReportQueueSeq[HID_REPORT_QUEUE_DEPTH];
+    // reports dropped because the ring was full
+    ULONG uReportsDropped;
+
     NTSTATUS(*EventToReportFunc)(struct _tagInputClassCommon *pClass, PVIRTIO_INPUT_EVENT pEvent);
     NTSTATUS(*ReportToEventFunc)(struct _tagInputClassCommon *pClass, struct _tagInputDevice *pContext,
                                  WDFREQUEST Request, PUCHAR pReport, ULONG cbReport);
@@ -101,6 +115,7 @@ typedef struct _tagInputDevice
     struct virtqueue       *EventQ;
     struct virtqueue       *StatusQ;
 
+    // also protects the report queues of the input classes
     WDFSPINLOCK            EventQLock;
     WDFSPINLOCK            StatusQLock;
 
@@ -121,6 +136,7 @@ typedef struct _tagInputDevice
     // for one device class (e.g. mouse)
     PINPUT_CLASS_COMMON    InputClasses[MAX_INPUT_CLASS_COUNT];
     ULONG                  uNumOfClasses;
+    ULONG                  uReportSequence;
 } INPUT_DEVICE, *PINPUT_DEVICE;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(INPUT_DEVICE, GetDeviceContext)
@@ -267,7 +283,8 @@ NTSTATUS
 VIOInputAddInBuf(
     IN struct virtqueue *vq,
     IN PVIRTIO_INPUT_EVENT buf,
-    IN PHYSICAL_ADDRESS pa
+    IN PHYSICAL_ADDRESS pa,
+    IN BOOLEAN kick
 );
 
 NTSTATUS
@@ -297,6 +314,11 @@ ProcessInputEvent(
     PVIRTIO_INPUT_EVENT pEvent
 );
 
+VOID
+CompleteHIDQueueRequests(
+    PINPUT_DEVICE pContext
+);
+
 NTSTATUS
 ProcessOutputReport(
     PINPUT_DEVICE pContext,
@@ -101,10 +101,6 @@ VOID VirtRngEvtInterruptDpc(IN WDFINTERRUPT Interrupt,
         WdfInterruptGetDevice(Interrupt));
     struct virtqueue *vq = context->VirtQueue;
     PREAD_BUFFER_ENTRY entry;
-    PSINGLE_LIST_ENTRY iter;
-    NTSTATUS status;
-    PVOID buffer;
-    size_t bufferLen;
     unsigned int length;
 
     UNREFERENCED_PARAMETER(AssociatedObject);
@@ -112,79 +108,31 @@ VOID VirtRngEvtInterruptDpc(IN WDFINTERRUPT Interrupt,
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_DPC,
         "--> %!FUNC! Interrupt: %p", Interrupt);
 
-    for (;;)
-    {
-        WdfSpinLockAcquire(context->VirtQueueLock);
-
-        entry = (PREAD_BUFFER_ENTRY)virtqueue_get_buf(vq, &length);
-        if (entry == NULL)
-        {
-            WdfSpinLockRelease(context->VirtQueueLock);
-            break;
-        }
+    WdfSpinLockAcquire(context->VirtQueueLock);
 
+    while ((entry = (PREAD_BUFFER_ENTRY)virtqueue_get_buf(vq, &length)) != NULL)
+    {
         TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ,
-            "Got %p Request: %p Buffer: %p",
-            entry, entry->Request, context->SingleBufferVA);
+            "Got %p Buffer: %p Length: %u", entry, entry->VirtualAddress,
+            length);
 
-        iter = &context->ReadBuffersList;
-        while (iter->Next != NULL)
-        {
-            PREAD_BUFFER_ENTRY current = CONTAINING_RECORD(iter->Next,
-                READ_BUFFER_ENTRY, ListEntry);
-
-            if (entry == current)
-            {
-                TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ,
-                    "Delete %p Request: %p Buffer: %p",
-                    entry, entry->Request, context->SingleBufferVA);
-
-                iter->Next = current->ListEntry.Next;
-                break;
-            }
-            else
-            {
-                iter = iter->Next;
-            }
-        };
-
-        if ((entry->Request == NULL) ||
-            (WdfRequestUnmarkCancelable(entry->Request) == STATUS_CANCELLED))
-        {
-            TraceEvents(TRACE_LEVEL_INFORMATION, DBG_DPC,
-                "Ignoring a canceled read request: %p", entry->Request);
+        entry->Length = min(length, PAGE_SIZE);
+        entry->Offset = 0;
 
-            entry->Request = NULL;
+        if (entry->Length != 0)
+        {
+            InsertTailList(&context->FilledBuffersList, &entry->ListEntry);
         }
-
-        WdfSpinLockRelease(context->VirtQueueLock);
-
-        if (entry->Request != NULL)
+        else
         {
-            status = WdfRequestRetrieveOutputBuffer(entry->Request, length,
-                &buffer, &bufferLen);
-
-            if (NT_SUCCESS(status))
-            {
-                length = min(length, (unsigned)bufferLen);
-                RtlCopyMemory(buffer, context->SingleBufferVA, length);
-
-                TraceEvents(TRACE_LEVEL_VERBOSE, DBG_DPC,
-                    "Complete Request: %p Length: %d", entry->Request, length);
-
-                WdfRequestCompleteWithInformation(entry->Request,
-                    STATUS_SUCCESS, (ULONG_PTR)length);
-            }
-            else
-            {
-                TraceEvents(TRACE_LEVEL_ERROR, DBG_READ,
-                    "WdfRequestRetrieveOutputBuffer failed: %!STATUS!", status);
-                WdfRequestComplete(entry->Request, status);
-            }
+            InsertTailList(&context->IdleBuffersList, &entry->ListEntry);
         }
-
-        ExFreePoolWithTag(entry, VIRT_RNG_MEMORY_TAG);
     }
 
+    WdfSpinLockRelease(context->VirtQueueLock);
+
+    // Complete the waiting readers and re-post the consumed buffers.
+    VirtRngProcessReads(context);
+
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_DPC, "<-- %!FUNC!");
 }
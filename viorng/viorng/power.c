@@ -118,10 +118,19 @@ NTSTATUS VirtRngEvtDeviceD0Entry(IN WDFDEVICE Device,
             "VirtIOWdfInitQueues failed with %x\n", status);
     }
 
-    context->SingleBufferVA = VirtIOWdfDeviceAllocDmaMemory(&context->VDevice.VIODevice, PAGE_SIZE, 0);
-    if (context->SingleBufferVA)
+    if (NT_SUCCESS(status))
     {
-        context->SingleBufferPA = VirtIOWdfDeviceGetPhysicalAddress(&context->VDevice.VIODevice, context->SingleBufferVA);
+        // Keep the virt queue full of entropy buffers, the reads are then
+        // served from the ones the host has already filled.
+        status = VirtRngInitBuffers(context);
+        if (!NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_POWER,
+                "VirtRngInitBuffers failed with %x\n", status);
+
+            // D0Exit is not called for a failed D0Entry
+            VirtIOWdfDestroyQueues(&context->VDevice);
+        }
     }
 
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_POWER, "<-- %!FUNC!");
@@ -143,10 +152,7 @@ NTSTATUS VirtRngEvtDeviceD0Exit(IN WDFDEVICE Device,
 
     VirtIOWdfDestroyQueues(&context->VDevice);
 
-    if (context->SingleBufferVA)
-    {
-        VirtIOWdfDeviceFreeDmaMemory(&context->VDevice.VIODevice, context->SingleBufferVA);
-    }
+    VirtRngFreeBuffers(context);
 
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_POWER, "<-- %!FUNC!");
 
@@ -30,75 +30,200 @@
 #include "viorng.h"
 #include "read.tmh"
 
-EVT_WDF_REQUEST_CANCEL VirtRngEvtRequestCancel;
-
-static NTSTATUS VirtQueueAddBuffer(IN PDEVICE_CONTEXT Context,
-                                   IN WDFREQUEST Request,
-                                   IN size_t Length)
+static BOOLEAN VirtRngPostIdleBuffers(IN PDEVICE_CONTEXT Context)
 {
-    PREAD_BUFFER_ENTRY entry;
-    size_t length;
     struct virtqueue *vq = Context->VirtQueue;
     struct VirtIOBufferDescriptor sg;
-    int ret;
+    BOOLEAN posted = FALSE;
+
+    while (!IsListEmpty(&Context->IdleBuffersList))
+    {
+        PLIST_ENTRY iter = RemoveHeadList(&Context->IdleBuffersList);
+        PREAD_BUFFER_ENTRY entry = CONTAINING_RECORD(iter,
+            READ_BUFFER_ENTRY, ListEntry);
+
+        sg.physAddr = entry->PhysicalAddress;
+        sg.length = PAGE_SIZE;
+
+        if (virtqueue_add_buf(vq, &sg, 0, 1, entry, NULL, 0) < 0)
+        {
+            // The virt queue is full, retry when the host returns a buffer.
+            InsertHeadList(&Context->IdleBuffersList, &entry->ListEntry);
+            break;
+        }
+
+        TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ, "Post %p Buffer: %p",
+            entry, entry->VirtualAddress);
+
+        posted = TRUE;
+    }
+
+    return posted && virtqueue_kick_prepare(vq);
+}
+
+static ULONG VirtRngCopyFromPool(IN PDEVICE_CONTEXT Context,
+                                 IN PUCHAR Buffer,
+                                 IN ULONG Length)
+{
+    ULONG copied = 0;
+
+    while ((copied < Length) && !IsListEmpty(&Context->FilledBuffersList))
+    {
+        PREAD_BUFFER_ENTRY entry = CONTAINING_RECORD(
+            Context->FilledBuffersList.Flink, READ_BUFFER_ENTRY, ListEntry);
+        ULONG length = min(Length - copied, entry->Length - entry->Offset);
+
+        RtlCopyMemory(Buffer + copied,
+            (PUCHAR)entry->VirtualAddress + entry->Offset, length);
+
+        copied += length;
+        entry->Offset += length;
+
+        if (entry->Offset == entry->Length)
+        {
+            RemoveEntryList(&entry->ListEntry);
+            InsertTailList(&Context->IdleBuffersList, &entry->ListEntry);
+        }
+    }
+
+    return copied;
+}
+
+NTSTATUS VirtRngInitBuffers(IN PDEVICE_CONTEXT Context)
+{
+    BOOLEAN kick;
+    ULONG i;
 
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ, "--> %!FUNC!");
 
-    entry = (PREAD_BUFFER_ENTRY)ExAllocatePoolWithTag(NonPagedPool,
-        sizeof(READ_BUFFER_ENTRY), VIRT_RNG_MEMORY_TAG);
+    InitializeListHead(&Context->FilledBuffersList);
+    InitializeListHead(&Context->IdleBuffersList);
 
-    if (entry == NULL)
+    // The common buffer is physically contiguous, so each page of it can
+    // be posted as a separate descriptor.
+    Context->BuffersVA = VirtIOWdfDeviceAllocDmaMemory(
+        &Context->VDevice.VIODevice,
+        VIRT_RNG_BUFFERS_COUNT * PAGE_SIZE, 0);
+
+    if (Context->BuffersVA == NULL)
     {
         TraceEvents(TRACE_LEVEL_ERROR, DBG_READ,
-            "Failed to allocate a read entry.");
+            "Failed to allocate the RX buffers.");
         return STATUS_INSUFFICIENT_RESOURCES;
     }
 
-    length = min(Length, PAGE_SIZE);
+    Context->BuffersPA = VirtIOWdfDeviceGetPhysicalAddress(
+        &Context->VDevice.VIODevice, Context->BuffersVA);
 
-    entry->Request = Request;
+    WdfSpinLockAcquire(Context->VirtQueueLock);
 
-    sg.physAddr = Context->SingleBufferPA;
-    sg.length = (unsigned)length;
+    for (i = 0; i < VIRT_RNG_BUFFERS_COUNT; i++)
+    {
+        PREAD_BUFFER_ENTRY entry = &Context->Buffers[i];
 
-    WdfSpinLockAcquire(Context->VirtQueueLock);
+        entry->VirtualAddress = (PUCHAR)Context->BuffersVA + i * PAGE_SIZE;
+        entry->PhysicalAddress.QuadPart =
+            Context->BuffersPA.QuadPart + i * PAGE_SIZE;
+        entry->Length = 0;
+        entry->Offset = 0;
 
-    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ,
-        "Push %p Request: %p Buffer: %p",
-        entry, entry->Request, Context->SingleBufferVA);
+        InsertTailList(&Context->IdleBuffersList, &entry->ListEntry);
+    }
 
-    PushEntryList(&Context->ReadBuffersList, &entry->ListEntry);
+    kick = VirtRngPostIdleBuffers(Context);
+
+    WdfSpinLockRelease(Context->VirtQueueLock);
 
-    ret = virtqueue_add_buf(vq, &sg, 0, 1, entry, NULL, 0);
-    if (ret < 0)
+    if (kick)
     {
-        PSINGLE_LIST_ENTRY removed;
+        virtqueue_notify(Context->VirtQueue);
+    }
 
-        TraceEvents(TRACE_LEVEL_ERROR, DBG_READ,
-            "Failed to add buffer to virt queue.");
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ, "<-- %!FUNC!");
 
-        TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ,
-            "Pop %p Request: %p Buffer: %p",
-            entry, entry->Request, Context->SingleBufferVA);
+    return STATUS_SUCCESS;
+}
+
+VOID VirtRngFreeBuffers(IN PDEVICE_CONTEXT Context)
+{
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ, "--> %!FUNC!");
+
+    // The virt queue is already destroyed, the host owns no buffer anymore.
+    InitializeListHead(&Context->FilledBuffersList);
+    InitializeListHead(&Context->IdleBuffersList);
+
+    if (Context->BuffersVA)
+    {
+        VirtIOWdfDeviceFreeDmaMemory(&Context->VDevice.VIODevice,
+            Context->BuffersVA);
+        Context->BuffersVA = NULL;
+    }
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ, "<-- %!FUNC!");
+}
+
+VOID VirtRngProcessReads(IN PDEVICE_CONTEXT Context)
+{
+    WDFREQUEST request;
+    NTSTATUS status;
+    PVOID buffer;
+    size_t bufferLen;
+    ULONG copied;
+    BOOLEAN kick;
 
-        removed = PopEntryList(&Context->ReadBuffersList);
-        NT_ASSERT(entry == CONTAINING_RECORD(
-            removed, READ_BUFFER_ENTRY, ListEntry));
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ, "--> %!FUNC!");
+
+    for (;;)
+    {
+        WdfSpinLockAcquire(Context->VirtQueueLock);
+
+        if (IsListEmpty(&Context->FilledBuffersList) ||
+            !NT_SUCCESS(WdfIoQueueRetrieveNextRequest(
+                Context->PendingReadQueue, &request)))
+        {
+            WdfSpinLockRelease(Context->VirtQueueLock);
+            break;
+        }
 
-        ExFreePoolWithTag(entry, VIRT_RNG_MEMORY_TAG);
+        status = WdfRequestRetrieveOutputBuffer(request, 1, &buffer,
+            &bufferLen);
+
+        copied = 0;
+        if (NT_SUCCESS(status))
+        {
+            copied = VirtRngCopyFromPool(Context, (PUCHAR)buffer,
+                (ULONG)min(bufferLen, MAXULONG));
+        }
 
         WdfSpinLockRelease(Context->VirtQueueLock);
 
-        return STATUS_UNSUCCESSFUL;
+        if (NT_SUCCESS(status))
+        {
+            TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ,
+                "Complete Request: %p Length: %d", request, copied);
+
+            WdfRequestCompleteWithInformation(request, STATUS_SUCCESS,
+                (ULONG_PTR)copied);
+        }
+        else
+        {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_READ,
+                "WdfRequestRetrieveOutputBuffer failed: %!STATUS!", status);
+            WdfRequestComplete(request, status);
+        }
     }
 
+    // Give the consumed buffers back to the host.
+    WdfSpinLockAcquire(Context->VirtQueueLock);
+    kick = VirtRngPostIdleBuffers(Context);
     WdfSpinLockRelease(Context->VirtQueueLock);
 
-    virtqueue_kick(vq);
+    if (kick)
+    {
+        virtqueue_notify(Context->VirtQueue);
+    }
 
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ, "<-- %!FUNC!");
-
-    return STATUS_SUCCESS;
 }
 
 VOID VirtRngEvtIoRead(IN WDFQUEUE Queue,
@@ -108,6 +233,8 @@ VOID VirtRngEvtIoRead(IN WDFQUEUE Queue,
     PDEVICE_CONTEXT context = GetDeviceContext(WdfIoQueueGetDevice(Queue));
     NTSTATUS status;
     PVOID buffer;
+    ULONG copied;
+    BOOLEAN kick;
 
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ,
         "--> %!FUNC! Queue: %p Request: %p Length: %d",
@@ -122,93 +249,51 @@ VOID VirtRngEvtIoRead(IN WDFQUEUE Queue,
         return;
     }
 
-    if (!context->SingleBufferPA.QuadPart || !context->SingleBufferVA)
+    if (!context->BuffersVA)
     {
         TraceEvents(TRACE_LEVEL_ERROR, DBG_READ,
-            "The RX buffer is not allocated!");
+            "The RX buffers are not allocated!");
         WdfRequestComplete(Request, STATUS_INSUFFICIENT_RESOURCES);
         return;
     }
 
-    status = WdfRequestMarkCancelableEx(Request, VirtRngEvtRequestCancel);
-    if (!NT_SUCCESS(status))
-    {
-        TraceEvents(TRACE_LEVEL_ERROR, DBG_READ,
-            "WdfRequestMarkCancelableEx failed: %!STATUS!", status);
-        WdfRequestComplete(Request, status);
-        return;
-    }
+    WdfSpinLockAcquire(context->VirtQueueLock);
 
-    status = VirtQueueAddBuffer(context, Request, Length);
-    if (!NT_SUCCESS(status))
+    // Serve the request from the pool, as much as is available and
+    // regardless of how many pages it spans. If the pool is empty the
+    // request waits for the DPC to bring more entropy.
+    copied = VirtRngCopyFromPool(context, (PUCHAR)buffer,
+        (ULONG)min(Length, MAXULONG));
+
+    if (copied == 0)
     {
-        if (WdfRequestUnmarkCancelable(Request) != STATUS_CANCELLED)
-        {
-            WdfRequestComplete(Request, status);
-        }
+        status = WdfRequestForwardToIoQueue(Request,
+            context->PendingReadQueue);
     }
 
-    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ, "<-- %!FUNC!");
-}
-
-VOID VirtRngEvtIoStop(IN WDFQUEUE Queue,
-                      IN WDFREQUEST Request,
-                      IN ULONG ActionFlags)
-{
-    UNREFERENCED_PARAMETER(Queue);
+    kick = VirtRngPostIdleBuffers(context);
 
-    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ,
-        "--> %!FUNC! Request: %p", Request);
+    WdfSpinLockRelease(context->VirtQueueLock);
 
-    if (ActionFlags & WdfRequestStopActionSuspend)
+    if (kick)
     {
-        WdfRequestStopAcknowledge(Request, FALSE);
+        virtqueue_notify(context->VirtQueue);
     }
-    else if (ActionFlags & WdfRequestStopActionPurge)
-    {
-        if (WdfRequestUnmarkCancelable(Request) != STATUS_CANCELLED)
-        {
-            WdfRequestComplete(Request , STATUS_CANCELLED);
-        }
-    }
-
-    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ, "<-- %!FUNC!");
-}
-
-VOID VirtRngEvtRequestCancel(IN WDFREQUEST Request)
-{
-    PDEVICE_CONTEXT context = GetDeviceContext(WdfIoQueueGetDevice(
-        WdfRequestGetIoQueue(Request)));
-    PSINGLE_LIST_ENTRY iter;
-
-    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ,
-        "--> %!FUNC! Cancelled Request: %p", Request);
-
-    WdfSpinLockAcquire(context->VirtQueueLock);
-
-    WdfRequestComplete(Request, STATUS_CANCELLED);
 
-    iter = &context->ReadBuffersList;
-    while (iter->Next != NULL)
+    if (copied != 0)
     {
-        PREAD_BUFFER_ENTRY entry = CONTAINING_RECORD(iter->Next,
-            READ_BUFFER_ENTRY, ListEntry);
-
-        if (Request == entry->Request)
-        {
-            TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ,
-                "Clear entry %p request.", entry);
-
-            entry->Request = NULL;
-            break;
-        }
-        else
-        {
-            iter = iter->Next;
-        }
-    };
+        TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ,
+            "Complete Request: %p Length: %d", Request, copied);
 
-    WdfSpinLockRelease(context->VirtQueueLock);
+        WdfRequestCompleteWithInformation(Request, STATUS_SUCCESS,
+            (ULONG_PTR)copied);
+    }
+    else if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_READ,
+            "WdfRequestForwardToIoQueue failed: %!STATUS!", status);
+        WdfRequestComplete(Request, status);
+    }
 
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ, "<-- %!FUNC!");
 }
@@ -99,7 +99,6 @@ NTSTATUS VirtRngEvtDeviceAdd(IN WDFDRIVER Driver,
     WdfDeviceInitSetIoType(DeviceInit, WdfDeviceIoDirect);
 
     WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, DEVICE_CONTEXT);
-    attributes.EvtCleanupCallback = VirtRngEvtDeviceContextCleanup;
 
     status = WdfDeviceCreate(&DeviceInit, &attributes, &device);
     if (!NT_SUCCESS(status))
@@ -149,11 +148,11 @@ NTSTATUS VirtRngEvtDeviceAdd(IN WDFDRIVER Driver,
         return status;
     }
 
-    // IMPORTANT: we have single 4K RX buffer that used for any read request
-    // so do not change the WdfIoQueueDispatchSequential!
-    WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchSequential);
+    // Read requests are served from the entropy buffers pool, so they can
+    // be dispatched in parallel. The ones that find the pool empty wait in
+    // the manual queue for the DPC.
+    WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchParallel);
     queueConfig.EvtIoRead = VirtRngEvtIoRead;
-    queueConfig.EvtIoStop = VirtRngEvtIoStop;
     queueConfig.AllowZeroLengthRequests = FALSE;
 
     status = WdfIoQueueCreate(device, &queueConfig,
@@ -176,30 +175,21 @@ NTSTATUS VirtRngEvtDeviceAdd(IN WDFDRIVER Driver,
         return status;
     }
 
-    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_INIT, "<-- %!FUNC!");
+    WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchManual);
 
-    return status;
-}
-
-VOID VirtRngEvtDeviceContextCleanup(IN WDFOBJECT DeviceObject)
-{
-    PDEVICE_CONTEXT context = GetDeviceContext(DeviceObject);
-    PSINGLE_LIST_ENTRY iter;
-
-    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_INIT, "--> %!FUNC!");
+    status = WdfIoQueueCreate(device, &queueConfig,
+        WDF_NO_OBJECT_ATTRIBUTES, &context->PendingReadQueue);
 
-    iter = PopEntryList(&context->ReadBuffersList);
-    while (iter != NULL)
+    if (!NT_SUCCESS(status))
     {
-        PREAD_BUFFER_ENTRY entry = CONTAINING_RECORD(iter,
-            READ_BUFFER_ENTRY, ListEntry);
-
-        ExFreePoolWithTag(entry, VIRT_RNG_MEMORY_TAG);
-
-        iter = PopEntryList(&context->ReadBuffersList);
-    };
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_INIT,
+            "WdfIoQueueCreate failed: %!STATUS!", status);
+        return status;
+    }
 
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_INIT, "<-- %!FUNC!");
+
+    return status;
 }
 
 VOID VirtRngEvtDriverContextCleanup(IN WDFOBJECT DriverObject)
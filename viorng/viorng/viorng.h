@@ -48,10 +48,16 @@
 DEFINE_GUID(GUID_DEVINTERFACE_VIRT_RNG,
     0x2489fc19, 0xd0fd, 0x4950, 0x83, 0x86, 0xf3, 0xda, 0x3f, 0xa8, 0x5, 0x8);
 
+// Number of page sized entropy buffers kept posted to the device.
+#define VIRT_RNG_BUFFERS_COUNT 8
+
 typedef struct _ReadBufferEntry
 {
-    SINGLE_LIST_ENTRY ListEntry;
-    WDFREQUEST Request;
+    LIST_ENTRY ListEntry;
+    PVOID VirtualAddress;
+    PHYSICAL_ADDRESS PhysicalAddress;
+    ULONG Length;   // bytes of entropy returned by the host
+    ULONG Offset;   // bytes already handed out to readers
 } READ_BUFFER_ENTRY, *PREAD_BUFFER_ENTRY;
 
 typedef struct _DEVICE_CONTEXT {
@@ -62,11 +68,17 @@ typedef struct _DEVICE_CONTEXT {
     WDFINTERRUPT        WdfInterrupt;
     WDFSPINLOCK         VirtQueueLock;
 
-    // Hold a list of allocated buffers which were put into the virt queue
-    // and was not returned yet.
-    SINGLE_LIST_ENTRY   ReadBuffersList;
-    void *              SingleBufferVA;
-    PHYSICAL_ADDRESS    SingleBufferPA;
+    // Read requests waiting for the host to return entropy.
+    WDFQUEUE            PendingReadQueue;
+
+    // Entropy buffers, all of them protected by the VirtQueueLock. A buffer
+    // is either in the virt queue, in the FilledBuffersList waiting to be
+    // consumed by readers or in the IdleBuffersList waiting to be re-posted.
+    void *              BuffersVA;
+    PHYSICAL_ADDRESS    BuffersPA;
+    READ_BUFFER_ENTRY   Buffers[VIRT_RNG_BUFFERS_COUNT];
+    LIST_ENTRY          FilledBuffersList;
+    LIST_ENTRY          IdleBuffersList;
 } DEVICE_CONTEXT, *PDEVICE_CONTEXT;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DEVICE_CONTEXT, GetDeviceContext);
@@ -81,7 +93,6 @@ WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DEVICE_CONTEXT, GetDeviceContext);
 
 DRIVER_INITIALIZE DriverEntry;
 EVT_WDF_DRIVER_DEVICE_ADD VirtRngEvtDeviceAdd;
-EVT_WDF_OBJECT_CONTEXT_CLEANUP VirtRngEvtDeviceContextCleanup;
 
 // Context cleanup callbacks generally run at IRQL <= DISPATCH_LEVEL but
 // WDFDRIVER context cleanup is guaranteed to run at PASSIVE_LEVEL.
@@ -99,4 +110,11 @@ EVT_WDF_INTERRUPT_ENABLE VirtRngEvtInterruptEnable;
 EVT_WDF_INTERRUPT_DISABLE VirtRngEvtInterruptDisable;
 
 EVT_WDF_IO_QUEUE_IO_READ VirtRngEvtIoRead;
-EVT_WDF_IO_QUEUE_IO_STOP VirtRngEvtIoStop;
+
+//
+// Entropy buffers pool
+//
+
+NTSTATUS VirtRngInitBuffers(IN PDEVICE_CONTEXT Context);
+VOID VirtRngFreeBuffers(IN PDEVICE_CONTEXT Context);
+VOID VirtRngProcessReads(IN PDEVICE_CONTEXT Context);
@@ -58,35 +58,37 @@ SendSRB(
     STOR_LOCK_HANDLE    LockHandle = { 0 };
     ULONG               status = STOR_STATUS_SUCCESS;
     PREQUEST_LIST       element = NULL;
+    PVIOSCSI_QUEUE_STATS stats = NULL;
 
 ENTER_FN_SRB();
 
     RhelDbgPrint(TRACE_LEVEL_INFORMATION, " SRB %p isr %d, MessageId %x.\n", Srb, isr, MessageID);
 
     if (Srb) {
+        srbExt = SRB_EXTENSION(Srb);
         if (adaptExt->num_queues > 1) {
-#ifdef USE_CPU_TO_VQ_MAP
-        QueueNumber = adaptExt->cpu_to_vq_map[srbExt->cpu] + VIRTIO_SCSI_REQUEST_QUEUE_0;
-#else // USE_CPU_TO_VQ_MAP
-            STARTIO_PERFORMANCE_PARAMETERS param;
-            param.Size = sizeof(STARTIO_PERFORMANCE_PARAMETERS);
-            status = StorPortGetStartIoPerfParams(DeviceExtension, (PSCSI_REQUEST_BLOCK)Srb, &param);
-            if (status == STOR_STATUS_SUCCESS && param.MessageNumber != 0) {
-                QueueNumber = MESSAGE_TO_QUEUE(param.MessageNumber);
+            if (srbExt->cpu < adaptExt->cpu_map_count) {
+                QueueNumber = adaptExt->cpu_to_vq_map[srbExt->cpu].Queue + VIRTIO_SCSI_REQUEST_QUEUE_0;
             }
             else {
-                RhelDbgPrint(TRACE_LEVEL_ERROR, " StorPortGetStartIoPerfParams failed srb %p status 0x%x MessageNumber %d.\n", Srb, status, param.MessageNumber);
-                QueueNumber = VIRTIO_SCSI_REQUEST_QUEUE_0;
+                STARTIO_PERFORMANCE_PARAMETERS param;
+                param.Size = sizeof(STARTIO_PERFORMANCE_PARAMETERS);
+                status = StorPortGetStartIoPerfParams(DeviceExtension, (PSCSI_REQUEST_BLOCK)Srb, &param);
+                if (status == STOR_STATUS_SUCCESS && param.MessageNumber != 0) {
+                    QueueNumber = MESSAGE_TO_QUEUE(param.MessageNumber);
+                }
+                else {
+                    RhelDbgPrint(TRACE_LEVEL_ERROR, " StorPortGetStartIoPerfParams failed srb %p status 0x%x MessageNumber %d.\n", Srb, status, param.MessageNumber);
+                    QueueNumber = VIRTIO_SCSI_REQUEST_QUEUE_0;
+                }
             }
         }
         else {
             QueueNumber = VIRTIO_SCSI_REQUEST_QUEUE_0;
         }
-        srbExt = SRB_EXTENSION(Srb);
         srbExt->vq_num = QueueNumber;
         element = &adaptExt->pending_list[QueueNumber - VIRTIO_SCSI_REQUEST_QUEUE_0];
         ExInterlockedInsertTailList(&element->srb_list, &srbExt->list_entry, &element->srb_list_lock);
-#endif // USE_CPU_TO_VQ_MAP
     }
     else {
         QueueNumber = MESSAGE_TO_QUEUE(MessageID);
@@ -103,6 +105,9 @@ ENTER_FN_SRB();
     RhelDbgPrint(TRACE_LEVEL_INFORMATION, " ExInterlockedRemoveHeadList SRB %p srbExt %p, QueueNumber %d vq_num %d.\n", srbExt->Srb, srbExt, QueueNumber, srbExt->vq_num);
 
     MessageID = QUEUE_TO_MESSAGE(QueueNumber);
+    if (adaptExt->stats) {
+        stats = &adaptExt->stats[QueueNumber - VIRTIO_SCSI_REQUEST_QUEUE_0];
+    }
 
     VioScsiVQLock(DeviceExtension, MessageID, &LockHandle, isr);
 
@@ -114,11 +119,19 @@ ENTER_FN_SRB();
                          srbExt->out, srbExt->in,
                          &srbExt->cmd, va, pa) >= 0){
             notify  = virtqueue_kick_prepare(adaptExt->vq[QueueNumber]) ? TRUE : notify;
+            if (stats) {
+                if (++stats->InFlight > stats->MaxInFlight) {
+                    stats->MaxInFlight = stats->InFlight;
+                }
+            }
             srbExt = (PSRB_EXTENSION)ExInterlockedRemoveHeadList(&element->srb_list, &element->srb_list_lock);
         }
         else {
             RhelDbgPrint(TRACE_LEVEL_FATAL, " can not add packet to queue (%d) SRB = %p .\n", QueueNumber, srbExt->Srb);
             ExInterlockedInsertHeadList(&element->srb_list, &srbExt->list_entry, &element->srb_list_lock);
+            if (stats) {
+                stats->BusyEvents++;
+            }
             notify = TRUE;
             srbExt = NULL;
         }
@@ -129,6 +142,11 @@ ENTER_FN_SRB();
     if (notify) {
         virtqueue_notify(adaptExt->vq[QueueNumber]);
     }
+#if (NTDDI_VERSION > NTDDI_WIN7)
+    if (Srb && !isr && adaptExt->poll_budget_ticks) {
+        VioScsiPollQueue(DeviceExtension, MessageID);
+    }
+#endif
 #ifdef USE_WORK_ITEM
 #if (NTDDI_VERSION > NTDDI_WIN7)
     if (adaptExt->num_queues > 1) {
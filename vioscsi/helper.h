@@ -201,6 +201,12 @@ ProcessQueue(
     IN BOOLEAN isr
     );
 
+VOID
+VioScsiPollQueue(
+    IN PVOID DeviceExtension,
+    IN ULONG MessageID
+    );
+
 VOID
 //FORCEINLINE
 VioScsiVQLock(
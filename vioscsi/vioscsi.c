@@ -53,6 +53,8 @@
 #define VIOSCSI_SETUP_GUID_INDEX               0
 #define VIOSCSI_MS_ADAPTER_INFORM_GUID_INDEX   1
 #define VIOSCSI_MS_PORT_INFORM_GUID_INDEX      2
+#define VIOSCSI_STATISTICS_GUID_INDEX          3
+#define VIOSCSI_QUEUE_MAPPING_GUID_INDEX       4
 
 BOOLEAN IsCrashDumpMode;
 
@@ -230,6 +232,20 @@ VioScsiReadExtendedData(
     OUT PUCHAR Buffer
    );
 
+ULONG
+VioScsiReadStatistics(
+    IN PVOID Context,
+    OUT PVIOSCSI_STATISTICS Buffer,
+    IN ULONG Length
+   );
+
+ULONG
+VioScsiReadQueueMapping(
+    IN PVOID Context,
+    OUT PVIOSCSI_QUEUE_MAPPING Buffer,
+    IN ULONG Length
+   );
+
 VOID
 VioScsiSaveInquiryData(
     IN PVOID  DeviceExtension,
@@ -240,14 +256,24 @@ VioScsiSaveInquiryData(
 GUID VioScsiWmiExtendedInfoGuid = VioScsiWmi_ExtendedInfo_Guid;
 GUID VioScsiWmiAdapterInformationQueryGuid = MS_SM_AdapterInformationQueryGuid;
 GUID VioScsiWmiPortInformationMethodsGuid = MS_SM_PortInformationMethodsGuid;
+GUID VioScsiWmiStatisticsGuid = VioScsiWmi_Statistics_Guid;
+GUID VioScsiWmiQueueMappingGuid = VioScsiWmi_QueueMapping_Guid;
 
 SCSIWMIGUIDREGINFO VioScsiGuidList[] =
 {
    { &VioScsiWmiExtendedInfoGuid,            1, 0 },
    { &VioScsiWmiAdapterInformationQueryGuid, 1, 0 },
    { &VioScsiWmiPortInformationMethodsGuid,  1, 0 },
+   { &VioScsiWmiStatisticsGuid,              1, 0 },
+   { &VioScsiWmiQueueMappingGuid,            1, 0 },
 };
 
+/* the WMI block is filled straight from the adapter counters */
+C_ASSERT(sizeof(VioScsiQueueStatistics) == sizeof(VIOSCSI_QUEUE_STATS));
+C_ASSERT(FIELD_OFFSET(VioScsiStatistics, Queues) == FIELD_OFFSET(VIOSCSI_STATISTICS, Queues));
+C_ASSERT(sizeof(VioScsiCpuMapping) == sizeof(VIOSCSI_CPU_MAPPING));
+C_ASSERT(FIELD_OFFSET(VioScsiQueueMapping, Cpus) == FIELD_OFFSET(VIOSCSI_QUEUE_MAPPING, Cpus));
+
 #define VioScsiGuidCount (sizeof(VioScsiGuidList) / sizeof(SCSIWMIGUIDREGINFO))
 
 void CopyUnicodeString(void* _pDest, const void* _pSrc, size_t _maxlength)
@@ -290,17 +316,16 @@ USHORT CopyBufferToAnsiString(void* _pDest, const void* _pSrc, const char delimi
 }
 
 #if (NTDDI_VERSION > NTDDI_WIN7)
-BOOLEAN VioScsiReadRegistry(
-    IN PVOID DeviceExtension
+BOOLEAN VioScsiReadRegistryParameter(
+    IN PVOID DeviceExtension,
+    IN PUCHAR ValueName,
+    OUT PULONG Value
 )
 {
     BOOLEAN Ret = FALSE;
     ULONG Len = sizeof(ULONG);
     UCHAR* pBuf = NULL;
-    PADAPTER_EXTENSION adaptExt;
 
-
-    adaptExt = (PADAPTER_EXTENSION)DeviceExtension;
     pBuf = StorPortAllocateRegistryBuffer(DeviceExtension, &Len);
     if (pBuf == NULL) {
         RhelDbgPrint(TRACE_LEVEL_FATAL, "StorPortAllocateRegistryBuffer failed to allocate buffer\n");
@@ -310,28 +335,45 @@ BOOLEAN VioScsiReadRegistry(
     memset(pBuf, 0, sizeof(ULONG));
 
     Ret = StorPortRegistryRead(DeviceExtension,
-                               MAX_PH_BREAKS ,
+                               ValueName,
                                1,
                                MINIPORT_REG_DWORD,
                                pBuf,
                                &Len);
 
     if ((Ret == FALSE) || (Len == 0)) {
-        RhelDbgPrint(TRACE_LEVEL_FATAL, "StorPortRegistryRead returned 0x%x, Len = %d\n", Ret, Len);
+        RhelDbgPrint(TRACE_LEVEL_FATAL, "StorPortRegistryRead %s returned 0x%x, Len = %d\n", ValueName, Ret, Len);
+        StorPortFreeRegistryBuffer(DeviceExtension, pBuf);
         return FALSE;
     }
 
-    StorPortCopyMemory((PVOID)(&adaptExt->max_physical_breaks),
+    StorPortCopyMemory((PVOID)Value,
            (PVOID)pBuf,
            sizeof(ULONG));
-    adaptExt->max_physical_breaks = min(
-                                        max(SCSI_MINIMUM_PHYSICAL_BREAKS, adaptExt->max_physical_breaks),
-                                        SCSI_MAXIMUM_PHYSICAL_BREAKS);
 
     StorPortFreeRegistryBuffer(DeviceExtension, pBuf );
 
     return TRUE;
 }
+
+BOOLEAN VioScsiReadRegistry(
+    IN PVOID DeviceExtension
+)
+{
+    PADAPTER_EXTENSION adaptExt;
+    ULONG max_physical_breaks = 0;
+
+    adaptExt = (PADAPTER_EXTENSION)DeviceExtension;
+    if (!VioScsiReadRegistryParameter(DeviceExtension, (PUCHAR)MAX_PH_BREAKS, &max_physical_breaks)) {
+        return FALSE;
+    }
+
+    adaptExt->max_physical_breaks = min(
+                                        max(SCSI_MINIMUM_PHYSICAL_BREAKS, max_physical_breaks),
+                                        SCSI_MAXIMUM_PHYSICAL_BREAKS);
+
+    return TRUE;
+}
 #endif
 
 
@@ -488,6 +530,17 @@ ENTER_FN();
         adaptExt->indirect = CHECKBIT(adaptExt->features, VIRTIO_RING_F_INDIRECT_DESC);
     }
 
+    /* polling is off unless PollBudget sets how many microseconds the
+     * submitting CPU may spin */
+    adaptExt->poll_budget = 0;
+#if (NTDDI_VERSION > NTDDI_WIN7)
+    if (!adaptExt->dump_mode &&
+        VioScsiReadRegistryParameter(DeviceExtension, (PUCHAR)POLL_BUDGET, &adaptExt->poll_budget)) {
+        adaptExt->poll_budget = min(adaptExt->poll_budget, MAX_POLL_BUDGET);
+        RhelDbgPrint(TRACE_LEVEL_INFORMATION, " PollBudget %d\n", adaptExt->poll_budget);
+    }
+#endif
+
     ConfigInfo->NumberOfBuses               = 1;//(UCHAR)adaptExt->num_queues;
     ConfigInfo->MaximumNumberOfTargets      = min((UCHAR)adaptExt->scsi_config.max_target, 255/*SCSI_MAXIMUM_TARGETS_PER_BUS*/);
     ConfigInfo->MaximumNumberOfLogicalUnits = min((UCHAR)adaptExt->scsi_config.max_lun, SCSI_MAXIMUM_LUNS_PER_TARGET);
@@ -586,6 +639,7 @@ ENTER_FN();
         adaptExt->poolAllocationSize += ROUND_TO_CACHE_LINES(sizeof(SRB_EXTENSION));
         adaptExt->poolAllocationSize += ROUND_TO_CACHE_LINES(sizeof(VirtIOSCSIEventNode) * 8);
         adaptExt->poolAllocationSize += ROUND_TO_CACHE_LINES(sizeof(STOR_DPC) * max_queues);
+        adaptExt->poolAllocationSize += ROUND_TO_CACHE_LINES(sizeof(VIOSCSI_QUEUE_STATS) * max_queues);
     }
     if (max_queues + VIRTIO_SCSI_REQUEST_QUEUE_0 > MAX_QUEUES_PER_DEVICE_DEFAULT)
     {
@@ -716,6 +770,154 @@ VioScsiPoolAlloc(
     }
 }
 
+/* Builds the CPU to request queue map SendSRB uses. The queues are first
+ * divided among the NUMA nodes in proportion to their processors, so a queue
+ * only serves one node unless there are fewer queues than nodes. When
+ * Storport reports the targets of the MSI-X messages (the INF has them
+ * spread across all processors), each targeted CPU then submits to the queue
+ * it receives the interrupt of and the other CPUs to a queue interrupting a
+ * CPU of their own node, so completions run on the node that submitted.
+ */
+static
+VOID
+VioScsiBuildCpuToVqMap(
+    IN PVOID DeviceExtension
+    )
+{
+    PADAPTER_EXTENSION   adaptExt = (PADAPTER_EXTENSION)DeviceExtension;
+#if (NTDDI_VERSION >= NTDDI_WIN7)
+    PVIOSCSI_CPU_MAPPING map = adaptExt->cpu_to_vq_map;
+    PROCESSOR_NUMBER     ProcNumber = { 0 };
+    GROUP_AFFINITY       ga;
+    ULONG                cpus, cpu, nodes, node, msg, bit, k;
+    ULONG                first, count, start, n, j;
+    USHORT               id;
+#endif
+
+ENTER_FN();
+    adaptExt->cpu_map_count = 0;
+    adaptExt->cpu_map_source = VIOSCSI_MAP_NONE;
+#if (NTDDI_VERSION >= NTDDI_WIN7)
+    if (adaptExt->dump_mode || adaptExt->num_queues < 2) {
+        EXIT_FN();
+        return;
+    }
+
+    cpus = min(KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS), MAX_CPU);
+    for (cpu = 0; cpu < cpus; cpu++) {
+        if (!NT_SUCCESS(KeGetProcessorNumberFromIndex(cpu, &ProcNumber))) {
+            RhelDbgPrint(TRACE_LEVEL_ERROR, " no processor number for cpu %d\n", cpu);
+            EXIT_FN();
+            return;
+        }
+        map[cpu].Group = ProcNumber.Group;
+        map[cpu].Number = ProcNumber.Number;
+        map[cpu].Flags = 0;
+        map[cpu].Node = VIOSCSI_NO_NODE;
+        map[cpu].Queue = 0;
+    }
+
+    nodes = (ULONG)KeQueryHighestNodeNumber() + 1;
+    for (node = 0; node < nodes; node++) {
+        KeQueryNodeActiveAffinity((USHORT)node, &ga, NULL);
+        for (bit = 0; bit < sizeof(KAFFINITY) * 8; bit++) {
+            if (ga.Mask & ((KAFFINITY)1 << bit)) {
+                ProcNumber.Group = ga.Group;
+                ProcNumber.Number = (UCHAR)bit;
+                cpu = KeGetProcessorIndexFromNumber(&ProcNumber);
+                if (cpu < cpus) {
+                    map[cpu].Node = (USHORT)node;
+                }
+            }
+        }
+    }
+
+    /* processors of no known node come last, as if they had their own */
+    for (node = 0, start = 0; node <= nodes; node++) {
+        id = (node < nodes) ? (USHORT)node : VIOSCSI_NO_NODE;
+        for (cpu = 0, n = 0; cpu < cpus; cpu++) {
+            n += (map[cpu].Node == id);
+        }
+        if (n == 0) {
+            continue;
+        }
+        first = start * adaptExt->num_queues / cpus;
+        count = (start + n) * adaptExt->num_queues / cpus - first;
+        if (count == 0) {
+            count = 1;
+        }
+        for (cpu = 0, j = 0; cpu < cpus; cpu++) {
+            if (map[cpu].Node == id) {
+                map[cpu].Queue = (USHORT)(first + j * count / n);
+                j++;
+            }
+        }
+        start += n;
+    }
+    adaptExt->cpu_map_source = VIOSCSI_MAP_TOPOLOGY;
+
+    if ((adaptExt->pmsg_affinity != NULL) && !adaptExt->msix_one_vector &&
+        CHECKFLAG(adaptExt->perfFlags, STOR_PERF_ADV_CONFIG_LOCALITY)) {
+        for (msg = QUEUE_TO_MESSAGE(VIRTIO_SCSI_REQUEST_QUEUE_0);
+             msg < QUEUE_TO_MESSAGE(VIRTIO_SCSI_REQUEST_QUEUE_0 + adaptExt->num_queues); msg++) {
+            ga = adaptExt->pmsg_affinity[msg];
+            for (bit = 0; bit < sizeof(KAFFINITY) * 8; bit++) {
+                if (!(ga.Mask & ((KAFFINITY)1 << bit))) {
+                    continue;
+                }
+                ProcNumber.Group = ga.Group;
+                ProcNumber.Number = (UCHAR)bit;
+                cpu = KeGetProcessorIndexFromNumber(&ProcNumber);
+                if (cpu < cpus && !(map[cpu].Flags & VIOSCSI_CPU_IRQ_AFFINE)) {
+                    map[cpu].Queue = (USHORT)(MESSAGE_TO_QUEUE(msg) - VIRTIO_SCSI_REQUEST_QUEUE_0);
+                    map[cpu].Flags |= VIOSCSI_CPU_IRQ_AFFINE;
+                    adaptExt->cpu_map_source = VIOSCSI_MAP_AFFINITY;
+                }
+            }
+        }
+    }
+
+    if (adaptExt->cpu_map_source == VIOSCSI_MAP_AFFINITY) {
+        /* spread the CPUs no interrupt targets round robin over the queues
+         * interrupting their node, the topology slice stays otherwise */
+        for (cpu = 0; cpu < cpus; cpu++) {
+            if (map[cpu].Flags & VIOSCSI_CPU_IRQ_AFFINE) {
+                continue;
+            }
+            for (k = 0, n = 0, j = 0; k < cpus; k++) {
+                if (map[k].Node == map[cpu].Node) {
+                    if (map[k].Flags & VIOSCSI_CPU_IRQ_AFFINE) {
+                        n++;
+                    }
+                    else if (k < cpu) {
+                        j++;
+                    }
+                }
+            }
+            if (n == 0) {
+                continue;
+            }
+            j %= n;
+            for (k = 0; k < cpus; k++) {
+                if ((map[k].Node == map[cpu].Node) &&
+                    (map[k].Flags & VIOSCSI_CPU_IRQ_AFFINE) && (j-- == 0)) {
+                    map[cpu].Queue = map[k].Queue;
+                    break;
+                }
+            }
+        }
+    }
+
+    for (cpu = 0; cpu < cpus; cpu++) {
+        RhelDbgPrint(TRACE_LEVEL_INFORMATION, " cpu %d (%hu:%hu) node %hu vq %hu%s\n",
+                     cpu, map[cpu].Group, (USHORT)map[cpu].Number, map[cpu].Node, map[cpu].Queue,
+                     (map[cpu].Flags & VIOSCSI_CPU_IRQ_AFFINE) ? " irq" : "");
+    }
+    adaptExt->cpu_map_count = cpus;
+#endif
+EXIT_FN();
+}
+
 BOOLEAN
 VioScsiHwInitialize(
     IN PVOID DeviceExtension
@@ -765,14 +967,6 @@ ENTER_FN();
         if (!InitializeVirtualQueues(adaptExt, adaptExt->num_queues + VIRTIO_SCSI_REQUEST_QUEUE_0)) {
             return FALSE;
         }
-
-#ifdef USE_CPU_TO_VQ_MAP
-        if (!CHECKFLAG(adaptExt->perfFlags, STOR_PERF_ADV_CONFIG_LOCALITY)) {
-            for (index = 0; index < adaptExt->num_queues; ++index) {
-                adaptExt->cpu_to_vq_map[index] = (UCHAR)(index);
-            }
-        }
-#endif // USE_CPU_TO_VQ_MAP
     }
     else
     {
@@ -797,6 +991,13 @@ ENTER_FN();
             adaptExt->tmf_cmd.SrbExtension = (PSRB_EXTENSION)VioScsiPoolAlloc(DeviceExtension, sizeof(SRB_EXTENSION));
             adaptExt->events = (PVirtIOSCSIEventNode)VioScsiPoolAlloc(DeviceExtension, sizeof(VirtIOSCSIEventNode) * 8);
             adaptExt->dpc = (PSTOR_DPC)VioScsiPoolAlloc(DeviceExtension, sizeof(STOR_DPC) * adaptExt->num_queues);
+            adaptExt->stats = (PVIOSCSI_QUEUE_STATS)VioScsiPoolAlloc(DeviceExtension, sizeof(VIOSCSI_QUEUE_STATS) * adaptExt->num_queues);
+        }
+        /* the counters survive a restart, the requests in the rings do not */
+        if (adaptExt->stats) {
+            for (index = 0; index < adaptExt->num_queues; ++index) {
+                adaptExt->stats[index].InFlight = 0;
+            }
         }
     }
 
@@ -862,29 +1063,30 @@ ENTER_FN();
                     adaptExt->perfFlags = 0;
                     RhelDbgPrint(TRACE_LEVEL_ERROR, " StorPortInitializePerfOpts set failed with status = 0x%x\n", status);
                 }
-#ifdef USE_CPU_TO_VQ_MAP
-                else if ((adaptExt->pmsg_affinity != NULL) && CHECKFLAG(perfData.Flags, STOR_PERF_ADV_CONFIG_LOCALITY)){
-                    UCHAR msg = 0;
-                    PGROUP_AFFINITY ga;
-                    UCHAR cpu = 0;
-                    RhelDbgPrint(TRACE_LEVEL_FATAL, " Perf Version = 0x%x, Flags = 0x%x, ConcurrentChannels = %d, FirstRedirectionMessageNumber = %d,LastRedirectionMessageNumber = %d\n",
-                        perfData.Version, perfData.Flags, perfData.ConcurrentChannels, perfData.FirstRedirectionMessageNumber, perfData.LastRedirectionMessageNumber);
-                    for (msg = 0; msg < adaptExt->num_queues + 3; msg++) {
-                        ga = &adaptExt->pmsg_affinity[msg];
-                        if ( ga->Mask > 0 && msg > 2) {
-                            cpu = RtlFindLeastSignificantBit((ULONGLONG)ga->Mask);
-                            adaptExt->cpu_to_vq_map[cpu] = MESSAGE_TO_QUEUE(msg) - VIRTIO_SCSI_REQUEST_QUEUE_0;
-                            RhelDbgPrint(TRACE_LEVEL_FATAL, " msg = %d, mask = 0x%lx group = %hu cpu = %hu vq = %hu\n", msg, ga->Mask, ga->Group, cpu, adaptExt->cpu_to_vq_map[cpu]);
-                        }
-                    }
-                }
-#endif // USE_CPU_TO_VQ_MAP
             }
             else {
                 RhelDbgPrint(TRACE_LEVEL_INFORMATION, " StorPortInitializePerfOpts get failed with status = 0x%x\n", status);
             }
 #endif
         }
+        VioScsiBuildCpuToVqMap(DeviceExtension);
+#if (NTDDI_VERSION > NTDDI_WIN7)
+        /* never in dump mode, latencies stay 0 without a performance counter */
+        adaptExt->stats_frequency = 0;
+        {
+            LARGE_INTEGER frequency, counter;
+            if (StorPortQueryPerformanceCounter(DeviceExtension, &frequency, &counter) == STOR_STATUS_SUCCESS) {
+                adaptExt->stats_frequency = (ULONGLONG)frequency.QuadPart;
+            }
+        }
+        adaptExt->poll_budget_ticks = 0;
+        if (adaptExt->poll_budget > 0) {
+            LARGE_INTEGER frequency, counter;
+            StorPortQueryPerformanceCounter(DeviceExtension, &frequency, &counter);
+            adaptExt->poll_budget_ticks = (ULONGLONG)frequency.QuadPart * adaptExt->poll_budget / 1000000;
+            RtlZeroMemory(adaptExt->poll, sizeof(adaptExt->poll));
+        }
+#endif
         if (!adaptExt->dpc_ok && !StorPortEnablePassiveInitialization(DeviceExtension, VioScsiPassiveInitializeRoutine)) {
             RhelDbgPrint(TRACE_LEVEL_FATAL, " StorPortEnablePassiveInitialization FAILED\n");
             return FALSE;
@@ -1291,15 +1493,11 @@ VioScsiBuildIo(
     VirtIOSCSICmd         *cmd;
     UCHAR                 TargetId;
     UCHAR                 Lun;
-#ifdef USE_CPU_TO_VQ_MAP
 #if (NTDDI_VERSION >= NTDDI_WIN7)
-    PROCESSOR_NUMBER ProcNumber;
-    ULONG processor = KeGetCurrentProcessorNumberEx(&ProcNumber);
-    ULONG cpu = ProcNumber.Number;
+    ULONG cpu = KeGetCurrentProcessorNumberEx(NULL);
 #else
     ULONG cpu = KeGetCurrentProcessorNumber();
 #endif
-#endif
 
 ENTER_FN_SRB();
     cdb      = SRB_CDB(Srb);
@@ -1326,8 +1524,13 @@ ENTER_FN_SRB();
     srbExt->pdesc = srbExt->desc_alias;
 
     srbExt->allocated = 0;
-#ifdef USE_CPU_TO_VQ_MAP
-    srbExt->cpu = (UCHAR)cpu;
+    srbExt->cpu = cpu;
+#if (NTDDI_VERSION > NTDDI_WIN7)
+    if (adaptExt->stats_frequency) {
+        LARGE_INTEGER counter;
+        StorPortQueryPerformanceCounter(DeviceExtension, NULL, &counter);
+        srbExt->submit_ticks = (ULONGLONG)counter.QuadPart;
+    }
 #endif
     cmd = &srbExt->cmd;
     cmd->srb = (PVOID)Srb;
@@ -1448,6 +1651,58 @@ EXIT_FN();
 EXIT_FN();
 }
 
+static
+VOID
+FORCEINLINE
+VioScsiUpdateStats(
+    IN PVOID DeviceExtension,
+    IN PVIOSCSI_QUEUE_STATS stats,
+    IN PVirtIOSCSICmd cmd,
+    IN ULONGLONG now
+)
+{
+    PADAPTER_EXTENSION  adaptExt = (PADAPTER_EXTENSION)DeviceExtension;
+    PSRB_TYPE           Srb = (PSRB_TYPE)cmd->srb;
+    PSRB_EXTENSION      srbExt = SRB_EXTENSION(Srb);
+    ULONG               flags = SRB_FLAGS(Srb);
+    ULONG               bytes = SRB_DATA_TRANSFER_LENGTH(Srb);
+    PULONGLONG          latency;
+    ULONGLONG           us;
+    ULONG               bucket = 0;
+
+    if (stats->InFlight) {
+        stats->InFlight--;
+    }
+    if (cmd->resp.cmd.resid < bytes) {
+        bytes -= cmd->resp.cmd.resid;
+    } else {
+        bytes = 0;
+    }
+    if (CHECKFLAG(flags, SRB_FLAGS_DATA_IN)) {
+        stats->ReadRequests++;
+        stats->ReadBytes += bytes;
+        latency = stats->ReadLatency;
+    } else if (CHECKFLAG(flags, SRB_FLAGS_DATA_OUT)) {
+        stats->WriteRequests++;
+        stats->WriteBytes += bytes;
+        latency = stats->WriteLatency;
+    } else {
+        stats->OtherRequests++;
+        return;
+    }
+
+    /* no timestamps before Windows 8 */
+    if (srbExt->submit_ticks == 0 || now < srbExt->submit_ticks) {
+        return;
+    }
+    us = (now - srbExt->submit_ticks) * 1000000 / adaptExt->stats_frequency;
+    while (us > 1 && bucket < LATENCY_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    latency[bucket]++;
+}
+
 VOID
 ProcessQueue(
     IN PVOID DeviceExtension,
@@ -1466,6 +1721,8 @@ ProcessQueue(
     LIST_ENTRY          complete_list;
     PSRB_TYPE           Srb = NULL;
     PSRB_EXTENSION      srbExt = NULL;
+    PVIOSCSI_QUEUE_STATS stats = NULL;
+    ULONGLONG           now = 0;
 ENTER_FN();
 #ifdef USE_WORK_ITEM
     handleResponseInline = (adaptExt->num_queues == 1);
@@ -1474,12 +1731,26 @@ ENTER_FN();
 #endif
     vq = adaptExt->vq[VIRTIO_SCSI_REQUEST_QUEUE_0 + index];
     InitializeListHead(&complete_list);
+    if (adaptExt->stats) {
+        stats = &adaptExt->stats[index];
+#if (NTDDI_VERSION > NTDDI_WIN7)
+        if (adaptExt->stats_frequency) {
+            /* one timestamp for the whole batch */
+            LARGE_INTEGER counter;
+            StorPortQueryPerformanceCounter(DeviceExtension, NULL, &counter);
+            now = (ULONGLONG)counter.QuadPart;
+        }
+#endif
+    }
 
     VioScsiVQLock(DeviceExtension, MessageID, &queueLock, isr);
 
     do {
         virtqueue_disable_cb(vq);
         while ((cmd = (PVirtIOSCSICmd)virtqueue_get_buf(vq, &len)) != NULL) {
+            if (stats) {
+                VioScsiUpdateStats(DeviceExtension, stats, cmd, now);
+            }
             if (handleResponseInline) {
                 Srb = (PSRB_TYPE)(cmd->srb);
                 srbExt = SRB_EXTENSION(Srb);
@@ -1539,6 +1810,36 @@ ENTER_FN();
 EXIT_FN();
 }
 
+#if (NTDDI_VERSION > NTDDI_WIN7)
+VOID
+VioScsiPollQueue(
+    IN PVOID DeviceExtension,
+    IN ULONG MessageID
+)
+{
+    PADAPTER_EXTENSION  adaptExt = (PADAPTER_EXTENSION)DeviceExtension;
+    ULONG               QueueNumber = MESSAGE_TO_QUEUE(MessageID);
+    PVIRTIO_POLL_QUEUE  poll = &adaptExt->poll[QueueNumber - VIRTIO_SCSI_REQUEST_QUEUE_0];
+    struct virtqueue    *vq = adaptExt->vq[QueueNumber];
+    STOR_LOCK_HANDLE    queueLock = { 0 };
+    ULONGLONG           limit;
+
+    if (!VirtioPollBegin(poll, adaptExt->poll_budget_ticks, &limit)) {
+        return;
+    }
+
+    /* no interrupt is needed while we spin, ProcessQueue arms the
+     * callbacks again */
+    VioScsiVQLock(DeviceExtension, MessageID, &queueLock, FALSE);
+    virtqueue_disable_cb(vq);
+    VioScsiVQUnlock(DeviceExtension, MessageID, &queueLock, FALSE);
+
+    VirtioPollSpin(DeviceExtension, poll, vq, adaptExt->poll_budget_ticks, limit);
+
+    ProcessQueue(DeviceExtension, MessageID, FALSE);
+}
+#endif
+
 VOID
 VioScsiCompleteDpcRoutine(
     IN PSTOR_DPC  Dpc,
@@ -1824,6 +2125,22 @@ ENTER_FN_SRB();
                 srbControl->Signature[4], srbControl->Signature[5], srbControl->Signature[6], srbControl->Signature[7]);
             RhelDbgPrint(TRACE_LEVEL_INFORMATION, " <--> IOCTL_SCSI_MINIPORT_NOT_QUORUM_CAPABLE\n");
             break;
+        case VIOSCSI_IOCTL_QUERY_STATISTICS:
+            if (memcmp(srbControl->Signature, VIOSCSI_IOCTL_SIGNATURE, sizeof(VIOSCSI_IOCTL_SIGNATURE) - 1) != 0 ||
+                SRB_DATA_TRANSFER_LENGTH(Srb) < sizeof(SRB_IO_CONTROL) ||
+                srbControl->Length > SRB_DATA_TRANSFER_LENGTH(Srb) - sizeof(SRB_IO_CONTROL) ||
+                srbControl->Length < FIELD_OFFSET(VIOSCSI_STATISTICS, Queues)) {
+                SRB_SET_SRB_STATUS(Srb, SRB_STATUS_INVALID_REQUEST);
+                break;
+            }
+            /* as many queues as fit, QueueCount tells the caller how many there are */
+            srbControl->Length = VioScsiReadStatistics(DeviceExtension,
+                                                       (PVIOSCSI_STATISTICS)(srbControl + 1),
+                                                       srbControl->Length);
+            srbControl->ReturnCode = 0;
+            SRB_SET_SRB_STATUS(Srb, SRB_STATUS_SUCCESS);
+            RhelDbgPrint(TRACE_LEVEL_INFORMATION, " <--> VIOSCSI_IOCTL_QUERY_STATISTICS\n");
+            break;
         default:
             SRB_SET_SRB_STATUS(Srb, SRB_STATUS_INVALID_REQUEST);
             RhelDbgPrint(TRACE_LEVEL_INFORMATION, " <--> Unsupport control code 0x%x\n", srbControl->ControlCode);
@@ -2071,6 +2388,40 @@ ENTER_FN();
             status = SRB_STATUS_SUCCESS;
         }
         break;
+        case VIOSCSI_STATISTICS_GUID_INDEX:
+        {
+            size = FIELD_OFFSET(VioScsiStatistics, Queues) +
+                   sizeof(VioScsiQueueStatistics) * (adaptExt->stats ? adaptExt->num_queues : 0);
+            if (OutBufferSize < size)
+            {
+                status = SRB_STATUS_DATA_OVERRUN;
+                break;
+            }
+
+            size = VioScsiReadStatistics(Context,
+                                         (PVIOSCSI_STATISTICS)Buffer,
+                                         OutBufferSize);
+            *InstanceLengthArray = size;
+            status = SRB_STATUS_SUCCESS;
+        }
+        break;
+        case VIOSCSI_QUEUE_MAPPING_GUID_INDEX:
+        {
+            size = FIELD_OFFSET(VioScsiQueueMapping, Cpus) +
+                   sizeof(VioScsiCpuMapping) * adaptExt->cpu_map_count;
+            if (OutBufferSize < size)
+            {
+                status = SRB_STATUS_DATA_OVERRUN;
+                break;
+            }
+
+            size = VioScsiReadQueueMapping(Context,
+                                           (PVIOSCSI_QUEUE_MAPPING)Buffer,
+                                           OutBufferSize);
+            *InstanceLengthArray = size;
+            status = SRB_STATUS_SUCCESS;
+        }
+        break;
         default:
         {
             status = SRB_STATUS_ERROR;
@@ -2110,6 +2461,16 @@ VioScsiExecuteWmiMethod(
             RhelDbgPrint(TRACE_LEVEL_FATAL, " --> VIOSCSI_SETUP_GUID_INDEX ERROR\n");
         }
         break;
+        case VIOSCSI_STATISTICS_GUID_INDEX:
+        {
+            RhelDbgPrint(TRACE_LEVEL_FATAL, " --> VIOSCSI_STATISTICS_GUID_INDEX ERROR\n");
+        }
+        break;
+        case VIOSCSI_QUEUE_MAPPING_GUID_INDEX:
+        {
+            RhelDbgPrint(TRACE_LEVEL_FATAL, " --> VIOSCSI_QUEUE_MAPPING_GUID_INDEX ERROR\n");
+        }
+        break;
         case VIOSCSI_MS_ADAPTER_INFORM_GUID_INDEX:
         {
             PMS_SM_AdapterInformationQuery pOutBfr = (PMS_SM_AdapterInformationQuery)Buffer;
@@ -2366,6 +2727,57 @@ ENTER_FN();
 EXIT_FN();
 }
 
+ULONG
+VioScsiReadStatistics(
+IN PVOID Context,
+OUT PVIOSCSI_STATISTICS Buffer,
+IN ULONG Length
+)
+{
+    PADAPTER_EXTENSION    adaptExt = (PADAPTER_EXTENSION)Context;
+    ULONG                 count = adaptExt->stats ? adaptExt->num_queues : 0;
+    ULONG                 copy;
+
+ENTER_FN();
+
+    copy = min(count, (Length - FIELD_OFFSET(VIOSCSI_STATISTICS, Queues)) / sizeof(VIOSCSI_QUEUE_STATS));
+    Buffer->QueueCount = count;
+    Buffer->Reserved = 0;
+    /* the counters are updated under the queue locks without stopping the
+     * other queues, a snapshot of a busy adapter is not atomic */
+    if (copy) {
+        RtlCopyMemory(Buffer->Queues, adaptExt->stats, sizeof(VIOSCSI_QUEUE_STATS) * copy);
+    }
+
+EXIT_FN();
+    return FIELD_OFFSET(VIOSCSI_STATISTICS, Queues) + sizeof(VIOSCSI_QUEUE_STATS) * copy;
+}
+
+ULONG
+VioScsiReadQueueMapping(
+IN PVOID Context,
+OUT PVIOSCSI_QUEUE_MAPPING Buffer,
+IN ULONG Length
+)
+{
+    PADAPTER_EXTENSION    adaptExt = (PADAPTER_EXTENSION)Context;
+    ULONG                 copy;
+
+ENTER_FN();
+
+    copy = min(adaptExt->cpu_map_count, (Length - FIELD_OFFSET(VIOSCSI_QUEUE_MAPPING, Cpus)) / sizeof(VIOSCSI_CPU_MAPPING));
+    Buffer->CpuCount = adaptExt->cpu_map_count;
+    Buffer->QueueCount = adaptExt->num_queues;
+    Buffer->Source = adaptExt->cpu_map_source;
+    Buffer->Reserved = 0;
+    if (copy) {
+        RtlCopyMemory(Buffer->Cpus, adaptExt->cpu_to_vq_map, sizeof(VIOSCSI_CPU_MAPPING) * copy);
+    }
+
+EXIT_FN();
+    return FIELD_OFFSET(VIOSCSI_QUEUE_MAPPING, Cpus) + sizeof(VIOSCSI_CPU_MAPPING) * copy;
+}
+
 #ifdef USE_WORK_ITEM
 #if (NTDDI_VERSION > NTDDI_WIN7)
 VOID
@@ -2383,8 +2795,10 @@ VioScsiWorkItemCallback(
 ENTER_FN();
     status = StorPortInterlockedFlushSList(DeviceExtension, &adaptExt->srb_list[index], &listEntryRev);
     if ((status == STOR_STATUS_SUCCESS) && (listEntryRev != NULL)) {
-        KAFFINITY old_affinity, new_affinity;
-        old_affinity = new_affinity = 0;
+        GROUP_AFFINITY old_affinity, new_affinity;
+        PROCESSOR_NUMBER ProcNumber;
+        RtlZeroMemory(&old_affinity, sizeof(old_affinity));
+        RtlZeroMemory(&new_affinity, sizeof(new_affinity));
 #if 1
         listEntry = listEntryRev;
 #else
@@ -2409,15 +2823,17 @@ ENTER_FN();
             Srb = (PSRB_TYPE)(srbExt->Srb);
             cmd = (PVirtIOSCSICmd)srbExt->priv;
             ASSERT(cmd);
-            if (new_affinity == 0) {
-                new_affinity = ((KAFFINITY)1) << srbExt->cpu;
-                old_affinity = KeSetSystemAffinityThreadEx(new_affinity);
+            if ((new_affinity.Mask == 0) &&
+                NT_SUCCESS(KeGetProcessorNumberFromIndex(srbExt->cpu, &ProcNumber))) {
+                new_affinity.Group = ProcNumber.Group;
+                new_affinity.Mask = ((KAFFINITY)1) << ProcNumber.Number;
+                KeSetSystemGroupAffinityThread(&new_affinity, &old_affinity);
             }
             HandleResponse(DeviceExtension, cmd);
             listEntry = next;
         }
-        if (new_affinity != 0) {
-            KeRevertToUserAffinityThreadEx(old_affinity);
+        if (new_affinity.Mask != 0) {
+            KeRevertToUserGroupAffinityThread(&old_affinity);
         }
     }
     else if (status != STOR_STATUS_SUCCESS) {
@@ -39,6 +39,7 @@
 #include "virtio_pci.h"
 #include "virtio.h"
 #include "virtio_ring.h"
+#include "windows\virtio_poll.h"
 
 typedef struct VirtIOBufferDescriptor VIO_SG, *PVIO_SG;
 
@@ -55,6 +56,14 @@ typedef struct VirtIOBufferDescriptor VIO_SG, *PVIO_SG;
 #define MAX_CPU                 256
 
 #define MAX_PH_BREAKS           "PhysicalBreaks"
+#define POLL_BUDGET             "PollBudget"
+#define MAX_POLL_BUDGET         1000
+
+#define LATENCY_BUCKETS         24
+
+/* SRB_IO_CONTROL signature and control codes of the miniport IOCTLs */
+#define VIOSCSI_IOCTL_SIGNATURE         "VIOSCSI"
+#define VIOSCSI_IOCTL_QUERY_STATISTICS  0x80000001
 
 
 /* Feature Bits */
@@ -247,9 +256,8 @@ typedef struct _SRB_EXTENSION {
     PVRING_DESC_ALIAS     pdesc;
     VIO_SG                vio_sg[VIRTIO_MAX_SG];
     VRING_DESC_ALIAS      desc_alias[VIRTIO_MAX_SG];
-#ifdef USE_CPU_TO_VQ_MAP
-    ULONG                 cpu;
-#endif // USE_CPU_TO_VQ_MAP
+    ULONGLONG             submit_ticks;
+    ULONG                 cpu;          /* system wide index of the submitting processor */
 }SRB_EXTENSION, * PSRB_EXTENSION;
 #pragma pack()
 
@@ -272,6 +280,57 @@ typedef struct virtio_bar {
     BOOLEAN           bPortSpace;
 } VIRTIO_BAR, *PVIRTIO_BAR;
 
+/* Per request queue statistics, the layout of the VioScsiQueueStatistics
+ * WMI class and of the VIOSCSI_IOCTL_QUERY_STATISTICS output. Latency
+ * bucket 0 counts requests completed in less than 2 us, bucket n those
+ * completed in [2^n, 2^(n+1)) us and the last one everything slower.
+ */
+typedef struct _VIOSCSI_QUEUE_STATS {
+    ULONGLONG             ReadRequests;
+    ULONGLONG             WriteRequests;
+    ULONGLONG             OtherRequests;
+    ULONGLONG             ReadBytes;
+    ULONGLONG             WriteBytes;
+    ULONGLONG             BusyEvents;   /* requests the ring had no room for */
+    ULONG                 InFlight;
+    ULONG                 MaxInFlight;
+    ULONGLONG             ReadLatency[LATENCY_BUCKETS];
+    ULONGLONG             WriteLatency[LATENCY_BUCKETS];
+} VIOSCSI_QUEUE_STATS, *PVIOSCSI_QUEUE_STATS;
+
+/* VIOSCSI_IOCTL_QUERY_STATISTICS output following the SRB_IO_CONTROL */
+typedef struct _VIOSCSI_STATISTICS {
+    ULONG                 QueueCount;
+    ULONG                 Reserved;
+    VIOSCSI_QUEUE_STATS   Queues[1];
+} VIOSCSI_STATISTICS, *PVIOSCSI_STATISTICS;
+
+/* Where the CPU to request queue map came from */
+#define VIOSCSI_MAP_NONE        0   /* no map, StorPortGetStartIoPerfParams picks the queue */
+#define VIOSCSI_MAP_TOPOLOGY    1   /* queues spread over the NUMA nodes */
+#define VIOSCSI_MAP_AFFINITY    2   /* refined with the MSI-X message targets */
+
+#define VIOSCSI_CPU_IRQ_AFFINE  0x01 /* the interrupt of the queue targets this CPU */
+#define VIOSCSI_NO_NODE         0xFFFF
+
+/* One entry per active processor, indexed by the system wide processor
+ * index, the layout of the VioScsiCpuMapping WMI class */
+typedef struct _VIOSCSI_CPU_MAPPING {
+    USHORT                Group;
+    UCHAR                 Number;
+    UCHAR                 Flags;
+    USHORT                Node;
+    USHORT                Queue;        /* request queue index, 0 based */
+} VIOSCSI_CPU_MAPPING, *PVIOSCSI_CPU_MAPPING;
+
+typedef struct _VIOSCSI_QUEUE_MAPPING {
+    ULONG                 CpuCount;
+    ULONG                 QueueCount;
+    ULONG                 Source;       /* VIOSCSI_MAP_XXX */
+    ULONG                 Reserved;
+    VIOSCSI_CPU_MAPPING   Cpus[1];
+} VIOSCSI_QUEUE_MAPPING, *PVIOSCSI_QUEUE_MAPPING;
+
 typedef struct _ADAPTER_EXTENSION {
     VirtIODevice          vdev;
 
@@ -309,9 +368,9 @@ typedef struct _ADAPTER_EXTENSION {
     PVirtIOSCSIEventNode  events;
 
     ULONG                 num_queues;
-#ifdef USE_CPU_TO_VQ_MAP
-    UCHAR                 cpu_to_vq_map[MAX_CPU];
-#endif
+    VIOSCSI_CPU_MAPPING   cpu_to_vq_map[MAX_CPU];
+    ULONG                 cpu_map_count;
+    ULONG                 cpu_map_source;
     REQUEST_LIST          pending_list[MAX_CPU];
     ULONG                 perfFlags;
     PGROUP_AFFINITY       pmsg_affinity;
@@ -327,6 +386,11 @@ typedef struct _ADAPTER_EXTENSION {
     UCHAR                 ven_id[8 + 1];
     UCHAR                 prod_id[16 + 1];
     UCHAR                 rev_id[4 + 1];
+    ULONG                 poll_budget;
+    ULONGLONG             poll_budget_ticks;
+    VIRTIO_POLL_QUEUE     poll[MAX_CPU];
+    PVIOSCSI_QUEUE_STATS  stats;
+    ULONGLONG             stats_frequency;
 }ADAPTER_EXTENSION, * PADAPTER_EXTENSION;
 
 #ifndef PCIX_TABLE_POINTER
@@ -68,4 +68,163 @@ typedef struct _VioScsiExtendedInfo
 
 #define VioScsiExtendedInfo_SIZE (FIELD_OFFSET(VioScsiExtendedInfo, PhysicalBreaks) + VioScsiExtendedInfo_PhysicalBreaks_SIZE)
 
+// VioScsiQueueStatistics - VioScsiQueueStatistics
+// VirtIO SCSI Request Queue Statistics
+typedef struct _VioScsiQueueStatistics
+{
+    // 
+    ULONGLONG ReadRequests;
+    #define VioScsiQueueStatistics_ReadRequests_SIZE sizeof(ULONGLONG)
+    #define VioScsiQueueStatistics_ReadRequests_ID 1
+
+    // 
+    ULONGLONG WriteRequests;
+    #define VioScsiQueueStatistics_WriteRequests_SIZE sizeof(ULONGLONG)
+    #define VioScsiQueueStatistics_WriteRequests_ID 2
+
+    // 
+    ULONGLONG OtherRequests;
+    #define VioScsiQueueStatistics_OtherRequests_SIZE sizeof(ULONGLONG)
+    #define VioScsiQueueStatistics_OtherRequests_ID 3
+
+    // 
+    ULONGLONG ReadBytes;
+    #define VioScsiQueueStatistics_ReadBytes_SIZE sizeof(ULONGLONG)
+    #define VioScsiQueueStatistics_ReadBytes_ID 4
+
+    // 
+    ULONGLONG WriteBytes;
+    #define VioScsiQueueStatistics_WriteBytes_SIZE sizeof(ULONGLONG)
+    #define VioScsiQueueStatistics_WriteBytes_ID 5
+
+    // 
+    ULONGLONG BusyEvents;
+    #define VioScsiQueueStatistics_BusyEvents_SIZE sizeof(ULONGLONG)
+    #define VioScsiQueueStatistics_BusyEvents_ID 6
+
+    // 
+    ULONG InFlight;
+    #define VioScsiQueueStatistics_InFlight_SIZE sizeof(ULONG)
+    #define VioScsiQueueStatistics_InFlight_ID 7
+
+    // 
+    ULONG MaxInFlight;
+    #define VioScsiQueueStatistics_MaxInFlight_SIZE sizeof(ULONG)
+    #define VioScsiQueueStatistics_MaxInFlight_ID 8
+
+    // 
+    ULONGLONG ReadLatency[24];
+    #define VioScsiQueueStatistics_ReadLatency_SIZE sizeof(ULONGLONG[24])
+    #define VioScsiQueueStatistics_ReadLatency_ID 9
+
+    // 
+    ULONGLONG WriteLatency[24];
+    #define VioScsiQueueStatistics_WriteLatency_SIZE sizeof(ULONGLONG[24])
+    #define VioScsiQueueStatistics_WriteLatency_ID 10
+
+} VioScsiQueueStatistics, *PVioScsiQueueStatistics;
+
+#define VioScsiQueueStatistics_SIZE (FIELD_OFFSET(VioScsiQueueStatistics, WriteLatency) + VioScsiQueueStatistics_WriteLatency_SIZE)
+
+// VioScsiStatisticsGuid - VioScsiStatistics
+// VirtIO SCSI Statistics
+#define VioScsiWmi_Statistics_Guid \
+    { 0xbca337da,0x2e12,0x4467, { 0xa7,0xe0,0x50,0x7c,0x8c,0x3a,0x85,0x85 } }
+
+#if ! (defined(MIDL_PASS))
+DEFINE_GUID(VioScsiStatisticsGuid_GUID, \
+            0xbca337da,0x2e12,0x4467,0xa7,0xe0,0x50,0x7c,0x8c,0x3a,0x85,0x85);
+#endif
+
+
+typedef struct _VioScsiStatistics
+{
+    // 
+    ULONG QueueCount;
+    #define VioScsiStatistics_QueueCount_SIZE sizeof(ULONG)
+    #define VioScsiStatistics_QueueCount_ID 1
+
+    // 
+    ULONG Reserved;
+    #define VioScsiStatistics_Reserved_SIZE sizeof(ULONG)
+    #define VioScsiStatistics_Reserved_ID 2
+
+    // 
+    VioScsiQueueStatistics Queues[1];
+    #define VioScsiStatistics_Queues_ID 3
+
+} VioScsiStatistics, *PVioScsiStatistics;
+
+// VioScsiCpuMapping - VioScsiCpuMapping
+// VirtIO SCSI Processor to Request Queue Mapping
+typedef struct _VioScsiCpuMapping
+{
+    // 
+    USHORT Group;
+    #define VioScsiCpuMapping_Group_SIZE sizeof(USHORT)
+    #define VioScsiCpuMapping_Group_ID 1
+
+    // 
+    UCHAR Number;
+    #define VioScsiCpuMapping_Number_SIZE sizeof(UCHAR)
+    #define VioScsiCpuMapping_Number_ID 2
+
+    // 
+    UCHAR Flags;
+    #define VioScsiCpuMapping_Flags_SIZE sizeof(UCHAR)
+    #define VioScsiCpuMapping_Flags_ID 3
+
+    // 
+    USHORT Node;
+    #define VioScsiCpuMapping_Node_SIZE sizeof(USHORT)
+    #define VioScsiCpuMapping_Node_ID 4
+
+    // 
+    USHORT Queue;
+    #define VioScsiCpuMapping_Queue_SIZE sizeof(USHORT)
+    #define VioScsiCpuMapping_Queue_ID 5
+
+} VioScsiCpuMapping, *PVioScsiCpuMapping;
+
+#define VioScsiCpuMapping_SIZE (FIELD_OFFSET(VioScsiCpuMapping, Queue) + VioScsiCpuMapping_Queue_SIZE)
+
+// VioScsiQueueMappingGuid - VioScsiQueueMapping
+// VirtIO SCSI Request Queue Mapping
+#define VioScsiWmi_QueueMapping_Guid \
+    { 0x0fba2514,0xf876,0x4a0d, { 0xaf,0x1e,0xdf,0x6e,0xd0,0x8e,0xc9,0xe1 } }
+
+#if ! (defined(MIDL_PASS))
+DEFINE_GUID(VioScsiQueueMappingGuid_GUID, \
+            0x0fba2514,0xf876,0x4a0d,0xaf,0x1e,0xdf,0x6e,0xd0,0x8e,0xc9,0xe1);
+#endif
+
+
+typedef struct _VioScsiQueueMapping
+{
+    // 
+    ULONG CpuCount;
+    #define VioScsiQueueMapping_CpuCount_SIZE sizeof(ULONG)
+    #define VioScsiQueueMapping_CpuCount_ID 1
+
+    // 
+    ULONG QueueCount;
+    #define VioScsiQueueMapping_QueueCount_SIZE sizeof(ULONG)
+    #define VioScsiQueueMapping_QueueCount_ID 2
+
+    // 
+    ULONG Source;
+    #define VioScsiQueueMapping_Source_SIZE sizeof(ULONG)
+    #define VioScsiQueueMapping_Source_ID 3
+
+    // 
+    ULONG Reserved;
+    #define VioScsiQueueMapping_Reserved_SIZE sizeof(ULONG)
+    #define VioScsiQueueMapping_Reserved_ID 4
+
+    // 
+    VioScsiCpuMapping Cpus[1];
+    #define VioScsiQueueMapping_Cpus_ID 5
+
+} VioScsiQueueMapping, *PVioScsiQueueMapping;
+
 #endif
@@ -7,6 +7,10 @@
 
 // Number of descriptors that queue contains.
 #define QUEUE_DESCRIPTORS 128
+// write buffers reclaimed per OutVqLock hold
+#define WRITE_RECLAIM_BATCH 64
+// read and wait requests completed per InBufLock hold
+#define READ_COMPLETE_BATCH 16
 
 static BOOLEAN DmaWriteCallback(PVIRTIO_DMA_TRANSACTION_PARAMS params);
 
@@ -95,7 +99,7 @@ DmaWriteCallback(PVIRTIO_DMA_TRANSACTION_PARAMS params)
     if (ret >= 0)
     {
         prepared = virtqueue_kick_prepare(vq);
-        PushEntryList(&Port->WriteBuffersList, &Entry->ListEntry);
+        InsertTailList(&Port->WriteBuffersList, &Entry->ListEntry);
         Entry->dmaTransaction = params->transaction;
     }
     else
@@ -161,36 +165,43 @@ VIOSerialFreeBuffer(
 VOID VIOSerialProcessInputBuffers(IN PVIOSERIAL_PORT Port)
 {
     NTSTATUS status;
-    ULONG Read;
-    WDFREQUEST Request = NULL;
+    WDFREQUEST Request;
+    WDFREQUEST Requests[READ_COMPLETE_BATCH];
+    NTSTATUS Status[READ_COMPLETE_BATCH];
+    ULONG_PTR Information[READ_COMPLETE_BATCH];
+    ULONG count, i;
+    BOOLEAN HasData;
 
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_QUEUEING, "--> %s\n", __FUNCTION__);
 
-    WdfSpinLockAcquire(Port->InBufLock);
-    if (!Port->InBuf)
+    do
     {
-        Port->InBuf = (PPORT_BUFFER)VIOSerialGetInBuf(Port);
-    }
+        count = 0;
 
-    if (!Port->GuestConnected)
-    {
-        VIOSerialDiscardPortDataLocked(Port);
-    }
+        WdfSpinLockAcquire(Port->InBufLock);
 
-    if (Port->InBuf && Port->PendingReadRequest)
-    {
-        status = WdfRequestUnmarkCancelable(Port->PendingReadRequest);
-        if (status != STATUS_CANCELLED)
+        if (!Port->GuestConnected)
+        {
+            VIOSerialDiscardPortDataLocked(Port);
+        }
+
+        // satisfy the pending reads in order, each one takes everything
+        // that fits from as many in-buffers as there are
+        while (count < READ_COMPLETE_BATCH && VIOSerialPortHasDataLocked(Port) &&
+            NT_SUCCESS(WdfIoQueueRetrieveNextRequest(Port->PendingReadQueue, &Request)))
         {
             PVOID Buffer;
-            size_t Length;
+            size_t Length, Read = 0;
+            SSIZE_T Filled;
 
-            status = WdfRequestRetrieveOutputBuffer(Port->PendingReadRequest, 0, &Buffer, &Length);
+            status = WdfRequestRetrieveOutputBuffer(Request, 0, &Buffer, &Length);
             if (NT_SUCCESS(status))
             {
-                Request = Port->PendingReadRequest;
-                Port->PendingReadRequest = NULL;
-                Read = (ULONG)VIOSerialFillReadBufLocked(Port, Buffer, Length);
+                while (Read < Length &&
+                    (Filled = VIOSerialFillReadBufLocked(Port, (PUCHAR)Buffer + Read, Length - Read)) > 0)
+                {
+                    Read += Filled;
+                }
             }
             else
             {
@@ -198,20 +209,40 @@ VOID VIOSerialProcessInputBuffers(IN PVIOSERIAL_PORT Port)
                     "Failed to retrieve output buffer (Status: %x Request: %p).\n",
                     status, Request);
             }
+            Requests[count] = Request;
+            Status[count] = status;
+            Information[count] = Read;
+            ++count;
         }
-        else
+
+        // wake up the waiters if data is left after the reads
+        HasData = VIOSerialPortHasDataLocked(Port);
+        while (count < READ_COMPLETE_BATCH && HasData &&
+            NT_SUCCESS(WdfIoQueueRetrieveNextRequest(Port->WaitQueue, &Request)))
         {
-            TraceEvents(TRACE_LEVEL_INFORMATION, DBG_QUEUEING,
-                "Request %p was cancelled.\n", Request);
+            PVIRTIO_PORT_DATA_READY Ready;
+
+            // the length was checked when the request was queued
+            status = WdfRequestRetrieveOutputBuffer(Request, sizeof(*Ready), (PVOID*)&Ready, NULL);
+            if (NT_SUCCESS(status))
+            {
+                Ready->BytesAvailable = (ULONG)(Port->InBuf->len - Port->InBuf->offset);
+                Ready->HostConnected = Port->HostConnected;
+            }
+            Requests[count] = Request;
+            Status[count] = status;
+            Information[count] = NT_SUCCESS(status) ? sizeof(*Ready) : 0;
+            ++count;
         }
-    }
-    WdfSpinLockRelease(Port->InBufLock);
 
-    if (Request != NULL)
-    {
-        // no need to have the lock when completing the request
-        WdfRequestCompleteWithInformation(Request, STATUS_SUCCESS, Read);
-    }
+        WdfSpinLockRelease(Port->InBufLock);
+
+        // no need to have the lock when completing the requests
+        for (i = 0; i < count; i++)
+        {
+            WdfRequestCompleteWithInformation(Requests[i], Status[i], Information[i]);
+        }
+    } while (count == READ_COMPLETE_BATCH);
 
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_QUEUEING, "<-- %s\n", __FUNCTION__);
 }
@@ -219,78 +250,68 @@ VOID VIOSerialProcessInputBuffers(IN PVIOSERIAL_PORT Port)
 BOOLEAN VIOSerialReclaimConsumedBuffers(IN PVIOSERIAL_PORT Port)
 {
     WDFREQUEST request;
-    SINGLE_LIST_ENTRY ReclaimedList = { NULL };
-    PSINGLE_LIST_ENTRY iter, last = &ReclaimedList;
-    PVOID buffer;
+    LIST_ENTRY ReclaimedList;
+    PLIST_ENTRY iter;
+    PWRITE_BUFFER_ENTRY entry;
     UINT len;
+    ULONG count;
     struct virtqueue *vq = GetOutQueue(Port);
     BOOLEAN ret;
 
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_QUEUEING, "--> %s\n", __FUNCTION__);
 
-    WdfSpinLockAcquire(Port->OutVqLock);
-
-    if (vq)
+    // Reap in batches so that the writers waiting for OutVqLock get a chance
+    // between them and the completions of one batch run without the lock.
+    do
     {
-        while ((buffer = virtqueue_get_buf(vq, &len)) != NULL)
+        InitializeListHead(&ReclaimedList);
+        count = 0;
+
+        WdfSpinLockAcquire(Port->OutVqLock);
+
+        while (vq && count < WRITE_RECLAIM_BATCH &&
+            (entry = (PWRITE_BUFFER_ENTRY)virtqueue_get_buf(vq, &len)) != NULL)
         {
-            iter = &Port->WriteBuffersList;
-            while (iter->Next != NULL)
+            if (entry->Request != NULL)
             {
-                PWRITE_BUFFER_ENTRY entry = CONTAINING_RECORD(iter->Next,
-                    WRITE_BUFFER_ENTRY, ListEntry);
-
-                if (buffer == entry)
-                {
-                    if (entry->Request != NULL)
-                    {
-                        request = entry->Request;
-                        if (WdfRequestUnmarkCancelable(request) == STATUS_CANCELLED)
-                        {
-                            TraceEvents(TRACE_LEVEL_INFORMATION, DBG_QUEUEING,
-                                "Request %p was cancelled.\n", request);
-                            entry->Request = NULL;
-                        }
-                    }
-
-                    // remove from WriteBuffersList
-                    iter->Next = entry->ListEntry.Next;
-
-                    // append to ReclaimedList
-                    last->Next = &entry->ListEntry;
-                    last = last->Next;
-                    last->Next = NULL;
-                }
-                else
+                request = entry->Request;
+                if (WdfRequestUnmarkCancelable(request) == STATUS_CANCELLED)
                 {
-                    iter = iter->Next;
+                    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_QUEUEING,
+                        "Request %p was cancelled.\n", request);
+                    entry->Request = NULL;
                 }
-            };
+            }
+
+            // move from WriteBuffersList to ReclaimedList
+            RemoveEntryList(&entry->ListEntry);
+            InsertTailList(&ReclaimedList, &entry->ListEntry);
+            ++count;
 
             Port->OutVqFull = FALSE;
         }
-    }
-    ret = Port->OutVqFull;
-
-    WdfSpinLockRelease(Port->OutVqLock);
+        ret = Port->OutVqFull;
 
-    // no need to hold the lock to complete requests and free buffers
-    while ((iter = PopEntryList(&ReclaimedList)) != NULL)
-    {
-        PWRITE_BUFFER_ENTRY entry = CONTAINING_RECORD(iter,
-            WRITE_BUFFER_ENTRY, ListEntry);
+        WdfSpinLockRelease(Port->OutVqLock);
 
-        if (entry->dmaTransaction) {
-            VirtIOWdfDeviceDmaTxComplete(vq->vdev, entry->dmaTransaction);
-        }
-        request = entry->Request;
-        if (request != NULL)
+        // no need to hold the lock to complete requests and free buffers
+        while (!IsListEmpty(&ReclaimedList))
         {
-            WdfRequestCompleteWithInformation(request, STATUS_SUCCESS,
-                WdfRequestGetInformation(request));
+            iter = RemoveHeadList(&ReclaimedList);
+            entry = CONTAINING_RECORD(iter, WRITE_BUFFER_ENTRY, ListEntry);
+
+            if (entry->dmaTransaction) {
+                VirtIOWdfDeviceDmaTxComplete(vq->vdev, entry->dmaTransaction);
+            }
+            request = entry->Request;
+            if (request != NULL)
+            {
+                WdfRequestCompleteWithInformation(request, STATUS_SUCCESS,
+                    WdfRequestGetInformation(request));
+            }
+            WdfObjectDelete(entry->EntryHandle);
         }
-        WdfObjectDelete(entry->EntryHandle);
-    };
+    } while (count == WRITE_RECLAIM_BATCH);
 
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_QUEUEING, "<-- %s Full: %d\n",
         __FUNCTION__, ret);
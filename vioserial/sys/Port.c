@@ -10,7 +10,6 @@
 EVT_WDF_WORKITEM VIOSerialPortSymbolicNameWork;
 EVT_WDF_WORKITEM VIOSerialPortPnpNotifyWork;
 EVT_WDF_WORKITEM VIOSerialInitPortConsoleWork;
-EVT_WDF_REQUEST_CANCEL VIOSerialPortReadRequestCancel;
 EVT_WDF_DEVICE_D0_ENTRY VIOSerialPortEvtDeviceD0Entry;
 EVT_WDF_DEVICE_D0_EXIT VIOSerialPortEvtDeviceD0Exit;
 
@@ -447,6 +446,7 @@ VIOSerialDeviceListCreatePdo(
         rawPdo = RawPdoSerialPortGetData(hChild);
         rawPdo->port = pport;
         pport->Device = hChild;
+        InitializeListHead(&pport->WriteBuffersList);
 
         WDF_IO_QUEUE_CONFIG_INIT(&queueConfig,
                                  WdfIoQueueDispatchSequential
@@ -481,7 +481,6 @@ VIOSerialDeviceListCreatePdo(
                                  WdfIoQueueDispatchSequential);
 
         queueConfig.EvtIoRead   =  VIOSerialPortRead;
-        queueConfig.EvtIoStop   =  VIOSerialPortReadIoStop;
         status = WdfIoQueueCreate(hChild,
                                  &queueConfig,
                                  WDF_NO_OBJECT_ATTRIBUTES,
@@ -507,6 +506,28 @@ VIOSerialDeviceListCreatePdo(
            break;
         }
 
+        // manual queues keep the requests waiting for data cancellable
+        WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchManual);
+        status = WdfIoQueueCreate(hChild,
+                                 &queueConfig,
+                                 WDF_NO_OBJECT_ATTRIBUTES,
+                                 &pport->PendingReadQueue
+                                 );
+        if (NT_SUCCESS(status))
+        {
+           status = WdfIoQueueCreate(hChild,
+                                 &queueConfig,
+                                 WDF_NO_OBJECT_ATTRIBUTES,
+                                 &pport->WaitQueue
+                                 );
+        }
+        if (!NT_SUCCESS(status))
+        {
+           TraceEvents(TRACE_LEVEL_ERROR, DBG_PNP,
+                    "WdfIoQueueCreate (Pending Read Queue) failed 0x%x\n", status);
+           break;
+        }
+
         WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchParallel);
         queueConfig.AllowZeroLengthRequests = WdfFalse;
         queueConfig.EvtIoWrite = VIOSerialPortWrite;
@@ -624,46 +645,39 @@ VIOSerialPortRead(
 
 	WdfSpinLockAcquire(pport->InBufLock);
 
-	if (!VIOSerialPortHasDataLocked(pport))
+	if (!VIOSerialPortHasDataLocked(pport) && !pport->HostConnected)
+	{
+		status = STATUS_INSUFFICIENT_RESOURCES;
+		length = 0;
+	}
+	else
 	{
-		if (!pport->HostConnected)
+		// queue behind the reads already waiting, VIOSerialProcessInputBuffers
+		// completes them in order as long as there is data
+		status = WdfRequestForwardToIoQueue(Request, pport->PendingReadQueue);
+		if (NT_SUCCESS(status))
 		{
-			status = STATUS_INSUFFICIENT_RESOURCES;
-			length = 0;
+			Request = NULL;
 		}
 		else
 		{
-			ASSERT (pport->PendingReadRequest == NULL);
-			status = WdfRequestMarkCancelableEx(Request,
-				VIOSerialPortReadRequestCancel);
-			if (!NT_SUCCESS(status))
-			{
-				length = 0;
-			}
-			else
-			{
-				pport->PendingReadRequest = Request;
-				Request = NULL;
-			}
+			TraceEvents(TRACE_LEVEL_ERROR, DBG_READ,
+				"WdfRequestForwardToIoQueue failed: 0x%x\n", status);
+			length = 0;
 		}
-    }
-    else
-    {
-        length = (ULONG)VIOSerialFillReadBufLocked(pport, systemBuffer, length);
-        if (!length)
-        {
-            status = STATUS_INSUFFICIENT_RESOURCES;
-        }
-    }
+	}
 
     WdfSpinLockRelease(pport->InBufLock);
 
     if (Request != NULL)
     {
-        // we are completing the request right here, either because of
-        // an error or because data was available in the input buffer
+        // the host is not connected and there is nothing to read
         WdfRequestCompleteWithInformation(Request, status, (ULONG_PTR)length);
     }
+    else
+    {
+        VIOSerialProcessInputBuffers(pport);
+    }
 
 	TraceEvents(TRACE_LEVEL_INFORMATION, DBG_READ,"<-- %s\n", __FUNCTION__);
 }
@@ -752,31 +766,11 @@ VOID VIOSerialPortWrite(IN WDFQUEUE Queue,
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_WRITE,"<-- %s\n", __FUNCTION__);
 }
 
-VOID
-VIOSerialPortReadRequestCancel(
-    IN WDFREQUEST Request
-    )
-{
-    PRAWPDO_VIOSERIAL_PORT  pdoData = RawPdoSerialPortGetData(WdfIoQueueGetDevice(WdfRequestGetIoQueue(Request)));
-
-    TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE, "-->%s called on request 0x%p\n", __FUNCTION__, Request);
-
-    // synchronize with VIOSerialQueuesInterruptDpc because the pending
-    // request is not guaranteed to be alive after we return from this callback
-    WdfSpinLockAcquire(pdoData->port->InBufLock);
-    pdoData->port->PendingReadRequest = NULL;
-    WdfSpinLockRelease(pdoData->port->InBufLock);
-
-    WdfRequestCompleteWithInformation(Request, STATUS_CANCELLED, 0L);
-
-    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_WRITE, "<-- %s\n", __FUNCTION__);
-}
-
 VOID VIOSerialPortWriteRequestCancel(IN WDFREQUEST Request)
 {
     PVIOSERIAL_PORT Port = RawPdoSerialPortGetData(
         WdfIoQueueGetDevice(WdfRequestGetIoQueue(Request)))->port;
-    PSINGLE_LIST_ENTRY iter;
+    PLIST_ENTRY iter;
 
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_WRITE, "--> %s Request: 0x%p\n",
         __FUNCTION__, Request);
@@ -784,8 +778,9 @@ VOID VIOSerialPortWriteRequestCancel(IN WDFREQUEST Request)
     // synchronize with VIOSerialReclaimConsumedBuffers because the pending
     // request is not guaranteed to be alive after we return from this callback
     WdfSpinLockAcquire(Port->OutVqLock);
-    iter = &Port->WriteBuffersList;
-    while ((iter = iter->Next) != NULL)
+    for (iter = Port->WriteBuffersList.Flink;
+         iter != &Port->WriteBuffersList;
+         iter = iter->Flink)
     {
         PWRITE_BUFFER_ENTRY entry = CONTAINING_RECORD(iter, WRITE_BUFFER_ENTRY, ListEntry);
         if (entry->Request == Request)
@@ -875,6 +870,31 @@ VIOSerialPortDeviceControl(
            break;
         }
 
+        case IOCTL_WAIT_FOR_DATA:
+        {
+           // check the output length now, the request is completed from DPC
+           status = WdfRequestRetrieveOutputBuffer(Request, sizeof(VIRTIO_PORT_DATA_READY), NULL, NULL);
+           if (!NT_SUCCESS(status))
+           {
+              TraceEvents(TRACE_LEVEL_ERROR, DBG_IOCTLS,
+                            "WdfRequestRetrieveOutputBuffer failed 0x%x\n", status);
+              break;
+           }
+
+           status = WdfRequestForwardToIoQueue(Request, pdoData->port->WaitQueue);
+           if (!NT_SUCCESS(status))
+           {
+              TraceEvents(TRACE_LEVEL_ERROR, DBG_IOCTLS,
+                            "WdfRequestForwardToIoQueue failed 0x%x\n", status);
+              break;
+           }
+
+           // complete it right away if there is data already
+           VIOSerialProcessInputBuffers(pdoData->port);
+           TraceEvents(TRACE_LEVEL_VERBOSE, DBG_IOCTLS, "<-- %s\n", __FUNCTION__);
+           return;
+        }
+
         default:
            status = STATUS_INVALID_DEVICE_REQUEST;
            break;
@@ -1253,7 +1273,8 @@ VIOSerialEvtChildListIdentificationDescriptionDuplicate(
     dst->Removed = src->Removed;
 
     dst->ReadQueue = src->ReadQueue;
-    dst->PendingReadRequest = src->PendingReadRequest;
+    dst->PendingReadQueue = src->PendingReadQueue;
+    dst->WaitQueue = src->WaitQueue;
     dst->WriteQueue = src->WriteQueue;
     dst->IoctlQueue = src->IoctlQueue;
 
@@ -1315,33 +1336,6 @@ VIOSerialEvtChildListIdentificationDescriptionCleanup(
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_CREATE_CLOSE, "<-- %s\n", __FUNCTION__);
 }
 
-VOID VIOSerialPortReadIoStop(IN WDFQUEUE Queue,
-                             IN WDFREQUEST Request,
-                             IN ULONG ActionFlags)
-{
-    PRAWPDO_VIOSERIAL_PORT pdoData = RawPdoSerialPortGetData(
-        WdfIoQueueGetDevice(Queue));
-    PVIOSERIAL_PORT pport = pdoData->port;
-
-    TraceEvents(TRACE_LEVEL_ERROR, DBG_READ, "--> %s\n", __FUNCTION__);
-    ASSERT(pport->PendingReadRequest == Request);
-
-    WdfSpinLockAcquire(pport->InBufLock);
-    if (ActionFlags & WdfRequestStopActionSuspend)
-    {
-        WdfRequestStopAcknowledge(Request, FALSE);
-    }
-    else if (ActionFlags & WdfRequestStopActionPurge)
-    {
-        if (WdfRequestUnmarkCancelable(Request) != STATUS_CANCELLED)
-        {
-           pport->PendingReadRequest = NULL;
-           WdfRequestCompleteWithInformation(Request , STATUS_CANCELLED, 0L);
-        }
-    }
-    WdfSpinLockRelease(pport->InBufLock);
-}
-
 VOID VIOSerialPortWriteIoStop(IN WDFQUEUE Queue,
                               IN WDFREQUEST Request,
                               IN ULONG ActionFlags)
@@ -1361,8 +1355,10 @@ VOID VIOSerialPortWriteIoStop(IN WDFQUEUE Queue,
    {
       if (WdfRequestUnmarkCancelable(Request) != STATUS_CANCELLED)
       {
-         PSINGLE_LIST_ENTRY iter = &pport->WriteBuffersList;
-         while ((iter = iter->Next) != NULL)
+         PLIST_ENTRY iter;
+         for (iter = pport->WriteBuffersList.Flink;
+              iter != &pport->WriteBuffersList;
+              iter = iter->Flink)
          {
             PWRITE_BUFFER_ENTRY entry = CONTAINING_RECORD(iter, WRITE_BUFFER_ENTRY, ListEntry);
             if (entry->Request == Request)
@@ -1433,7 +1429,7 @@ VIOSerialPortEvtDeviceD0Exit(
     )
 {
     PVIOSERIAL_PORT Port = RawPdoSerialPortGetData(Device)->port;
-    PSINGLE_LIST_ENTRY iter;
+    PLIST_ENTRY iter;
 
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_INIT, "--> %s port 0x%X -> D%d\n",
         __FUNCTION__, Port->PortId, TargetState - WdfPowerDeviceD0);
@@ -1459,19 +1455,18 @@ VIOSerialPortEvtDeviceD0Exit(
 
     VirtIOWdfDeviceFreeDmaMemoryByTag(GetInQueue(Port)->vdev, Port->DmaGroupTag);
 
-    iter = PopEntryList(&Port->WriteBuffersList);
-    while (iter != NULL)
+    while (!IsListEmpty(&Port->WriteBuffersList))
     {
-        PWRITE_BUFFER_ENTRY entry = CONTAINING_RECORD(iter,
-            WRITE_BUFFER_ENTRY, ListEntry);
+        PWRITE_BUFFER_ENTRY entry;
+
+        iter = RemoveHeadList(&Port->WriteBuffersList);
+        entry = CONTAINING_RECORD(iter, WRITE_BUFFER_ENTRY, ListEntry);
 
         if (entry->dmaTransaction) {
             VirtIOWdfDeviceDmaTxComplete(GetOutQueue(Port)->vdev, entry->dmaTransaction);
         }
 
         WdfObjectDelete(entry->EntryHandle);
-
-        iter = PopEntryList(&Port->WriteBuffersList);
     };
 
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_INIT, "<-- %s\n", __FUNCTION__);
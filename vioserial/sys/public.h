@@ -47,6 +47,18 @@ typedef struct _tagVirtioPortInfo {
     CHAR                Name[1];
 }VIRTIO_PORT_INFO, * PVIRTIO_PORT_INFO;
 
+// Pends until data can be read from the port, then returns
+// VIRTIO_PORT_DATA_READY. Any number of them may be outstanding, so an
+// overlapped caller can keep one posted on an I/O completion port instead
+// of a read. Host connection changes are still reported through
+// GUID_VIOSERIAL_PORT_CHANGE_STATUS.
+#define IOCTL_WAIT_FOR_DATA      CTL_CODE(FILE_DEVICE_UNKNOWN, 0x801, METHOD_BUFFERED, FILE_ANY_ACCESS)
+
+typedef struct _tagVirtioPortDataReady {
+    ULONG               BytesAvailable; // in the first receive buffer, more may follow
+    BOOLEAN             HostConnected;
+}VIRTIO_PORT_DATA_READY, * PVIRTIO_PORT_DATA_READY;
+
 DEFINE_GUID(GUID_VIOSERIAL_PORT_CHANGE_STATUS,
 0x2c0f39ac, 0xb156, 0x4237, 0x9c, 0x64, 0x89, 0x91, 0xa1, 0x8b, 0xf3, 0x5c);
 // {2C0F39AC-B156-4237-9C64-8991A18BF35C}
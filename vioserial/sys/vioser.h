@@ -132,7 +132,7 @@ typedef struct _tagPortBuffer
 
 typedef struct _WriteBufferEntry
 {
-    SINGLE_LIST_ENTRY ListEntry;
+    LIST_ENTRY ListEntry;
     WDFMEMORY EntryHandle;
     WDFREQUEST Request;
     PVOID      OriginalWriteBuffer;
@@ -160,11 +160,15 @@ typedef struct _tagVioSerialPort
 
     BOOLEAN             Removed;
     WDFQUEUE            ReadQueue;
-    WDFREQUEST          PendingReadRequest;
+    // Manual queues of the reads waiting for data and of the
+    // IOCTL_WAIT_FOR_DATA requests, both drained under InBufLock.
+    WDFQUEUE            PendingReadQueue;
+    WDFQUEUE            WaitQueue;
 
     // Hold a list of allocated buffers which were written to the virt queue
-    // and was not returned yet.
-    SINGLE_LIST_ENTRY   WriteBuffersList;
+    // and was not returned yet. The entry is also the virtqueue cookie, so a
+    // returned buffer is unlinked without searching.
+    LIST_ENTRY          WriteBuffersList;
 
     WDFQUEUE            WriteQueue;
     WDFQUEUE            IoctlQueue;
@@ -322,7 +326,6 @@ EVT_WDF_CHILD_LIST_IDENTIFICATION_DESCRIPTION_DUPLICATE VIOSerialEvtChildListIde
 // PASSIVE_LEVEL. Annotate the prototypes to make static analysis happy.
 EVT_WDF_IO_QUEUE_IO_READ _IRQL_requires_(PASSIVE_LEVEL) VIOSerialPortRead;
 EVT_WDF_IO_QUEUE_IO_WRITE _IRQL_requires_(PASSIVE_LEVEL) VIOSerialPortWrite;
-EVT_WDF_IO_QUEUE_IO_STOP _IRQL_requires_(PASSIVE_LEVEL) VIOSerialPortReadIoStop;
 EVT_WDF_IO_QUEUE_IO_STOP _IRQL_requires_(PASSIVE_LEVEL) VIOSerialPortWriteIoStop;
 EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL _IRQL_requires_(PASSIVE_LEVEL) VIOSerialPortDeviceControl;
 EVT_WDF_REQUEST_CANCEL VIOSerialPortWriteRequestCancel;
@@ -137,6 +137,183 @@ NtStatusToWsaError(
     return wsaError;
 }
 
+static
+INT
+Win32ErrorToWsaError(
+    DWORD dwError
+)
+{
+    switch (dwError)
+    {
+    case ERROR_SUCCESS:
+        return ERROR_SUCCESS;
+    case ERROR_IO_PENDING:
+        return WSA_IO_PENDING;
+    case ERROR_IO_INCOMPLETE:
+        return WSA_IO_INCOMPLETE;
+    case ERROR_OPERATION_ABORTED:
+        return WSA_OPERATION_ABORTED;
+    case ERROR_INVALID_HANDLE:
+        return WSAENOTSOCK;
+    case ERROR_INVALID_PARAMETER:
+    case ERROR_INVALID_FUNCTION:
+        return WSAEINVAL;
+    case ERROR_NOT_ENOUGH_MEMORY:
+    case ERROR_NO_SYSTEM_RESOURCES:
+        return WSAENOBUFS;
+    case ERROR_CONNECTION_REFUSED:
+        return WSAECONNREFUSED;
+    case ERROR_NETNAME_DELETED:         //STATUS_CONNECTION_RESET
+        return WSAECONNRESET;
+    case ERROR_PIPE_NOT_CONNECTED:      //STATUS_PIPE_DISCONNECTED
+        return WSAESHUTDOWN;
+    case ERROR_BUSY:                    //STATUS_DEVICE_BUSY
+        return WSAEALREADY;
+    case ERROR_BAD_COMMAND:             //STATUS_INVALID_DEVICE_STATE
+    case ERROR_CONNECTION_INVALID:
+        return WSAENOTCONN;
+    case ERROR_SEM_TIMEOUT:
+        return WSAETIMEDOUT;
+    default:
+        return WSASYSCALLFAILURE;
+    }
+}
+
+//Prepares OVERLAPPED for a blocking call. The low bit of hEvent keeps the
+//completion away from the completion port the socket may be bound to.
+static
+INT
+VIOSockSyncIoInit(
+    _Out_ LPOVERLAPPED lpOverlapped
+)
+{
+    HANDLE hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    ZeroMemory(lpOverlapped, sizeof(*lpOverlapped));
+    if (!hEvent)
+        return WSAENOBUFS;
+
+    lpOverlapped->hEvent = (HANDLE)((ULONG_PTR)hEvent | 1);
+    return ERROR_SUCCESS;
+}
+
+static
+INT
+VIOSockSyncIoWait(
+    _In_ HANDLE hFile,
+    _In_ LPOVERLAPPED lpOverlapped,
+    _In_ BOOL bCompleted,
+    _Out_opt_ LPDWORD lpTransferred
+)
+{
+    HANDLE hEvent = (HANDLE)((ULONG_PTR)lpOverlapped->hEvent & ~(ULONG_PTR)1);
+    DWORD dwTransferred = 0;
+    INT iError = ERROR_SUCCESS;
+
+    if (!bCompleted && GetLastError() != ERROR_IO_PENDING)
+    {
+        iError = Win32ErrorToWsaError(GetLastError());
+    }
+    else
+    {
+        if (!bCompleted)
+            WaitForSingleObject(hEvent, INFINITE);
+
+        if (!GetOverlappedResult(hFile, lpOverlapped, &dwTransferred, FALSE))
+            iError = Win32ErrorToWsaError(GetLastError());
+    }
+
+    CloseHandle(hEvent);
+
+    if (lpTransferred)
+        *lpTransferred = dwTransferred;
+
+    return iError;
+}
+
+static
+INT
+VIOSockDeviceControl(
+    _In_ SOCKET s,
+    _In_ DWORD dwIoControlCode,
+    _In_reads_bytes_opt_(nInBufferSize) LPVOID lpInBuffer,
+    _In_ DWORD nInBufferSize,
+    _Out_writes_bytes_to_opt_(nOutBufferSize, *lpBytesReturned) LPVOID lpOutBuffer,
+    _In_ DWORD nOutBufferSize,
+    _Out_opt_ LPDWORD lpBytesReturned
+)
+{
+    OVERLAPPED ov;
+    BOOL bRes;
+    INT iError = VIOSockSyncIoInit(&ov);
+
+    if (iError != ERROR_SUCCESS)
+        return iError;
+
+    bRes = DeviceIoControl((HANDLE)s, dwIoControlCode, lpInBuffer, nInBufferSize,
+        lpOutBuffer, nOutBufferSize, NULL, &ov);
+
+    return VIOSockSyncIoWait((HANDLE)s, &ov, bRes, lpBytesReturned);
+}
+
+//Reads or writes a single buffer. With lpOverlapped the request completes
+//asynchronously through its event or the completion port of the socket,
+//otherwise the call blocks until the driver completes it.
+static
+INT
+VIOSockReadWrite(
+    _In_ SOCKET s,
+    _In_ BOOL bWrite,
+    _Inout_updates_bytes_(dwLength) PCHAR pBuffer,
+    _In_ DWORD dwLength,
+    _Out_opt_ LPDWORD lpTransferred,
+    _Inout_opt_ LPWSAOVERLAPPED lpOverlapped
+)
+{
+    OVERLAPPED ov;
+    BOOL bRes;
+    INT iError;
+
+    if (lpOverlapped)
+    {
+        bRes = bWrite ?
+            WriteFile((HANDLE)s, pBuffer, dwLength, NULL, lpOverlapped) :
+            ReadFile((HANDLE)s, pBuffer, dwLength, NULL, lpOverlapped);
+
+        if (!bRes)
+            return Win32ErrorToWsaError(GetLastError());
+
+        if (lpTransferred)
+            *lpTransferred = (DWORD)lpOverlapped->InternalHigh;
+        return ERROR_SUCCESS;
+    }
+
+    iError = VIOSockSyncIoInit(&ov);
+    if (iError != ERROR_SUCCESS)
+        return iError;
+
+    bRes = bWrite ?
+        WriteFile((HANDLE)s, pBuffer, dwLength, NULL, &ov) :
+        ReadFile((HANDLE)s, pBuffer, dwLength, NULL, &ov);
+
+    return VIOSockSyncIoWait((HANDLE)s, &ov, bRes, lpTransferred);
+}
+
+static
+DWORD
+VIOSockBuffersLength(
+    _In_reads_(dwBufferCount) LPWSABUF lpBuffers,
+    _In_ DWORD dwBufferCount
+)
+{
+    DWORD i, dwLength = 0;
+
+    for (i = 0; i < dwBufferCount; ++i)
+        dwLength += lpBuffers[i].len;
+
+    return dwLength;
+}
+
 _Must_inspect_result_
 SOCKET
 WSPAPI
@@ -310,17 +487,46 @@ VIOSockConnect(
 )
 {
     int iRes = -1;
+    PSOCKADDR_VM pAddr = (PSOCKADDR_VM)name;
+    VIRTIO_VSOCK_CONNECT Connect;
 
-    UNREFERENCED_PARAMETER(name);
-    UNREFERENCED_PARAMETER(namelen);
     UNREFERENCED_PARAMETER(lpCallerData);
-    UNREFERENCED_PARAMETER(lpCalleeData);
     UNREFERENCED_PARAMETER(lpSQOS);
     UNREFERENCED_PARAMETER(lpGQOS);
 
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_SOCKET, "--> %s, socket: %p\n", __FUNCTION__, (PVOID)s);
 
-    *lpErrno = WSAVERNOTSUPPORTED;
+    if (!name || namelen < sizeof(*pAddr))
+    {
+        *lpErrno = WSAEFAULT;
+    }
+    else if (pAddr->svm_family != AF_VSOCK)
+    {
+        *lpErrno = WSAEAFNOSUPPORT;
+    }
+    else
+    {
+        Connect.dst_cid = pAddr->svm_cid;
+        Connect.dst_port = pAddr->svm_port;
+
+        *lpErrno = VIOSockDeviceControl(s, IOCTL_SOCKET_CONNECT, &Connect, sizeof(Connect),
+            NULL, 0, NULL);
+
+        if (*lpErrno == ERROR_SUCCESS)
+        {
+            if (lpCalleeData)
+                lpCalleeData->len = 0;
+            iRes = 0;
+        }
+        else if (*lpErrno == WSAENOTCONN)
+        {
+            //STATUS_INVALID_DEVICE_STATE, the socket is not in the closed state
+            *lpErrno = WSAEISCONN;
+        }
+    }
+
+    if (iRes)
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_SOCKET, "Connect failed: %d\n", *lpErrno);
 
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_SOCKET, "<-- %s\n", __FUNCTION__);
     return iRes;
@@ -403,19 +609,18 @@ VIOSockGetOverlappedResult(
     _Out_ LPINT lpErrno
 )
 {
-    int iRes = -1;
+    BOOL bRes;
 
-    UNREFERENCED_PARAMETER(lpOverlapped);
-    UNREFERENCED_PARAMETER(lpcbTransfer);
-    UNREFERENCED_PARAMETER(fWait);
-    UNREFERENCED_PARAMETER(lpdwFlags);
-
-    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_SOCKET, "--> %s, socket: %p\n", __FUNCTION__, (PVOID)s);
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_SOCKET, "--> %s, socket: %p\n", __FUNCTION__, (PVOID)s);
 
-    *lpErrno = WSAVERNOTSUPPORTED;
+    bRes = GetOverlappedResult((HANDLE)s, lpOverlapped, lpcbTransfer, fWait);
+    if (bRes)
+        *lpdwFlags = 0;
+    else
+        *lpErrno = Win32ErrorToWsaError(GetLastError());
 
-    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_SOCKET, "<-- %s\n", __FUNCTION__);
-    return iRes;
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_SOCKET, "<-- %s\n", __FUNCTION__);
+    return bRes;
 }
 
 int
@@ -611,20 +816,75 @@ VIOSockRecv(
 )
 {
     int iRes = -1;
+    PCHAR pBuffer;
+    DWORD dwLength, dwRecvd = 0;
 
-    UNREFERENCED_PARAMETER(lpBuffers);
-    UNREFERENCED_PARAMETER(dwBufferCount);
-    UNREFERENCED_PARAMETER(lpNumberOfBytesRecvd);
-    UNREFERENCED_PARAMETER(lpFlags);
-    UNREFERENCED_PARAMETER(lpOverlapped);
-    UNREFERENCED_PARAMETER(lpCompletionRoutine);
     UNREFERENCED_PARAMETER(lpThreadId);
 
-    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_SOCKET, "--> %s, socket: %p\n", __FUNCTION__, (PVOID)s);
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_SOCKET, "--> %s, socket: %p\n", __FUNCTION__, (PVOID)s);
 
-    *lpErrno = WSAVERNOTSUPPORTED;
+    if (!dwBufferCount)
+    {
+        *lpErrno = WSAEINVAL;
+        return iRes;
+    }
 
-    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_SOCKET, "<-- %s\n", __FUNCTION__);
+    //completion routines, MSG_PEEK and MSG_OOB are not supported yet,
+    //as well as scatter reads for overlapped requests
+    if (lpCompletionRoutine || *lpFlags || (lpOverlapped && dwBufferCount > 1))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_SOCKET, "Unsupported receive parameters\n");
+        *lpErrno = WSAEOPNOTSUPP;
+        return iRes;
+    }
+
+    //the driver drains all the queued packets into one buffer, so gather the
+    //WSABUFs into a single read and scatter it afterwards
+    dwLength = VIOSockBuffersLength(lpBuffers, dwBufferCount);
+    if (dwBufferCount == 1)
+    {
+        pBuffer = lpBuffers[0].buf;
+    }
+    else
+    {
+        pBuffer = HeapAlloc(GetProcessHeap(), 0, dwLength);
+        if (!pBuffer)
+        {
+            *lpErrno = WSAENOBUFS;
+            return iRes;
+        }
+    }
+
+    *lpErrno = VIOSockReadWrite(s, FALSE, pBuffer, dwLength, &dwRecvd, lpOverlapped);
+    if (*lpErrno == ERROR_SUCCESS)
+    {
+        if (pBuffer != lpBuffers[0].buf)
+        {
+            DWORD i, dwOffset = 0;
+
+            for (i = 0; i < dwBufferCount && dwOffset < dwRecvd; ++i)
+            {
+                DWORD dwChunk = min(lpBuffers[i].len, dwRecvd - dwOffset);
+
+                memcpy(lpBuffers[i].buf, pBuffer + dwOffset, dwChunk);
+                dwOffset += dwChunk;
+            }
+        }
+
+        if (lpNumberOfBytesRecvd)
+            *lpNumberOfBytesRecvd = dwRecvd;
+        *lpFlags = 0;
+        iRes = 0;
+    }
+    else if (*lpErrno != WSA_IO_PENDING)
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_SOCKET, "Receive failed: %d\n", *lpErrno);
+    }
+
+    if (pBuffer != lpBuffers[0].buf)
+        HeapFree(GetProcessHeap(), 0, pBuffer);
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_SOCKET, "<-- %s\n", __FUNCTION__);
     return iRes;
 }
 
@@ -684,6 +944,79 @@ VIOSockRecvFrom(
     return iRes;
 }
 
+typedef struct _VIOSOCK_SELECT_ENTRY {
+    SOCKET      s;
+    ULONG       Events;         //IOCTL_SOCKET_POLL input
+    ULONG       Ready;          //IOCTL_SOCKET_POLL output
+    OVERLAPPED  ov;
+} VIOSOCK_SELECT_ENTRY, *PVIOSOCK_SELECT_ENTRY;
+
+static
+BOOL
+VIOSockSelectAdd(
+    _Inout_updates_(MAXIMUM_WAIT_OBJECTS) PVIOSOCK_SELECT_ENTRY pEntries,
+    _Inout_ PULONG puCount,
+    _In_opt_ fd_set FAR * fds,
+    _In_ ULONG uEvents
+)
+{
+    u_int i;
+    ULONG j;
+
+    if (!fds)
+        return TRUE;
+
+    for (i = 0; i < fds->fd_count; ++i)
+    {
+        for (j = 0; j < *puCount; ++j)
+        {
+            if (pEntries[j].s == fds->fd_array[i])
+                break;
+        }
+
+        if (j == *puCount)
+        {
+            if (j == MAXIMUM_WAIT_OBJECTS)
+                return FALSE;
+
+            pEntries[j].s = fds->fd_array[i];
+            pEntries[j].Events = 0;
+            ++*puCount;
+        }
+
+        pEntries[j].Events |= uEvents;
+    }
+
+    return TRUE;
+}
+
+static
+int
+VIOSockSelectSet(
+    _In_reads_(uCount) PVIOSOCK_SELECT_ENTRY pEntries,
+    _In_ ULONG uCount,
+    _Inout_opt_ fd_set FAR * fds,
+    _In_ ULONG uEvents
+)
+{
+    ULONG i;
+
+    if (!fds)
+        return 0;
+
+    FD_ZERO(fds);
+    for (i = 0; i < uCount; ++i)
+    {
+        if ((pEntries[i].Events & uEvents) && (pEntries[i].Ready & (uEvents | VIRTIO_VSOCK_POLL_HUP)))
+            FD_SET(pEntries[i].s, fds);
+    }
+
+    return fds->fd_count;
+}
+
+//Every socket gets an overlapped IOCTL_SOCKET_POLL, which the driver completes
+//as soon as one of the requested events is ready. The polls left pending after
+//the wait are cancelled.
 int
 WSPAPI
 VIOSockSelect(
@@ -696,18 +1029,98 @@ VIOSockSelect(
 )
 {
     int iRes = -1;
+    VIOSOCK_SELECT_ENTRY Entries[MAXIMUM_WAIT_OBJECTS];
+    HANDLE hEvents[MAXIMUM_WAIT_OBJECTS];
+    ULONG i, uCount = 0, uStarted = 0;
+    BOOL bReady = FALSE;
+    DWORD dwTimeout = INFINITE;
 
     UNREFERENCED_PARAMETER(nfds);
-    UNREFERENCED_PARAMETER(readfds);
-    UNREFERENCED_PARAMETER(writefds);
-    UNREFERENCED_PARAMETER(exceptfds);
-    UNREFERENCED_PARAMETER(timeout);
 
-    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_SOCKET, "--> %s\n", __FUNCTION__);
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_SOCKET, "--> %s\n", __FUNCTION__);
 
-    *lpErrno = WSAVERNOTSUPPORTED;
+    if (!VIOSockSelectAdd(Entries, &uCount, readfds, VIRTIO_VSOCK_POLL_IN) ||
+        !VIOSockSelectAdd(Entries, &uCount, writefds, VIRTIO_VSOCK_POLL_OUT) ||
+        (!uCount && (!exceptfds || !exceptfds->fd_count)))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_SOCKET, "Invalid socket sets\n");
+        *lpErrno = WSAEINVAL;
+        return iRes;
+    }
 
-    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_SOCKET, "<-- %s\n", __FUNCTION__);
+    //neither OOB data nor non-blocking connect are supported,
+    //so there are no exceptional conditions to report
+    if (exceptfds)
+        FD_ZERO(exceptfds);
+
+    if (timeout)
+        dwTimeout = timeout->tv_sec * 1000 + timeout->tv_usec / 1000;
+
+    *lpErrno = ERROR_SUCCESS;
+
+    for (; uStarted < uCount; ++uStarted)
+    {
+        PVIOSOCK_SELECT_ENTRY pEntry = &Entries[uStarted];
+
+        *lpErrno = VIOSockSyncIoInit(&pEntry->ov);
+        if (*lpErrno != ERROR_SUCCESS)
+            break;
+
+        hEvents[uStarted] = (HANDLE)((ULONG_PTR)pEntry->ov.hEvent & ~(ULONG_PTR)1);
+        pEntry->Ready = 0;
+
+        if (DeviceIoControl((HANDLE)pEntry->s, IOCTL_SOCKET_POLL, &pEntry->Events, sizeof(pEntry->Events),
+            &pEntry->Ready, sizeof(pEntry->Ready), NULL, &pEntry->ov))
+        {
+            bReady = TRUE;
+        }
+        else if (GetLastError() != ERROR_IO_PENDING)
+        {
+            *lpErrno = Win32ErrorToWsaError(GetLastError());
+            CloseHandle(hEvents[uStarted]);
+            break;
+        }
+    }
+
+    if (*lpErrno == ERROR_SUCCESS && !bReady && uCount)
+    {
+        if (WaitForMultipleObjects(uCount, hEvents, FALSE, dwTimeout) == WAIT_FAILED)
+            *lpErrno = Win32ErrorToWsaError(GetLastError());
+    }
+    else if (*lpErrno == ERROR_SUCCESS && !uCount && dwTimeout)
+    {
+        //only exceptfds, nothing can become ready
+        Sleep(dwTimeout);
+    }
+
+    for (i = 0; i < uStarted; ++i)
+    {
+        PVIOSOCK_SELECT_ENTRY pEntry = &Entries[i];
+
+        DWORD dwReturned;
+
+        if (!HasOverlappedIoCompleted(&pEntry->ov))
+            CancelIoEx((HANDLE)pEntry->s, &pEntry->ov);
+
+        //cancelled polls complete with ERROR_OPERATION_ABORTED and nothing ready
+        WaitForSingleObject(hEvents[i], INFINITE);
+        if (!GetOverlappedResult((HANDLE)pEntry->s, &pEntry->ov, &dwReturned, FALSE))
+            pEntry->Ready = 0;
+
+        CloseHandle(hEvents[i]);
+    }
+
+    if (*lpErrno == ERROR_SUCCESS)
+    {
+        iRes = VIOSockSelectSet(Entries, uCount, readfds, VIRTIO_VSOCK_POLL_IN) +
+            VIOSockSelectSet(Entries, uCount, writefds, VIRTIO_VSOCK_POLL_OUT);
+    }
+    else
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_SOCKET, "Select failed: %d\n", *lpErrno);
+    }
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_SOCKET, "<-- %s\n", __FUNCTION__);
     return iRes;
 }
 
@@ -726,20 +1139,67 @@ VIOSockSend(
 )
 {
     int iRes = -1;
+    PCHAR pBuffer;
+    DWORD i, dwLength, dwSent = 0;
 
-    UNREFERENCED_PARAMETER(lpBuffers);
-    UNREFERENCED_PARAMETER(dwBufferCount);
-    UNREFERENCED_PARAMETER(lpNumberOfBytesSent);
-    UNREFERENCED_PARAMETER(dwFlags);
-    UNREFERENCED_PARAMETER(lpOverlapped);
-    UNREFERENCED_PARAMETER(lpCompletionRoutine);
     UNREFERENCED_PARAMETER(lpThreadId);
 
-    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_SOCKET, "--> %s, socket: %p\n", __FUNCTION__, (PVOID)s);
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_SOCKET, "--> %s, socket: %p\n", __FUNCTION__, (PVOID)s);
 
-    *lpErrno = WSAVERNOTSUPPORTED;
+    if (!dwBufferCount)
+    {
+        *lpErrno = WSAEINVAL;
+        return iRes;
+    }
 
-    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_SOCKET, "<-- %s\n", __FUNCTION__);
+    //completion routines and MSG_OOB are not supported yet,
+    //as well as gather writes for overlapped requests
+    if (lpCompletionRoutine || dwFlags || (lpOverlapped && dwBufferCount > 1))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_SOCKET, "Unsupported send parameters\n");
+        *lpErrno = WSAEOPNOTSUPP;
+        return iRes;
+    }
+
+    dwLength = VIOSockBuffersLength(lpBuffers, dwBufferCount);
+    if (dwBufferCount == 1)
+    {
+        pBuffer = lpBuffers[0].buf;
+    }
+    else
+    {
+        DWORD dwOffset = 0;
+
+        pBuffer = HeapAlloc(GetProcessHeap(), 0, dwLength);
+        if (!pBuffer)
+        {
+            *lpErrno = WSAENOBUFS;
+            return iRes;
+        }
+
+        for (i = 0; i < dwBufferCount; ++i)
+        {
+            memcpy(pBuffer + dwOffset, lpBuffers[i].buf, lpBuffers[i].len);
+            dwOffset += lpBuffers[i].len;
+        }
+    }
+
+    *lpErrno = VIOSockReadWrite(s, TRUE, pBuffer, dwLength, &dwSent, lpOverlapped);
+    if (*lpErrno == ERROR_SUCCESS)
+    {
+        if (lpNumberOfBytesSent)
+            *lpNumberOfBytesSent = dwSent;
+        iRes = 0;
+    }
+    else if (*lpErrno != WSA_IO_PENDING)
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_SOCKET, "Send failed: %d\n", *lpErrno);
+    }
+
+    if (pBuffer != lpBuffers[0].buf)
+        HeapFree(GetProcessHeap(), 0, pBuffer);
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_SOCKET, "<-- %s\n", __FUNCTION__);
     return iRes;
 }
 
@@ -834,12 +1294,29 @@ VIOSockShutdown(
 )
 {
     int iRes = -1;
-
-    UNREFERENCED_PARAMETER(how);
+    ULONG uFlags;
 
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_SOCKET, "--> %s, socket: %p\n", __FUNCTION__, (PVOID)s);
 
-    *lpErrno = WSAVERNOTSUPPORTED;
+    switch (how)
+    {
+    case SD_RECEIVE:
+        uFlags = VIRTIO_VSOCK_SHUTDOWN_RCV;
+        break;
+    case SD_SEND:
+        uFlags = VIRTIO_VSOCK_SHUTDOWN_SEND;
+        break;
+    case SD_BOTH:
+        uFlags = VIRTIO_VSOCK_SHUTDOWN_MASK;
+        break;
+    default:
+        *lpErrno = WSAEINVAL;
+        return iRes;
+    }
+
+    *lpErrno = VIOSockDeviceControl(s, IOCTL_SOCKET_SHUTDOWN, &uFlags, sizeof(uFlags), NULL, 0, NULL);
+    if (*lpErrno == ERROR_SUCCESS)
+        iRes = 0;
 
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_SOCKET, "<-- %s\n", __FUNCTION__);
     return iRes;
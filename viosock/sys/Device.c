@@ -98,7 +98,7 @@ VIOSockEvtDeviceAdd(
     IN PWDFDEVICE_INIT DeviceInit)
 {
     NTSTATUS                     status = STATUS_SUCCESS;
-    WDF_OBJECT_ATTRIBUTES        deviceAttributes, fileAttributes, collectionAttributes;
+    WDF_OBJECT_ATTRIBUTES        deviceAttributes, fileAttributes, collectionAttributes, lockAttributes;
     WDFDEVICE                    hDevice;
     WDF_PNPPOWER_EVENT_CALLBACKS PnpPowerCallbacks;
     PDEVICE_CONTEXT              pContext = NULL;
@@ -139,7 +139,7 @@ VIOSockEvtDeviceAdd(
         &fileConfig,
         VIOSockCreate,
         VIOSockClose,
-        WDF_NO_EVENT_CALLBACK // Cleanup
+        VIOSockCleanup
     );
     fileConfig.FileObjectClass = WdfFileObjectWdfCanUseFsContext;
 
@@ -192,6 +192,61 @@ VIOSockEvtDeviceAdd(
         return status;
     }
 
+    WDF_OBJECT_ATTRIBUTES_INIT(&lockAttributes);
+    lockAttributes.ParentObject = hDevice;
+
+    status = WdfSpinLockCreate(&lockAttributes, &pContext->SocketListLock);
+    if (NT_SUCCESS(status))
+        status = WdfSpinLockCreate(&lockAttributes, &pContext->RxLock);
+    if (NT_SUCCESS(status))
+        status = WdfSpinLockCreate(&lockAttributes, &pContext->TxLock);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_INIT, "WdfSpinLockCreate failed - 0x%x\n", status);
+        return status;
+    }
+
+    InitializeListHead(&pContext->TxWaitList);
+
+    // Create parallel queue for Read/Write requests, they are forwarded to socket queues
+    WDF_IO_QUEUE_CONFIG_INIT(&queueConfig,
+        WdfIoQueueDispatchParallel
+    );
+    queueConfig.EvtIoRead = VIOSockRead;
+    queueConfig.EvtIoWrite = VIOSockWrite;
+    queueConfig.AllowZeroLengthRequests = WdfFalse;
+
+    status = WdfIoQueueCreate(hDevice,
+        &queueConfig,
+        WDF_NO_OBJECT_ATTRIBUTES,
+        &pContext->RwQueue
+    );
+
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_INIT,
+            "WdfIoQueueCreate failed (Read/Write Queue): 0x%x\n", status);
+        return status;
+    }
+
+    status = WdfDeviceConfigureRequestDispatching(hDevice,
+        pContext->RwQueue,
+        WdfRequestTypeRead);
+
+    if (NT_SUCCESS(status))
+    {
+        status = WdfDeviceConfigureRequestDispatching(hDevice,
+            pContext->RwQueue,
+            WdfRequestTypeWrite);
+    }
+
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_INIT,
+            "WdfDeviceConfigureRequestDispatching failed (Read/Write Queue): 0x%x\n", status);
+        return status;
+    }
+
     // Create sequential queue for IoCtl requests
     WDF_IO_QUEUE_CONFIG_INIT(&queueConfig,
         WdfIoQueueDispatchSequential
@@ -295,6 +350,20 @@ VIOSockEvtDevicePrepareHardware(
             pContext->RxQueue = vqs[0];
             pContext->TxQueue = vqs[1];
             pContext->EvtQueue = vqs[2];
+
+            status = VIOSockRxVqInit(pContext);
+            if (NT_SUCCESS(status))
+                status = VIOSockTxVqInit(pContext);
+            if (NT_SUCCESS(status))
+                status = VIOSockEvtVqInit(pContext);
+
+            if (!NT_SUCCESS(status))
+            {
+                TraceEvents(TRACE_LEVEL_ERROR, DBG_HW_ACCESS, "Packet pools init failed: %x\n", status);
+                VIOSockTxVqCleanup(pContext);
+                VIOSockRxVqCleanup(pContext);
+                VirtIOWdfSetDriverFailed(&pContext->VDevice);
+            }
         }
         else
         {
@@ -321,6 +390,9 @@ VIOSockEvtDeviceReleaseHardware(
 
     VirtIOWdfShutdown(&pContext->VDevice);
 
+    VIOSockTxVqCleanup(pContext);
+    VIOSockRxVqCleanup(pContext);
+
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_HW_ACCESS, "<-- %s\n", __FUNCTION__);
     return STATUS_SUCCESS;
 }
@@ -385,6 +457,9 @@ VIOSockEvtDeviceD0EntryPostInterruptsEnabled(
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_HW_ACCESS, "Setting VIRTIO_CONFIG_S_DRIVER_OK flag\n");
     VirtIOWdfSetDriverOK(&pContext->VDevice);
 
+    //RX and event buffers were posted in PrepareHardware
+    VIOSockRxVqKick(pContext);
+
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_HW_ACCESS, "<-- %s\n", __FUNCTION__);
     return STATUS_SUCCESS;
 }
@@ -434,11 +509,25 @@ VIOSockDeviceControl(
         break;
     }
 
+    case IOCTL_SOCKET_CONNECT:
+        status = VIOSockConnect(Request);
+        break;
+
+    case IOCTL_SOCKET_SHUTDOWN:
+        status = VIOSockShutdown(Request);
+        break;
+
+    case IOCTL_SOCKET_POLL:
+        status = VIOSockPoll(Request);
+        break;
+
     default:
         status = STATUS_INVALID_DEVICE_REQUEST;
         break;
     }
 
-    WdfRequestCompleteWithInformation(Request, status, length);
+    if (status != STATUS_PENDING)
+        WdfRequestCompleteWithInformation(Request, status, length);
+
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_IOCTLS, "<-- %s\n", __FUNCTION__);
 }
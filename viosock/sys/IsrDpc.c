@@ -69,9 +69,16 @@ VIOSockInterruptDpc(
 
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_DPC, "--> %s\n", __FUNCTION__);
 
+    UNREFERENCED_PARAMETER(AssociatedObject);
+
     WDF_INTERRUPT_INFO_INIT(&info);
     WdfInterruptGetInfo(Context->WdfInterrupt, &info);
 
+    //TX first, completions free packets for the RX path replies
+    VIOSockTxVqProcess(Context);
+    VIOSockRxVqProcess(Context);
+    VIOSockEvtVqProcess(Context);
+
     TraceEvents(TRACE_LEVEL_VERBOSE, DBG_DPC, "<-- %s\n", __FUNCTION__);
 }
 
@@ -86,6 +93,13 @@ VIOSockInterruptEnable(
 
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_INTERRUPT, "--> %s\n", __FUNCTION__);
 
+    if (Context->RxQueue)
+        virtqueue_enable_cb(Context->RxQueue);
+    if (Context->TxQueue)
+        virtqueue_enable_cb(Context->TxQueue);
+    if (Context->EvtQueue)
+        virtqueue_enable_cb(Context->EvtQueue);
+
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_INTERRUPT, "<-- %s\n", __FUNCTION__);
     return STATUS_SUCCESS;
 }
@@ -100,6 +114,13 @@ VIOSockInterruptDisable(
 
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_INTERRUPT, "--> %s\n", __FUNCTION__);
 
+    if (Context->RxQueue)
+        virtqueue_disable_cb(Context->RxQueue);
+    if (Context->TxQueue)
+        virtqueue_disable_cb(Context->TxQueue);
+    if (Context->EvtQueue)
+        virtqueue_disable_cb(Context->EvtQueue);
+
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_INTERRUPT, "<-- %s\n", __FUNCTION__);
     return STATUS_SUCCESS;
 }
@@ -0,0 +1,660 @@
+/*
+ * Placeholder for the Rx path functions
+ *
+ * Copyright (c) 2019 Virtuozzo International GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met :
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and / or other materials provided with the distribution.
+ * 3. Neither the names of the copyright holders nor the names of their contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "precomp.h"
+#include "viosock.h"
+
+#if defined(EVENT_TRACING)
+#include "Rx.tmh"
+#endif
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (PAGE, VIOSockRxVqInit)
+#pragma alloc_text (PAGE, VIOSockRxVqCleanup)
+#pragma alloc_text (PAGE, VIOSockEvtVqInit)
+#endif
+
+//The peer is told about freed space when its view of our buffer drops below this
+#define VIOSOCK_CREDIT_UPDATE_THRESHOLD VIOSOCK_DMA_TRX_LEN
+
+static
+BOOLEAN
+VIOSockRxPktInsert(
+    IN PDEVICE_CONTEXT pContext,
+    IN PVIOSOCK_RX_CB pCb
+)
+{
+    VIOSOCK_SG_DESC sg[2];
+
+    sg[0].physAddr.QuadPart = pCb->PA.QuadPart;
+    sg[0].length = sizeof(VIRTIO_VSOCK_HDR);
+    sg[1].physAddr.QuadPart = pCb->PA.QuadPart + FIELD_OFFSET(VIOSOCK_RX_PKT, Buffer);
+    sg[1].length = VIOSOCK_RX_BUF_SIZE;
+
+    if (0 > virtqueue_add_buf(pContext->RxQueue, sg, 0, 2, pCb, NULL, 0))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_HW_ACCESS, "Can't add RX buffer %p\n", pCb);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+NTSTATUS
+VIOSockRxVqInit(
+    IN PDEVICE_CONTEXT pContext
+)
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_INIT, "--> %s\n", __FUNCTION__);
+
+    //each packet takes two descriptors: header and payload
+    pContext->RxPktNum = virtio_get_queue_size(pContext->RxQueue) / 2;
+
+    pContext->RxCbBuffers = ExAllocatePoolWithTag(NonPagedPool,
+        sizeof(VIOSOCK_RX_CB) * pContext->RxPktNum, VIOSOCK_DRIVER_MEMORY_TAG);
+    if (!pContext->RxCbBuffers)
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_INIT, "Can't allocate %u RX control blocks\n",
+            pContext->RxPktNum);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    pContext->RxPktVA = VirtIOWdfDeviceAllocDmaMemory(&pContext->VDevice.VIODevice,
+        VIOSOCK_RX_PKT_SIZE * pContext->RxPktNum, VIOSOCK_DRIVER_MEMORY_TAG);
+    if (!pContext->RxPktVA)
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_INIT, "Can't allocate %u RX packets\n",
+            pContext->RxPktNum);
+        ExFreePoolWithTag(pContext->RxCbBuffers, VIOSOCK_DRIVER_MEMORY_TAG);
+        pContext->RxCbBuffers = NULL;
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    pContext->RxPktPA = VirtIOWdfDeviceGetPhysicalAddress(&pContext->VDevice.VIODevice,
+        pContext->RxPktVA);
+
+    //the device is not running yet, kick is postponed until DRIVER_OK
+    for (i = 0; i < pContext->RxPktNum; ++i)
+    {
+        PVIOSOCK_RX_CB pCb = &pContext->RxCbBuffers[i];
+
+        pCb->pPacket = (PVIOSOCK_RX_PKT)((PCHAR)pContext->RxPktVA + VIOSOCK_RX_PKT_SIZE * i);
+        pCb->PA.QuadPart = pContext->RxPktPA.QuadPart + VIOSOCK_RX_PKT_SIZE * i;
+
+        if (!VIOSockRxPktInsert(pContext, pCb))
+        {
+            VIOSockRxVqCleanup(pContext);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+    }
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_INIT, "<-- %s, %u RX packets posted\n",
+        __FUNCTION__, pContext->RxPktNum);
+    return STATUS_SUCCESS;
+}
+
+VOID
+VIOSockRxVqCleanup(
+    IN PDEVICE_CONTEXT pContext
+)
+{
+    PAGED_CODE();
+
+    if (pContext->RxPktVA)
+    {
+        VirtIOWdfDeviceFreeDmaMemory(&pContext->VDevice.VIODevice, pContext->RxPktVA);
+        pContext->RxPktVA = NULL;
+    }
+
+    if (pContext->RxCbBuffers)
+    {
+        ExFreePoolWithTag(pContext->RxCbBuffers, VIOSOCK_DRIVER_MEMORY_TAG);
+        pContext->RxCbBuffers = NULL;
+    }
+    pContext->RxPktNum = 0;
+}
+
+VOID
+VIOSockRxVqKick(
+    IN PDEVICE_CONTEXT pContext
+)
+{
+    WdfSpinLockAcquire(pContext->RxLock);
+    virtqueue_kick(pContext->RxQueue);
+    virtqueue_kick(pContext->EvtQueue);
+    WdfSpinLockRelease(pContext->RxLock);
+}
+
+//Complete pending reads with EOF once all data is consumed and no more can come
+static
+BOOLEAN
+VIOSockRxIsEof(
+    IN PSOCKET_CONTEXT pSocket
+)
+{
+    return IsListEmpty(&pSocket->RxList) &&
+        (pSocket->State == VIOSOCK_STATE_CLOSE ||
+        pSocket->State == VIOSOCK_STATE_CLOSING ||
+        (pSocket->PeerShutdown & VIRTIO_VSOCK_SHUTDOWN_SEND) ||
+        (pSocket->Shutdown & VIRTIO_VSOCK_SHUTDOWN_RCV));
+}
+
+static
+BOOLEAN
+VIOSockRxNeedCreditUpdate(
+    IN PSOCKET_CONTEXT pSocket
+)
+{
+    //free space as the peer sees it
+    ULONG32 uPeerFree = pSocket->buf_alloc - (pSocket->rx_cnt - pSocket->last_fwd_cnt);
+
+    return pSocket->State == VIOSOCK_STATE_CONNECTED &&
+        pSocket->fwd_cnt != pSocket->last_fwd_cnt &&
+        uPeerFree < VIOSOCK_CREDIT_UPDATE_THRESHOLD;
+}
+
+static
+ULONG
+VIOSockRxCopyFromList(
+    IN PSOCKET_CONTEXT pSocket,
+    IN PCHAR pBuffer,
+    IN ULONG uLength,
+    OUT PLIST_ENTRY pFreeList
+)
+{
+    ULONG uCopied = 0;
+
+    while (uCopied < uLength && !IsListEmpty(&pSocket->RxList))
+    {
+        PVIOSOCK_RX_ENTRY pEntry = CONTAINING_RECORD(pSocket->RxList.Flink,
+            VIOSOCK_RX_ENTRY, ListEntry);
+        ULONG uChunk = min(uLength - uCopied, pEntry->Length - pEntry->Offset);
+
+        RtlCopyMemory(pBuffer + uCopied, &pEntry->Buffer[pEntry->Offset], uChunk);
+        pEntry->Offset += uChunk;
+        uCopied += uChunk;
+
+        if (pEntry->Offset == pEntry->Length)
+        {
+            RemoveEntryList(&pEntry->ListEntry);
+            InsertTailList(pFreeList, &pEntry->ListEntry);
+        }
+    }
+
+    pSocket->RxBytes -= uCopied;
+    pSocket->fwd_cnt += uCopied;
+    return uCopied;
+}
+
+static
+VOID
+VIOSockRxFreeList(
+    IN PLIST_ENTRY pFreeList
+)
+{
+    while (!IsListEmpty(pFreeList))
+    {
+        PVIOSOCK_RX_ENTRY pEntry = CONTAINING_RECORD(RemoveHeadList(pFreeList),
+            VIOSOCK_RX_ENTRY, ListEntry);
+        ExFreePoolWithTag(pEntry, VIOSOCK_DRIVER_MEMORY_TAG);
+    }
+}
+
+VOID
+VIOSockReadProcess(
+    IN PSOCKET_CONTEXT pSocket
+)
+{
+    BOOLEAN bCreditUpdate = FALSE;
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ, "--> %s\n", __FUNCTION__);
+
+    for (;;)
+    {
+        WDFREQUEST  Request;
+        NTSTATUS    status;
+        PCHAR       pBuffer;
+        size_t      stBufferLength;
+        ULONG       uCopied = 0;
+        LIST_ENTRY  FreeList;
+        BOOLEAN     bConnecting = FALSE;
+
+        InitializeListHead(&FreeList);
+
+        WdfSpinLockAcquire(pSocket->StateLock);
+
+        if (IsListEmpty(&pSocket->RxList) && !VIOSockRxIsEof(pSocket))
+        {
+            //nothing to read before the connection is up, and no EOF either
+            bConnecting = (pSocket->State == VIOSOCK_STATE_CONNECTING);
+            if (!bConnecting)
+            {
+                WdfSpinLockRelease(pSocket->StateLock);
+                break;
+            }
+        }
+
+        status = WdfIoQueueRetrieveNextRequest(pSocket->ReadQueue, &Request);
+        if (!NT_SUCCESS(status))
+        {
+            WdfSpinLockRelease(pSocket->StateLock);
+            break;
+        }
+
+        if (bConnecting)
+            status = STATUS_INVALID_DEVICE_STATE;
+        else
+            status = WdfRequestRetrieveOutputBuffer(Request, 0, &pBuffer, &stBufferLength);
+
+        if (NT_SUCCESS(status))
+        {
+            uCopied = VIOSockRxCopyFromList(pSocket, pBuffer, (ULONG)stBufferLength, &FreeList);
+            bCreditUpdate = VIOSockRxNeedCreditUpdate(pSocket);
+        }
+        else if (!bConnecting)
+        {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_READ,
+                "WdfRequestRetrieveOutputBuffer failed: 0x%x\n", status);
+        }
+
+        WdfSpinLockRelease(pSocket->StateLock);
+
+        VIOSockRxFreeList(&FreeList);
+
+        TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ, "Read request %p completed, %u bytes\n",
+            Request, uCopied);
+        WdfRequestCompleteWithInformation(Request, status, uCopied);
+    }
+
+    if (bCreditUpdate)
+        VIOSockSendControl(pSocket, VIRTIO_VSOCK_OP_CREDIT_UPDATE, 0);
+
+    VIOSockPollProcess(pSocket);
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ, "<-- %s\n", __FUNCTION__);
+}
+
+VOID
+VIOSockRxPurge(
+    IN PSOCKET_CONTEXT pSocket
+)
+{
+    LIST_ENTRY FreeList;
+
+    InitializeListHead(&FreeList);
+
+    WdfSpinLockAcquire(pSocket->StateLock);
+    while (!IsListEmpty(&pSocket->RxList))
+    {
+        InsertTailList(&FreeList, RemoveHeadList(&pSocket->RxList));
+    }
+    pSocket->RxBytes = 0;
+    WdfSpinLockRelease(pSocket->StateLock);
+
+    VIOSockRxFreeList(&FreeList);
+}
+
+//Called under StateLock. Payload goes straight to a pending read if there is
+//one and nothing is queued before it, the rest is copied to the socket queue.
+//Returns FALSE if the payload can't be kept, the stream is broken then and
+//the caller resets the connection.
+static
+BOOLEAN
+VIOSockRxPktEnqueue(
+    IN PSOCKET_CONTEXT pSocket,
+    IN PCHAR pPayload,
+    IN ULONG uLength,
+    OUT WDFREQUEST *pReadRequest,
+    OUT PULONG pReadLength,
+    OUT NTSTATUS *pReadStatus
+)
+{
+    PVIOSOCK_RX_ENTRY pEntry;
+
+    *pReadRequest = WDF_NO_HANDLE;
+    *pReadLength = 0;
+    *pReadStatus = STATUS_SUCCESS;
+
+    if (!uLength)
+        return TRUE;
+
+    if (pSocket->RxBytes + uLength > pSocket->buf_alloc)
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_READ,
+            "Peer exceeded credit (%u queued, %u received)\n",
+            pSocket->RxBytes, uLength);
+        return FALSE;
+    }
+
+    pSocket->rx_cnt += uLength;
+
+    if (IsListEmpty(&pSocket->RxList) &&
+        NT_SUCCESS(WdfIoQueueRetrieveNextRequest(pSocket->ReadQueue, pReadRequest)))
+    {
+        PCHAR   pBuffer;
+        size_t  stBufferLength;
+
+        *pReadStatus = WdfRequestRetrieveOutputBuffer(*pReadRequest, 0, &pBuffer, &stBufferLength);
+        if (NT_SUCCESS(*pReadStatus))
+        {
+            *pReadLength = min(uLength, (ULONG)stBufferLength);
+            RtlCopyMemory(pBuffer, pPayload, *pReadLength);
+            pSocket->fwd_cnt += *pReadLength;
+            pPayload += *pReadLength;
+            uLength -= *pReadLength;
+        }
+        else
+        {
+            //the request fails alone, the payload is queued for the next one
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_READ,
+                "WdfRequestRetrieveOutputBuffer failed: 0x%x\n", *pReadStatus);
+        }
+
+        if (!uLength)
+            return TRUE;
+    }
+
+    pEntry = ExAllocatePoolWithTag(NonPagedPool,
+        FIELD_OFFSET(VIOSOCK_RX_ENTRY, Buffer[uLength]), VIOSOCK_DRIVER_MEMORY_TAG);
+    if (!pEntry)
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_READ, "Can't allocate RX entry for %u bytes\n", uLength);
+        return FALSE;
+    }
+
+    pEntry->Length = uLength;
+    pEntry->Offset = 0;
+    RtlCopyMemory(pEntry->Buffer, pPayload, uLength);
+
+    InsertTailList(&pSocket->RxList, &pEntry->ListEntry);
+    pSocket->RxBytes += uLength;
+    return TRUE;
+}
+
+static
+VOID
+VIOSockRxPktHandle(
+    IN PSOCKET_CONTEXT pSocket,
+    IN PVIRTIO_VSOCK_HDR pHdr,
+    IN PCHAR pPayload,
+    IN ULONG uLength
+)
+{
+    WDFREQUEST  ReadRequest = WDF_NO_HANDLE;
+    ULONG       uReadLength = 0;
+    NTSTATUS    ReadStatus = STATUS_SUCCESS;
+    BOOLEAN     bReadProcess = FALSE, bWriteProcess = FALSE, bCreditUpdate = FALSE;
+    BOOLEAN     bConnected = FALSE, bReset = FALSE;
+    NTSTATUS    ConnectStatus = STATUS_SUCCESS;
+
+    WdfSpinLockAcquire(pSocket->StateLock);
+
+    //every packet carries the peer credit
+    pSocket->peer_buf_alloc = pHdr->buf_alloc;
+    pSocket->peer_fwd_cnt = pHdr->fwd_cnt;
+
+    switch (pSocket->State)
+    {
+    case VIOSOCK_STATE_CONNECTING:
+        if (pHdr->op == VIRTIO_VSOCK_OP_RESPONSE)
+        {
+            pSocket->State = VIOSOCK_STATE_CONNECTED;
+            bConnected = TRUE;
+        }
+        else
+        {
+            pSocket->State = VIOSOCK_STATE_CLOSE;
+            bConnected = TRUE;
+            bReset = (pHdr->op != VIRTIO_VSOCK_OP_RST);
+            ConnectStatus = (pHdr->op == VIRTIO_VSOCK_OP_RST) ?
+                STATUS_CONNECTION_REFUSED : STATUS_INVALID_CONNECTION;
+        }
+        break;
+
+    case VIOSOCK_STATE_CONNECTED:
+    case VIOSOCK_STATE_CLOSING:
+        switch (pHdr->op)
+        {
+        case VIRTIO_VSOCK_OP_RW:
+            if (VIOSockRxPktEnqueue(pSocket, pPayload, uLength, &ReadRequest, &uReadLength,
+                &ReadStatus))
+            {
+                bCreditUpdate = (ReadRequest != WDF_NO_HANDLE) && VIOSockRxNeedCreditUpdate(pSocket);
+            }
+            else
+            {
+                //a stream must not lose bytes in the middle, drop the connection instead
+                pSocket->State = VIOSOCK_STATE_CLOSE;
+                bReset = bReadProcess = bWriteProcess = TRUE;
+            }
+            break;
+
+        case VIRTIO_VSOCK_OP_CREDIT_UPDATE:
+            bWriteProcess = TRUE;
+            break;
+
+        case VIRTIO_VSOCK_OP_CREDIT_REQUEST:
+            bCreditUpdate = TRUE;
+            break;
+
+        case VIRTIO_VSOCK_OP_SHUTDOWN:
+            pSocket->PeerShutdown |= pHdr->flags & VIRTIO_VSOCK_SHUTDOWN_MASK;
+            if (pSocket->PeerShutdown == VIRTIO_VSOCK_SHUTDOWN_MASK &&
+                IsListEmpty(&pSocket->RxList))
+            {
+                pSocket->State = VIOSOCK_STATE_CLOSE;
+                bReset = TRUE;
+            }
+            bReadProcess = bWriteProcess = TRUE;
+            break;
+
+        case VIRTIO_VSOCK_OP_RST:
+            pSocket->State = VIOSOCK_STATE_CLOSE;
+            bReadProcess = bWriteProcess = TRUE;
+            break;
+
+        default:
+            TraceEvents(TRACE_LEVEL_WARNING, DBG_READ, "Unexpected op %u\n", pHdr->op);
+            break;
+        }
+        break;
+
+    default:
+        bReset = (pHdr->op != VIRTIO_VSOCK_OP_RST);
+        break;
+    }
+
+    WdfSpinLockRelease(pSocket->StateLock);
+
+    if (ReadRequest != WDF_NO_HANDLE)
+        WdfRequestCompleteWithInformation(ReadRequest, ReadStatus, uReadLength);
+
+    if (bConnected)
+        VIOSockConnectComplete(pSocket, ConnectStatus);
+
+    if (bReset)
+        VIOSockSendReset(GetDeviceContextFromSocket(pSocket), pHdr);
+    else if (bCreditUpdate)
+        VIOSockSendControl(pSocket, VIRTIO_VSOCK_OP_CREDIT_UPDATE, 0);
+
+    if (bReadProcess)
+        VIOSockReadProcess(pSocket);
+
+    if (bWriteProcess)
+        VIOSockWriteProcess(pSocket);
+
+    VIOSockPollProcess(pSocket);
+}
+
+VOID
+VIOSockRxVqProcess(
+    IN PDEVICE_CONTEXT pContext
+)
+{
+    PVIOSOCK_RX_CB  pCb;
+    UINT            len;
+    BOOLEAN         bKick = FALSE;
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_DPC, "--> %s\n", __FUNCTION__);
+
+    for (;;)
+    {
+        PVIRTIO_VSOCK_HDR pHdr;
+        PSOCKET_CONTEXT pSocket;
+        ULONG uPayload;
+
+        WdfSpinLockAcquire(pContext->RxLock);
+        pCb = virtqueue_get_buf(pContext->RxQueue, &len);
+        WdfSpinLockRelease(pContext->RxLock);
+
+        if (!pCb)
+            break;
+
+        pHdr = &pCb->pPacket->Header;
+
+        if (len < sizeof(VIRTIO_VSOCK_HDR))
+        {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_DPC, "Short RX packet: %u bytes\n", len);
+        }
+        else if (pHdr->type != VIRTIO_VSOCK_TYPE_STREAM ||
+            pHdr->dst_cid != pContext->Config.guest_cid)
+        {
+            TraceEvents(TRACE_LEVEL_WARNING, DBG_DPC, "Invalid packet, type %u, dst_cid %I64u\n",
+                pHdr->type, pHdr->dst_cid);
+            if (pHdr->op != VIRTIO_VSOCK_OP_RST)
+                VIOSockSendReset(pContext, pHdr);
+        }
+        else
+        {
+            uPayload = min(pHdr->len, len - (UINT)sizeof(VIRTIO_VSOCK_HDR));
+
+            pSocket = VIOSockSocketLookupAndRef(pContext, pHdr);
+            if (pSocket)
+            {
+                VIOSockRxPktHandle(pSocket, pHdr, (PCHAR)pCb->pPacket->Buffer, uPayload);
+                VIOSockSocketDeref(pSocket);
+            }
+            else if (pHdr->op != VIRTIO_VSOCK_OP_RST)
+            {
+                TraceEvents(TRACE_LEVEL_WARNING, DBG_DPC,
+                    "No socket for %I64u:%u -> %u, op %u\n",
+                    pHdr->src_cid, pHdr->src_port, pHdr->dst_port, pHdr->op);
+                VIOSockSendReset(pContext, pHdr);
+            }
+        }
+
+        //return the buffer to the pool
+        WdfSpinLockAcquire(pContext->RxLock);
+        if (VIOSockRxPktInsert(pContext, pCb))
+            bKick = TRUE;
+        WdfSpinLockRelease(pContext->RxLock);
+    }
+
+    if (bKick)
+    {
+        WdfSpinLockAcquire(pContext->RxLock);
+        virtqueue_kick(pContext->RxQueue);
+        WdfSpinLockRelease(pContext->RxLock);
+    }
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_DPC, "<-- %s\n", __FUNCTION__);
+}
+
+static
+BOOLEAN
+VIOSockEvtPktInsert(
+    IN PDEVICE_CONTEXT pContext
+)
+{
+    VIOSOCK_SG_DESC sg;
+
+    sg.physAddr = pContext->EvtPA;
+    sg.length = sizeof(VIRTIO_VSOCK_EVENT);
+
+    if (0 > virtqueue_add_buf(pContext->EvtQueue, &sg, 0, 1, pContext->EvtVA, NULL, 0))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_HW_ACCESS, "Can't add event buffer\n");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+NTSTATUS
+VIOSockEvtVqInit(
+    IN PDEVICE_CONTEXT pContext
+)
+{
+    PAGED_CODE();
+
+    if (!pContext->EvtVA)
+    {
+        pContext->EvtVA = VirtIOWdfDeviceAllocDmaMemory(&pContext->VDevice.VIODevice,
+            sizeof(VIRTIO_VSOCK_EVENT), VIOSOCK_DRIVER_MEMORY_TAG);
+        if (!pContext->EvtVA)
+        {
+            TraceEvents(TRACE_LEVEL_ERROR, DBG_INIT, "Can't allocate event buffer\n");
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+        pContext->EvtPA = VirtIOWdfDeviceGetPhysicalAddress(&pContext->VDevice.VIODevice,
+            pContext->EvtVA);
+    }
+
+    return VIOSockEvtPktInsert(pContext) ? STATUS_SUCCESS : STATUS_INSUFFICIENT_RESOURCES;
+}
+
+VOID
+VIOSockEvtVqProcess(
+    IN PDEVICE_CONTEXT pContext
+)
+{
+    PVIRTIO_VSOCK_EVENT pEvt;
+    UINT                len;
+    BOOLEAN             bReset = FALSE;
+
+    WdfSpinLockAcquire(pContext->RxLock);
+    pEvt = virtqueue_get_buf(pContext->EvtQueue, &len);
+    if (pEvt)
+    {
+        bReset = (len >= sizeof(*pEvt) && pEvt->id == VIRTIO_VSOCK_EVENT_TRANSPORT_RESET);
+        if (VIOSockEvtPktInsert(pContext))
+            virtqueue_kick(pContext->EvtQueue);
+    }
+    WdfSpinLockRelease(pContext->RxLock);
+
+    if (bReset)
+    {
+        TraceEvents(TRACE_LEVEL_INFORMATION, DBG_DPC, "Transport reset\n");
+
+        //guest cid might be changed, i.e. after migration
+        VirtIOWdfDeviceGet(&pContext->VDevice, 0, &pContext->Config, sizeof(pContext->Config));
+        VIOSockResetAll(pContext);
+    }
+}
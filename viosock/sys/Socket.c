@@ -34,6 +34,62 @@
 #include "Socket.tmh"
 #endif
 
+static
+NTSTATUS
+VIOSockSocketInit(
+    IN WDFFILEOBJECT FileObject
+)
+{
+    PSOCKET_CONTEXT         pSocket = GetSocketContext(FileObject);
+    WDF_OBJECT_ATTRIBUTES   attributes;
+    WDF_IO_QUEUE_CONFIG     queueConfig;
+    NTSTATUS                status;
+
+    pSocket->ThisSocket = FileObject;
+    pSocket->State = VIOSOCK_STATE_CLOSE;
+    pSocket->buf_alloc = VIOSOCK_BUF_ALLOC_DEFAULT;
+    pSocket->TxRequest = WDF_NO_HANDLE;
+    InitializeListHead(&pSocket->RxList);
+    InitializeListHead(&pSocket->TxWaitEntry);
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = FileObject;
+
+    status = WdfSpinLockCreate(&attributes, &pSocket->StateLock);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_CREATE_CLOSE, "WdfSpinLockCreate failed: 0x%x\n", status);
+        return status;
+    }
+
+    //manual queues keep pending requests cancellable
+    WDF_IO_QUEUE_CONFIG_INIT(&queueConfig, WdfIoQueueDispatchManual);
+
+    status = WdfIoQueueCreate(WdfFileObjectGetDevice(FileObject), &queueConfig, &attributes,
+        &pSocket->ReadQueue);
+    if (NT_SUCCESS(status))
+    {
+        status = WdfIoQueueCreate(WdfFileObjectGetDevice(FileObject), &queueConfig, &attributes,
+            &pSocket->WriteQueue);
+    }
+    if (NT_SUCCESS(status))
+    {
+        status = WdfIoQueueCreate(WdfFileObjectGetDevice(FileObject), &queueConfig, &attributes,
+            &pSocket->ConnectQueue);
+    }
+    if (NT_SUCCESS(status))
+    {
+        status = WdfIoQueueCreate(WdfFileObjectGetDevice(FileObject), &queueConfig, &attributes,
+            &pSocket->PollQueue);
+    }
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_CREATE_CLOSE, "WdfIoQueueCreate failed: 0x%x\n", status);
+    }
+
+    return status;
+}
+
 VOID
 VIOSockCreate(
     IN WDFDEVICE WdfDevice,
@@ -99,8 +155,10 @@ VIOSockCreate(
 
                 if (NT_SUCCESS(status))
                 {
-                    //TODO: lock collection
-                    ULONG i, ItemCount = WdfCollectionGetCount(pContext->SocketList);
+                    ULONG i, ItemCount;
+
+                    WdfSpinLockAcquire(pContext->SocketListLock);
+                    ItemCount = WdfCollectionGetCount(pContext->SocketList);
                     for (i = 0; i < ItemCount; ++i)
                     {
                         WDFFILEOBJECT CurrentFile = WdfCollectionGetItem(pContext->SocketList, i);
@@ -113,6 +171,7 @@ VIOSockCreate(
                             pSocket->ListenSocket = CurrentFile;
                         }
                     }
+                    WdfSpinLockRelease(pContext->SocketListLock);
 
                     ObDereferenceObject(pFileObj);
 
@@ -129,9 +188,15 @@ VIOSockCreate(
                 }
             }
 
-            //TODO: lock collection
             if (NT_SUCCESS(status))
+                status = VIOSockSocketInit(FileObject);
+
+            if (NT_SUCCESS(status))
+            {
+                WdfSpinLockAcquire(pContext->SocketListLock);
                 status = WdfCollectionAdd(pContext->SocketList, FileObject);
+                WdfSpinLockRelease(pContext->SocketListLock);
+            }
         }
         else
         {
@@ -151,6 +216,51 @@ VIOSockCreate(
         "<-- %s\n", __FUNCTION__);
 }
 
+VOID
+VIOSockCleanup(
+    IN WDFFILEOBJECT FileObject
+)
+{
+    PSOCKET_CONTEXT pSocket = GetSocketContext(FileObject);
+    ULONG           PrevState;
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_CREATE_CLOSE,
+        "--> %s\n", __FUNCTION__);
+
+    if (pSocket->IsControl || !pSocket->StateLock)
+        return;
+
+    WdfSpinLockAcquire(pSocket->StateLock);
+    PrevState = pSocket->State;
+    if (PrevState == VIOSOCK_STATE_CONNECTED)
+    {
+        pSocket->State = VIOSOCK_STATE_CLOSING;
+        pSocket->Shutdown = VIRTIO_VSOCK_SHUTDOWN_MASK;
+    }
+    else
+    {
+        pSocket->State = VIOSOCK_STATE_CLOSE;
+    }
+    WdfSpinLockRelease(pSocket->StateLock);
+
+    if (PrevState == VIOSOCK_STATE_CONNECTED)
+    {
+        //the peer replies with RST
+        VIOSockSendControl(pSocket, VIRTIO_VSOCK_OP_SHUTDOWN, VIRTIO_VSOCK_SHUTDOWN_MASK);
+    }
+    else if (PrevState == VIOSOCK_STATE_CONNECTING)
+    {
+        VIOSockSendControl(pSocket, VIRTIO_VSOCK_OP_RST, 0);
+    }
+
+    VIOSockConnectComplete(pSocket, STATUS_CANCELLED);
+    VIOSockReadProcess(pSocket);
+    VIOSockWriteProcess(pSocket);
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_CREATE_CLOSE,
+        "<-- %s\n", __FUNCTION__);
+}
+
 VOID
 VIOSockClose(
     IN WDFFILEOBJECT FileObject
@@ -170,10 +280,494 @@ VIOSockClose(
 
     if (!pSocket->IsControl)
     {
-        //TODO: lock collection
+        WdfSpinLockAcquire(pContext->SocketListLock);
         WdfCollectionRemove(pContext->SocketList, FileObject);
+        WdfSpinLockRelease(pContext->SocketListLock);
+
+        if (pSocket->StateLock)
+        {
+            VIOSockTxSocketRemove(pSocket);
+            VIOSockRxPurge(pSocket);
+        }
     }
 
     TraceEvents(TRACE_LEVEL_INFORMATION, DBG_CREATE_CLOSE,
         "<-- %s\n", __FUNCTION__);
 }
+
+PSOCKET_CONTEXT
+VIOSockSocketLookupAndRef(
+    IN PDEVICE_CONTEXT pContext,
+    IN PVIRTIO_VSOCK_HDR pHdr
+)
+{
+    PSOCKET_CONTEXT pSocket = NULL;
+    ULONG i, ItemCount;
+
+    WdfSpinLockAcquire(pContext->SocketListLock);
+    ItemCount = WdfCollectionGetCount(pContext->SocketList);
+    for (i = 0; i < ItemCount; ++i)
+    {
+        WDFFILEOBJECT CurrentFile = WdfCollectionGetItem(pContext->SocketList, i);
+        PSOCKET_CONTEXT pCurrent = GetSocketContext(CurrentFile);
+
+        if (pCurrent->State != VIOSOCK_STATE_CLOSE &&
+            pCurrent->src_port == pHdr->dst_port &&
+            pCurrent->dst_port == pHdr->src_port &&
+            pCurrent->dst_cid == pHdr->src_cid)
+        {
+            WdfObjectReference(CurrentFile);
+            pSocket = pCurrent;
+            break;
+        }
+    }
+    WdfSpinLockRelease(pContext->SocketListLock);
+
+    return pSocket;
+}
+
+VOID
+VIOSockSocketDeref(
+    IN PSOCKET_CONTEXT pSocket
+)
+{
+    WdfObjectDereference(pSocket->ThisSocket);
+}
+
+VOID
+VIOSockResetAll(
+    IN PDEVICE_CONTEXT pContext
+)
+{
+    ULONG i;
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_DPC, "--> %s\n", __FUNCTION__);
+
+    for (i = 0;; ++i)
+    {
+        WDFFILEOBJECT   CurrentFile = WDF_NO_HANDLE;
+        PSOCKET_CONTEXT pSocket;
+        ULONG           PrevState;
+
+        WdfSpinLockAcquire(pContext->SocketListLock);
+        if (i < WdfCollectionGetCount(pContext->SocketList))
+        {
+            CurrentFile = WdfCollectionGetItem(pContext->SocketList, i);
+            WdfObjectReference(CurrentFile);
+        }
+        WdfSpinLockRelease(pContext->SocketListLock);
+
+        if (CurrentFile == WDF_NO_HANDLE)
+            break;
+
+        pSocket = GetSocketContext(CurrentFile);
+
+        WdfSpinLockAcquire(pSocket->StateLock);
+        PrevState = pSocket->State;
+        pSocket->State = VIOSOCK_STATE_CLOSE;
+        //the transport is gone, and the peer with it
+        pSocket->TxControlOps = pSocket->TxShutdownFlags = 0;
+        WdfSpinLockRelease(pSocket->StateLock);
+
+        if (PrevState == VIOSOCK_STATE_CONNECTING)
+            VIOSockConnectComplete(pSocket, STATUS_CONNECTION_RESET);
+
+        if (PrevState != VIOSOCK_STATE_CLOSE)
+        {
+            VIOSockReadProcess(pSocket);
+            VIOSockWriteProcess(pSocket);
+        }
+
+        WdfObjectDereference(CurrentFile);
+    }
+
+    TraceEvents(TRACE_LEVEL_INFORMATION, DBG_DPC, "<-- %s\n", __FUNCTION__);
+}
+
+//Called under SocketListLock
+static
+BOOLEAN
+VIOSockIsLocalPortUsed(
+    IN PDEVICE_CONTEXT pContext,
+    IN ULONG32 uPort
+)
+{
+    ULONG i, ItemCount = WdfCollectionGetCount(pContext->SocketList);
+
+    for (i = 0; i < ItemCount; ++i)
+    {
+        if (GetSocketContext(WdfCollectionGetItem(pContext->SocketList, i))->src_port == uPort)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+VOID
+VIOSockConnectComplete(
+    IN PSOCKET_CONTEXT pSocket,
+    IN NTSTATUS Status
+)
+{
+    WDFREQUEST Request;
+
+    while (NT_SUCCESS(WdfIoQueueRetrieveNextRequest(pSocket->ConnectQueue, &Request)))
+    {
+        TraceEvents(TRACE_LEVEL_INFORMATION, DBG_IOCTLS, "Connect request %p completed: 0x%x\n",
+            Request, Status);
+        WdfRequestComplete(Request, Status);
+    }
+
+    VIOSockPollProcess(pSocket);
+}
+
+NTSTATUS
+VIOSockConnect(
+    IN WDFREQUEST Request
+)
+{
+    PSOCKET_CONTEXT         pSocket = GetSocketContextFromRequest(Request);
+    PDEVICE_CONTEXT         pContext = GetDeviceContextFromSocket(pSocket);
+    PVIRTIO_VSOCK_CONNECT   pConnect;
+    NTSTATUS                status;
+    ULONG32                 uPort;
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_IOCTLS, "--> %s\n", __FUNCTION__);
+
+    if (pSocket->IsControl)
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    status = WdfRequestRetrieveInputBuffer(Request, sizeof(*pConnect), (PVOID*)&pConnect, NULL);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_IOCTLS,
+            "WdfRequestRetrieveInputBuffer failed 0x%x\n", status);
+        return status;
+    }
+
+    //assign ephemeral local port
+    WdfSpinLockAcquire(pContext->SocketListLock);
+    if (!pSocket->src_port)
+    {
+        do
+        {
+            uPort = ++pContext->LastLocalPort;
+            if (uPort < VIOSOCK_LOCAL_PORT_FIRST || uPort == (ULONG32)-1)
+                uPort = pContext->LastLocalPort = VIOSOCK_LOCAL_PORT_FIRST;
+        } while (VIOSockIsLocalPortUsed(pContext, uPort));
+        pSocket->src_port = uPort;
+    }
+    WdfSpinLockRelease(pContext->SocketListLock);
+
+    WdfSpinLockAcquire(pSocket->StateLock);
+    if (pSocket->State != VIOSOCK_STATE_CLOSE)
+    {
+        status = (pSocket->State == VIOSOCK_STATE_CONNECTING) ?
+            STATUS_DEVICE_BUSY : STATUS_INVALID_DEVICE_STATE;
+    }
+    else
+    {
+        pSocket->dst_cid = pConnect->dst_cid;
+        pSocket->dst_port = pConnect->dst_port;
+        pSocket->peer_buf_alloc = pSocket->peer_fwd_cnt = 0;
+        pSocket->rx_cnt = pSocket->tx_cnt = 0;
+        pSocket->fwd_cnt = pSocket->last_fwd_cnt = 0;
+        pSocket->Shutdown = pSocket->PeerShutdown = 0;
+        pSocket->TxControlOps = pSocket->TxShutdownFlags = 0;
+        pSocket->State = VIOSOCK_STATE_CONNECTING;
+    }
+    WdfSpinLockRelease(pSocket->StateLock);
+
+    if (!NT_SUCCESS(status))
+        return status;
+
+    //the response can come before this thread returns
+    status = WdfRequestForwardToIoQueue(Request, pSocket->ConnectQueue);
+    if (NT_SUCCESS(status))
+    {
+        status = VIOSockSendControl(pSocket, VIRTIO_VSOCK_OP_REQUEST, 0);
+        if (!NT_SUCCESS(status))
+        {
+            WdfSpinLockAcquire(pSocket->StateLock);
+            pSocket->State = VIOSOCK_STATE_CLOSE;
+            WdfSpinLockRelease(pSocket->StateLock);
+
+            VIOSockConnectComplete(pSocket, status);
+        }
+        status = STATUS_PENDING;
+    }
+    else
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_IOCTLS,
+            "WdfRequestForwardToIoQueue failed 0x%x\n", status);
+
+        WdfSpinLockAcquire(pSocket->StateLock);
+        pSocket->State = VIOSOCK_STATE_CLOSE;
+        WdfSpinLockRelease(pSocket->StateLock);
+    }
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_IOCTLS, "<-- %s\n", __FUNCTION__);
+    return status;
+}
+
+NTSTATUS
+VIOSockShutdown(
+    IN WDFREQUEST Request
+)
+{
+    PSOCKET_CONTEXT pSocket = GetSocketContextFromRequest(Request);
+    PULONG          pFlags;
+    ULONG32         uFlags;
+    NTSTATUS        status;
+
+    if (pSocket->IsControl)
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    status = WdfRequestRetrieveInputBuffer(Request, sizeof(*pFlags), (PVOID*)&pFlags, NULL);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_IOCTLS,
+            "WdfRequestRetrieveInputBuffer failed 0x%x\n", status);
+        return status;
+    }
+
+    uFlags = *pFlags & VIRTIO_VSOCK_SHUTDOWN_MASK;
+    if (!uFlags)
+        return STATUS_INVALID_PARAMETER;
+
+    WdfSpinLockAcquire(pSocket->StateLock);
+    if (pSocket->State != VIOSOCK_STATE_CONNECTED)
+        status = STATUS_INVALID_DEVICE_STATE;
+    else
+        pSocket->Shutdown |= uFlags;
+    WdfSpinLockRelease(pSocket->StateLock);
+
+    if (NT_SUCCESS(status))
+    {
+        status = VIOSockSendControl(pSocket, VIRTIO_VSOCK_OP_SHUTDOWN, uFlags);
+
+        if (uFlags & VIRTIO_VSOCK_SHUTDOWN_RCV)
+            VIOSockReadProcess(pSocket);
+        if (uFlags & VIRTIO_VSOCK_SHUTDOWN_SEND)
+            VIOSockWriteProcess(pSocket);
+    }
+
+    return status;
+}
+
+VOID
+VIOSockRead(
+    IN WDFQUEUE Queue,
+    IN WDFREQUEST Request,
+    IN size_t Length
+)
+{
+    PSOCKET_CONTEXT pSocket = GetSocketContextFromRequest(Request);
+    NTSTATUS        status;
+
+    UNREFERENCED_PARAMETER(Queue);
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ, "--> %s, %Iu bytes\n", __FUNCTION__, Length);
+
+    if (pSocket->IsControl)
+    {
+        WdfRequestComplete(Request, STATUS_INVALID_DEVICE_REQUEST);
+        return;
+    }
+
+    status = WdfRequestForwardToIoQueue(Request, pSocket->ReadQueue);
+    if (NT_SUCCESS(status))
+    {
+        VIOSockReadProcess(pSocket);
+    }
+    else
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_READ, "WdfRequestForwardToIoQueue failed: 0x%x\n", status);
+        WdfRequestComplete(Request, status);
+    }
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_READ, "<-- %s\n", __FUNCTION__);
+}
+
+VOID
+VIOSockWrite(
+    IN WDFQUEUE Queue,
+    IN WDFREQUEST Request,
+    IN size_t Length
+)
+{
+    PSOCKET_CONTEXT pSocket = GetSocketContextFromRequest(Request);
+    NTSTATUS        status;
+
+    UNREFERENCED_PARAMETER(Queue);
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_WRITE, "--> %s, %Iu bytes\n", __FUNCTION__, Length);
+
+    if (pSocket->IsControl)
+    {
+        WdfRequestComplete(Request, STATUS_INVALID_DEVICE_REQUEST);
+        return;
+    }
+
+    status = WdfRequestForwardToIoQueue(Request, pSocket->WriteQueue);
+    if (NT_SUCCESS(status))
+    {
+        VIOSockWriteProcess(pSocket);
+    }
+    else
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE, "WdfRequestForwardToIoQueue failed: 0x%x\n", status);
+        WdfRequestComplete(Request, status);
+    }
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_WRITE, "<-- %s\n", __FUNCTION__);
+}
+
+//Called under StateLock
+static
+ULONG
+VIOSockPollEvents(
+    IN PSOCKET_CONTEXT pSocket
+)
+{
+    ULONG uEvents = 0;
+
+    if (!IsListEmpty(&pSocket->RxList) ||
+        (pSocket->PeerShutdown & VIRTIO_VSOCK_SHUTDOWN_SEND) ||
+        (pSocket->Shutdown & VIRTIO_VSOCK_SHUTDOWN_RCV))
+        uEvents |= VIRTIO_VSOCK_POLL_IN;
+
+    if (pSocket->State == VIOSOCK_STATE_CONNECTED &&
+        !(pSocket->Shutdown & VIRTIO_VSOCK_SHUTDOWN_SEND) &&
+        !(pSocket->PeerShutdown & VIRTIO_VSOCK_SHUTDOWN_RCV) &&
+        pSocket->TxRequest == WDF_NO_HANDLE &&
+        VIOSockTxCredit(pSocket))
+        uEvents |= VIRTIO_VSOCK_POLL_OUT;
+
+    if (pSocket->State == VIOSOCK_STATE_CLOSE)
+        uEvents |= VIRTIO_VSOCK_POLL_HUP;
+
+    return uEvents;
+}
+
+//Completes the pending poll requests whose events are ready. Called after
+//every state, RX list or credit change.
+VOID
+VIOSockPollProcess(
+    IN PSOCKET_CONTEXT pSocket
+)
+{
+    WDFREQUEST  PrevRequest = WDF_NO_HANDLE;
+    ULONG       uEvents = 0;
+    BOOLEAN     bEventsValid = FALSE;
+
+    for (;;)
+    {
+        WDFREQUEST  FoundRequest, Request;
+        NTSTATUS    status;
+        PULONG      pEvents;
+
+        status = WdfIoQueueFindRequest(pSocket->PollQueue, PrevRequest, NULL, NULL, &FoundRequest);
+
+        if (PrevRequest != WDF_NO_HANDLE)
+        {
+            WdfObjectDereference(PrevRequest);
+            PrevRequest = WDF_NO_HANDLE;
+
+            if (status == STATUS_NOT_FOUND)
+                continue;   //previous request was cancelled, restart the scan
+        }
+
+        if (!NT_SUCCESS(status))
+            break;
+
+        //the state is sampled once, polls queued meanwhile are checked by VIOSockPoll
+        if (!bEventsValid)
+        {
+            WdfSpinLockAcquire(pSocket->StateLock);
+            uEvents = VIOSockPollEvents(pSocket);
+            WdfSpinLockRelease(pSocket->StateLock);
+            bEventsValid = TRUE;
+        }
+
+        if (!(uEvents & GetPollContext(FoundRequest)->Events))
+        {
+            PrevRequest = FoundRequest;
+            continue;
+        }
+
+        status = WdfIoQueueRetrieveFoundRequest(pSocket->PollQueue, FoundRequest, &Request);
+        WdfObjectDereference(FoundRequest);
+
+        if (NT_SUCCESS(status))
+        {
+            status = WdfRequestRetrieveOutputBuffer(Request, sizeof(*pEvents), (PVOID*)&pEvents, NULL);
+            if (NT_SUCCESS(status))
+                *pEvents = uEvents;
+
+            TraceEvents(TRACE_LEVEL_VERBOSE, DBG_IOCTLS, "Poll request %p completed, events: 0x%x\n",
+                Request, uEvents);
+            WdfRequestCompleteWithInformation(Request, status, NT_SUCCESS(status) ? sizeof(*pEvents) : 0);
+        }
+        //restart the scan, the queue has changed
+    }
+}
+
+NTSTATUS
+VIOSockPoll(
+    IN WDFREQUEST Request
+)
+{
+    PSOCKET_CONTEXT         pSocket = GetSocketContextFromRequest(Request);
+    PVIOSOCK_POLL_CONTEXT   pPollContext;
+    WDF_OBJECT_ATTRIBUTES   attributes;
+    PULONG                  pEvents;
+    NTSTATUS                status;
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_IOCTLS, "--> %s\n", __FUNCTION__);
+
+    if (pSocket->IsControl)
+        return STATUS_INVALID_DEVICE_REQUEST;
+
+    status = WdfRequestRetrieveInputBuffer(Request, sizeof(*pEvents), (PVOID*)&pEvents, NULL);
+    if (NT_SUCCESS(status))
+    {
+        //check the output length now, the request can be completed from DPC
+        status = WdfRequestRetrieveOutputBuffer(Request, sizeof(*pEvents), NULL, NULL);
+    }
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_IOCTLS,
+            "WdfRequestRetrieveBuffer failed 0x%x\n", status);
+        return status;
+    }
+
+    if (!(*pEvents & VIRTIO_VSOCK_POLL_MASK))
+        return STATUS_INVALID_PARAMETER;
+
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&attributes, VIOSOCK_POLL_CONTEXT);
+    status = WdfObjectAllocateContext(Request, &attributes, &pPollContext);
+    if (!NT_SUCCESS(status))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_IOCTLS,
+            "WdfObjectAllocateContext failed 0x%x\n", status);
+        return status;
+    }
+
+    pPollContext->Events = (*pEvents & VIRTIO_VSOCK_POLL_MASK) | VIRTIO_VSOCK_POLL_HUP;
+
+    //queue first, so an event coming right now is not missed
+    status = WdfRequestForwardToIoQueue(Request, pSocket->PollQueue);
+    if (NT_SUCCESS(status))
+    {
+        VIOSockPollProcess(pSocket);
+        status = STATUS_PENDING;
+    }
+    else
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_IOCTLS,
+            "WdfRequestForwardToIoQueue failed 0x%x\n", status);
+    }
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_IOCTLS, "<-- %s\n", __FUNCTION__);
+    return status;
+}
@@ -0,0 +1,653 @@
+/*
+ * Placeholder for the Tx path functions
+ *
+ * Copyright (c) 2019 Virtuozzo International GmbH
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met :
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and / or other materials provided with the distribution.
+ * 3. Neither the names of the copyright holders nor the names of their contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT HOLDERS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "precomp.h"
+#include "viosock.h"
+
+#if defined(EVENT_TRACING)
+#include "Tx.tmh"
+#endif
+
+EVT_WDF_REQUEST_CANCEL VIOSockTxRequestCancel;
+
+#ifdef ALLOC_PRAGMA
+#pragma alloc_text (PAGE, VIOSockTxVqInit)
+#pragma alloc_text (PAGE, VIOSockTxVqCleanup)
+#endif
+
+NTSTATUS
+VIOSockTxVqInit(
+    IN PDEVICE_CONTEXT pContext
+)
+{
+    ULONG i;
+
+    PAGED_CODE();
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_INIT, "--> %s\n", __FUNCTION__);
+
+    //each packet takes two descriptors: header and payload
+    pContext->TxPktNum = min(VIOSOCK_TX_PKT_NUM, virtio_get_queue_size(pContext->TxQueue) / 2);
+
+    pContext->TxCbBuffers = ExAllocatePoolWithTag(NonPagedPool,
+        sizeof(VIOSOCK_TX_CB) * pContext->TxPktNum, VIOSOCK_DRIVER_MEMORY_TAG);
+    if (!pContext->TxCbBuffers)
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_INIT, "Can't allocate %u TX control blocks\n",
+            pContext->TxPktNum);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    pContext->TxPktVA = VirtIOWdfDeviceAllocDmaMemory(&pContext->VDevice.VIODevice,
+        VIOSOCK_TX_PKT_SIZE * pContext->TxPktNum, VIOSOCK_DRIVER_MEMORY_TAG);
+    if (!pContext->TxPktVA)
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_INIT, "Can't allocate %u TX packets\n",
+            pContext->TxPktNum);
+        ExFreePoolWithTag(pContext->TxCbBuffers, VIOSOCK_DRIVER_MEMORY_TAG);
+        pContext->TxCbBuffers = NULL;
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+    pContext->TxPktPA = VirtIOWdfDeviceGetPhysicalAddress(&pContext->VDevice.VIODevice,
+        pContext->TxPktVA);
+
+    pContext->TxFreeList.Next = NULL;
+    for (i = 0; i < pContext->TxPktNum; ++i)
+    {
+        PVIOSOCK_TX_CB pCb = &pContext->TxCbBuffers[i];
+
+        pCb->pPacket = (PVIOSOCK_TX_PKT)((PCHAR)pContext->TxPktVA + VIOSOCK_TX_PKT_SIZE * i);
+        pCb->PA.QuadPart = pContext->TxPktPA.QuadPart + VIOSOCK_TX_PKT_SIZE * i;
+        PushEntryList(&pContext->TxFreeList, &pCb->ListEntry);
+    }
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_INIT, "<-- %s, %u TX packets\n",
+        __FUNCTION__, pContext->TxPktNum);
+    return STATUS_SUCCESS;
+}
+
+VOID
+VIOSockTxVqCleanup(
+    IN PDEVICE_CONTEXT pContext
+)
+{
+    PAGED_CODE();
+
+    pContext->TxFreeList.Next = NULL;
+
+    if (pContext->TxPktVA)
+    {
+        VirtIOWdfDeviceFreeDmaMemory(&pContext->VDevice.VIODevice, pContext->TxPktVA);
+        pContext->TxPktVA = NULL;
+    }
+
+    if (pContext->TxCbBuffers)
+    {
+        ExFreePoolWithTag(pContext->TxCbBuffers, VIOSOCK_DRIVER_MEMORY_TAG);
+        pContext->TxCbBuffers = NULL;
+    }
+    pContext->TxPktNum = 0;
+}
+
+//Called under TxLock
+static
+PVIOSOCK_TX_CB
+VIOSockTxCbAlloc(
+    IN PDEVICE_CONTEXT pContext
+)
+{
+    PSINGLE_LIST_ENTRY pEntry = PopEntryList(&pContext->TxFreeList);
+
+    return pEntry ? CONTAINING_RECORD(pEntry, VIOSOCK_TX_CB, ListEntry) : NULL;
+}
+
+//Called under TxLock
+static
+BOOLEAN
+VIOSockTxCbEnqueue(
+    IN PDEVICE_CONTEXT pContext,
+    IN PVIOSOCK_TX_CB pCb
+)
+{
+    VIOSOCK_SG_DESC sg[2];
+    ULONG uLength = pCb->pPacket->Header.len;
+
+    sg[0].physAddr.QuadPart = pCb->PA.QuadPart;
+    sg[0].length = sizeof(VIRTIO_VSOCK_HDR);
+    sg[1].physAddr.QuadPart = pCb->PA.QuadPart + FIELD_OFFSET(VIOSOCK_TX_PKT, Buffer);
+    sg[1].length = uLength;
+
+    if (0 > virtqueue_add_buf(pContext->TxQueue, sg, uLength ? 2 : 1, 0, pCb, NULL, 0))
+    {
+        TraceEvents(TRACE_LEVEL_ERROR, DBG_WRITE, "Can't add TX packet %p\n", pCb);
+        PushEntryList(&pContext->TxFreeList, &pCb->ListEntry);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+//Called under StateLock, reports our receive credit to the peer
+static
+VOID
+VIOSockTxFillHeader(
+    IN PDEVICE_CONTEXT pContext,
+    IN PSOCKET_CONTEXT pSocket,
+    IN PVIRTIO_VSOCK_HDR pHdr,
+    IN VIRTIO_VSOCK_OP Op,
+    IN ULONG32 Flags,
+    IN ULONG32 Length
+)
+{
+    pHdr->src_cid = pContext->Config.guest_cid;
+    pHdr->dst_cid = pSocket->dst_cid;
+    pHdr->src_port = pSocket->src_port;
+    pHdr->dst_port = pSocket->dst_port;
+    pHdr->len = Length;
+    pHdr->type = VIRTIO_VSOCK_TYPE_STREAM;
+    pHdr->op = (USHORT)Op;
+    pHdr->flags = Flags;
+    pHdr->buf_alloc = pSocket->buf_alloc;
+    pHdr->fwd_cnt = pSocket->fwd_cnt;
+
+    pSocket->last_fwd_cnt = pSocket->fwd_cnt;
+}
+
+//Called under TxLock, the socket is resumed by VIOSockTxVqProcess
+static
+VOID
+VIOSockTxWait(
+    IN PDEVICE_CONTEXT pContext,
+    IN PSOCKET_CONTEXT pSocket
+)
+{
+    if (IsListEmpty(&pSocket->TxWaitEntry))
+    {
+        WdfObjectReference(pSocket->ThisSocket);
+        InsertTailList(&pContext->TxWaitList, &pSocket->TxWaitEntry);
+    }
+}
+
+#define VIOSOCK_TX_OP(Op) (1UL << (Op))
+
+//Called under StateLock and TxLock, sends the control packets waiting on the
+//socket. The ones that get no TX packet wait for TX completion like data.
+//Returns TRUE if anything was added to the TX queue.
+static
+BOOLEAN
+VIOSockTxControlFlush(
+    IN PDEVICE_CONTEXT pContext,
+    IN PSOCKET_CONTEXT pSocket
+)
+{
+    static const VIRTIO_VSOCK_OP Ops[] = {
+        VIRTIO_VSOCK_OP_REQUEST,
+        VIRTIO_VSOCK_OP_CREDIT_UPDATE,
+        VIRTIO_VSOCK_OP_SHUTDOWN,
+        VIRTIO_VSOCK_OP_RST,
+    };
+    BOOLEAN bQueued = FALSE;
+    ULONG   i;
+
+    for (i = 0; i < ARRAYSIZE(Ops) && pSocket->TxControlOps; ++i)
+    {
+        PVIOSOCK_TX_CB pCb;
+
+        if (!(pSocket->TxControlOps & VIOSOCK_TX_OP(Ops[i])))
+            continue;
+
+        pCb = VIOSockTxCbAlloc(pContext);
+        if (!pCb)
+        {
+            TraceEvents(TRACE_LEVEL_WARNING, DBG_WRITE, "No free TX packet for op %u, deferred\n", Ops[i]);
+            VIOSockTxWait(pContext, pSocket);
+            break;
+        }
+
+        VIOSockTxFillHeader(pContext, pSocket, &pCb->pPacket->Header, Ops[i],
+            (Ops[i] == VIRTIO_VSOCK_OP_SHUTDOWN) ? pSocket->TxShutdownFlags : 0, 0);
+        if (!VIOSockTxCbEnqueue(pContext, pCb))
+        {
+            VIOSockTxWait(pContext, pSocket);
+            break;
+        }
+
+        pSocket->TxControlOps &= ~VIOSOCK_TX_OP(Ops[i]);
+        if (Ops[i] == VIRTIO_VSOCK_OP_SHUTDOWN)
+            pSocket->TxShutdownFlags = 0;
+        bQueued = TRUE;
+    }
+    return bQueued;
+}
+
+//Called under TxLock, returns FALSE if the RST ring is full
+static
+BOOLEAN
+VIOSockTxResetAdd(
+    IN PDEVICE_CONTEXT pContext,
+    IN ULONG64 DstCid,
+    IN ULONG32 SrcPort,
+    IN ULONG32 DstPort
+)
+{
+    PVIRTIO_VSOCK_HDR pRstHdr;
+
+    if (pContext->TxResetCount == VIOSOCK_TX_RESET_NUM)
+    {
+        TraceEvents(TRACE_LEVEL_WARNING, DBG_WRITE, "Too many RST packets waiting, %I64u:%u dropped\n",
+            DstCid, DstPort);
+        return FALSE;
+    }
+
+    pRstHdr = &pContext->TxResetHdr[(pContext->TxResetFirst + pContext->TxResetCount++) % VIOSOCK_TX_RESET_NUM];
+
+    RtlZeroMemory(pRstHdr, sizeof(*pRstHdr));
+    pRstHdr->src_cid = pContext->Config.guest_cid;
+    pRstHdr->dst_cid = DstCid;
+    pRstHdr->src_port = SrcPort;
+    pRstHdr->dst_port = DstPort;
+    pRstHdr->type = VIRTIO_VSOCK_TYPE_STREAM;
+    pRstHdr->op = VIRTIO_VSOCK_OP_RST;
+    return TRUE;
+}
+
+//Called under TxLock, sends the RST packets waiting in the ring. Returns TRUE
+//if anything was added to the TX queue.
+static
+BOOLEAN
+VIOSockTxResetFlush(
+    IN PDEVICE_CONTEXT pContext
+)
+{
+    BOOLEAN bQueued = FALSE;
+
+    while (pContext->TxResetCount)
+    {
+        PVIOSOCK_TX_CB pCb = VIOSockTxCbAlloc(pContext);
+
+        if (!pCb)
+            break;
+
+        pCb->pPacket->Header = pContext->TxResetHdr[pContext->TxResetFirst];
+        if (!VIOSockTxCbEnqueue(pContext, pCb))
+            break;
+
+        pContext->TxResetFirst = (pContext->TxResetFirst + 1) % VIOSOCK_TX_RESET_NUM;
+        --pContext->TxResetCount;
+        bQueued = TRUE;
+    }
+    return bQueued;
+}
+
+//Control packets are never dropped for lack of TX packets, they wait on the
+//socket and go out from VIOSockTxVqProcess
+NTSTATUS
+VIOSockSendControl(
+    IN PSOCKET_CONTEXT pSocket,
+    IN VIRTIO_VSOCK_OP Op,
+    IN ULONG32 Flags
+)
+{
+    PDEVICE_CONTEXT pContext = GetDeviceContextFromSocket(pSocket);
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_WRITE, "--> %s, op: %u\n", __FUNCTION__, Op);
+
+    WdfSpinLockAcquire(pSocket->StateLock);
+
+    //nothing else is worth sending after a reset
+    if (Op == VIRTIO_VSOCK_OP_RST)
+        pSocket->TxControlOps = VIOSOCK_TX_OP(Op);
+    else
+        pSocket->TxControlOps |= VIOSOCK_TX_OP(Op);
+    if (Op == VIRTIO_VSOCK_OP_SHUTDOWN)
+        pSocket->TxShutdownFlags |= Flags;
+
+    WdfSpinLockAcquire(pContext->TxLock);
+    if (VIOSockTxControlFlush(pContext, pSocket))
+        virtqueue_kick(pContext->TxQueue);
+    WdfSpinLockRelease(pContext->TxLock);
+
+    WdfSpinLockRelease(pSocket->StateLock);
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_WRITE, "<-- %s\n", __FUNCTION__);
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+VIOSockSendReset(
+    IN PDEVICE_CONTEXT pContext,
+    IN PVIRTIO_VSOCK_HDR pHdr
+)
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    WdfSpinLockAcquire(pContext->TxLock);
+
+    //behind the RST packets still waiting for the TX pool
+    if (!VIOSockTxResetAdd(pContext, pHdr->src_cid, pHdr->dst_port, pHdr->src_port))
+        status = STATUS_INSUFFICIENT_RESOURCES;
+    if (VIOSockTxResetFlush(pContext))
+        virtqueue_kick(pContext->TxQueue);
+
+    WdfSpinLockRelease(pContext->TxLock);
+    return status;
+}
+
+//Detaches a closed socket from the TX path. A SHUTDOWN or RST it could not
+//send yet turns into a RST without socket, the peer still learns about the close.
+VOID
+VIOSockTxSocketRemove(
+    IN PSOCKET_CONTEXT pSocket
+)
+{
+    PDEVICE_CONTEXT pContext = GetDeviceContextFromSocket(pSocket);
+    BOOLEAN         bWaiting = FALSE;
+
+    WdfSpinLockAcquire(pSocket->StateLock);
+    WdfSpinLockAcquire(pContext->TxLock);
+
+    if (pSocket->TxControlOps & (VIOSOCK_TX_OP(VIRTIO_VSOCK_OP_SHUTDOWN) | VIOSOCK_TX_OP(VIRTIO_VSOCK_OP_RST)))
+    {
+        VIOSockTxResetAdd(pContext, pSocket->dst_cid, pSocket->src_port, pSocket->dst_port);
+        if (VIOSockTxResetFlush(pContext))
+            virtqueue_kick(pContext->TxQueue);
+    }
+    pSocket->TxControlOps = pSocket->TxShutdownFlags = 0;
+
+    if (!IsListEmpty(&pSocket->TxWaitEntry))
+    {
+        RemoveEntryList(&pSocket->TxWaitEntry);
+        InitializeListHead(&pSocket->TxWaitEntry);
+        bWaiting = TRUE;
+    }
+
+    WdfSpinLockRelease(pContext->TxLock);
+    WdfSpinLockRelease(pSocket->StateLock);
+
+    if (bWaiting)
+        WdfObjectDereference(pSocket->ThisSocket);
+}
+
+//Called under StateLock
+static
+BOOLEAN
+VIOSockTxIsBroken(
+    IN PSOCKET_CONTEXT pSocket
+)
+{
+    return pSocket->State != VIOSOCK_STATE_CONNECTED ||
+        (pSocket->Shutdown & VIRTIO_VSOCK_SHUTDOWN_SEND) ||
+        (pSocket->PeerShutdown & VIRTIO_VSOCK_SHUTDOWN_RCV);
+}
+
+//The write request being sent is out of the manual queue, the cancel routine
+//takes it from the socket with the bytes sent so far
+VOID
+VIOSockTxRequestCancel(
+    IN WDFREQUEST Request
+)
+{
+    PSOCKET_CONTEXT pSocket = GetSocketContextFromRequest(Request);
+    ULONG           uCompleteLength = 0;
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_WRITE, "--> %s, request: %p\n", __FUNCTION__, Request);
+
+    //the socket must survive the completion of its last request
+    WdfObjectReference(pSocket->ThisSocket);
+
+    WdfSpinLockAcquire(pSocket->StateLock);
+    if (pSocket->TxRequest == Request)
+    {
+        uCompleteLength = pSocket->TxRequestOffset;
+        pSocket->TxRequest = WDF_NO_HANDLE;
+        pSocket->TxRequestCanceling = FALSE;
+    }
+    WdfSpinLockRelease(pSocket->StateLock);
+
+    WdfRequestCompleteWithInformation(Request, STATUS_CANCELLED, uCompleteLength);
+
+    //the next write request can go
+    VIOSockWriteProcess(pSocket);
+    WdfObjectDereference(pSocket->ThisSocket);
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_WRITE, "<-- %s\n", __FUNCTION__);
+}
+
+//Moves as much of the pending write requests into TX packets as both the
+//peer credit and the TX pool allow. Write request is completed as soon
+//as all its data is copied.
+VOID
+VIOSockWriteProcess(
+    IN PSOCKET_CONTEXT pSocket
+)
+{
+    PDEVICE_CONTEXT pContext = GetDeviceContextFromSocket(pSocket);
+    BOOLEAN         bKick = FALSE;
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_WRITE, "--> %s\n", __FUNCTION__);
+
+    for (;;)
+    {
+        WDFREQUEST      CompleteRequest = WDF_NO_HANDLE;
+        NTSTATUS        status = STATUS_SUCCESS;
+        ULONG           uCompleteLength = 0;
+        PCHAR           pBuffer;
+        size_t          stBufferLength;
+        ULONG32         uCredit, uChunk;
+        PVIOSOCK_TX_CB  pCb;
+        BOOLEAN         bQueued;
+
+        WdfSpinLockAcquire(pSocket->StateLock);
+
+        if (pSocket->TxRequest == WDF_NO_HANDLE)
+        {
+            if (!NT_SUCCESS(WdfIoQueueRetrieveNextRequest(pSocket->WriteQueue, &pSocket->TxRequest)))
+            {
+                pSocket->TxRequest = WDF_NO_HANDLE;
+                WdfSpinLockRelease(pSocket->StateLock);
+                break;
+            }
+            pSocket->TxRequestOffset = 0;
+
+            status = WdfRequestMarkCancelableEx(pSocket->TxRequest, VIOSockTxRequestCancel);
+            if (!NT_SUCCESS(status))
+            {
+                //canceled before it was marked
+                CompleteRequest = pSocket->TxRequest;
+                pSocket->TxRequest = WDF_NO_HANDLE;
+                WdfSpinLockRelease(pSocket->StateLock);
+
+                WdfRequestComplete(CompleteRequest, status);
+                continue;
+            }
+        }
+        else if (pSocket->TxRequestCanceling)
+        {
+            WdfSpinLockRelease(pSocket->StateLock);
+            break;
+        }
+
+        status = WdfRequestRetrieveInputBuffer(pSocket->TxRequest, 0, &pBuffer, &stBufferLength);
+
+        if (!NT_SUCCESS(status) || VIOSockTxIsBroken(pSocket))
+        {
+            if (NT_SUCCESS(status))
+                status = (pSocket->State == VIOSOCK_STATE_CONNECTED) ?
+                    STATUS_PIPE_DISCONNECTED : STATUS_CONNECTION_RESET;
+
+            if (WdfRequestUnmarkCancelable(pSocket->TxRequest) == STATUS_CANCELLED)
+            {
+                //the cancel routine completes it
+                pSocket->TxRequestCanceling = TRUE;
+                WdfSpinLockRelease(pSocket->StateLock);
+                break;
+            }
+
+            CompleteRequest = pSocket->TxRequest;
+            uCompleteLength = pSocket->TxRequestOffset;
+            pSocket->TxRequest = WDF_NO_HANDLE;
+            WdfSpinLockRelease(pSocket->StateLock);
+
+            WdfRequestCompleteWithInformation(CompleteRequest, status, uCompleteLength);
+            continue;
+        }
+
+        uCredit = VIOSockTxCredit(pSocket);
+        if (!uCredit)
+        {
+            //wait for VIRTIO_VSOCK_OP_CREDIT_UPDATE
+            TraceEvents(TRACE_LEVEL_VERBOSE, DBG_WRITE, "No peer credit\n");
+            WdfSpinLockRelease(pSocket->StateLock);
+            break;
+        }
+
+        uChunk = min((ULONG32)(stBufferLength - pSocket->TxRequestOffset), uCredit);
+        uChunk = min(uChunk, VIOSOCK_TX_BUF_SIZE);
+
+        WdfSpinLockAcquire(pContext->TxLock);
+
+        pCb = VIOSockTxCbAlloc(pContext);
+        if (!pCb)
+        {
+            //wait for TX completion
+            VIOSockTxWait(pContext, pSocket);
+            WdfSpinLockRelease(pContext->TxLock);
+            WdfSpinLockRelease(pSocket->StateLock);
+            break;
+        }
+
+        VIOSockTxFillHeader(pContext, pSocket, &pCb->pPacket->Header, VIRTIO_VSOCK_OP_RW, 0, uChunk);
+        RtlCopyMemory(pCb->pPacket->Buffer, pBuffer + pSocket->TxRequestOffset, uChunk);
+
+        bQueued = VIOSockTxCbEnqueue(pContext, pCb);
+        if (bQueued)
+        {
+            //a large write is kicked every VIRTQUEUE_MAX_DEFERRED_KICKS packets,
+            //the device starts sending while the rest is being copied
+            virtqueue_kick_deferred(pContext->TxQueue, TRUE);
+            bKick = TRUE;
+            pSocket->tx_cnt += uChunk;
+            pSocket->TxRequestOffset += uChunk;
+        }
+        else
+        {
+            VIOSockTxWait(pContext, pSocket);
+        }
+
+        WdfSpinLockRelease(pContext->TxLock);
+
+        if (pSocket->TxRequestOffset == stBufferLength)
+        {
+            if (WdfRequestUnmarkCancelable(pSocket->TxRequest) == STATUS_CANCELLED)
+            {
+                //the cancel routine completes it
+                pSocket->TxRequestCanceling = TRUE;
+            }
+            else
+            {
+                CompleteRequest = pSocket->TxRequest;
+                uCompleteLength = pSocket->TxRequestOffset;
+                pSocket->TxRequest = WDF_NO_HANDLE;
+            }
+        }
+
+        WdfSpinLockRelease(pSocket->StateLock);
+
+        if (CompleteRequest != WDF_NO_HANDLE)
+        {
+            TraceEvents(TRACE_LEVEL_VERBOSE, DBG_WRITE, "Write request %p completed, %u bytes\n",
+                CompleteRequest, uCompleteLength);
+            WdfRequestCompleteWithInformation(CompleteRequest, STATUS_SUCCESS, uCompleteLength);
+        }
+        else if (!bQueued)
+            break;
+    }
+
+    if (bKick)
+    {
+        //end of the burst
+        WdfSpinLockAcquire(pContext->TxLock);
+        virtqueue_kick_deferred(pContext->TxQueue, FALSE);
+        WdfSpinLockRelease(pContext->TxLock);
+    }
+
+    VIOSockPollProcess(pSocket);
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_WRITE, "<-- %s\n", __FUNCTION__);
+}
+
+VOID
+VIOSockTxVqProcess(
+    IN PDEVICE_CONTEXT pContext
+)
+{
+    PVIOSOCK_TX_CB  pCb;
+    UINT            len;
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_DPC, "--> %s\n", __FUNCTION__);
+
+    WdfSpinLockAcquire(pContext->TxLock);
+    while ((pCb = virtqueue_get_buf(pContext->TxQueue, &len)) != NULL)
+    {
+        PushEntryList(&pContext->TxFreeList, &pCb->ListEntry);
+    }
+    if (VIOSockTxResetFlush(pContext))
+        virtqueue_kick(pContext->TxQueue);
+    WdfSpinLockRelease(pContext->TxLock);
+
+    //resume sockets waiting for free TX packets, control packets go first
+    for (;;)
+    {
+        PSOCKET_CONTEXT pSocket;
+        PLIST_ENTRY pEntry;
+
+        WdfSpinLockAcquire(pContext->TxLock);
+        if (!pContext->TxFreeList.Next || IsListEmpty(&pContext->TxWaitList))
+        {
+            WdfSpinLockRelease(pContext->TxLock);
+            break;
+        }
+        pEntry = RemoveHeadList(&pContext->TxWaitList);
+        InitializeListHead(pEntry);
+        WdfSpinLockRelease(pContext->TxLock);
+
+        pSocket = CONTAINING_RECORD(pEntry, SOCKET_CONTEXT, TxWaitEntry);
+
+        WdfSpinLockAcquire(pSocket->StateLock);
+        WdfSpinLockAcquire(pContext->TxLock);
+        if (VIOSockTxControlFlush(pContext, pSocket))
+            virtqueue_kick(pContext->TxQueue);
+        WdfSpinLockRelease(pContext->TxLock);
+        WdfSpinLockRelease(pSocket->StateLock);
+
+        VIOSockWriteProcess(pSocket);
+        WdfObjectDereference(pSocket->ThisSocket);
+    }
+
+    TraceEvents(TRACE_LEVEL_VERBOSE, DBG_DPC, "<-- %s\n", __FUNCTION__);
+}
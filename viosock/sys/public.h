@@ -37,6 +37,9 @@ DEFINE_GUID(GUID_DEVINTERFACE_VIOSOCK,
     0x6b58dc1f, 0x1c3, 0x440f, 0xbe, 0x1c, 0xb9, 0x5d, 0x0, 0xf, 0x1f, 0xf5);
 
 #define IOCTL_GET_CONFIG        CTL_CODE(FILE_DEVICE_UNKNOWN, 0x800, METHOD_BUFFERED, FILE_READ_ACCESS)
+#define IOCTL_SOCKET_CONNECT    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x801, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_SOCKET_SHUTDOWN   CTL_CODE(FILE_DEVICE_UNKNOWN, 0x802, METHOD_BUFFERED, FILE_WRITE_ACCESS)
+#define IOCTL_SOCKET_POLL       CTL_CODE(FILE_DEVICE_UNKNOWN, 0x803, METHOD_BUFFERED, FILE_READ_ACCESS)
 
 typedef struct _VIRTIO_VSOCK_CONFIG {
     ULONG64 guest_cid;
@@ -55,4 +58,27 @@ typedef struct _VIRTIO_VSOCK_PARAMS {
     ULONGLONG Socket;
 }VIRTIO_VSOCK_PARAMS, *PVIRTIO_VSOCK_PARAMS;
 
+//IOCTL_SOCKET_CONNECT input
+typedef struct _VIRTIO_VSOCK_CONNECT {
+    ULONG64 dst_cid;
+    ULONG32 dst_port;
+}VIRTIO_VSOCK_CONNECT, *PVIRTIO_VSOCK_CONNECT;
+
+//IOCTL_SOCKET_SHUTDOWN input, ULONG of the flags below
+typedef enum _VIRTIO_VSOCK_SHUTDOWN_FLAGS {
+    VIRTIO_VSOCK_SHUTDOWN_RCV = 1,
+    VIRTIO_VSOCK_SHUTDOWN_SEND = 2,
+    VIRTIO_VSOCK_SHUTDOWN_MASK = VIRTIO_VSOCK_SHUTDOWN_RCV | VIRTIO_VSOCK_SHUTDOWN_SEND,
+}VIRTIO_VSOCK_SHUTDOWN_FLAGS;
+
+//IOCTL_SOCKET_POLL input is a ULONG mask of the events below, output is a ULONG
+//of the ready ones. The request stays pending until any requested event is ready,
+//VIRTIO_VSOCK_POLL_HUP is always reported.
+typedef enum _VIRTIO_VSOCK_POLL_EVENTS {
+    VIRTIO_VSOCK_POLL_IN = 1,       //data or EOF can be read without blocking
+    VIRTIO_VSOCK_POLL_OUT = 2,      //peer has credit for a new write
+    VIRTIO_VSOCK_POLL_HUP = 4,      //socket is not connected
+    VIRTIO_VSOCK_POLL_MASK = VIRTIO_VSOCK_POLL_IN | VIRTIO_VSOCK_POLL_OUT | VIRTIO_VSOCK_POLL_HUP,
+}VIRTIO_VSOCK_POLL_EVENTS;
+
 #endif /* PUBLIC_H */
@@ -65,6 +65,10 @@ typedef struct _VIRTIO_VSOCK_HDR {
     ULONG32 fwd_cnt;
 }VIRTIO_VSOCK_HDR, *PVIRTIO_VSOCK_HDR;
 
+typedef enum _VIRTIO_VSOCK_TYPE {
+    VIRTIO_VSOCK_TYPE_STREAM = 1,
+}VIRTIO_VSOCK_TYPE;
+
 typedef enum _VIRTIO_VSOCK_EVENT_ID {
     VIRTIO_VSOCK_EVENT_TRANSPORT_RESET = 0,
 }VIRTIO_VSOCK_EVENT_ID;
@@ -84,11 +88,50 @@ EVT_WDF_INTERRUPT_ENABLE                        VIOSockInterruptEnable;
 EVT_WDF_INTERRUPT_DISABLE                       VIOSockInterruptDisable;
 
 EVT_WDF_DEVICE_FILE_CREATE VIOSockCreate;
+EVT_WDF_FILE_CLEANUP VIOSockCleanup;
 EVT_WDF_FILE_CLOSE VIOSockClose;
 
+EVT_WDF_IO_QUEUE_IO_READ VIOSockRead;
+EVT_WDF_IO_QUEUE_IO_WRITE VIOSockWrite;
+
 typedef struct virtqueue VIOSOCK_VQ, *PVIOSOCK_VQ;
 typedef struct VirtIOBufferDescriptor VIOSOCK_SG_DESC, *PVIOSOCK_SG_DESC;
 
+//RX packet as posted to the RX virtqueue, lives in DMA memory
+typedef struct _VIOSOCK_RX_PKT {
+    VIRTIO_VSOCK_HDR    Header;
+    UCHAR               Buffer[1];
+}VIOSOCK_RX_PKT, *PVIOSOCK_RX_PKT;
+
+//RX packet control block, one per pre-posted RX buffer
+typedef struct _VIOSOCK_RX_CB {
+    PVIOSOCK_RX_PKT     pPacket;
+    PHYSICAL_ADDRESS    PA;
+}VIOSOCK_RX_CB, *PVIOSOCK_RX_CB;
+
+//Received payload queued on the socket while no read request is pending
+typedef struct _VIOSOCK_RX_ENTRY {
+    LIST_ENTRY          ListEntry;
+    ULONG               Length;
+    ULONG               Offset;
+    UCHAR               Buffer[1];
+}VIOSOCK_RX_ENTRY, *PVIOSOCK_RX_ENTRY;
+
+//TX packet as posted to the TX virtqueue, lives in DMA memory
+typedef struct _VIOSOCK_TX_PKT {
+    VIRTIO_VSOCK_HDR    Header;
+    UCHAR               Buffer[1];
+}VIOSOCK_TX_PKT, *PVIOSOCK_TX_PKT;
+
+typedef struct _VIOSOCK_TX_CB {
+    SINGLE_LIST_ENTRY   ListEntry;
+    PVIOSOCK_TX_PKT     pPacket;
+    PHYSICAL_ADDRESS    PA;
+}VIOSOCK_TX_CB, *PVIOSOCK_TX_CB;
+
+//RST packets without socket kept while the TX pool is empty, more are dropped
+#define VIOSOCK_TX_RESET_NUM    16
+
 typedef struct _DEVICE_CONTEXT {
 
     VIRTIO_WDF_DRIVER   VDevice;
@@ -100,14 +143,45 @@ typedef struct _DEVICE_CONTEXT {
     WDFINTERRUPT        WdfInterrupt;
 
     WDFCOLLECTION   SocketList;
+    WDFSPINLOCK     SocketListLock;
+    ULONG32         LastLocalPort;
 
     WDFQUEUE            IoCtlQueue;
+    WDFQUEUE            RwQueue;
+
+    //RX buffer pool, all entries are posted to RxQueue
+    WDFSPINLOCK         RxLock;
+    PVOID               RxPktVA;
+    PHYSICAL_ADDRESS    RxPktPA;
+    PVIOSOCK_RX_CB      RxCbBuffers;
+    ULONG               RxPktNum;
+
+    //TX packet pool, free entries are kept in TxFreeList
+    WDFSPINLOCK         TxLock;
+    PVOID               TxPktVA;
+    PHYSICAL_ADDRESS    TxPktPA;
+    PVIOSOCK_TX_CB      TxCbBuffers;
+    ULONG               TxPktNum;
+    SINGLE_LIST_ENTRY   TxFreeList;
+    LIST_ENTRY          TxWaitList;     //sockets waiting for a free TX packet
+    VIRTIO_VSOCK_HDR    TxResetHdr[VIOSOCK_TX_RESET_NUM];   //RST packets without socket
+    ULONG               TxResetFirst;   //waiting for a free TX packet, ring
+    ULONG               TxResetCount;
+
+    PVIRTIO_VSOCK_EVENT EvtVA;
+    PHYSICAL_ADDRESS    EvtPA;
 
     VIRTIO_VSOCK_CONFIG Config;
  } DEVICE_CONTEXT, *PDEVICE_CONTEXT;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(DEVICE_CONTEXT, GetDeviceContext);
 
+typedef enum _VIOSOCK_STATE {
+    VIOSOCK_STATE_CLOSE = 0,
+    VIOSOCK_STATE_CONNECTING,
+    VIOSOCK_STATE_CONNECTED,
+    VIOSOCK_STATE_CLOSING,
+}VIOSOCK_STATE;
 
 typedef struct _SOCKET_CONTEXT {
 
@@ -121,10 +195,187 @@ typedef struct _SOCKET_CONTEXT {
     ULONG State;
     WDFFILEOBJECT ListenSocket;
     BOOLEAN IsControl;
+
+    WDFFILEOBJECT   ThisSocket;
+    WDFSPINLOCK     StateLock;      //protects state, credit and RX list
+
+    //RX side
+    WDFQUEUE        ReadQueue;
+    LIST_ENTRY      RxList;
+    ULONG32         RxBytes;        //bytes queued in RxList
+    ULONG32         rx_cnt;         //total payload bytes received
+    ULONG32         last_fwd_cnt;   //fwd_cnt last reported to the peer
+    ULONG32         PeerShutdown;
+
+    //TX side
+    WDFQUEUE        WriteQueue;
+    WDFQUEUE        ConnectQueue;
+    WDFREQUEST      TxRequest;      //write request being sent, cancelable
+    ULONG           TxRequestOffset;
+    BOOLEAN         TxRequestCanceling; //TxRequest is left to its cancel routine
+    ULONG32         tx_cnt;         //total payload bytes sent
+    ULONG32         peer_buf_alloc;
+    ULONG32         peer_fwd_cnt;
+    LIST_ENTRY      TxWaitEntry;    //linked into DEVICE_CONTEXT::TxWaitList
+    ULONG32         TxControlOps;   //control packets waiting for a free TX packet
+    ULONG32         TxShutdownFlags;//flags of the waiting SHUTDOWN
+    ULONG32         Shutdown;
+
+    WDFQUEUE        PollQueue;      //pending IOCTL_SOCKET_POLL requests
 } SOCKET_CONTEXT, *PSOCKET_CONTEXT;
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(SOCKET_CONTEXT, GetSocketContext);
 
+#define GetSocketContextFromRequest(r) GetSocketContext(WdfRequestGetFileObject((r)))
+
+typedef struct _VIOSOCK_POLL_CONTEXT {
+    ULONG Events;                   //events the poll request waits for
+} VIOSOCK_POLL_CONTEXT, *PVIOSOCK_POLL_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(VIOSOCK_POLL_CONTEXT, GetPollContext);
+
+//Rx.c
+NTSTATUS
+VIOSockRxVqInit(
+    IN PDEVICE_CONTEXT pContext
+);
+
+VOID
+VIOSockRxVqCleanup(
+    IN PDEVICE_CONTEXT pContext
+);
+
+VOID
+VIOSockRxVqKick(
+    IN PDEVICE_CONTEXT pContext
+);
+
+VOID
+VIOSockRxVqProcess(
+    IN PDEVICE_CONTEXT pContext
+);
+
+NTSTATUS
+VIOSockEvtVqInit(
+    IN PDEVICE_CONTEXT pContext
+);
+
+VOID
+VIOSockEvtVqProcess(
+    IN PDEVICE_CONTEXT pContext
+);
+
+VOID
+VIOSockReadProcess(
+    IN PSOCKET_CONTEXT pSocket
+);
+
+VOID
+VIOSockRxPurge(
+    IN PSOCKET_CONTEXT pSocket
+);
+
+//Tx.c
+NTSTATUS
+VIOSockTxVqInit(
+    IN PDEVICE_CONTEXT pContext
+);
+
+VOID
+VIOSockTxVqCleanup(
+    IN PDEVICE_CONTEXT pContext
+);
+
+VOID
+VIOSockTxVqProcess(
+    IN PDEVICE_CONTEXT pContext
+);
+
+NTSTATUS
+VIOSockSendControl(
+    IN PSOCKET_CONTEXT pSocket,
+    IN VIRTIO_VSOCK_OP Op,
+    IN ULONG32 Flags
+);
+
+NTSTATUS
+VIOSockSendReset(
+    IN PDEVICE_CONTEXT pContext,
+    IN PVIRTIO_VSOCK_HDR pHdr
+);
+
+VOID
+VIOSockWriteProcess(
+    IN PSOCKET_CONTEXT pSocket
+);
+
+VOID
+VIOSockTxSocketRemove(
+    IN PSOCKET_CONTEXT pSocket
+);
+
+//Socket.c
+PSOCKET_CONTEXT
+VIOSockSocketLookupAndRef(
+    IN PDEVICE_CONTEXT pContext,
+    IN PVIRTIO_VSOCK_HDR pHdr
+);
+
+VOID
+VIOSockSocketDeref(
+    IN PSOCKET_CONTEXT pSocket
+);
+
+VOID
+VIOSockConnectComplete(
+    IN PSOCKET_CONTEXT pSocket,
+    IN NTSTATUS Status
+);
+
+VOID
+VIOSockResetAll(
+    IN PDEVICE_CONTEXT pContext
+);
+
+NTSTATUS
+VIOSockConnect(
+    IN WDFREQUEST Request
+);
+
+NTSTATUS
+VIOSockShutdown(
+    IN WDFREQUEST Request
+);
+
+NTSTATUS
+VIOSockPoll(
+    IN WDFREQUEST Request
+);
+
+VOID
+VIOSockPollProcess(
+    IN PSOCKET_CONTEXT pSocket
+);
+
+__inline
+PDEVICE_CONTEXT
+GetDeviceContextFromSocket(
+    IN PSOCKET_CONTEXT pSocket
+)
+{
+    return GetDeviceContext(WdfFileObjectGetDevice(pSocket->ThisSocket));
+}
+
+//Peer free credit: how many payload bytes the peer can still accept
+__inline
+ULONG32
+VIOSockTxCredit(
+    IN PSOCKET_CONTEXT pSocket
+)
+{
+    return pSocket->peer_buf_alloc - (pSocket->tx_cnt - pSocket->peer_fwd_cnt);
+}
+
 #define VIOSOCK_DRIVER_MEMORY_TAG (ULONG)'cosV'
 
 #define  VIOSOCK_DEVICE_NAME L"\\Device\\Viosock"
@@ -132,4 +383,16 @@ WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(SOCKET_CONTEXT, GetSocketContext);
 #define VIOSOCK_DMA_TRX_LEN 0x10000
 #define VIOSOCK_DMA_TRX_PAGES (VIOSOCK_DMA_TRX_LEN/PAGE_SIZE+1)
 
+//RX/TX packet pools, payload size matches VIRTIO_VSOCK_DEFAULT_RX_BUF_SIZE of linux
+#define VIOSOCK_RX_BUF_SIZE     PAGE_SIZE
+#define VIOSOCK_RX_PKT_SIZE     (sizeof(VIRTIO_VSOCK_HDR) + VIOSOCK_RX_BUF_SIZE)
+#define VIOSOCK_TX_BUF_SIZE     PAGE_SIZE
+#define VIOSOCK_TX_PKT_SIZE     (sizeof(VIRTIO_VSOCK_HDR) + VIOSOCK_TX_BUF_SIZE)
+#define VIOSOCK_TX_PKT_NUM      128
+
+//Receive buffer advertised to the peer (buf_alloc)
+#define VIOSOCK_BUF_ALLOC_DEFAULT   (256 * 1024)
+
+#define VIOSOCK_LOCAL_PORT_FIRST    1024
+
 #endif /* VIOSOCK_H */
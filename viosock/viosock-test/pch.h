@@ -14,6 +14,7 @@
 #include <windows.h>
 #include <winioctl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <winsock2.h>
 #include <winternl.h>
 #include <crtdbg.h>
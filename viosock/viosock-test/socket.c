@@ -78,3 +78,18 @@ VIOSockGetConfig(
     DWORD dwBytes;
     return DeviceIoControl((HANDLE)hViosock, IOCTL_GET_CONFIG, NULL, 0, pConfig, sizeof(*pConfig), &dwBytes, NULL);
 }
+
+BOOL
+WINAPI
+VIOSockConnect(
+    _In_ SOCKET hViosock,
+    _In_ ULONG64 uCid,
+    _In_ ULONG uPort
+)
+{
+    DWORD dwBytes;
+    VIRTIO_VSOCK_CONNECT Connect = { uCid, uPort };
+
+    return DeviceIoControl((HANDLE)hViosock, IOCTL_SOCKET_CONNECT, &Connect, sizeof(Connect),
+        NULL, 0, &dwBytes, NULL);
+}
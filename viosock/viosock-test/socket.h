@@ -19,3 +19,11 @@ VIOSockGetConfig(
     _In_ SOCKET hViosock,
     _Out_ PVIRTIO_VSOCK_CONFIG pConfig
 );
+
+BOOL
+WINAPI
+VIOSockConnect(
+    _In_ SOCKET hViosock,
+    _In_ ULONG64 uCid,
+    _In_ ULONG uPort
+);
@@ -101,6 +101,80 @@ GetGuestCidFromAcceptSocket()
 }
 
 #define TEST_PORT 2222
+#define TEST_BUF_SIZE 0x10000
+#define TEST_ROUNDS 64
+
+//Expects an echo server on the host, e.g. "socat VSOCK-LISTEN:2222,fork EXEC:cat"
+BOOL
+StreamEcho()
+{
+    BOOL bRes = FALSE;
+    SOCKET hSocket;
+    VIRTIO_VSOCK_PARAMS SocketParams = { 0 };
+    PUCHAR pTxBuf = NULL, pRxBuf = NULL;
+    DWORD i, dwBytes;
+
+    _tprintf(L"--> %s\n", TEXT(__FUNCTION__));
+
+    hSocket = VIOSockCreateSocket(&SocketParams);
+    if (hSocket == INVALID_SOCKET)
+    {
+        _tprintf(L"VIOSockCreateSocket(new) error: %d\n", GetLastError());
+        return bRes;
+    }
+
+    if (!VIOSockConnect(hSocket, VMADDR_CID_HOST, TEST_PORT))
+    {
+        _tprintf(L"VIOSockConnect error: %d\n", GetLastError());
+        VIOSockCloseSocket(hSocket);
+        return bRes;
+    }
+
+    pTxBuf = malloc(TEST_BUF_SIZE);
+    pRxBuf = malloc(TEST_BUF_SIZE);
+    if (!pTxBuf || !pRxBuf)
+        goto out;
+
+    for (i = 0; i < TEST_ROUNDS; ++i)
+    {
+        DWORD dwReceived = 0;
+
+        memset(pTxBuf, (UCHAR)i, TEST_BUF_SIZE);
+
+        if (!WriteFile((HANDLE)hSocket, pTxBuf, TEST_BUF_SIZE, &dwBytes, NULL) || dwBytes != TEST_BUF_SIZE)
+        {
+            _tprintf(L"WriteFile error: %d, %d bytes sent\n", GetLastError(), dwBytes);
+            goto out;
+        }
+
+        //stream socket, data can be split in any way
+        while (dwReceived < TEST_BUF_SIZE)
+        {
+            if (!ReadFile((HANDLE)hSocket, pRxBuf + dwReceived, TEST_BUF_SIZE - dwReceived, &dwBytes, NULL) || !dwBytes)
+            {
+                _tprintf(L"ReadFile error: %d, %d bytes received\n", GetLastError(), dwReceived);
+                goto out;
+            }
+            dwReceived += dwBytes;
+        }
+
+        if (memcmp(pTxBuf, pRxBuf, TEST_BUF_SIZE))
+        {
+            _tprintf(L"Data mismatch at round %d\n", i);
+            goto out;
+        }
+    }
+
+    bRes = TRUE;
+
+out:
+    free(pTxBuf);
+    free(pRxBuf);
+    VIOSockCloseSocket(hSocket);
+
+    _tprintf(L"<-- %s\n", TEXT(__FUNCTION__));
+    return bRes;
+}
 
 int __cdecl main()
 {
@@ -123,5 +197,7 @@ int __cdecl main()
         _tprintf(L"GetGuestCidFromAcceptSocket cid: %d\n", (DWORD)uGuestCid);
     }
 
+    _tprintf(L"StreamEcho %s\n", StreamEcho() ? L"passed" : L"failed");
+
     return 0;
 }
@@ -156,6 +156,14 @@ RhelScsiReportLuns(
     IN OUT PSRB_TYPE Srb
     );
 
+#if (NTDDI_VERSION > NTDDI_WIN7)
+UCHAR
+RhelScsiWriteSame(
+    IN PVOID DeviceExtension,
+    IN OUT PSRB_TYPE Srb
+    );
+#endif
+
 VOID
 FORCEINLINE
 CompleteSRB(
@@ -192,6 +200,71 @@ CompleteDPC(
     IN ULONG  MessageID
     );
 
+BOOLEAN
+VioStorFlush(
+    IN PVOID DeviceExtension,
+    IN PSRB_TYPE Srb,
+    IN BOOLEAN resend,
+    IN BOOLEAN bIsr
+    );
+
+VOID
+VioStorFlushCompleted(
+    IN PVOID DeviceExtension,
+    IN PSRB_TYPE Srb,
+    IN UCHAR srbStatus,
+    IN ULONG MessageID
+    );
+
+UCHAR
+VioStorIoControl(
+    IN PVOID DeviceExtension,
+    IN PSRB_TYPE Srb
+    );
+
+#if (NTDDI_VERSION > NTDDI_WIN7)
+BOOLEAN VioStorReadRegistry(
+    IN PVOID DeviceExtension,
+    IN PUCHAR ValueName,
+    OUT PULONG Value
+)
+{
+    BOOLEAN Ret = FALSE;
+    ULONG Len = sizeof(ULONG);
+    UCHAR* pBuf = NULL;
+
+    pBuf = StorPortAllocateRegistryBuffer(DeviceExtension, &Len);
+    if (pBuf == NULL) {
+        RhelDbgPrint(TRACE_LEVEL_FATAL, "StorPortAllocateRegistryBuffer failed to allocate buffer\n");
+        return FALSE;
+    }
+
+    memset(pBuf, 0, sizeof(ULONG));
+
+    Ret = StorPortRegistryRead(DeviceExtension,
+                               ValueName,
+                               1,
+                               MINIPORT_REG_DWORD,
+                               pBuf,
+                               &Len);
+
+    if ((Ret == FALSE) || (Len == 0)) {
+        RhelDbgPrint(TRACE_LEVEL_INFORMATION, "StorPortRegistryRead %s returned 0x%x, Len = %d\n", ValueName, Ret, Len);
+        StorPortFreeRegistryBuffer(DeviceExtension, pBuf);
+        return FALSE;
+    }
+
+    StorPortCopyMemory((PVOID)Value,
+           (PVOID)pBuf,
+           sizeof(ULONG));
+    RhelDbgPrint(TRACE_LEVEL_INFORMATION, " %s = %lu\n", ValueName, *Value);
+
+    StorPortFreeRegistryBuffer(DeviceExtension, pBuf);
+
+    return TRUE;
+}
+#endif
+
 #ifdef EVENT_TRACING
 VOID WppCleanupRoutine(PVOID arg1) {
     RhelDbgPrint(TRACE_LEVEL_INFORMATION, " WppCleanupRoutine\n");
@@ -348,6 +421,25 @@ VirtIoFindAdapter(
     adaptExt->slot_number = ConfigInfo->SlotNumber;
     adaptExt->dump_mode  = IsCrashDumpMode;
 
+    KeInitializeSpinLock(&adaptExt->flush_lock);
+    adaptExt->flush_in_flight = FALSE;
+    InitializeListHead(&adaptExt->flush_waiters);
+    InitializeListHead(&adaptExt->flush_pending);
+
+    /* merging adjacent requests is off unless MergeRequests sets how many
+     * SRBs one request may carry, polling unless PollBudget sets how many
+     * microseconds the submitting CPU may spin */
+    adaptExt->merge_max = 0;
+    adaptExt->poll_budget = 0;
+#if (NTDDI_VERSION > NTDDI_WIN7)
+    if (!adaptExt->dump_mode) {
+        VioStorReadRegistry(DeviceExtension, (PUCHAR)MERGE_REQUESTS, &adaptExt->merge_max);
+        adaptExt->merge_max = min(adaptExt->merge_max, MAX_MERGE_REQUESTS);
+        VioStorReadRegistry(DeviceExtension, (PUCHAR)POLL_BUDGET, &adaptExt->poll_budget);
+        adaptExt->poll_budget = min(adaptExt->poll_budget, MAX_POLL_BUDGET);
+    }
+#endif
+
     ConfigInfo->Master                 = TRUE;
     ConfigInfo->ScatterGather          = TRUE;
     ConfigInfo->DmaWidth               = Width32Bits;
@@ -551,6 +643,13 @@ VirtIoFindAdapter(
     if (!adaptExt->dump_mode) {
         adaptExt->poolAllocationSize += ROUND_TO_CACHE_LINES(sizeof(SRB_EXTENSION));
         adaptExt->poolAllocationSize += ROUND_TO_CACHE_LINES(sizeof(STOR_DPC) * max_queues);
+        adaptExt->poolAllocationSize += ROUND_TO_CACHE_LINES(sizeof(VIOSTOR_QUEUE_STATS) * max_queues);
+        if (adaptExt->merge_max > 1) {
+            adaptExt->poolAllocationSize += ROUND_TO_CACHE_LINES(sizeof(MERGE_QUEUE) * max_queues);
+        }
+        if (adaptExt->poll_budget > 0) {
+            adaptExt->poolAllocationSize += ROUND_TO_CACHE_LINES(sizeof(VIRTIO_POLL_QUEUE) * max_queues);
+        }
     }
     if (max_queues > MAX_QUEUES_PER_DEVICE_DEFAULT)
     {
@@ -633,6 +732,9 @@ RhelSetGuestFeatures(
         if (CHECKBIT(adaptExt->features, VIRTIO_F_RING_PACKED)) {
             guestFeatures |= (1ULL << VIRTIO_F_RING_PACKED);
         }
+        if (CHECKBIT(adaptExt->features, VIRTIO_F_IN_ORDER)) {
+            guestFeatures |= (1ULL << VIRTIO_F_IN_ORDER);
+        }
     }
 
 #if (WINVER == 0x0A00)
@@ -657,6 +759,10 @@ RhelSetGuestFeatures(
         guestFeatures |= (1ULL << VIRTIO_BLK_F_FLUSH);
     }
 
+    if (CHECKBIT(adaptExt->features, VIRTIO_BLK_F_CONFIG_WCE)) {
+        guestFeatures |= (1ULL << VIRTIO_BLK_F_CONFIG_WCE);
+    }
+
     if (CHECKBIT(adaptExt->features, VIRTIO_BLK_F_BARRIER)) {
         guestFeatures |= (1ULL << VIRTIO_BLK_F_BARRIER);
     }
@@ -831,6 +937,38 @@ VirtIoHwInitialize(
         if (adaptExt->dpc == NULL) {
             adaptExt->dpc = (PSTOR_DPC)VioStorPoolAlloc(DeviceExtension, sizeof(STOR_DPC) * adaptExt->num_queues);
         }
+        if (adaptExt->stats == NULL) {
+            adaptExt->stats = (PVIOSTOR_QUEUE_STATS)VioStorPoolAlloc(DeviceExtension, sizeof(VIOSTOR_QUEUE_STATS) * adaptExt->num_queues);
+        }
+        /* a merged request takes one descriptor with indirect tables,
+         * without them it could need more than the ring has free */
+        if (adaptExt->merge == NULL && adaptExt->merge_max > 1 && adaptExt->indirect) {
+            adaptExt->merge = (PMERGE_QUEUE)VioStorPoolAlloc(DeviceExtension, sizeof(MERGE_QUEUE) * adaptExt->num_queues);
+        }
+        if (adaptExt->merge != NULL) {
+            adaptExt->merge_max_segs = MAX_PHYS_SEGMENTS + 1;
+            if (CHECKBIT(adaptExt->features, VIRTIO_BLK_F_SEG_MAX) && adaptExt->info.seg_max > 0) {
+                adaptExt->merge_max_segs = min(adaptExt->merge_max_segs, adaptExt->info.seg_max);
+            }
+        }
+#if (NTDDI_VERSION > NTDDI_WIN7)
+        /* latencies stay 0 without a performance counter */
+        adaptExt->stats_frequency = 0;
+        if (adaptExt->stats != NULL) {
+            LARGE_INTEGER frequency, counter;
+            if (StorPortQueryPerformanceCounter(DeviceExtension, &frequency, &counter) == STOR_STATUS_SUCCESS) {
+                adaptExt->stats_frequency = (ULONGLONG)frequency.QuadPart;
+            }
+        }
+        if (adaptExt->poll == NULL && adaptExt->poll_budget > 0) {
+            adaptExt->poll = (PVIRTIO_POLL_QUEUE)VioStorPoolAlloc(DeviceExtension, sizeof(VIRTIO_POLL_QUEUE) * adaptExt->num_queues);
+        }
+        if (adaptExt->poll != NULL) {
+            LARGE_INTEGER frequency, counter;
+            StorPortQueryPerformanceCounter(DeviceExtension, &frequency, &counter);
+            adaptExt->poll_budget_ticks = (ULONGLONG)frequency.QuadPart * adaptExt->poll_budget / 1000000;
+        }
+#endif
         if ((adaptExt->dpc != NULL) && (adaptExt->dpc_ok == FALSE)) {
             ret = StorPortEnablePassiveInitialization(DeviceExtension, VirtIoPassiveInitializeRoutine);
         }
@@ -865,7 +1003,7 @@ VirtIoStartIo(
             break;
         }
         case SRB_FUNCTION_IO_CONTROL: {
-            CompleteRequestWithStatus(DeviceExtension, (PSRB_TYPE)Srb, SRB_STATUS_SUCCESS);
+            CompleteRequestWithStatus(DeviceExtension, (PSRB_TYPE)Srb, VioStorIoControl(DeviceExtension, (PSRB_TYPE)Srb));
             return TRUE;
         }
         case SRB_FUNCTION_PNP: {
@@ -913,8 +1051,12 @@ VirtIoStartIo(
         }
         case SRB_FUNCTION_FLUSH:
         case SRB_FUNCTION_SHUTDOWN: {
+            if (adaptExt->write_through) {
+                CompleteRequestWithStatus(DeviceExtension, (PSRB_TYPE)Srb, SRB_STATUS_SUCCESS);
+                return TRUE;
+            }
             SRB_SET_SRB_STATUS(Srb, SRB_STATUS_PENDING);
-            if (!RhelDoFlush(DeviceExtension, (PSRB_TYPE)Srb, FALSE, FALSE)) {
+            if (!VioStorFlush(DeviceExtension, (PSRB_TYPE)Srb, FALSE, FALSE)) {
                 CompleteRequestWithStatus(DeviceExtension, (PSRB_TYPE)Srb, SRB_STATUS_ERROR);
             }
             return TRUE;
@@ -1009,12 +1151,12 @@ VirtIoStartIo(
         }
         case SCSIOP_SYNCHRONIZE_CACHE:
         case SCSIOP_SYNCHRONIZE_CACHE16: {
-            if (CHECKBIT(adaptExt->features, VIRTIO_BLK_F_RO)) {
+            if (CHECKBIT(adaptExt->features, VIRTIO_BLK_F_RO) || adaptExt->write_through) {
                 CompleteRequestWithStatus(DeviceExtension, (PSRB_TYPE)Srb, SRB_STATUS_SUCCESS);
                 return TRUE;
             }
             SRB_SET_SRB_STATUS(Srb, SRB_STATUS_PENDING);
-            if (!RhelDoFlush(DeviceExtension, (PSRB_TYPE)Srb, FALSE, FALSE)) {
+            if (!VioStorFlush(DeviceExtension, (PSRB_TYPE)Srb, FALSE, FALSE)) {
                 CompleteRequestWithStatus(DeviceExtension, (PSRB_TYPE)Srb, SRB_STATUS_ERROR);
             }
             return TRUE;
@@ -1028,6 +1170,19 @@ VirtIoStartIo(
             }
             return TRUE;
         }
+        case SCSIOP_WRITE_SAME:
+        case SCSIOP_WRITE_SAME16: {
+            UCHAR SrbStatus;
+            SRB_SET_SRB_STATUS(Srb, SRB_STATUS_PENDING);
+            SrbStatus = RhelScsiWriteSame(DeviceExtension, (PSRB_TYPE)Srb);
+            if (SrbStatus == SRB_STATUS_ERROR && SetSenseInfo(DeviceExtension, (PSRB_TYPE)Srb)) {
+                SrbStatus |= SRB_STATUS_AUTOSENSE_VALID;
+            }
+            if (SrbStatus != SRB_STATUS_PENDING) {
+                CompleteRequestWithStatus(DeviceExtension, (PSRB_TYPE)Srb, SrbStatus);
+            }
+            return TRUE;
+        }
 #endif
     }
 
@@ -1162,12 +1317,29 @@ VirtIoHwReinitialize(
 {
     PADAPTER_EXTENSION  adaptExt = NULL;
     ULONGLONG           old_features = 0;
+    ULONG               i;
     /* The adapter is being restarted and we need to bring it back up without
      * running any passive-level code. Note that VirtIoFindAdapter is *not*
      * called on restart.
      */
     adaptExt = (PADAPTER_EXTENSION)DeviceExtension;
     old_features = adaptExt->features;
+    /* no request survives the restart, neither does a flush in flight */
+    adaptExt->flush_in_flight = FALSE;
+    InitializeListHead(&adaptExt->flush_waiters);
+    InitializeListHead(&adaptExt->flush_pending);
+    if (adaptExt->merge != NULL) {
+        RtlZeroMemory(adaptExt->merge, sizeof(MERGE_QUEUE) * adaptExt->num_queues);
+    }
+    if (adaptExt->poll != NULL) {
+        RtlZeroMemory(adaptExt->poll, sizeof(VIRTIO_POLL_QUEUE) * adaptExt->num_queues);
+    }
+    if (adaptExt->stats != NULL) {
+        /* the counters survive the restart */
+        for (i = 0; i < adaptExt->num_queues; i++) {
+            adaptExt->stats[i].InFlight = 0;
+        }
+    }
     if (InitVirtIODevice(DeviceExtension) != SP_RETURN_FOUND) {
         return FALSE;
     }
@@ -1224,6 +1396,13 @@ VirtIoBuildIo(
     }
 
     RtlZeroMemory(srbExt, sizeof(*srbExt));
+#if (NTDDI_VERSION > NTDDI_WIN7)
+    if (adaptExt->stats_frequency) {
+        LARGE_INTEGER counter;
+        StorPortQueryPerformanceCounter(DeviceExtension, NULL, &counter);
+        srbExt->submit_ticks = (ULONGLONG)counter.QuadPart;
+    }
+#endif
 
     if (SRB_FUNCTION(Srb) != SRB_FUNCTION_EXECUTE_SCSI )
     {
@@ -1289,7 +1468,8 @@ VirtIoBuildIo(
     srbExt->vbr.out_hdr.sector = lba;
     srbExt->vbr.out_hdr.ioprio = 0;
     srbExt->vbr.req            = (PVOID)Srb;
-    srbExt->fua                = CHECKBIT(adaptExt->features, VIRTIO_BLK_F_FLUSH) ? (cdb->CDB10.ForceUnitAccess == 1) : FALSE;
+    srbExt->fua                = (CHECKBIT(adaptExt->features, VIRTIO_BLK_F_FLUSH) && !adaptExt->write_through) ?
+                                 (cdb->CDB10.ForceUnitAccess == 1) : FALSE;
 
     if (SRB_FLAGS(Srb) & SRB_FLAGS_DATA_OUT) {
         srbExt->vbr.out_hdr.type = VIRTIO_BLK_T_OUT;
@@ -1391,7 +1571,8 @@ RhelScsiGetInquiryData(
         SupportPages->SupportedPageList[3] = VPD_BLOCK_LIMITS;
         SupportPages->PageLength = 4;
 #if (NTDDI_VERSION > NTDDI_WIN7)
-        if (CHECKBIT(adaptExt->features, VIRTIO_BLK_F_DISCARD)) {
+        if (CHECKBIT(adaptExt->features, VIRTIO_BLK_F_DISCARD) ||
+            CHECKBIT(adaptExt->features, VIRTIO_BLK_F_WRITE_ZEROES)) {
             SupportPages->SupportedPageList[4] = VPD_BLOCK_DEVICE_CHARACTERISTICS;
             SupportPages->SupportedPageList[5] = VPD_LOGICAL_BLOCK_PROVISIONING;
             SupportPages->PageLength = 6;
@@ -1488,15 +1669,34 @@ RhelScsiGetInquiryData(
         REVERSE_BYTES(&LimitsPage->MaximumTransferLength, &max_io_size);
         REVERSE_BYTES(&LimitsPage->OptimalTransferLength, &adaptExt->info.opt_io_size);
 #if (NTDDI_VERSION > NTDDI_WIN7)
-        if ((CHECKBIT(adaptExt->features, VIRTIO_BLK_F_DISCARD)) &&
-            (dataLen >= 0x14)) {
-            ULONG opt_unmap_granularity = 8;
+        /* the device limits are in 512-byte sectors, the page counts blocks.
+         * MAXIMUM WRITE SAME LENGTH follows UNMAP GRANULARITY ALIGNMENT,
+         * older WDKs do not name it */
+        if ((CHECKBIT(adaptExt->features, VIRTIO_BLK_F_DISCARD) ||
+             CHECKBIT(adaptExt->features, VIRTIO_BLK_F_WRITE_ZEROES)) &&
+            (dataLen >= FIELD_OFFSET(VPD_BLOCK_LIMITS_PAGE, UnmapGranularityAlignment) + 4 + 8)) {
+            ULONG sectors_per_block = adaptExt->info.blk_size / SECTOR_SIZE;
+            ULONGLONG max_write_same = 0;
             pageLen = 0x3c;
-            REVERSE_BYTES(&LimitsPage->MaximumUnmapLBACount, &adaptExt->info.max_discard_sectors);
-            REVERSE_BYTES(&LimitsPage->MaximumUnmapBlockDescriptorCount, &adaptExt->info.max_discard_seg);
-            REVERSE_BYTES(&LimitsPage->OptimalUnmapGranularity, &opt_unmap_granularity);
-            REVERSE_BYTES(&LimitsPage->UnmapGranularityAlignment, &adaptExt->info.discard_sector_alignment);
-            LimitsPage->UGAValid = adaptExt->info.discard_sector_alignment ? 1 : 0;
+            if (CHECKBIT(adaptExt->features, VIRTIO_BLK_F_DISCARD)) {
+                ULONG max_unmap = adaptExt->info.max_discard_sectors / sectors_per_block;
+                ULONG opt_unmap_granularity = 8;
+                ULONG unmap_alignment = 0;
+                if (adaptExt->info.discard_sector_alignment >= adaptExt->info.blk_size) {
+                    opt_unmap_granularity = adaptExt->info.discard_sector_alignment / adaptExt->info.blk_size;
+                }
+                REVERSE_BYTES(&LimitsPage->MaximumUnmapLBACount, &max_unmap);
+                REVERSE_BYTES(&LimitsPage->MaximumUnmapBlockDescriptorCount, &adaptExt->info.max_discard_seg);
+                REVERSE_BYTES(&LimitsPage->OptimalUnmapGranularity, &opt_unmap_granularity);
+                REVERSE_BYTES(&LimitsPage->UnmapGranularityAlignment, &unmap_alignment);
+                LimitsPage->UGAValid = adaptExt->info.discard_sector_alignment ? 1 : 0;
+                max_write_same = max_unmap;
+            }
+            if (CHECKBIT(adaptExt->features, VIRTIO_BLK_F_WRITE_ZEROES)) {
+                max_write_same = adaptExt->info.max_write_zeroes_sectors / sectors_per_block;
+            }
+            REVERSE_BYTES_QUAD((PUCHAR)LimitsPage + FIELD_OFFSET(VPD_BLOCK_LIMITS_PAGE, UnmapGranularityAlignment) + 4,
+                               &max_write_same);
         }
 #endif
         REVERSE_BYTES_SHORT(&LimitsPage->PageLength, &pageLen);
@@ -1534,8 +1734,9 @@ RhelScsiGetInquiryData(
 
         ProvisioningPage->DP = 0;
         ProvisioningPage->LBPRZ = 0;
-        ProvisioningPage->LBPWS10 = 0;
-        ProvisioningPage->LBPWS = 0;
+        /* WRITE SAME with UNMAP, see RhelScsiWriteSame */
+        ProvisioningPage->LBPWS10 = CHECKBIT(adaptExt->features, VIRTIO_BLK_F_DISCARD) ? 1 : 0;
+        ProvisioningPage->LBPWS = ProvisioningPage->LBPWS10;
         ProvisioningPage->LBPU = CHECKBIT(adaptExt->features, VIRTIO_BLK_F_DISCARD) ? 1 : 0;
         ProvisioningPage->ProvisioningType = CHECKBIT(adaptExt->features, VIRTIO_BLK_F_DISCARD) ? PROVISIONING_TYPE_THIN : PROVISIONING_TYPE_RESOURCE;
     }
@@ -1635,7 +1836,7 @@ RhelScsiGetModeSense(
            memset(cachePage, 0, sizeof(MODE_CACHING_PAGE));
            cachePage->PageCode = MODE_PAGE_CACHING;
            cachePage->PageLength = 10;
-           cachePage->WriteCacheEnable = CHECKBIT(adaptExt->features, VIRTIO_BLK_F_FLUSH) ? 1 : 0;
+           cachePage->WriteCacheEnable = (CHECKBIT(adaptExt->features, VIRTIO_BLK_F_FLUSH) && !adaptExt->write_through) ? 1 : 0;
 
            SRB_SET_DATA_TRANSFER_LENGTH(Srb, (sizeof(MODE_PARAMETER_HEADER) +
                                         sizeof(MODE_CACHING_PAGE)));
@@ -1792,6 +1993,99 @@ RhelScsiVerify(
     return SrbStatus;
 }
 
+#if (NTDDI_VERSION > NTDDI_WIN7)
+/* WRITE SAME of a block of zeroes becomes a WRITE ZEROES, or a DISCARD if
+ * the UNMAP bit allows it and the device has no WRITE ZEROES. Any other
+ * pattern would have to be written block by block and is rejected, as
+ * are ANCHOR and the LBDATA/PBDATA variants. Returns SRB_STATUS_PENDING
+ * once the request is in the ring, or SRB_STATUS_ERROR with sense_info
+ * set.
+ */
+UCHAR
+RhelScsiWriteSame(
+    IN PVOID DeviceExtension,
+    IN OUT PSRB_TYPE Srb
+)
+{
+    PADAPTER_EXTENSION  adaptExt = (PADAPTER_EXTENSION)DeviceExtension;
+    PCDB                cdb = SRB_CDB(Srb);
+    UCHAR               flags = ((PUCHAR)cdb)[1];
+    BOOLEAN             unmap = (flags & WRITE_SAME_UNMAP) != 0;
+    BOOLEAN             ndob = FALSE;
+    ULONG               blocks = 0;
+    ULONGLONG           sector;
+    ULONGLONG           sectors;
+    ULONG               limit;
+    PUCHAR              pattern;
+    ULONG               i;
+
+    adaptExt->sense_info.senseKey = SCSI_SENSE_ILLEGAL_REQUEST;
+    adaptExt->sense_info.additionalSenseCode = SCSI_ADSENSE_INVALID_CDB;
+    adaptExt->sense_info.additionalSenseCodeQualifier = 0;
+
+    if (CHECKBIT(adaptExt->features, VIRTIO_BLK_F_RO)) {
+        adaptExt->sense_info.senseKey = SCSI_SENSE_DATA_PROTECT;
+        adaptExt->sense_info.additionalSenseCode = SCSI_ADSENSE_WRITE_PROTECT;
+        adaptExt->sense_info.additionalSenseCodeQualifier = SCSI_SENSEQ_SPACE_ALLOC_FAILED_WRITE_PROTECT;
+        return SRB_STATUS_ERROR;
+    }
+    if (CHECKBIT(adaptExt->features, VIRTIO_BLK_F_WRITE_ZEROES)) {
+        limit = adaptExt->info.max_write_zeroes_sectors;
+    }
+    else if (unmap && CHECKBIT(adaptExt->features, VIRTIO_BLK_F_DISCARD)) {
+        limit = adaptExt->info.max_discard_sectors;
+    }
+    else {
+        return SRB_STATUS_ERROR;
+    }
+    if (flags & (WRITE_SAME_LBDATA | WRITE_SAME_PBDATA | WRITE_SAME_ANCHOR)) {
+        return SRB_STATUS_ERROR;
+    }
+
+    if (cdb->CDB6GENERIC.OperationCode == SCSIOP_WRITE_SAME16) {
+        ndob = (flags & WRITE_SAME_NDOB) != 0;
+        REVERSE_BYTES(&blocks, &cdb->CDB16.TransferLength[0]);
+    }
+    else {
+        blocks = (cdb->CDB10.TransferBlocksMsb << 8) | cdb->CDB10.TransferBlocksLsb;
+    }
+    if (!ndob) {
+        pattern = (PUCHAR)SRB_DATA_BUFFER(Srb);
+        if (pattern == NULL || SRB_DATA_TRANSFER_LENGTH(Srb) < adaptExt->info.blk_size) {
+            return SRB_STATUS_ERROR;
+        }
+        for (i = 0; i < adaptExt->info.blk_size; i++) {
+            if (pattern[i] != 0) {
+                RhelDbgPrint(TRACE_LEVEL_ERROR, " WRITE SAME of a non-zero pattern\n");
+                return SRB_STATUS_ERROR;
+            }
+        }
+    }
+
+    /* lastLBA and the request are in 512-byte sectors, no blocks means
+     * up to the end of the disk */
+    sector = RhelGetLba(DeviceExtension, cdb);
+    if (sector >= adaptExt->lastLBA) {
+        adaptExt->sense_info.additionalSenseCode = SCSI_ADSENSE_ILLEGAL_BLOCK;
+        return SRB_STATUS_ERROR;
+    }
+    sectors = blocks ? (ULONGLONG)blocks * (adaptExt->info.blk_size / SECTOR_SIZE) : adaptExt->lastLBA - sector;
+    if (sector + sectors > adaptExt->lastLBA) {
+        adaptExt->sense_info.additionalSenseCode = SCSI_ADSENSE_ILLEGAL_BLOCK;
+        return SRB_STATUS_ERROR;
+    }
+    if (sectors == 0 || sectors > limit) {
+        adaptExt->sense_info.additionalSenseCode = SCSI_ADSENSE_INVALID_FIELD_IN_CDB;
+        return SRB_STATUS_ERROR;
+    }
+
+    if (!RhelDoWriteZeroes(DeviceExtension, Srb, sector, (ULONG)sectors, unmap)) {
+        return SRB_STATUS_BUSY;
+    }
+    return SRB_STATUS_PENDING;
+}
+#endif
+
 VOID
 CompleteSRB(
     IN PVOID DeviceExtension,
@@ -1912,6 +2206,129 @@ CompleteDPC(
     return FALSE;
 }
 
+/* Only one flush is sent to the device at a time. Flushes and FUA writes
+ * arriving while it is in flight cannot complete with it, as it may have been
+ * issued before their writes completed, so they wait on flush_pending. When
+ * the flush in flight completes, the first of them is sent as the next flush
+ * and the others become its waiters, completing together with it. Without
+ * the DPC (crash dump, early initialization) and in the ISR every request
+ * issues its own flush.
+ */
+static VOID
+VioStorFlushAbort(
+    IN PVOID DeviceExtension
+    )
+{
+    PADAPTER_EXTENSION  adaptExt = (PADAPTER_EXTENSION)DeviceExtension;
+    LIST_ENTRY          busy_list;
+    pblk_req            vbr = NULL;
+    KIRQL               oldIrql;
+
+    InitializeListHead(&busy_list);
+
+    KeAcquireSpinLock(&adaptExt->flush_lock, &oldIrql);
+    while (!IsListEmpty(&adaptExt->flush_waiters)) {
+        InsertTailList(&busy_list, RemoveHeadList(&adaptExt->flush_waiters));
+    }
+    while (!IsListEmpty(&adaptExt->flush_pending)) {
+        InsertTailList(&busy_list, RemoveHeadList(&adaptExt->flush_pending));
+    }
+    adaptExt->flush_in_flight = FALSE;
+    KeReleaseSpinLock(&adaptExt->flush_lock, oldIrql);
+
+    while (!IsListEmpty(&busy_list)) {
+        vbr = (pblk_req)RemoveHeadList(&busy_list);
+        CompleteRequestWithStatus(DeviceExtension, (PSRB_TYPE)vbr->req, SRB_STATUS_BUSY);
+    }
+}
+
+BOOLEAN
+VioStorFlush(
+    IN PVOID DeviceExtension,
+    IN PSRB_TYPE Srb,
+    IN BOOLEAN resend,
+    IN BOOLEAN bIsr
+    )
+{
+    PADAPTER_EXTENSION  adaptExt = (PADAPTER_EXTENSION)DeviceExtension;
+    PSRB_EXTENSION      srbExt   = SRB_EXTENSION(Srb);
+    KIRQL               oldIrql;
+
+    if (bIsr || adaptExt->dump_mode || !adaptExt->dpc_ok) {
+        srbExt->flush_leader = FALSE;
+        return RhelDoFlush(DeviceExtension, Srb, resend, bIsr);
+    }
+
+    srbExt->vbr.req = (struct request *)Srb;
+
+    KeAcquireSpinLock(&adaptExt->flush_lock, &oldIrql);
+    if (adaptExt->flush_in_flight) {
+        srbExt->flush_leader = FALSE;
+        InsertTailList(&adaptExt->flush_pending, &srbExt->vbr.list_entry);
+        KeReleaseSpinLock(&adaptExt->flush_lock, oldIrql);
+        return TRUE;
+    }
+    adaptExt->flush_in_flight = TRUE;
+    KeReleaseSpinLock(&adaptExt->flush_lock, oldIrql);
+
+    srbExt->flush_leader = TRUE;
+    if (RhelDoFlush(DeviceExtension, Srb, resend, FALSE)) {
+        return TRUE;
+    }
+    VioStorFlushAbort(DeviceExtension);
+    return FALSE;
+}
+
+VOID
+VioStorFlushCompleted(
+    IN PVOID DeviceExtension,
+    IN PSRB_TYPE Srb,
+    IN UCHAR srbStatus,
+    IN ULONG MessageID
+    )
+{
+    PADAPTER_EXTENSION  adaptExt = (PADAPTER_EXTENSION)DeviceExtension;
+    LIST_ENTRY          done_list;
+    pblk_req            vbr = NULL;
+    PSRB_TYPE           next = NULL;
+    PSRB_EXTENSION      nextExt = NULL;
+    KIRQL               oldIrql;
+
+    InitializeListHead(&done_list);
+
+    KeAcquireSpinLock(&adaptExt->flush_lock, &oldIrql);
+    while (!IsListEmpty(&adaptExt->flush_waiters)) {
+        InsertTailList(&done_list, RemoveHeadList(&adaptExt->flush_waiters));
+    }
+    if (!IsListEmpty(&adaptExt->flush_pending)) {
+        vbr = (pblk_req)RemoveHeadList(&adaptExt->flush_pending);
+        next = (PSRB_TYPE)vbr->req;
+        while (!IsListEmpty(&adaptExt->flush_pending)) {
+            InsertTailList(&adaptExt->flush_waiters, RemoveHeadList(&adaptExt->flush_pending));
+        }
+    }
+    else {
+        adaptExt->flush_in_flight = FALSE;
+    }
+    KeReleaseSpinLock(&adaptExt->flush_lock, oldIrql);
+
+    CompleteRequestWithStatus(DeviceExtension, Srb, srbStatus);
+    while (!IsListEmpty(&done_list)) {
+        vbr = (pblk_req)RemoveHeadList(&done_list);
+        CompleteRequestWithStatus(DeviceExtension, (PSRB_TYPE)vbr->req, srbStatus);
+    }
+
+    if (next) {
+        nextExt = SRB_EXTENSION(next);
+        nextExt->MessageID = MessageID;
+        nextExt->flush_leader = TRUE;
+        if (!RhelDoFlush(DeviceExtension, next, TRUE, FALSE)) {
+            CompleteRequestWithStatus(DeviceExtension, next, SRB_STATUS_BUSY);
+            VioStorFlushAbort(DeviceExtension);
+        }
+    }
+}
+
 UCHAR DeviceToSrbStatus(UCHAR status)
 {
     switch (status) {
@@ -1928,6 +2345,58 @@ UCHAR DeviceToSrbStatus(UCHAR status)
     return SRB_STATUS_ERROR;
 }
 
+/* Accounts for a request taken from the ring, the VQ lock is held */
+static VOID
+VioStorUpdateStats(
+    IN PADAPTER_EXTENSION adaptExt,
+    IN PVIOSTOR_QUEUE_STATS stats,
+    IN pblk_req vbr,
+    IN ULONGLONG now
+)
+{
+    PSRB_TYPE           Srb = (PSRB_TYPE)vbr->req;
+    PSRB_EXTENSION      srbExt = NULL;
+    PULONGLONG          requests;
+    PULONGLONG          bytes;
+    PULONGLONG          latency;
+    ULONGLONG           us;
+    ULONG               bucket;
+
+    if (stats->InFlight) {
+        stats->InFlight--;
+    }
+    if (vbr->out_hdr.type == VIRTIO_BLK_T_IN) {
+        requests = &stats->ReadRequests;
+        bytes = &stats->ReadBytes;
+        latency = stats->ReadLatency;
+    }
+    else if (vbr->out_hdr.type == VIRTIO_BLK_T_OUT) {
+        requests = &stats->WriteRequests;
+        bytes = &stats->WriteBytes;
+        latency = stats->WriteLatency;
+    }
+    else {
+        stats->OtherRequests++;
+        return;
+    }
+
+    /* SRBs merged into this request count one by one */
+    while (Srb != NULL) {
+        srbExt = SRB_EXTENSION(Srb);
+        (*requests)++;
+        *bytes += SRB_DATA_TRANSFER_LENGTH(Srb);
+        /* no timestamps before Windows 8 */
+        if (srbExt->submit_ticks != 0 && now >= srbExt->submit_ticks) {
+            us = (now - srbExt->submit_ticks) * 1000000 / adaptExt->stats_frequency;
+            for (bucket = 0; us > 1 && bucket < LATENCY_BUCKETS - 1; bucket++) {
+                us >>= 1;
+            }
+            latency[bucket]++;
+        }
+        Srb = (PSRB_TYPE)srbExt->merge_next;
+    }
+}
+
 VOID
 VioStorCompleteRequest(
     IN PVOID DeviceExtension,
@@ -1943,14 +2412,33 @@ VioStorCompleteRequest(
     pblk_req            vbr = NULL;
     PSRB_TYPE           Srb = NULL;
     PSRB_EXTENSION      srbExt = NULL;
+    PSRB_TYPE           next = NULL;
     LIST_ENTRY          complete_list;
     UCHAR               srbStatus = SRB_STATUS_SUCCESS;
+    PMERGE_QUEUE        merge = NULL;
+    PVIOSTOR_QUEUE_STATS stats = NULL;
+    ULONGLONG           now = 0;
+    bool                notify = FALSE;
 
     RhelDbgPrint(TRACE_LEVEL_VERBOSE, " ---> MessageID 0x%x\n", MessageID);
 
     adaptExt = (PADAPTER_EXTENSION)DeviceExtension;
 
     vq = adaptExt->vq[QueueNumber];
+    if (adaptExt->merge != NULL) {
+        merge = &adaptExt->merge[QueueNumber];
+    }
+    if (adaptExt->stats != NULL) {
+        stats = &adaptExt->stats[QueueNumber];
+#if (NTDDI_VERSION > NTDDI_WIN7)
+        if (adaptExt->stats_frequency) {
+            /* one timestamp for the whole batch */
+            LARGE_INTEGER counter;
+            StorPortQueryPerformanceCounter(DeviceExtension, NULL, &counter);
+            now = (ULONGLONG)counter.QuadPart;
+        }
+#endif
+    }
 
     InitializeListHead(&complete_list);
 
@@ -1959,12 +2447,28 @@ VioStorCompleteRequest(
         virtqueue_disable_cb(vq);
         while ((vbr = (pblk_req)virtqueue_get_buf(vq, &len)) != NULL) {
             InsertTailList(&complete_list, &vbr->list_entry);
+            if (stats != NULL) {
+                VioStorUpdateStats(adaptExt, stats, vbr, now);
+            }
+            if (merge != NULL &&
+                (vbr->out_hdr.type == VIRTIO_BLK_T_IN || vbr->out_hdr.type == VIRTIO_BLK_T_OUT)) {
+                merge->inflight--;
+            }
 #ifdef DBG
             InterlockedDecrement((LONG volatile*)&adaptExt->inqueue_cnt);
 #endif
         }
     } while (!virtqueue_enable_cb(vq));
+    /* requests waiting for more adjacent ones go now that the device
+     * has made progress */
+    if (merge != NULL && !IsListEmpty(&complete_list) &&
+        RhelMergeSubmit(DeviceExtension, QueueNumber)) {
+        notify = virtqueue_kick_prepare(vq);
+    }
     VioStorVQUnlock(DeviceExtension, MessageID, &queueLock, bIsr);
+    if (notify) {
+        virtqueue_notify(vq);
+    }
 
     while (!IsListEmpty(&complete_list)) {
         vbr = (pblk_req)RemoveHeadList(&complete_list);
@@ -2001,15 +2505,26 @@ VioStorCompleteRequest(
             srbStatus = DeviceToSrbStatus(vbr->status);
             RhelDbgPrint(TRACE_LEVEL_INFORMATION, " srb %p, QueueNumber %lu, MessageId %lu, srbExt->MessageId %lu.\n",
                         Srb, QueueNumber, MessageID, srbExt->MessageID);
-            if (srbExt->fua == TRUE) {
+            if (vbr->out_hdr.type == VIRTIO_BLK_T_FLUSH && srbExt->flush_leader) {
+                VioStorFlushCompleted(DeviceExtension, Srb, srbStatus, MessageID);
+            }
+            else if (srbExt->fua == TRUE && srbStatus == SRB_STATUS_SUCCESS) {
+                srbExt->fua = FALSE;
                 SRB_SET_SRB_STATUS(Srb, SRB_STATUS_PENDING);
-                if (!RhelDoFlush(DeviceExtension, Srb, TRUE, bIsr)) {
+                if (!VioStorFlush(DeviceExtension, Srb, TRUE, bIsr)) {
                     CompleteRequestWithStatus(DeviceExtension, (PSRB_TYPE)Srb, SRB_STATUS_ERROR);
                 }
-                srbExt->fua = FALSE;
             }
             else {
+                /* SRBs merged into this request share its status */
+                next = (PSRB_TYPE)srbExt->merge_next;
                 CompleteRequestWithStatus(DeviceExtension, (PSRB_TYPE)Srb, srbStatus);
+                while (next != NULL) {
+                    Srb = next;
+                    srbExt = SRB_EXTENSION(Srb);
+                    next = (PSRB_TYPE)srbExt->merge_next;
+                    CompleteRequestWithStatus(DeviceExtension, Srb, srbStatus);
+                }
             }
         }
     }
@@ -2017,6 +2532,36 @@ VioStorCompleteRequest(
     RhelDbgPrint(TRACE_LEVEL_VERBOSE, " <--- MessageID 0x%x\n", MessageID);
 }
 
+#if (NTDDI_VERSION > NTDDI_WIN7)
+/* Polls the request queue after a submission, see virtio_poll.h */
+VOID
+VioStorPollQueue(
+    IN PVOID DeviceExtension,
+    IN ULONG MessageID
+)
+{
+    PADAPTER_EXTENSION  adaptExt = (PADAPTER_EXTENSION)DeviceExtension;
+    PVIRTIO_POLL_QUEUE  poll = &adaptExt->poll[MessageID - 1];
+    struct virtqueue    *vq = adaptExt->vq[MessageID - 1];
+    STOR_LOCK_HANDLE    queueLock = { 0 };
+    ULONGLONG           limit;
+
+    if (!VirtioPollBegin(poll, adaptExt->poll_budget_ticks, &limit)) {
+        return;
+    }
+
+    /* no interrupt is needed while we spin, VioStorCompleteRequest arms
+     * the callbacks again */
+    VioStorVQLock(DeviceExtension, MessageID, &queueLock, FALSE);
+    virtqueue_disable_cb(vq);
+    VioStorVQUnlock(DeviceExtension, MessageID, &queueLock, FALSE);
+
+    VirtioPollSpin(DeviceExtension, poll, vq, adaptExt->poll_budget_ticks, limit);
+
+    VioStorCompleteRequest(DeviceExtension, MessageID, FALSE);
+}
+#endif
+
 #pragma warning(disable: 4100 4701)
 VOID
 CompleteDpcRoutine(
@@ -2077,3 +2622,50 @@ VioStorPoolAlloc(
     RhelDbgPrint(TRACE_LEVEL_FATAL, "Ran out of memory in VioStorPoolAlloc(%Id)\n", size);
     return NULL;
 }
+
+/* Miniport IOCTLs. Control codes of other drivers keep completing with
+ * success as they always have. */
+UCHAR
+VioStorIoControl(
+    IN PVOID DeviceExtension,
+    IN PSRB_TYPE Srb
+    )
+{
+    PADAPTER_EXTENSION  adaptExt = (PADAPTER_EXTENSION)DeviceExtension;
+    PSRB_IO_CONTROL     srbControl = (PSRB_IO_CONTROL)SRB_DATA_BUFFER(Srb);
+    PVIOSTOR_STATISTICS statistics;
+    ULONG               count;
+    ULONG               copy;
+
+    if (SRB_DATA_TRANSFER_LENGTH(Srb) < sizeof(SRB_IO_CONTROL) ||
+        memcmp(srbControl->Signature, VIOSTOR_IOCTL_SIGNATURE, sizeof(VIOSTOR_IOCTL_SIGNATURE) - 1) != 0) {
+        return SRB_STATUS_SUCCESS;
+    }
+
+    switch (srbControl->ControlCode) {
+    case VIOSTOR_IOCTL_QUERY_STATISTICS:
+        /* the header size was checked above, this cannot wrap on x86 */
+        if (srbControl->Length > SRB_DATA_TRANSFER_LENGTH(Srb) - sizeof(SRB_IO_CONTROL) ||
+            srbControl->Length < FIELD_OFFSET(VIOSTOR_STATISTICS, Queues)) {
+            return SRB_STATUS_INVALID_REQUEST;
+        }
+        /* as many queues as fit, QueueCount tells the caller how many there
+         * are. The counters are updated under the queue locks without
+         * stopping the other queues, the snapshot is not atomic. */
+        statistics = (PVIOSTOR_STATISTICS)(srbControl + 1);
+        count = adaptExt->stats ? adaptExt->num_queues : 0;
+        copy = min(count, (srbControl->Length - FIELD_OFFSET(VIOSTOR_STATISTICS, Queues)) / sizeof(VIOSTOR_QUEUE_STATS));
+        statistics->QueueCount = count;
+        statistics->Reserved = 0;
+        if (copy) {
+            RtlCopyMemory(statistics->Queues, adaptExt->stats, sizeof(VIOSTOR_QUEUE_STATS) * copy);
+        }
+        srbControl->Length = FIELD_OFFSET(VIOSTOR_STATISTICS, Queues) + sizeof(VIOSTOR_QUEUE_STATS) * copy;
+        srbControl->ReturnCode = 0;
+        RhelDbgPrint(TRACE_LEVEL_INFORMATION, " VIOSTOR_IOCTL_QUERY_STATISTICS %lu queues\n", copy);
+        return SRB_STATUS_SUCCESS;
+    default:
+        RhelDbgPrint(TRACE_LEVEL_INFORMATION, " Unsupported control code 0x%x\n", srbControl->ControlCode);
+        return SRB_STATUS_INVALID_REQUEST;
+    }
+}
@@ -38,6 +38,7 @@
 #include "virtio_pci.h"
 #include "virtio.h"
 #include "virtio_ring.h"
+#include "windows\virtio_poll.h"
 #include "virtio_stor_utils.h"
 #include "virtio_stor_hw_helper.h"
 
@@ -70,6 +71,13 @@ typedef struct VirtIOBufferDescriptor VIO_SG, *PVIO_SG;
 
 #define VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP   0x00000001
 
+/* Byte 1 of the WRITE SAME(10) and WRITE SAME(16) CDBs */
+#define WRITE_SAME_NDOB         0x01    /* no data-out buffer, WRITE SAME(16) only */
+#define WRITE_SAME_LBDATA       0x02
+#define WRITE_SAME_PBDATA       0x04
+#define WRITE_SAME_UNMAP        0x08
+#define WRITE_SAME_ANCHOR       0x10
+
 #define VIRTIO_BLK_S_OK         0
 #define VIRTIO_BLK_S_IOERR      1
 #define VIRTIO_BLK_S_UNSUPP     2
@@ -94,6 +102,18 @@ typedef struct VirtIOBufferDescriptor VIO_SG, *PVIO_SG;
 
 #define VIOBLK_MAX_TRANSFER     0x00FFFFFF
 
+#define MERGE_REQUESTS          "MergeRequests"
+#define MAX_MERGE_REQUESTS      16
+
+#define POLL_BUDGET             "PollBudget"
+#define MAX_POLL_BUDGET         1000
+
+#define LATENCY_BUCKETS         24
+
+/* SRB_IO_CONTROL signature and control codes of the miniport IOCTLs */
+#define VIOSTOR_IOCTL_SIGNATURE         "VIOSTOR"
+#define VIOSTOR_IOCTL_QUERY_STATISTICS  0x80000001
+
 #pragma pack(1)
 typedef struct virtio_blk_config {
     /* The capacity (in 512-byte sectors). */
@@ -181,6 +201,44 @@ typedef struct virtio_blk_req {
     u8         status;
 }blk_req, *pblk_req;
 
+/* Reads or writes of adjacent sectors waiting in a queue to be put in the
+ * ring as one request. The SRBs are chained through merge_next in their
+ * extension, the sg list of head describes all of them.
+ */
+typedef struct _MERGE_QUEUE {
+    PVOID                 head;
+    PVOID                 tail;
+    ULONGLONG             next_sector;
+    ULONG                 length;
+    ULONG                 count;
+    ULONG                 inflight;     /* reads and writes in the ring */
+} MERGE_QUEUE, *PMERGE_QUEUE;
+
+/* Per queue statistics, the layout of the VIOSTOR_IOCTL_QUERY_STATISTICS
+ * output. Latency bucket 0 counts requests completed in less than 2 us,
+ * bucket n those completed in [2^n, 2^(n+1)) us and the last one everything
+ * slower. Merged reads and writes count as one request in flight.
+ */
+typedef struct _VIOSTOR_QUEUE_STATS {
+    ULONGLONG             ReadRequests;
+    ULONGLONG             WriteRequests;
+    ULONGLONG             OtherRequests;
+    ULONGLONG             ReadBytes;
+    ULONGLONG             WriteBytes;
+    ULONGLONG             BusyEvents;   /* requests sent back with StorPortBusy */
+    ULONG                 InFlight;
+    ULONG                 MaxInFlight;
+    ULONGLONG             ReadLatency[LATENCY_BUCKETS];
+    ULONGLONG             WriteLatency[LATENCY_BUCKETS];
+} VIOSTOR_QUEUE_STATS, *PVIOSTOR_QUEUE_STATS;
+
+/* VIOSTOR_IOCTL_QUERY_STATISTICS output following the SRB_IO_CONTROL */
+typedef struct _VIOSTOR_STATISTICS {
+    ULONG                 QueueCount;
+    ULONG                 Reserved;
+    VIOSTOR_QUEUE_STATS   Queues[1];
+} VIOSTOR_STATISTICS, *PVIOSTOR_STATISTICS;
+
 typedef struct virtio_bar {
     PHYSICAL_ADDRESS  BasePA;
     ULONG             uLength;
@@ -238,6 +296,19 @@ typedef struct _ADAPTER_EXTENSION {
     STOR_ADDR_BTL8        device_address;
     blk_discard_write_zeroes blk_discard[16];
 #endif
+    BOOLEAN               write_through;
+    KSPIN_LOCK            flush_lock;
+    BOOLEAN               flush_in_flight;
+    LIST_ENTRY            flush_waiters;
+    LIST_ENTRY            flush_pending;
+    PMERGE_QUEUE          merge;
+    ULONG                 merge_max;
+    ULONG                 merge_max_segs;
+    PVIRTIO_POLL_QUEUE    poll;
+    ULONG                 poll_budget;
+    ULONGLONG             poll_budget_ticks;
+    PVIOSTOR_QUEUE_STATS  stats;
+    ULONGLONG             stats_frequency;
 #ifdef DBG
     ULONG                 srb_cnt;
     ULONG                 inqueue_cnt;
@@ -259,6 +330,10 @@ typedef struct _SRB_EXTENSION {
     ULONG                 in;
     ULONG                 MessageID;
     BOOLEAN               fua;
+    BOOLEAN               flush_leader;
+    PVOID                 merge_next;
+    ULONGLONG             submit_ticks;
+    blk_discard_write_zeroes zeroes;    /* range of a WRITE SAME */
     VIO_SG                sg[VIRTIO_MAX_SG];
     VRING_DESC_ALIAS      desc[VIRTIO_MAX_SG];
 }SRB_EXTENSION, *PSRB_EXTENSION;
@@ -43,6 +43,28 @@
                       pa = va ? StorPortGetPhysicalAddress(DeviceExtension, NULL, va, &len).QuadPart : 0; \
                     }
 
+/* Counts a request put in the ring or sent back busy, the VQ lock is held */
+static VOID
+RhelCountAdd(
+    PADAPTER_EXTENSION adaptExt,
+    ULONG QueueNumber,
+    BOOLEAN added
+    )
+{
+    PVIOSTOR_QUEUE_STATS stats;
+
+    if (adaptExt->stats == NULL) {
+        return;
+    }
+    stats = &adaptExt->stats[QueueNumber];
+    if (!added) {
+        stats->BusyEvents++;
+    }
+    else if (++stats->InFlight > stats->MaxInFlight) {
+        stats->MaxInFlight = stats->InFlight;
+    }
+}
+
 BOOLEAN
 RhelDoFlush(
     PVOID DeviceExtension,
@@ -107,20 +129,22 @@ RhelDoFlush(
     srbExt->sg[1].physAddr = StorPortGetPhysicalAddress(DeviceExtension, NULL, &srbExt->vbr.status, &fragLen);
     srbExt->sg[1].length   = sizeof(srbExt->vbr.status);
 
-    VioStorVQLock(DeviceExtension, MessageId, &LockHandle, FALSE);
+    VioStorVQLock(DeviceExtension, MessageId, &LockHandle, bIsr);
     if (virtqueue_add_buf(vq,
                      &srbExt->sg[0],
                      srbExt->out, srbExt->in,
                      &srbExt->vbr, va, pa) >= 0) {
         notify = virtqueue_kick_prepare(vq);
-        VioStorVQUnlock(DeviceExtension, MessageId, &LockHandle, FALSE);
+        RhelCountAdd(adaptExt, QueueNumber, TRUE);
+        VioStorVQUnlock(DeviceExtension, MessageId, &LockHandle, bIsr);
         result = TRUE;
 #ifdef DBG
         InterlockedIncrement((LONG volatile*)&adaptExt->inqueue_cnt);
 #endif
     }
     else {
-        VioStorVQUnlock(DeviceExtension, MessageId, &LockHandle, FALSE);
+        RhelCountAdd(adaptExt, QueueNumber, FALSE);
+        VioStorVQUnlock(DeviceExtension, MessageId, &LockHandle, bIsr);
         RhelDbgPrint(TRACE_LEVEL_ERROR, " Can not add packet to queue %d.\n", QueueNumber);
         StorPortBusy(DeviceExtension, 2);
     }
@@ -131,25 +155,168 @@ RhelDoFlush(
     return result;
 }
 
+/* Puts a read or write in the ring, the VQ lock is held */
+static BOOLEAN
+RhelAddReadWrite(
+    PVOID DeviceExtension,
+    struct virtqueue *vq,
+    PMERGE_QUEUE merge,
+    PSRB_TYPE Srb
+    )
+{
+    PADAPTER_EXTENSION  adaptExt = (PADAPTER_EXTENSION)DeviceExtension;
+    PSRB_EXTENSION      srbExt   = SRB_EXTENSION(Srb);
+    PVOID               va = NULL;
+    ULONGLONG           pa = 0ULL;
+
+    SET_VA_PA();
+
+    if (virtqueue_add_buf(vq,
+                     &srbExt->sg[0],
+                     srbExt->out, srbExt->in,
+                     &srbExt->vbr, va, pa) < 0) {
+        return FALSE;
+    }
+    if (merge) {
+        merge->inflight++;
+    }
+    RhelCountAdd(adaptExt, srbExt->MessageID - 1, TRUE);
+#ifdef DBG
+    InterlockedIncrement((LONG volatile*)&adaptExt->inqueue_cnt);
+#endif
+    return TRUE;
+}
+
+static VOID
+RhelMergeStart(
+    PMERGE_QUEUE merge,
+    PSRB_TYPE Srb
+    )
+{
+    PSRB_EXTENSION      srbExt = SRB_EXTENSION(Srb);
+    ULONG               length = SRB_DATA_TRANSFER_LENGTH(Srb);
+
+    merge->head = Srb;
+    merge->tail = Srb;
+    merge->next_sector = srbExt->vbr.out_hdr.sector + length / SECTOR_SIZE;
+    merge->length = length;
+    merge->count = 1;
+}
+
+/* Appends the data segments of Srb to the request in the merge window if it
+ * goes in the same direction and starts where the window ends. A segment
+ * physically contiguous with the last one of the window extends it.
+ */
+static BOOLEAN
+RhelMergeAppend(
+    PADAPTER_EXTENSION adaptExt,
+    PMERGE_QUEUE merge,
+    PSRB_TYPE Srb
+    )
+{
+    PSRB_EXTENSION      srbExt = SRB_EXTENSION(Srb);
+    PSRB_TYPE           head = (PSRB_TYPE)merge->head;
+    PSRB_TYPE           tail = (PSRB_TYPE)merge->tail;
+    PSRB_EXTENSION      headExt;
+    PSRB_EXTENSION      tailExt;
+    PVIO_SG             last;
+    VIO_SG              status;
+    ULONG               length = SRB_DATA_TRANSFER_LENGTH(Srb);
+    ULONG               headSegs, srbSegs, i, j;
+    BOOLEAN             write;
+
+    if (head == NULL || srbExt->fua ||
+        merge->count >= adaptExt->merge_max ||
+        length > VIOBLK_MAX_TRANSFER - merge->length) {
+        return FALSE;
+    }
+    headExt = SRB_EXTENSION(head);
+    if (srbExt->vbr.out_hdr.type != headExt->vbr.out_hdr.type ||
+        srbExt->vbr.out_hdr.sector != merge->next_sector) {
+        return FALSE;
+    }
+    write = (headExt->vbr.out_hdr.type == VIRTIO_BLK_T_OUT);
+    headSegs = (write ? headExt->out : headExt->in) - 1;
+    srbSegs = (write ? srbExt->out : srbExt->in) - 1;
+    if (headSegs + srbSegs > adaptExt->merge_max_segs) {
+        return FALSE;
+    }
+
+    status = headExt->sg[headSegs + 1];
+    last = &headExt->sg[headSegs];
+    j = 1;
+    if (last->physAddr.QuadPart + last->length == srbExt->sg[1].physAddr.QuadPart &&
+        last->length + srbExt->sg[1].length <= adaptExt->info.size_max) {
+        last->length += srbExt->sg[1].length;
+        j = 2;
+    }
+    for (i = headSegs + 1; j <= srbSegs; i++, j++) {
+        headExt->sg[i] = srbExt->sg[j];
+    }
+    headExt->sg[i] = status;
+    if (write) {
+        headExt->out = i;
+    } else {
+        headExt->in = i;
+    }
+
+    tailExt = SRB_EXTENSION(tail);
+    tailExt->merge_next = Srb;
+    merge->tail = Srb;
+    merge->next_sector += length / SECTOR_SIZE;
+    merge->length += length;
+    merge->count++;
+    return TRUE;
+}
+
+/* Puts the request of the merge window in the ring, the VQ lock is held.
+ * If the ring is full the window stays as it is, the completion of any of
+ * the requests in the ring submits it again.
+ */
+BOOLEAN
+RhelMergeSubmit(
+    PVOID DeviceExtension,
+    ULONG QueueNumber
+    )
+{
+    PADAPTER_EXTENSION  adaptExt = (PADAPTER_EXTENSION)DeviceExtension;
+    PMERGE_QUEUE        merge = &adaptExt->merge[QueueNumber];
+
+    if (merge->head == NULL) {
+        return FALSE;
+    }
+    if (!RhelAddReadWrite(DeviceExtension, adaptExt->vq[QueueNumber], merge, (PSRB_TYPE)merge->head)) {
+        RhelDbgPrint(TRACE_LEVEL_ERROR, " Can not add merged request to queue %d.\n", QueueNumber);
+        return FALSE;
+    }
+    RhelDbgPrint(TRACE_LEVEL_VERBOSE, " merged %lu requests, %lu bytes, queue %d\n",
+                 merge->count, merge->length, QueueNumber);
+    merge->head = NULL;
+    merge->tail = NULL;
+    merge->count = 0;
+    merge->length = 0;
+    return TRUE;
+}
+
 BOOLEAN
 RhelDoReadWrite(PVOID DeviceExtension,
                 PSRB_TYPE Srb)
 {
     PADAPTER_EXTENSION  adaptExt = (PADAPTER_EXTENSION)DeviceExtension;
     PSRB_EXTENSION      srbExt   = SRB_EXTENSION(Srb);
-    PVOID               va = NULL;
-    ULONGLONG           pa = 0ULL;
 
     ULONG               QueueNumber = 0;
     ULONG               OldIrql = 0;
     ULONG               MessageId = 0;
     BOOLEAN             result = FALSE;
+    BOOLEAN             held = FALSE;
+    BOOLEAN             added = FALSE;
+    BOOLEAN             full = FALSE;
     bool                notify = FALSE;
     STOR_LOCK_HANDLE    LockHandle = { 0 };
     ULONG               status = STOR_STATUS_SUCCESS;
     struct virtqueue    *vq = NULL;
-
-    SET_VA_PA();
+    PMERGE_QUEUE        merge = NULL;
 
     if (adaptExt->num_queues > 1) {
         STARTIO_PERFORMANCE_PARAMETERS param;
@@ -178,19 +345,44 @@ RhelDoReadWrite(PVOID DeviceExtension,
     RhelDbgPrint(TRACE_LEVEL_VERBOSE, " QueueNumber 0x%x vq = %p\n", QueueNumber, vq);
 
     VioStorVQLock(DeviceExtension, MessageId, &LockHandle, FALSE);
-    if (virtqueue_add_buf(vq,
-                     &srbExt->sg[0],
-                     srbExt->out, srbExt->in,
-                     &srbExt->vbr, va, pa) >= 0) {
-        notify = virtqueue_kick_prepare(vq);
-        VioStorVQUnlock(DeviceExtension, MessageId, &LockHandle, FALSE);
-#ifdef DBG
-        InterlockedIncrement((LONG volatile*)&adaptExt->inqueue_cnt);
-#endif
+    if (adaptExt->merge != NULL) {
+        /* A request is only held back while others are in the ring, their
+         * completion puts it in the ring if nothing else has */
+        merge = &adaptExt->merge[QueueNumber];
+        if (RhelMergeAppend(adaptExt, merge, Srb)) {
+            held = TRUE;
+            if (merge->count >= adaptExt->merge_max) {
+                added = RhelMergeSubmit(DeviceExtension, QueueNumber);
+            }
+        }
+        else {
+            if (merge->head != NULL) {
+                /* if the ring is full, Srb would not fit either */
+                added = RhelMergeSubmit(DeviceExtension, QueueNumber);
+                full = !added;
+            }
+            if (!full && merge->inflight > 0 && !srbExt->fua) {
+                RhelMergeStart(merge, Srb);
+                held = TRUE;
+            }
+        }
+    }
+    if (held) {
         result = TRUE;
     }
-    else {
-        VioStorVQUnlock(DeviceExtension, MessageId, &LockHandle, FALSE);
+    else if (!full) {
+        result = RhelAddReadWrite(DeviceExtension, vq, merge, Srb);
+        added = added || result;
+    }
+    if (added) {
+        notify = virtqueue_kick_prepare(vq);
+    }
+    if (!result) {
+        RhelCountAdd(adaptExt, QueueNumber, FALSE);
+    }
+    VioStorVQUnlock(DeviceExtension, MessageId, &LockHandle, FALSE);
+
+    if (!result) {
         RhelDbgPrint(TRACE_LEVEL_ERROR, " Can not add packet to queue %d.\n", QueueNumber);
         StorPortBusy(DeviceExtension, 2);
     }
@@ -199,7 +391,12 @@ RhelDoReadWrite(PVOID DeviceExtension,
     }
 
 #if (NTDDI_VERSION > NTDDI_WIN7)
-    if (adaptExt->num_queues > 1) {
+    if (adaptExt->poll != NULL) {
+        if (added) {
+            VioStorPollQueue(DeviceExtension, MessageId);
+        }
+    }
+    else if (adaptExt->num_queues > 1) {
         if (CHECKFLAG(adaptExt->perfFlags, STOR_PERF_OPTIMIZE_FOR_COMPLETION_DURING_STARTIO)) {
            VioStorCompleteRequest(DeviceExtension, MessageId, FALSE);
         }
@@ -268,8 +465,9 @@ RhelDoUnMap(
         REVERSE_BYTES(&blockDescrLbaCount, BlockDescriptors[i].LbaCount);
         RhelDbgPrint(TRACE_LEVEL_INFORMATION, "Count %d BlockDescrCount = %d blockDescrStartingLba = %llu blockDescrLbaCount = %lu\n",
                      i, BlockDescrCount, blockDescrStartingLba, blockDescrLbaCount);
-        adaptExt->blk_discard[i].sector = blockDescrStartingLba;
-        adaptExt->blk_discard[i].num_sectors = blockDescrLbaCount;
+        /* the device counts in 512-byte sectors */
+        adaptExt->blk_discard[i].sector = blockDescrStartingLba * (adaptExt->info.blk_size / SECTOR_SIZE);
+        adaptExt->blk_discard[i].num_sectors = blockDescrLbaCount * (adaptExt->info.blk_size / SECTOR_SIZE);
         adaptExt->blk_discard[i].flags = 0;
     }
 
@@ -319,6 +517,7 @@ RhelDoUnMap(
                      srbExt->out, srbExt->in,
                      &srbExt->vbr, va, pa) >= 0) {
         notify = virtqueue_kick_prepare(vq);
+        RhelCountAdd(adaptExt, QueueNumber, TRUE);
         VioStorVQUnlock(DeviceExtension, MessageId, &LockHandle, FALSE);
 #ifdef DBG
         InterlockedIncrement((LONG volatile*)&adaptExt->inqueue_cnt);
@@ -326,6 +525,7 @@ RhelDoUnMap(
         result = TRUE;
     }
     else {
+        RhelCountAdd(adaptExt, QueueNumber, FALSE);
         VioStorVQUnlock(DeviceExtension, MessageId, &LockHandle, FALSE);
         RhelDbgPrint(TRACE_LEVEL_ERROR, " Can not add packet to queue %d.\n", QueueNumber);
         StorPortBusy(DeviceExtension, 2);
@@ -337,6 +537,111 @@ RhelDoUnMap(
     return result;
 }
 
+/* Zeroes or discards the 512-byte sectors of a WRITE SAME. With unmap set
+ * the device may deallocate them, a device without WRITE ZEROES is sent a
+ * DISCARD in that case. */
+BOOLEAN
+RhelDoWriteZeroes(
+    IN PVOID DeviceExtension,
+    IN PSRB_TYPE Srb,
+    IN ULONGLONG sector,
+    IN ULONG sectors,
+    IN BOOLEAN unmap
+    )
+{
+    PADAPTER_EXTENSION  adaptExt = (PADAPTER_EXTENSION)DeviceExtension;
+    PSRB_EXTENSION      srbExt   = SRB_EXTENSION(Srb);
+    ULONG               fragLen = 0UL;
+    PVOID               va = NULL;
+    ULONGLONG           pa = 0ULL;
+
+    ULONG               QueueNumber = 0;
+    ULONG               MessageId = 0;
+    BOOLEAN             result = FALSE;
+    BOOLEAN             notify = FALSE;
+    STOR_LOCK_HANDLE    LockHandle = { 0 };
+    ULONG               status = STOR_STATUS_SUCCESS;
+    struct virtqueue    *vq = NULL;
+
+    SET_VA_PA();
+
+    srbExt->zeroes.sector      = sector;
+    srbExt->zeroes.num_sectors = sectors;
+    srbExt->zeroes.flags       = 0;
+
+    srbExt->vbr.out_hdr.sector = 0;
+    srbExt->vbr.out_hdr.ioprio = 0;
+    srbExt->vbr.req            = (struct request *)Srb;
+    if (CHECKBIT(adaptExt->features, VIRTIO_BLK_F_WRITE_ZEROES)) {
+        srbExt->vbr.out_hdr.type = VIRTIO_BLK_T_WRITE_ZEROES | VIRTIO_BLK_T_OUT;
+        if (unmap && adaptExt->info.write_zeroes_may_unmap) {
+            srbExt->zeroes.flags = VIRTIO_BLK_WRITE_ZEROES_FLAG_UNMAP;
+        }
+    }
+    else {
+        NT_ASSERT(unmap && CHECKBIT(adaptExt->features, VIRTIO_BLK_F_DISCARD));
+        srbExt->vbr.out_hdr.type = VIRTIO_BLK_T_DISCARD | VIRTIO_BLK_T_OUT;
+    }
+    srbExt->out                = 2;
+    srbExt->in                 = 1;
+
+    srbExt->sg[0].physAddr = StorPortGetPhysicalAddress(DeviceExtension, NULL, &srbExt->vbr.out_hdr, &fragLen);
+    srbExt->sg[0].length   = sizeof(srbExt->vbr.out_hdr);
+    srbExt->sg[1].physAddr = StorPortGetPhysicalAddress(DeviceExtension, NULL, &srbExt->zeroes, &fragLen);
+    srbExt->sg[1].length   = sizeof(srbExt->zeroes);
+    srbExt->sg[2].physAddr = StorPortGetPhysicalAddress(DeviceExtension, NULL, &srbExt->vbr.status, &fragLen);
+    srbExt->sg[2].length   = sizeof(srbExt->vbr.status);
+
+    if (adaptExt->num_queues > 1) {
+        STARTIO_PERFORMANCE_PARAMETERS param;
+        param.Size = sizeof(STARTIO_PERFORMANCE_PARAMETERS);
+        status = StorPortGetStartIoPerfParams(DeviceExtension, (PSCSI_REQUEST_BLOCK)Srb, &param);
+        if (status == STOR_STATUS_SUCCESS && param.MessageNumber != 0) {
+           MessageId = param.MessageNumber;
+           QueueNumber = MessageId - 1;
+        }
+        else {
+           RhelDbgPrint(TRACE_LEVEL_ERROR, " StorPortGetStartIoPerfParams failed srb %p status 0x%x.\n",
+                        Srb, status);
+           QueueNumber = 0;
+           MessageId = 1;
+        }
+    }
+    else {
+        QueueNumber = 0;
+        MessageId = 1;
+    }
+
+    srbExt->MessageID = MessageId;
+    vq = adaptExt->vq[QueueNumber];
+    RhelDbgPrint(TRACE_LEVEL_INFORMATION, " QueueNumber 0x%x vq = %p type = %d sector = %llu sectors = %lu\n",
+                 QueueNumber, vq, srbExt->vbr.out_hdr.type, sector, sectors);
+
+    VioStorVQLock(DeviceExtension, MessageId, &LockHandle, FALSE);
+    if (virtqueue_add_buf(vq,
+                     &srbExt->sg[0],
+                     srbExt->out, srbExt->in,
+                     &srbExt->vbr, va, pa) >= 0) {
+        notify = virtqueue_kick_prepare(vq);
+        RhelCountAdd(adaptExt, QueueNumber, TRUE);
+        VioStorVQUnlock(DeviceExtension, MessageId, &LockHandle, FALSE);
+#ifdef DBG
+        InterlockedIncrement((LONG volatile*)&adaptExt->inqueue_cnt);
+#endif
+        result = TRUE;
+    }
+    else {
+        RhelCountAdd(adaptExt, QueueNumber, FALSE);
+        VioStorVQUnlock(DeviceExtension, MessageId, &LockHandle, FALSE);
+        RhelDbgPrint(TRACE_LEVEL_ERROR, " Can not add packet to queue %d.\n", QueueNumber);
+        StorPortBusy(DeviceExtension, 2);
+    }
+    if (notify) {
+        virtqueue_notify(vq);
+    }
+    return result;
+}
+
 #endif
 
 BOOLEAN
@@ -403,6 +708,7 @@ RhelGetSerialNumber(
                      srbExt->out, srbExt->in,
                      &srbExt->vbr, va, pa) >= 0) {
         notify = virtqueue_kick_prepare(vq);
+        RhelCountAdd(adaptExt, QueueNumber, TRUE);
         VioStorVQUnlock(DeviceExtension, MessageId, &LockHandle, FALSE);
         result = TRUE;
 #ifdef DBG
@@ -410,6 +716,7 @@ RhelGetSerialNumber(
 #endif
     }
     else {
+        RhelCountAdd(adaptExt, QueueNumber, FALSE);
         VioStorVQUnlock(DeviceExtension, MessageId, &LockHandle, FALSE);
         RhelDbgPrint(TRACE_LEVEL_ERROR, " Can not add packet to queue %d.\n", QueueNumber);
         StorPortBusy(DeviceExtension, 2);
@@ -459,6 +766,7 @@ RhelGetLba(
         case SCSIOP_VERIFY:
 #if (NTDDI_VERSION > NTDDI_WIN7)
         case SCSIOP_UNMAP:
+        case SCSIOP_WRITE_SAME:
 #endif
         {
             lba.Byte0 = Cdb->CDB10.LogicalBlockByte3;
@@ -484,7 +792,11 @@ RhelGetLba(
         case SCSIOP_WRITE16:
         case SCSIOP_READ_CAPACITY16:
         case SCSIOP_WRITE_VERIFY16:
-        case SCSIOP_VERIFY16: {
+        case SCSIOP_VERIFY16:
+#if (NTDDI_VERSION > NTDDI_WIN7)
+        case SCSIOP_WRITE_SAME16:
+#endif
+        {
             REVERSE_BYTES_QUAD(&lba, &Cdb->CDB16.LogicalBlock[0]);
         }
         break;
@@ -513,7 +825,11 @@ RhelGetSectors(
         case SCSIOP_WRITE:
         case SCSIOP_READ_CAPACITY:
         case SCSIOP_WRITE_VERIFY:
-        case SCSIOP_VERIFY:{
+        case SCSIOP_VERIFY:
+#if (NTDDI_VERSION > NTDDI_WIN7)
+        case SCSIOP_WRITE_SAME:
+#endif
+        {
             sector.Byte0 = Cdb->CDB10.TransferBlocksLsb;
             sector.Byte1 = Cdb->CDB10.TransferBlocksMsb;
         }
@@ -522,7 +838,11 @@ RhelGetSectors(
         case SCSIOP_WRITE16:
         case SCSIOP_READ_CAPACITY16:
         case SCSIOP_WRITE_VERIFY16:
-        case SCSIOP_VERIFY16: {
+        case SCSIOP_VERIFY16:
+#if (NTDDI_VERSION > NTDDI_WIN7)
+        case SCSIOP_WRITE_SAME16:
+#endif
+        {
             REVERSE_BYTES(&sector, &Cdb->CDB16.TransferLength[0]);
         }
         break;
@@ -542,6 +862,7 @@ RhelGetDiskGeometry(
 {
     u64                cap;
     u32                v;
+    u8                 wce;
     struct virtio_blk_geometry vgeo;
 
     PADAPTER_EXTENSION adaptExt = (PADAPTER_EXTENSION)DeviceExtension;
@@ -555,6 +876,17 @@ RhelGetDiskGeometry(
         RhelDbgPrint(TRACE_LEVEL_INFORMATION, " VIRTIO_BLK_F_RO\n");
     }
 
+    /* A device with the cache in writethrough mode makes every write stable
+     * before completing it, FUA and SYNCHRONIZE CACHE are then no-ops */
+    adaptExt->write_through = FALSE;
+    if (CHECKBIT(adaptExt->features, VIRTIO_BLK_F_FLUSH) &&
+        CHECKBIT(adaptExt->features, VIRTIO_BLK_F_CONFIG_WCE)) {
+        virtio_get_config(&adaptExt->vdev, FIELD_OFFSET(blk_config, wce),
+                          &wce, sizeof(wce));
+        adaptExt->write_through = (wce == 0);
+        RhelDbgPrint(TRACE_LEVEL_INFORMATION, " VIRTIO_BLK_F_CONFIG_WCE wce = %d\n", wce);
+    }
+
     if (CHECKBIT(adaptExt->features, VIRTIO_BLK_F_SIZE_MAX)) {
         virtio_get_config(&adaptExt->vdev, FIELD_OFFSET(blk_config, size_max),
                           &v, sizeof(v));
@@ -628,6 +960,17 @@ RhelGetDiskGeometry(
         adaptExt->info.max_discard_seg = (v < MAX_DISCARD_SEGMENTS) ? v : MAX_DISCARD_SEGMENTS -1;
         RhelDbgPrint(TRACE_LEVEL_INFORMATION, " max_discard_seg = %d\n", adaptExt->info.max_discard_seg);
     }
+
+    if(CHECKBIT(adaptExt->features, VIRTIO_BLK_F_WRITE_ZEROES)) {
+        virtio_get_config(&adaptExt->vdev, FIELD_OFFSET(blk_config, max_write_zeroes_sectors),
+                          &v, sizeof(v));
+        adaptExt->info.max_write_zeroes_sectors = v ? v : UINT_MAX;
+        RhelDbgPrint(TRACE_LEVEL_INFORMATION, " max_write_zeroes_sectors = %d\n", adaptExt->info.max_write_zeroes_sectors);
+
+        virtio_get_config(&adaptExt->vdev, FIELD_OFFSET(blk_config, write_zeroes_may_unmap),
+                          &adaptExt->info.write_zeroes_may_unmap, sizeof(adaptExt->info.write_zeroes_may_unmap));
+        RhelDbgPrint(TRACE_LEVEL_INFORMATION, " write_zeroes_may_unmap = %d\n", adaptExt->info.write_zeroes_may_unmap);
+    }
 }
 
 VOID
@@ -125,6 +125,12 @@ RhelDoReadWrite(
     IN PSRB_TYPE Srb
     );
 
+BOOLEAN
+RhelMergeSubmit(
+    IN PVOID DeviceExtension,
+    IN ULONG QueueNumber
+    );
+
 BOOLEAN
 RhelDoFlush(
     IN PVOID DeviceExtension,
@@ -139,6 +145,15 @@ RhelDoUnMap(
     IN PVOID DeviceExtension,
     IN PSRB_TYPE Srb
     );
+
+BOOLEAN
+RhelDoWriteZeroes(
+    IN PVOID DeviceExtension,
+    IN PSRB_TYPE Srb,
+    IN ULONGLONG sector,
+    IN ULONG sectors,
+    IN BOOLEAN unmap
+    );
 #endif
 
 VOID
@@ -175,6 +190,12 @@ VioStorCompleteRequest(
     IN BOOLEAN bIsr
     );
 
+VOID
+VioStorPollQueue(
+    IN PVOID DeviceExtension,
+    IN ULONG MessageID
+    );
+
 PVOID
 VioStorPoolAlloc(
     IN PVOID DeviceExtension,